@@ -1,6 +1,7 @@
 #include "ble_scanner.h"
 #include "../hal/ble_api.h"
 #include "esp_log.h"
+#include "deferred_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
@@ -22,7 +23,7 @@ bool BLEScanner::execute(const std::map<std::string, std::string>& params) {
     ESP_LOGI(TAG, "Found %d BLE devices", (int)results.size());
     
     for (const auto& device : results) {
-        ESP_LOGI(TAG, "Device: %s, RSSI: %d", device.name.c_str(), device.rssi);
+        DZ_LOGI(TAG, "Device: %s, RSSI: %d", device.name.c_str(), device.rssi);
     }
     
     ble.stopScan();
@@ -1,6 +1,7 @@
 #include "wifi_scanner.h"
 #include "../hal/wifi_api.h"
 #include "esp_log.h"
+#include "deferred_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
@@ -11,19 +12,18 @@ bool WiFiScanner::execute(const std::map<std::string, std::string>& params) {
     
     auto& wifi = WiFiAPI::getInstance();
     
+    // Blocks until the scan is done
     if (!wifi.startScan()) {
-        ESP_LOGE(TAG, "Failed to start WiFi scan");
+        ESP_LOGE(TAG, "WiFi scan failed");
         return false;
     }
     
-    vTaskDelay(pdMS_TO_TICKS(3000));
-    
     auto results = wifi.getScanResults();
     ESP_LOGI(TAG, "Found %d WiFi networks", (int)results.size());
     
     for (const auto& ap : results) {
-        ESP_LOGI(TAG, "SSID: %s, RSSI: %d, Channel: %d",
-                 (char*)ap.ssid, ap.rssi, ap.primary);
+        DZ_LOGI(TAG, "SSID: %s, RSSI: %d, Channel: %d",
+                (char*)ap.ssid, ap.rssi, ap.primary);
     }
     
     return true;
@@ -1,50 +1,235 @@
 #include "ble_server.h"
+#include <string.h>
 #include "esp_log.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
+#include "esp_gatt_common_api.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "../core/boot_sequence.h"
 
 static const char* TAG = "BLEServer";
 
 #define DEZERO_SERVICE_UUID 0x00FF
-#define DEZERO_CHAR_UUID 0xFF01
+#define DEZERO_RX_CHAR_UUID 0xFF01
+#define DEZERO_TX_CHAR_UUID 0xFF02
+
+#define COMMAND_TASK_STACK 6144
+#define COMMAND_TASK_PRIORITY 5
+#define COMMAND_TASK_CORE 0             // Next to the Bluedroid host task
+
+static const EventBits_t TX_UNCONGESTED_BIT = 1 << 0;
+static const EventBits_t TASK_EXIT_BIT = 1 << 1;
+
+#define BLE_CREDIT_TIMEOUT_MS 2000
+#define BLE_CONGESTION_TIMEOUT_MS 2000
+#define BLE_IDLE_MS 1000                // Ends a transfer for the throughput log
+#define BLE_REPORT_MIN_BYTES 4096
+
+// Requested on connect: 7.5-15 ms interval, no latency, 4 s supervision
+#define BLE_CONN_INT_MIN 0x06
+#define BLE_CONN_INT_MAX 0x0C
+#define BLE_CONN_TIMEOUT 400
+#define BLE_MAX_TX_OCTETS 251
+
+enum {
+    ATTR_SERVICE,
+    ATTR_RX_DECL,
+    ATTR_RX_VALUE,
+    ATTR_TX_DECL,
+    ATTR_TX_VALUE,
+    ATTR_TX_CCCD,
+    ATTR_COUNT
+};
+
+static const uint16_t primary_service_uuid = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t char_declaration_uuid = ESP_GATT_UUID_CHAR_DECLARE;
+static const uint16_t char_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+static const uint16_t service_uuid = DEZERO_SERVICE_UUID;
+static const uint16_t rx_char_uuid = DEZERO_RX_CHAR_UUID;
+static const uint16_t tx_char_uuid = DEZERO_TX_CHAR_UUID;
+static const uint8_t rx_char_prop = ESP_GATT_CHAR_PROP_BIT_WRITE_NR | ESP_GATT_CHAR_PROP_BIT_WRITE;
+static const uint8_t tx_char_prop = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static uint8_t tx_cccd_value[2] = {0x00, 0x00};
+
+// Values are kept by the stack and writes acknowledged by it, except on RX:
+// its writes go to the command task and long (prepared) writes are
+// reassembled here, so the server answers those itself
+static const esp_gatts_attr_db_t GATT_DB[ATTR_COUNT] = {
+    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&primary_service_uuid, ESP_GATT_PERM_READ,
+                           sizeof(uint16_t), sizeof(service_uuid), (uint8_t*)&service_uuid}},
+    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&char_declaration_uuid, ESP_GATT_PERM_READ,
+                           sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&rx_char_prop}},
+    {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16, (uint8_t*)&rx_char_uuid, ESP_GATT_PERM_WRITE,
+                           BLE_MAX_ATTR_LEN, 0, NULL}},
+    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&char_declaration_uuid, ESP_GATT_PERM_READ,
+                           sizeof(uint8_t), sizeof(uint8_t), (uint8_t*)&tx_char_prop}},
+    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&tx_char_uuid, ESP_GATT_PERM_READ,
+                           BLE_MAX_ATTR_LEN, 0, NULL}},
+    {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t*)&char_client_config_uuid,
+                           ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                           sizeof(tx_cccd_value), sizeof(tx_cccd_value), tx_cccd_value}},
+};
+
+// DEZERO_SERVICE_UUID on the Bluetooth base UUID, as advertised
+static uint8_t adv_service_uuid128[16] = {
+    0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00, 0x00, 0x80,
+    0x00, 0x10, 0x00, 0x00, DEZERO_SERVICE_UUID & 0xFF, DEZERO_SERVICE_UUID >> 8, 0x00, 0x00,
+};
+
+static esp_ble_adv_params_t adv_params = {};
+
+// Prepared write response; the value it echoes is too large for the stack
+static esp_gatt_rsp_t prep_rsp;
 
 bool BLEServer::initialize() {
+    if (initialized_) {
+        return true;
+    }
     ESP_LOGI(TAG, "Initializing BLE Server");
     
+    // Only BLE is ever used; hand the classic BT controller memory back to
+    // the heap. This can only be done once, before the first init.
+    if (!classic_released_) {
+        esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+        classic_released_ = true;
+    }
+    
     esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
-    esp_bt_controller_init(&bt_cfg);
-    esp_bt_controller_enable(ESP_BT_MODE_BLE);
+    esp_err_t err = esp_bt_controller_init(&bt_cfg);
+    if (err == ESP_OK) {
+        err = esp_bt_controller_enable(ESP_BT_MODE_BLE);
+    }
+    if (err == ESP_OK) {
+        err = esp_bluedroid_init();
+    }
+    if (err == ESP_OK) {
+        err = esp_bluedroid_enable();
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to bring up Bluetooth: %s", esp_err_to_name(err));
+        deinitialize();
+        return false;
+    }
+    
+    // The command task and what it shares with the Bluedroid callbacks
+    rx_stream_ = xStreamBufferCreate(BLE_RX_STREAM_SIZE, 1);
+    events_ = xEventGroupCreate();
+    tx_lock_ = xSemaphoreCreateMutex();
+    tx_credits_ = xSemaphoreCreateCounting(BLE_TX_CREDITS, BLE_TX_CREDITS);
+    if (!rx_stream_ || !events_ || !tx_lock_ || !tx_credits_) {
+        ESP_LOGE(TAG, "Failed to allocate transport");
+        deinitialize();
+        return false;
+    }
+    xEventGroupSetBits(events_, TX_UNCONGESTED_BIT);
+    stopping_ = false;
+    rx_len_ = 0;
+    rx_read_ = 0;
+    rx_queued_ = 0;
+    link_start_ = 0;
+    if (xTaskCreatePinnedToCore(commandTask, "ble_cmd", COMMAND_TASK_STACK, this,
+                                COMMAND_TASK_PRIORITY, &task_, COMMAND_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create command task");
+        task_ = nullptr;
+        deinitialize();
+        return false;
+    }
     
-    esp_bluedroid_init();
-    esp_bluedroid_enable();
+    esp_ble_gap_register_callback(gapEventHandler);
+    esp_ble_gatts_register_callback(gattsEventHandler);
+    esp_ble_gatt_set_local_mtu(BLE_LOCAL_MTU);
+    esp_ble_gatts_app_register(0);
     
+    initialized_ = true;
     running_ = false;
     return true;
 }
 
+bool BLEServer::deinitialize() {
+    if (initialized_) {
+        ESP_LOGI(TAG, "Shutting down BLE Server");
+    }
+    
+    stop();
+    
+    // The command task finishes the frame it is on and exits
+    if (task_) {
+        stopping_ = true;
+        xEventGroupWaitBits(events_, TASK_EXIT_BIT, pdTRUE, pdTRUE, portMAX_DELAY);
+        task_ = nullptr;
+    }
+    
+    // Undo only the steps that completed, so this also cleans up after a
+    // failed initialize()
+    if (esp_bluedroid_get_status() == ESP_BLUEDROID_STATUS_ENABLED) {
+        esp_bluedroid_disable();
+    }
+    if (esp_bluedroid_get_status() == ESP_BLUEDROID_STATUS_INITIALIZED) {
+        esp_bluedroid_deinit();
+    }
+    if (esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_ENABLED) {
+        esp_bt_controller_disable();
+    }
+    if (esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_INITED) {
+        esp_bt_controller_deinit();
+    }
+    
+    if (rx_stream_) {
+        vStreamBufferDelete(rx_stream_);
+        rx_stream_ = nullptr;
+    }
+    if (events_) {
+        vEventGroupDelete(events_);
+        events_ = nullptr;
+    }
+    if (tx_lock_) {
+        vSemaphoreDelete(tx_lock_);
+        tx_lock_ = nullptr;
+    }
+    if (tx_credits_) {
+        vSemaphoreDelete(tx_credits_);
+        tx_credits_ = nullptr;
+    }
+    
+    gatts_if_ = ESP_GATT_IF_NONE;
+    connected_ = false;
+    notify_enabled_ = false;
+    initialized_ = false;
+    return true;
+}
+
 bool BLEServer::start() {
     ESP_LOGI(TAG, "Starting BLE Server");
     
     esp_ble_gap_set_device_name("DeZero");
     
+    // A legacy advertisement holds 31 bytes: flags, the 128-bit service
+    // UUID scanners filter on and the TX power fit (24), and the name and
+    // connection interval range go in the scan response
     esp_ble_adv_data_t adv_data = {};
     adv_data.set_scan_rsp = false;
-    adv_data.include_name = true;
+    adv_data.include_name = false;
     adv_data.include_txpower = true;
-    adv_data.min_interval = 0x20;
-    adv_data.max_interval = 0x40;
     adv_data.appearance = 0x00;
     adv_data.manufacturer_len = 0;
     adv_data.p_manufacturer_data = NULL;
     adv_data.service_data_len = 0;
     adv_data.p_service_data = NULL;
-    adv_data.service_uuid_len = 0;
-    adv_data.p_service_uuid = NULL;
+    adv_data.service_uuid_len = sizeof(adv_service_uuid128);
+    adv_data.p_service_uuid = adv_service_uuid128;
     adv_data.flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT);
     
     esp_ble_gap_config_adv_data(&adv_data);
     
-    esp_ble_adv_params_t adv_params = {};
+    esp_ble_adv_data_t scan_rsp_data = {};
+    scan_rsp_data.set_scan_rsp = true;
+    scan_rsp_data.include_name = true;
+    scan_rsp_data.min_interval = 0x20;
+    scan_rsp_data.max_interval = 0x40;
+    
+    esp_ble_gap_config_adv_data(&scan_rsp_data);
+    
     adv_params.adv_int_min = 0x20;
     adv_params.adv_int_max = 0x40;
     adv_params.adv_type = ADV_TYPE_IND;
@@ -69,19 +254,370 @@ bool BLEServer::stop() {
 }
 
 bool BLEServer::sendNotification(const uint8_t* data, size_t length) {
-    if (!running_) {
+    if (!running_ || !tx_lock_) {
         return false;
     }
+    xSemaphoreTake(tx_lock_, portMAX_DELAY);
+    bool ok = notify(data, length);
+    xSemaphoreGive(tx_lock_);
+    return ok;
+}
+
+void BLEServer::getStats(BleLinkStats& stats) {
+    portENTER_CRITICAL(&stats_lock_);
+    stats = stats_;
+    portEXIT_CRITICAL(&stats_lock_);
+    stats.mtu = mtu_;
+}
+
+uint8_t* BLEServer::txBuffer(size_t* capacity) {
+    *capacity = sizeof(tx_);
+    return tx_;
+}
+
+bool BLEServer::send(size_t length) {
+    xSemaphoreTake(tx_lock_, portMAX_DELAY);
+    bool ok = notify(tx_, length);
+    xSemaphoreGive(tx_lock_);
+    return ok;
+}
+
+// Splits data into MTU-sized notifications; called with tx_lock_ held
+bool BLEServer::notify(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        if (!connected_ || !notify_enabled_) {
+            return false;
+        }
+        size_t chunk = mtu_ - 3;
+        if (chunk > BLE_MAX_ATTR_LEN) {
+            chunk = BLE_MAX_ATTR_LEN;
+        }
+        if (chunk > length) {
+            chunk = length;
+        }
+    
+        // Every notification the stack accepts is confirmed (a disconnect
+        // returns all credits), so a credit that never comes back means
+        // the stack is stuck and sending more would only overrun it
+        if (xSemaphoreTake(tx_credits_, pdMS_TO_TICKS(BLE_CREDIT_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGW(TAG, "No notification credit returned, dropping %u bytes", (unsigned)length);
+            return false;
+        }
+    
+        if (!(xEventGroupGetBits(events_) & TX_UNCONGESTED_BIT)) {
+            portENTER_CRITICAL(&stats_lock_);
+            stats_.congestion_waits++;
+            portEXIT_CRITICAL(&stats_lock_);
+            EventBits_t bits = xEventGroupWaitBits(events_, TX_UNCONGESTED_BIT, pdFALSE, pdTRUE,
+                                                   pdMS_TO_TICKS(BLE_CONGESTION_TIMEOUT_MS));
+            if (!(bits & TX_UNCONGESTED_BIT)) {
+                ESP_LOGW(TAG, "Link stayed congested, dropping %u bytes", (unsigned)length);
+                xSemaphoreGive(tx_credits_);
+                return false;
+            }
+        }
+    
+        esp_err_t err = esp_ble_gatts_send_indicate(gatts_if_, conn_id_, tx_handle_,
+                                                    chunk, (uint8_t*)data, false);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Notification failed: %s", esp_err_to_name(err));
+            xSemaphoreGive(tx_credits_);
+            return false;
+        }
     
-    // TODO: Implement notification sending
-    ESP_LOGI(TAG, "Sending notification: %d bytes", length);
+        portENTER_CRITICAL(&stats_lock_);
+        stats_.tx_bytes += chunk;
+        transfer_tx_ += chunk;
+        portEXIT_CRITICAL(&stats_lock_);
+        data += chunk;
+        length -= chunk;
+    }
     return true;
 }
 
+void BLEServer::restoreCredits() {
+    while (uxSemaphoreGetCount(tx_credits_) < BLE_TX_CREDITS) {
+        xSemaphoreGive(tx_credits_);
+    }
+    xEventGroupSetBits(events_, TX_UNCONGESTED_BIT);
+}
+
+// Parses and runs frames as they arrive; a transfer is a run of traffic
+// without a BLE_IDLE_MS gap, and its sustained rate is logged at the end
+void BLEServer::commandTask(void* arg) {
+    BLEServer* server = static_cast<BLEServer*>(arg);
+    CommandDispatcher& dispatcher = CommandDispatcher::getInstance();
+    
+    while (!server->stopping_) {
+        size_t received = xStreamBufferReceive(server->rx_stream_, server->rx_ + server->rx_len_,
+                                               sizeof(server->rx_) - server->rx_len_,
+                                               pdMS_TO_TICKS(BLE_IDLE_MS));
+        server->rx_read_ += received;
+        server->rx_len_ += received;
+    
+        // Bytes left from a previous connection never start a frame
+        int32_t stale = (int32_t)(server->link_start_ - (server->rx_read_ - server->rx_len_));
+        if (stale > 0) {
+            size_t drop = (size_t)stale < server->rx_len_ ? (size_t)stale : server->rx_len_;
+            server->rx_len_ -= drop;
+            memmove(server->rx_, server->rx_ + drop, server->rx_len_);
+            if (received > server->rx_len_) {
+                received = server->rx_len_;
+            }
+            server->finishTransfer();
+        }
+        if (received == 0) {
+            server->finishTransfer();
+            continue;
+        }
+    
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&server->stats_lock_);
+        if (!server->transfer_active_) {
+            server->transfer_active_ = true;
+            server->transfer_start_us_ = now;
+            server->transfer_rx_ = 0;
+            server->transfer_tx_ = 0;
+        }
+        server->transfer_rx_ += received;
+        server->stats_.rx_bytes += received;
+        portEXIT_CRITICAL(&server->stats_lock_);
+    
+        size_t used = dispatcher.process(server->rx_, server->rx_len_, *server);
+        server->rx_len_ -= used;
+        if (server->rx_len_ > 0 && used > 0) {
+            memmove(server->rx_, server->rx_ + used, server->rx_len_);
+        }
+        server->transfer_last_us_ = esp_timer_get_time();
+    }
+    
+    xEventGroupSetBits(server->events_, TASK_EXIT_BIT);
+    vTaskDelete(NULL);
+}
+
+void BLEServer::finishTransfer() {
+    if (!transfer_active_) {
+        return;
+    }
+    uint32_t elapsed_us = (uint32_t)(transfer_last_us_ - transfer_start_us_);
+    portENTER_CRITICAL(&stats_lock_);
+    transfer_active_ = false;
+    uint32_t rx = transfer_rx_;
+    uint32_t tx = transfer_tx_;
+    if (elapsed_us > 0 && rx + tx >= BLE_REPORT_MIN_BYTES) {
+        stats_.last_rx_bps = (uint32_t)((uint64_t)rx * 1000000 / elapsed_us);
+        stats_.last_tx_bps = (uint32_t)((uint64_t)tx * 1000000 / elapsed_us);
+    }
+    BleLinkStats stats = stats_;
+    portEXIT_CRITICAL(&stats_lock_);
+    
+    if (elapsed_us == 0 || rx + tx < BLE_REPORT_MIN_BYTES) {
+        return;
+    }
+    ESP_LOGI(TAG, "Transfer: %u B in, %u B out in %u ms: %u.%u KB/s in, %u.%u KB/s out "
+             "(MTU %u, LL %u, %s PHY, %u congestion waits)",
+             (unsigned)rx, (unsigned)tx, (unsigned)(elapsed_us / 1000),
+             (unsigned)(stats.last_rx_bps / 1024), (unsigned)(stats.last_rx_bps % 1024 * 10 / 1024),
+             (unsigned)(stats.last_tx_bps / 1024), (unsigned)(stats.last_tx_bps % 1024 * 10 / 1024),
+             (unsigned)mtu_.load(), stats.tx_octets, stats.phy_2m ? "2M" : "1M",
+             (unsigned)stats.congestion_waits);
+}
+
+void BLEServer::onConnect(const esp_ble_gatts_cb_param_t* param) {
+    conn_id_ = param->connect.conn_id;
+    mtu_ = 23;
+    notify_enabled_ = false;
+    prep_len_ = 0;
+    portENTER_CRITICAL(&stats_lock_);
+    stats_ = {};
+    stats_.tx_octets = 27;
+    portEXIT_CRITICAL(&stats_lock_);
+    restoreCredits();
+    link_start_ = rx_queued_.load();
+    connected_ = true;
+    BootSequence::getInstance().mark(BOOT_MILESTONE_FIRST_CONNECTION);
+    ESP_LOGI(TAG, "Connected, conn_id %u", conn_id_);
+    
+    // Ask for what the peer can do; it may refuse any of these, and the
+    // outcome arrives as GAP events
+    esp_bd_addr_t bda;
+    memcpy(bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+    esp_ble_conn_update_params_t conn_params = {};
+    memcpy(conn_params.bda, bda, sizeof(esp_bd_addr_t));
+    conn_params.min_int = BLE_CONN_INT_MIN;
+    conn_params.max_int = BLE_CONN_INT_MAX;
+    conn_params.latency = 0;
+    conn_params.timeout = BLE_CONN_TIMEOUT;
+    esp_ble_gap_update_conn_params(&conn_params);
+    esp_ble_gap_set_pkt_data_len(bda, BLE_MAX_TX_OCTETS);
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    esp_ble_gap_set_preferred_phy(bda, 0, ESP_BLE_GAP_PHY_2M_PREF_MASK, ESP_BLE_GAP_PHY_2M_PREF_MASK,
+                                  ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+#endif
+}
+
+void BLEServer::onDisconnect() {
+    connected_ = false;
+    notify_enabled_ = false;
+    prep_len_ = 0;
+    link_start_ = rx_queued_.load();
+    // Wakes a sender waiting on the link, which then sees it is gone
+    restoreCredits();
+    ESP_LOGI(TAG, "Disconnected");
+    if (running_) {
+        esp_ble_gap_start_advertising(&adv_params);
+    }
+}
+
+// Runs on the Bluedroid task: only copies the bytes for the command task
+void BLEServer::onWrite(const esp_ble_gatts_cb_param_t* param) {
+    if (param->write.handle == cccd_handle_ && !param->write.is_prep && param->write.len == 2) {
+        notify_enabled_ = (param->write.value[0] & 0x01) != 0;
+        return;
+    }
+    if (param->write.handle != rx_handle_) {
+        return;
+    }
+    if (param->write.is_prep) {
+        onPrepareWrite(param);
+        return;
+    }
+    
+    queueRx(param->write.value, param->write.len);
+    if (param->write.need_rsp) {
+        esp_ble_gatts_send_response(gatts_if_, param->write.conn_id, param->write.trans_id,
+                                    ESP_GATT_OK, NULL);
+    }
+}
+
+// A long write arrives as parts at increasing offsets, each echoed back,
+// and is queued whole once the client executes it
+void BLEServer::onPrepareWrite(const esp_ble_gatts_cb_param_t* param) {
+    esp_gatt_status_t status = ESP_GATT_OK;
+    if (param->write.offset != prep_len_) {
+        status = ESP_GATT_INVALID_OFFSET;
+    } else if (prep_len_ + param->write.len > sizeof(prep_)) {
+        status = ESP_GATT_INVALID_ATTR_LEN;
+    } else {
+        memcpy(prep_ + prep_len_, param->write.value, param->write.len);
+        prep_len_ += param->write.len;
+    }
+    
+    if (!param->write.need_rsp) {
+        return;
+    }
+    memset(&prep_rsp, 0, sizeof(prep_rsp));
+    prep_rsp.attr_value.handle = param->write.handle;
+    prep_rsp.attr_value.offset = param->write.offset;
+    prep_rsp.attr_value.len = param->write.len;
+    memcpy(prep_rsp.attr_value.value, param->write.value, param->write.len);
+    esp_ble_gatts_send_response(gatts_if_, param->write.conn_id, param->write.trans_id,
+                                status, &prep_rsp);
+}
+
+void BLEServer::onExecWrite(const esp_ble_gatts_cb_param_t* param) {
+    if (param->exec_write.exec_write_flag == ESP_GATT_PREP_WRITE_EXEC && prep_len_ > 0) {
+        queueRx(prep_, prep_len_);
+    }
+    prep_len_ = 0;
+    esp_ble_gatts_send_response(gatts_if_, param->exec_write.conn_id, param->exec_write.trans_id,
+                                ESP_GATT_OK, NULL);
+}
+
+void BLEServer::queueRx(const uint8_t* data, size_t length) {
+    size_t sent = xStreamBufferSend(rx_stream_, data, length, 0);
+    rx_queued_ += sent;
+    if (sent < length) {
+        ESP_LOGW(TAG, "RX overflow, dropped %u bytes", (unsigned)(length - sent));
+    }
+}
+
 void BLEServer::gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param) {
-    // Handle GAP events
+    BLEServer& server = getInstance();
+    switch (event) {
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+        ESP_LOGI(TAG, "Connection interval %u.%02u ms, latency %u",
+                 param->update_conn_params.conn_int * 125 / 100,
+                 param->update_conn_params.conn_int * 125 % 100,
+                 param->update_conn_params.latency);
+        break;
+    case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+        if (param->pkt_data_length_cmpl.status == ESP_BT_STATUS_SUCCESS) {
+            portENTER_CRITICAL(&server.stats_lock_);
+            server.stats_.tx_octets = param->pkt_data_length_cmpl.params.tx_len;
+            portEXIT_CRITICAL(&server.stats_lock_);
+            ESP_LOGI(TAG, "Data length: tx %u rx %u",
+                     param->pkt_data_length_cmpl.params.tx_len,
+                     param->pkt_data_length_cmpl.params.rx_len);
+        }
+        break;
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    case ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT:
+        if (param->phy_update.status == ESP_BT_STATUS_SUCCESS) {
+            portENTER_CRITICAL(&server.stats_lock_);
+            server.stats_.phy_2m = param->phy_update.tx_phy == ESP_BLE_GAP_PHY_2M;
+            portEXIT_CRITICAL(&server.stats_lock_);
+            ESP_LOGI(TAG, "PHY: tx %uM rx %uM", param->phy_update.tx_phy, param->phy_update.rx_phy);
+        }
+        break;
+#endif
+    default:
+        break;
+    }
 }
 
 void BLEServer::gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param) {
-    // Handle GATT server events
+    BLEServer& server = getInstance();
+    switch (event) {
+    case ESP_GATTS_REG_EVT:
+        if (param->reg.status != ESP_GATT_OK) {
+            ESP_LOGE(TAG, "App registration failed: %d", param->reg.status);
+            break;
+        }
+        server.gatts_if_ = gatts_if;
+        esp_ble_gatts_create_attr_tab(GATT_DB, gatts_if, ATTR_COUNT, 0);
+        break;
+    case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+        if (param->add_attr_tab.status != ESP_GATT_OK || param->add_attr_tab.num_handle != ATTR_COUNT) {
+            ESP_LOGE(TAG, "Failed to create service: %d", param->add_attr_tab.status);
+            break;
+        }
+        server.service_handle_ = param->add_attr_tab.handles[ATTR_SERVICE];
+        server.rx_handle_ = param->add_attr_tab.handles[ATTR_RX_VALUE];
+        server.tx_handle_ = param->add_attr_tab.handles[ATTR_TX_VALUE];
+        server.cccd_handle_ = param->add_attr_tab.handles[ATTR_TX_CCCD];
+        esp_ble_gatts_start_service(server.service_handle_);
+        break;
+    case ESP_GATTS_CONNECT_EVT:
+        server.onConnect(param);
+        break;
+    case ESP_GATTS_DISCONNECT_EVT:
+        server.onDisconnect();
+        break;
+    case ESP_GATTS_MTU_EVT:
+        server.mtu_ = param->mtu.mtu;
+        ESP_LOGI(TAG, "MTU %u", param->mtu.mtu);
+        break;
+    case ESP_GATTS_WRITE_EVT:
+        server.onWrite(param);
+        break;
+    case ESP_GATTS_EXEC_WRITE_EVT:
+        server.onExecWrite(param);
+        break;
+    case ESP_GATTS_CONF_EVT:
+        // A notification left the stack; its credit can be used again
+        if (uxSemaphoreGetCount(server.tx_credits_) < BLE_TX_CREDITS) {
+            xSemaphoreGive(server.tx_credits_);
+        }
+        break;
+    case ESP_GATTS_CONGEST_EVT:
+        if (param->congest.congested) {
+            xEventGroupClearBits(server.events_, TX_UNCONGESTED_BIT);
+        } else {
+            xEventGroupSetBits(server.events_, TX_UNCONGESTED_BIT);
+        }
+        break;
+    default:
+        break;
+    }
 }
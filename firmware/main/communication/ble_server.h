@@ -1,34 +1,134 @@
 #ifndef BLE_SERVER_H
 #define BLE_SERVER_H
 
+#include <atomic>
 #include "esp_gap_ble_api.h"
 #include "esp_gatts_api.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/task.h"
+#include "command_dispatcher.h"
 
-class BLEServer {
+#define BLE_LOCAL_MTU 517
+#define BLE_MAX_ATTR_LEN 512            // GATT limit on one write or notification
+#define BLE_TX_CREDITS 8                // Notifications handed to the stack at once
+#define BLE_RX_STREAM_SIZE 8192
+
+struct BleLinkStats {
+    uint16_t mtu;
+    uint16_t tx_octets;                 // Link layer payload per packet: 27, or up to 251 with DLE
+    bool phy_2m;
+    uint32_t rx_bytes;                  // This connection
+    uint32_t tx_bytes;
+    uint32_t congestion_waits;          // Notifications that waited for the stack
+    uint32_t last_rx_bps;               // Sustained rates of the last transfer
+    uint32_t last_tx_bps;
+};
+
+// BLE GATT server carrying command frames (CommandDispatcher).
+//
+// The DeZer0 service has an RX characteristic the app writes frames to,
+// preferably without response, and a TX characteristic the device
+// notifies frames on. Frames are a byte stream across both: a write or a
+// notification holds up to MTU - 3 bytes (at most 512) of it, and frames
+// may span several. On connect the server asks for a short connection
+// interval, the longest link layer packets (DLE) and, on controllers with
+// BLE 5, the 2M PHY; the 517-byte MTU is offered when the app exchanges
+// MTUs. Whatever the peer accepts is logged and kept in BleLinkStats.
+//
+// Writes arrive on the Bluedroid task and are only copied into a stream
+// buffer there. A command task parses and runs the frames and sends the
+// responses, so a slow command never stalls the stack. Notifications go
+// out back-to-back as long as the sender holds one of BLE_TX_CREDITS
+// credits, each returned when the stack reports the notification sent,
+// and pause while the stack reports the link congested.
+class BLEServer : public CommandTransport {
 public:
     static BLEServer& getInstance() {
         static BLEServer instance;
         return instance;
     }
     
+    // Brings the controller and Bluedroid up or down (see SubsystemManager)
     bool initialize();
+    bool deinitialize();
     bool start();
     bool stop();
+    
+    // Sends already framed bytes on the TX characteristic; never
+    // interleaves with a command response
     bool sendNotification(const uint8_t* data, size_t length);
     
+    bool isConnected() const { return connected_; }
+    void getStats(BleLinkStats& stats);
+    
 private:
     BLEServer() = default;
     ~BLEServer() = default;
     BLEServer(const BLEServer&) = delete;
     BLEServer& operator=(const BLEServer&) = delete;
     
+    // CommandTransport, used by the command task
+    uint8_t* txBuffer(size_t* capacity) override;
+    bool send(size_t length) override;
+    
     static void gapEventHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t* param);
     static void gattsEventHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t* param);
+    static void commandTask(void* arg);
+    
+    void onConnect(const esp_ble_gatts_cb_param_t* param);
+    void onDisconnect();
+    void onWrite(const esp_ble_gatts_cb_param_t* param);
+    void onPrepareWrite(const esp_ble_gatts_cb_param_t* param);
+    void onExecWrite(const esp_ble_gatts_cb_param_t* param);
+    void queueRx(const uint8_t* data, size_t length);
+    bool notify(const uint8_t* data, size_t length);
+    void restoreCredits();
+    void finishTransfer();
+    
+    bool initialized_ = false;
+    bool classic_released_ = false;
+    bool running_ = false;
+    
+    // Connection, set on the Bluedroid task
+    esp_gatt_if_t gatts_if_ = ESP_GATT_IF_NONE;
+    uint16_t service_handle_ = 0;
+    uint16_t rx_handle_ = 0;
+    uint16_t tx_handle_ = 0;
+    uint16_t cccd_handle_ = 0;
+    uint16_t conn_id_ = 0;
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> notify_enabled_{false};
+    std::atomic<uint16_t> mtu_{23};
+    // Stream offsets: bytes queued so far, and where the bytes of the
+    // current connection begin; anything before that is never parsed
+    std::atomic<uint32_t> rx_queued_{0};
+    std::atomic<uint32_t> link_start_{0};
+    uint8_t prep_[BLE_MAX_ATTR_LEN];    // Long write being reassembled
+    size_t prep_len_ = 0;
+    
+    TaskHandle_t task_ = nullptr;
+    std::atomic<bool> stopping_{false};
+    StreamBufferHandle_t rx_stream_ = nullptr;
+    EventGroupHandle_t events_ = nullptr;
+    SemaphoreHandle_t tx_lock_ = nullptr;
+    SemaphoreHandle_t tx_credits_ = nullptr;
+    
+    // Command task side
+    uint8_t rx_[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + BLE_MAX_ATTR_LEN];
+    size_t rx_len_ = 0;
+    uint32_t rx_read_ = 0;              // Stream offset just past rx_
+    uint8_t tx_[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    bool transfer_active_ = false;
+    int64_t transfer_start_us_ = 0;
+    int64_t transfer_last_us_ = 0;
+    uint32_t transfer_rx_ = 0;
+    uint32_t transfer_tx_ = 0;
     
-    bool running_;
-    uint16_t conn_id_;
-    uint16_t service_handle_;
-    uint16_t char_handle_;
+    portMUX_TYPE stats_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    BleLinkStats stats_ = {};
 };
 
 #endif // BLE_SERVER_H
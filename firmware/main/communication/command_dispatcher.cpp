@@ -0,0 +1,636 @@
+#include "command_dispatcher.h"
+#include <string.h>
+#include <map>
+#include <string>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "../core/boot_manager.h"
+#include "../core/boot_sequence.h"
+#include "../core/log_store.h"
+#include "../core/plugin_manager.h"
+#include "../core/storage_manager.h"
+#include "../core/subsystem_manager.h"
+
+static const char* TAG = "CommandDispatcher";
+
+// Header bytes covered by header_crc: everything before it
+static const size_t FRAME_CRC_OFFSET = FRAME_HEADER_SIZE - sizeof(uint16_t);
+
+static void put32(uint8_t* out, uint32_t value) {
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = (value >> 24) & 0xFF;
+}
+
+bool FrameReader::u8(uint8_t& value) {
+    if (remaining() < 1) {
+        return false;
+    }
+    value = data_[pos_++];
+    return true;
+}
+
+bool FrameReader::u32(uint32_t& value) {
+    if (remaining() < 4) {
+        return false;
+    }
+    const uint8_t* p = data_ + pos_;
+    value = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    pos_ += 4;
+    return true;
+}
+
+bool FrameReader::str(char* out, size_t capacity) {
+    uint8_t length;
+    if (!u8(length) || length >= capacity || remaining() < length) {
+        return false;
+    }
+    memcpy(out, data_ + pos_, length);
+    out[length] = '\0';
+    pos_ += length;
+    return true;
+}
+
+bool FrameReader::bytes(const uint8_t*& data, size_t length) {
+    if (remaining() < length) {
+        return false;
+    }
+    data = data_ + pos_;
+    pos_ += length;
+    return true;
+}
+
+const uint8_t* FrameReader::rest(size_t* length) {
+    *length = remaining();
+    const uint8_t* data = data_ + pos_;
+    pos_ = length_;
+    return data;
+}
+
+bool FrameWriter::reserve(size_t length) {
+    if (overflow_ || capacity_ - pos_ < length) {
+        overflow_ = true;
+        return false;
+    }
+    return true;
+}
+
+void FrameWriter::u8(uint8_t value) {
+    if (reserve(1)) {
+        data_[pos_++] = value;
+    }
+}
+
+void FrameWriter::u32(uint32_t value) {
+    if (reserve(4)) {
+        put32(data_ + pos_, value);
+        pos_ += 4;
+    }
+}
+
+void FrameWriter::str(const char* value) {
+    size_t length = strnlen(value, 255);
+    if (reserve(1 + length)) {
+        data_[pos_++] = (uint8_t)length;
+        memcpy(data_ + pos_, value, length);
+        pos_ += length;
+    }
+}
+
+void FrameWriter::bytes(const uint8_t* data, size_t length) {
+    if (reserve(length)) {
+        memcpy(data_ + pos_, data, length);
+        pos_ += length;
+    }
+}
+
+CommandDispatcher::CommandDispatcher() {
+    lock_ = xSemaphoreCreateMutex();
+
+    handlers_[CMD_PING] = &CommandDispatcher::handlePing;
+    handlers_[CMD_GET_INFO] = &CommandDispatcher::handleGetInfo;
+    handlers_[CMD_LIST_PAYLOADS] = &CommandDispatcher::handleListPayloads;
+    handlers_[CMD_UPLOAD_PAYLOAD] = &CommandDispatcher::handleUpload;
+    handlers_[CMD_DELETE_PAYLOAD] = &CommandDispatcher::handleDelete;
+    handlers_[CMD_EXECUTE_PAYLOAD] = &CommandDispatcher::handleExecute;
+    handlers_[CMD_STOP_PAYLOAD] = &CommandDispatcher::handleStop;
+    handlers_[CMD_GET_PAYLOAD_STATUS] = &CommandDispatcher::handleGetStatus;
+    handlers_[CMD_GET_LOGS] = &CommandDispatcher::handleGetLogs;
+    handlers_[CMD_GET_BOOT_TIMELINE] = &CommandDispatcher::handleGetBootTimeline;
+    handlers_[CMD_OTA_BEGIN] = &CommandDispatcher::handleOtaBegin;
+    handlers_[CMD_OTA_WRITE] = &CommandDispatcher::handleOtaWrite;
+    handlers_[CMD_OTA_END] = &CommandDispatcher::handleOtaEnd;
+    handlers_[CMD_OTA_ABORT] = &CommandDispatcher::handleOtaAbort;
+    handlers_[CMD_REBOOT] = &CommandDispatcher::handleReboot;
+}
+
+frame_parse_t CommandDispatcher::parseFrame(const uint8_t* data, size_t length,
+                                            CommandFrame& frame, size_t* frame_size) {
+    if (length == 0) {
+        return FRAME_INCOMPLETE;
+    }
+    if (data[0] != FRAME_MAGIC) {
+        return FRAME_INVALID;
+    }
+    if (length < FRAME_HEADER_SIZE) {
+        return FRAME_INCOMPLETE;
+    }
+
+    const FrameHeader* header = reinterpret_cast<const FrameHeader*>(data);
+    if (esp_rom_crc16_le(0, data, FRAME_CRC_OFFSET) != header->header_crc ||
+        header->length > FRAME_MAX_PAYLOAD) {
+        return FRAME_INVALID;
+    }
+    size_t size = FRAME_HEADER_SIZE + header->length;
+    if (length < size) {
+        return FRAME_INCOMPLETE;
+    }
+
+    frame.header = header;
+    frame.payload = data + FRAME_HEADER_SIZE;
+    *frame_size = size;
+    if (esp_rom_crc16_le(0, frame.payload, header->length) != header->payload_crc) {
+        return FRAME_CORRUPT;
+    }
+    return FRAME_OK;
+}
+
+// Fills in the header in front of a payload already at out + FRAME_HEADER_SIZE
+size_t CommandDispatcher::encodeFrame(uint8_t* out, uint8_t opcode, uint8_t flags, uint8_t status,
+                                      uint16_t request_id, size_t payload_length) {
+    out[0] = FRAME_MAGIC;
+    out[1] = opcode;
+    out[2] = flags;
+    out[3] = status;
+    out[4] = request_id & 0xFF;
+    out[5] = request_id >> 8;
+    out[6] = payload_length & 0xFF;
+    out[7] = payload_length >> 8;
+    uint16_t crc = esp_rom_crc16_le(0, out + FRAME_HEADER_SIZE, payload_length);
+    out[8] = crc & 0xFF;
+    out[9] = crc >> 8;
+    crc = esp_rom_crc16_le(0, out, FRAME_CRC_OFFSET);
+    out[10] = crc & 0xFF;
+    out[11] = crc >> 8;
+    return FRAME_HEADER_SIZE + payload_length;
+}
+
+size_t CommandDispatcher::process(const uint8_t* data, size_t length, CommandTransport& transport) {
+    size_t used = 0;
+    while (used < length) {
+        CommandFrame frame;
+        size_t frame_size = 0;
+        frame_parse_t result = parseFrame(data + used, length - used, frame, &frame_size);
+        if (result == FRAME_INCOMPLETE) {
+            break;
+        }
+        if (result == FRAME_INVALID) {
+            // Resynchronize on the next possible frame start
+            const void* next = memchr(data + used + 1, FRAME_MAGIC, length - used - 1);
+            used = next ? (const uint8_t*)next - data : length;
+            continue;
+        }
+
+        if (!(frame.header->flags & FRAME_FLAG_RESPONSE)) {
+            xSemaphoreTake(lock_, portMAX_DELAY);
+            if (result == FRAME_CORRUPT) {
+                // Answered so the client can resend without waiting out a timeout
+                ESP_LOGW(TAG, "Dropped frame %u with bad payload CRC", frame.header->request_id);
+                size_t capacity = 0;
+                uint8_t* tx = transport.txBuffer(&capacity);
+                if (tx && capacity >= FRAME_HEADER_SIZE) {
+                    transport.send(encodeFrame(tx, frame.header->opcode, FRAME_FLAG_RESPONSE,
+                                               RESP_BAD_FRAME, frame.header->request_id, 0));
+                }
+            } else {
+                dispatch(frame, transport);
+            }
+            xSemaphoreGive(lock_);
+        }
+        used += frame_size;
+    }
+    return used;
+}
+
+void CommandDispatcher::dispatch(const CommandFrame& frame, CommandTransport& transport) {
+    size_t capacity = 0;
+    uint8_t* tx = transport.txBuffer(&capacity);
+    if (!tx || capacity < FRAME_HEADER_SIZE) {
+        ESP_LOGE(TAG, "No TX buffer for response to 0x%02x", frame.header->opcode);
+        return;
+    }
+    size_t payload_capacity = capacity - FRAME_HEADER_SIZE;
+    if (payload_capacity > FRAME_MAX_PAYLOAD) {
+        payload_capacity = FRAME_MAX_PAYLOAD;
+    }
+
+    FrameReader in(frame.payload, frame.header->length);
+    FrameWriter out(tx + FRAME_HEADER_SIZE, payload_capacity);
+    handler_t handler = handlers_[frame.header->opcode];
+    response_code_t status = handler ? (this->*handler)(in, out) : RESP_INVALID_COMMAND;
+    if (status == RESP_OK && out.overflowed()) {
+        status = RESP_ERROR;
+    }
+
+    size_t length = encodeFrame(tx, frame.header->opcode, FRAME_FLAG_RESPONSE, status,
+                                frame.header->request_id, status == RESP_OK ? out.size() : 0);
+    if (!transport.send(length)) {
+        ESP_LOGW(TAG, "Failed to send response to 0x%02x", frame.header->opcode);
+    }
+
+    after_send_t after = after_send_;
+    after_send_ = AFTER_NONE;
+    if (after == AFTER_NONE) {
+        return;
+    }
+    // Give the transport a moment to get the response out
+    vTaskDelay(pdMS_TO_TICKS(200));
+    if (after == AFTER_APPLY_UPDATE) {
+        BootManager::getInstance().applyUpdate();   // Restarts on success
+    } else {
+        esp_restart();
+    }
+}
+
+// Payload echoed back
+response_code_t CommandDispatcher::handlePing(FrameReader& in, FrameWriter& out) {
+    size_t length;
+    const uint8_t* data = in.rest(&length);
+    out.bytes(data, length);
+    return RESP_OK;
+}
+
+// No request payload. Response:
+//   str version, str firmware_version, u32 uptime_ms, u32 free_heap,
+//   u32 min_free_heap, u32 storage_total, u32 storage_free,
+//   u32 subsystems (SUBSYSTEM_BIT()s up), u8 payloads, u8 ota_in_progress
+response_code_t CommandDispatcher::handleGetInfo(FrameReader& in, FrameWriter& out) {
+    StorageManager& storage = StorageManager::getInstance();
+    BootManager& boot = BootManager::getInstance();
+
+    out.str(DEZERO_VERSION);
+    out.str(boot.getFirmwareVersion());
+    out.u32((uint32_t)(esp_timer_get_time() / 1000));
+    out.u32(esp_get_free_heap_size());
+    out.u32(esp_get_minimum_free_heap_size());
+    out.u32(storage.getTotalSpace());
+    out.u32(storage.getFreeSpace());
+    out.u32(SubsystemManager::getInstance().getActiveMask());
+    out.u8((uint8_t)PluginManager::getInstance().getCatalog()->summaries.size());
+    out.u8(boot.isOtaInProgress() ? 1 : 0);
+    return RESP_OK;
+}
+
+// str after_id (empty for the first page). Response: a listPayloads() page
+response_code_t CommandDispatcher::handleListPayloads(FrameReader& in, FrameWriter& out) {
+    char after_id[MAX_PAYLOAD_ID_LEN];
+    if (!in.str(after_id, sizeof(after_id))) {
+        return RESP_INVALID_PARAMS;
+    }
+    size_t capacity;
+    uint8_t* page = out.tail(&capacity);
+    size_t length = PluginManager::getInstance().listPayloads(after_id, page, capacity);
+    if (length == 0) {
+        return RESP_ERROR;
+    }
+    out.advance(length);
+    return RESP_OK;
+}
+
+// u8 step (upload_step_t), str payload_id, then by step:
+//   UPLOAD_BEGIN   u32 total_size, optionally 32-byte SHA-256 of the upload;
+//                  response u32 resume_offset
+//   UPLOAD_WRITE   u32 offset, chunk bytes up to the end of the frame
+//   UPLOAD_MANIFEST  manifest.json up to the end of the frame; required
+//                  once per session, any time between begin and commit
+//   UPLOAD_COMMIT, UPLOAD_ABORT  nothing
+response_code_t CommandDispatcher::handleUpload(FrameReader& in, FrameWriter& out) {
+    PluginManager& plugins = PluginManager::getInstance();
+    uint8_t step;
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+    if (!in.u8(step) || !in.str(payload_id, sizeof(payload_id)) || payload_id[0] == '\0') {
+        return RESP_INVALID_PARAMS;
+    }
+
+    switch (step) {
+    case UPLOAD_BEGIN: {
+        uint32_t total_size;
+        const uint8_t* digest = nullptr;
+        if (!in.u32(total_size) ||
+            (in.remaining() && !in.bytes(digest, PAYLOAD_DIGEST_SIZE)) || in.remaining()) {
+            return RESP_INVALID_PARAMS;
+        }
+        if (total_size > MAX_PAYLOAD_SIZE) {
+            return RESP_STORAGE_FULL;
+        }
+        size_t resume_offset = 0;
+        if (!plugins.beginInstall(payload_id, total_size, digest, &resume_offset)) {
+            return RESP_ERROR;
+        }
+        out.u32(resume_offset);
+        return RESP_OK;
+    }
+    case UPLOAD_WRITE: {
+        uint32_t offset;
+        if (!in.u32(offset)) {
+            return RESP_INVALID_PARAMS;
+        }
+        size_t length;
+        const uint8_t* data = in.rest(&length);
+        return plugins.writeInstallChunk(payload_id, offset, data, length) ? RESP_OK : RESP_ERROR;
+    }
+    case UPLOAD_MANIFEST: {
+        size_t length;
+        const uint8_t* manifest = in.rest(&length);
+        if (length == 0) {
+            return RESP_INVALID_PARAMS;
+        }
+        return plugins.writeInstallManifest(payload_id, manifest, length) ? RESP_OK : RESP_ERROR;
+    }
+    case UPLOAD_COMMIT:
+        return plugins.commitInstall(payload_id) ? RESP_OK : RESP_ERROR;
+    case UPLOAD_ABORT:
+        plugins.abortInstall(payload_id);
+        return RESP_OK;
+    default:
+        return RESP_INVALID_PARAMS;
+    }
+}
+
+// str payload_id
+response_code_t CommandDispatcher::handleDelete(FrameReader& in, FrameWriter& out) {
+    PluginManager& plugins = PluginManager::getInstance();
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+    if (!in.str(payload_id, sizeof(payload_id))) {
+        return RESP_INVALID_PARAMS;
+    }
+    if (!plugins.getPayloadManifest(payload_id)) {
+        return RESP_NOT_FOUND;
+    }
+    return plugins.uninstallPayload(payload_id) ? RESP_OK : RESP_ERROR;
+}
+
+// str payload_id, u8 count, count x { str name, str value }
+response_code_t CommandDispatcher::handleExecute(FrameReader& in, FrameWriter& out) {
+    PluginManager& plugins = PluginManager::getInstance();
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+    uint8_t count;
+    if (!in.str(payload_id, sizeof(payload_id)) || !in.u8(count)) {
+        return RESP_INVALID_PARAMS;
+    }
+
+    std::map<std::string, std::string> params;
+    char name[64];
+    char value[256];
+    for (uint8_t i = 0; i < count; i++) {
+        if (!in.str(name, sizeof(name)) || !in.str(value, sizeof(value))) {
+            return RESP_INVALID_PARAMS;
+        }
+        params[name] = value;
+    }
+
+    if (!plugins.getPayloadManifest(payload_id)) {
+        return RESP_NOT_FOUND;
+    }
+    if (plugins.getPayloadStatus(payload_id) == PAYLOAD_STATUS_RUNNING) {
+        return RESP_ALREADY_RUNNING;
+    }
+    return plugins.executePayload(payload_id, params) ? RESP_OK : RESP_ERROR;
+}
+
+// str payload_id
+response_code_t CommandDispatcher::handleStop(FrameReader& in, FrameWriter& out) {
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+    if (!in.str(payload_id, sizeof(payload_id))) {
+        return RESP_INVALID_PARAMS;
+    }
+    return PluginManager::getInstance().stopPayload(payload_id) ? RESP_OK : RESP_NOT_FOUND;
+}
+
+// str payload_id. Response:
+//   u8 status (payload_status_t), u8 core (0xFF if not running),
+//   u32 runtime_ms, u32 stored_size, u32 raw_size, u32 decode_us
+// The sizes are 0 until the payload has been verified.
+response_code_t CommandDispatcher::handleGetStatus(FrameReader& in, FrameWriter& out) {
+    PluginManager& plugins = PluginManager::getInstance();
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+    if (!in.str(payload_id, sizeof(payload_id))) {
+        return RESP_INVALID_PARAMS;
+    }
+
+    PayloadStatusEntry entry;
+    if (!plugins.getPayloadStatusEntry(payload_id, entry)) {
+        if (!plugins.getPayloadManifest(payload_id)) {
+            return RESP_NOT_FOUND;
+        }
+        entry.status = PAYLOAD_STATUS_IDLE;
+        entry.core_id = -1;
+        entry.start_time = 0;
+    }
+    uint32_t runtime_ms = 0;
+    if (entry.status == PAYLOAD_STATUS_RUNNING) {
+        runtime_ms = (uint32_t)(esp_timer_get_time() / 1000 - entry.start_time);
+    }
+
+    PayloadStreamStats stats = {};
+    plugins.getPayloadStorageStats(payload_id, stats);
+
+    out.u8((uint8_t)entry.status);
+    out.u8(entry.core_id < 0 ? 0xFF : (uint8_t)entry.core_id);
+    out.u32(runtime_ms);
+    out.u32(stats.stored_size);
+    out.u32(stats.raw_size);
+    out.u32(stats.decode_us);
+    return RESP_OK;
+}
+
+// u32 cursor. Response: u32 next_cursor, u32 dropped, then the records
+// from LogStore::read()
+response_code_t CommandDispatcher::handleGetLogs(FrameReader& in, FrameWriter& out) {
+    LogStore& logs = LogStore::getInstance();
+    uint32_t cursor;
+    if (!in.u32(cursor)) {
+        return RESP_INVALID_PARAMS;
+    }
+    size_t capacity;
+    uint8_t* body = out.tail(&capacity);
+    if (capacity < 8) {
+        return RESP_ERROR;
+    }
+    uint32_t next_cursor = cursor;
+    size_t length = logs.read(cursor, body + 8, capacity - 8, &next_cursor);
+    put32(body, next_cursor);
+    put32(body + 4, logs.getDropped());
+    out.advance(8 + length);
+    return RESP_OK;
+}
+
+// No request payload. Response: BootSequence::getTimeline()
+response_code_t CommandDispatcher::handleGetBootTimeline(FrameReader& in, FrameWriter& out) {
+    size_t capacity;
+    uint8_t* body = out.tail(&capacity);
+    size_t length = BootSequence::getInstance().getTimeline(body, capacity);
+    if (length == 0) {
+        return RESP_ERROR;
+    }
+    out.advance(length);
+    return RESP_OK;
+}
+
+// u8 kind (ota_image_t), u32 size, and for a full image its 32-byte
+// SHA-256. Response: u32 resume_offset (always 0 for a delta)
+response_code_t CommandDispatcher::handleOtaBegin(FrameReader& in, FrameWriter& out) {
+    BootManager& boot = BootManager::getInstance();
+    uint8_t kind;
+    uint32_t size;
+    if (!in.u8(kind) || !in.u32(size)) {
+        return RESP_INVALID_PARAMS;
+    }
+
+    size_t resume_offset = 0;
+    if (kind == OTA_IMAGE_FULL) {
+        const uint8_t* digest;
+        if (!in.bytes(digest, PAYLOAD_DIGEST_SIZE)) {
+            return RESP_INVALID_PARAMS;
+        }
+        if (!boot.beginOta(size, digest, &resume_offset)) {
+            return RESP_ERROR;
+        }
+    } else if (kind == OTA_IMAGE_DELTA) {
+        if (!boot.beginDeltaOta(size)) {
+            return RESP_ERROR;
+        }
+    } else {
+        return RESP_INVALID_PARAMS;
+    }
+
+    ota_delta_ = kind == OTA_IMAGE_DELTA;
+    out.u32(resume_offset);
+    return RESP_OK;
+}
+
+// u32 offset, image or patch bytes up to the end of the frame
+response_code_t CommandDispatcher::handleOtaWrite(FrameReader& in, FrameWriter& out) {
+    BootManager& boot = BootManager::getInstance();
+    uint32_t offset;
+    if (!in.u32(offset)) {
+        return RESP_INVALID_PARAMS;
+    }
+    size_t length;
+    const uint8_t* data = in.rest(&length);
+    bool ok = ota_delta_ ? boot.writeDeltaOta(offset, data, length)
+                         : boot.writeOta(offset, data, length);
+    return ok ? RESP_OK : RESP_ERROR;
+}
+
+// No request payload. On success the new image is booted once the
+// response has been sent
+response_code_t CommandDispatcher::handleOtaEnd(FrameReader& in, FrameWriter& out) {
+    BootManager& boot = BootManager::getInstance();
+    if (!(ota_delta_ ? boot.endDeltaOta() : boot.endOta())) {
+        return RESP_ERROR;
+    }
+    after_send_ = AFTER_APPLY_UPDATE;
+    return RESP_OK;
+}
+
+// No request payload
+response_code_t CommandDispatcher::handleOtaAbort(FrameReader& in, FrameWriter& out) {
+    BootManager::getInstance().abortOta();
+    return RESP_OK;
+}
+
+// No request payload; restarts once the response has been sent
+response_code_t CommandDispatcher::handleReboot(FrameReader& in, FrameWriter& out) {
+    after_send_ = AFTER_REBOOT;
+    return RESP_OK;
+}
+
+#if CONFIG_DEZERO_PROTOCOL_BENCHMARK
+// Answers land back in the same task, where they are checked
+class LoopbackTransport : public CommandTransport {
+public:
+    uint8_t* txBuffer(size_t* capacity) override {
+        *capacity = sizeof(tx_);
+        return tx_;
+    }
+
+    bool send(size_t length) override {
+        CommandFrame frame;
+        size_t size;
+        ok_ = CommandDispatcher::parseFrame(tx_, length, frame, &size) == FRAME_OK &&
+              size == length && frame.header->request_id == expected_id_ &&
+              frame.header->status == RESP_OK;
+        return true;
+    }
+
+    uint16_t expected_id_ = 0;
+    bool ok_ = false;
+
+private:
+    uint8_t tx_[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+};
+
+// Round trips through process() and a loopback transport: frame parsing,
+// dispatch, the handler and response encoding, without a radio in the way
+void CommandDispatcher::benchmark() {
+    static const int CALLS = 200;
+    static LoopbackTransport loopback;
+    static uint8_t request[FRAME_HEADER_SIZE + 64];
+
+    const char* payload_id = "";
+    PayloadCatalogRef catalog = PluginManager::getInstance().getCatalog();
+    if (!catalog->summaries.empty()) {
+        payload_id = catalog->summaries[0].id;
+    }
+
+    struct {
+        const char* name;
+        uint8_t opcode;
+        size_t length;
+    } cases[] = {
+        {"ping",        CMD_PING,               32},
+        {"get_info",    CMD_GET_INFO,           0},
+        {"list",        CMD_LIST_PAYLOADS,      1},
+        {"status",      CMD_GET_PAYLOAD_STATUS, 1 + strlen(payload_id)},
+    };
+
+    for (const auto& c : cases) {
+        uint8_t* payload = request + FRAME_HEADER_SIZE;
+        memset(payload, 0xA5, c.length);
+        if (c.opcode == CMD_LIST_PAYLOADS) {
+            payload[0] = 0;
+        } else if (c.opcode == CMD_GET_PAYLOAD_STATUS) {
+            payload[0] = (uint8_t)strlen(payload_id);
+            memcpy(payload + 1, payload_id, payload[0]);
+        }
+
+        int64_t total = 0;
+        int64_t min = INT64_MAX;
+        int64_t max = 0;
+        int failed = 0;
+        for (int i = 0; i < CALLS; i++) {
+            uint16_t request_id = (uint16_t)i;
+            size_t size = encodeFrame(request, c.opcode, 0, 0, request_id, c.length);
+            loopback.expected_id_ = request_id;
+            loopback.ok_ = false;
+
+            int64_t start = esp_timer_get_time();
+            process(request, size, loopback);
+            int64_t elapsed = esp_timer_get_time() - start;
+
+            total += elapsed;
+            min = elapsed < min ? elapsed : min;
+            max = elapsed > max ? elapsed : max;
+            failed += loopback.ok_ ? 0 : 1;
+        }
+        ESP_LOGI(TAG, "%-8s %6u cmd/s, latency min %u avg %u max %u us%s",
+                 c.name, (unsigned)(total ? CALLS * 1000000LL / total : 0),
+                 (unsigned)min, (unsigned)(total / CALLS), (unsigned)max,
+                 failed ? " (some failed)" : "");
+    }
+}
+#endif
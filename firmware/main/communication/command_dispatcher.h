@@ -0,0 +1,190 @@
+#ifndef COMMAND_DISPATCHER_H
+#define COMMAND_DISPATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "../include/types.h"
+
+#define FRAME_MAGIC 0xD0
+#define FRAME_HEADER_SIZE 12
+#define FRAME_MAX_PAYLOAD 4096          // One OTA slot per OTA_WRITE
+
+#define FRAME_FLAG_RESPONSE 0x01
+
+// Frame header as sent on every transport, little endian; the payload
+// follows it. Both checks are esp_rom_crc16_le() with a seed of 0 (the
+// reflected CCITT polynomial): header_crc over the ten header bytes before
+// it, so a stray magic byte is never taken for a length to wait for, and
+// payload_crc over the payload. A response carries the request's opcode
+// and request_id, the RESPONSE flag and a response_code_t in status.
+struct __attribute__((packed)) FrameHeader {
+    uint8_t magic;
+    uint8_t opcode;                     // command_type_t
+    uint8_t flags;
+    uint8_t status;                     // response_code_t; 0 in requests
+    uint16_t request_id;
+    uint16_t length;                    // Payload bytes
+    uint16_t payload_crc;
+    uint16_t header_crc;
+};
+static_assert(sizeof(FrameHeader) == FRAME_HEADER_SIZE, "FrameHeader is a wire format");
+
+// CMD_UPLOAD_PAYLOAD steps of an install session
+typedef enum {
+    UPLOAD_BEGIN = 0,
+    UPLOAD_WRITE,
+    UPLOAD_COMMIT,
+    UPLOAD_ABORT,
+    UPLOAD_MANIFEST
+} upload_step_t;
+
+// CMD_OTA_BEGIN image kinds
+typedef enum {
+    OTA_IMAGE_FULL = 0,                 // A complete firmware image
+    OTA_IMAGE_DELTA                     // A tools/make_delta.py patch
+} ota_image_t;
+
+// A parsed frame; both pointers point into the receive buffer
+struct CommandFrame {
+    const FrameHeader* header;
+    const uint8_t* payload;
+};
+
+typedef enum {
+    FRAME_OK,
+    FRAME_INCOMPLETE,                   // Wait for more bytes
+    FRAME_INVALID,                      // Not a frame header
+    FRAME_CORRUPT                       // Payload CRC mismatch
+} frame_parse_t;
+
+// Bounds-checked reads from a frame payload. Byte fields are returned as
+// pointers into the payload; only strings are copied, to NUL-terminate
+// them for the C-string APIs they are passed to.
+class FrameReader {
+public:
+    FrameReader(const uint8_t* data, size_t length) : data_(data), length_(length) {}
+
+    bool u8(uint8_t& value);
+    bool u32(uint32_t& value);
+    bool str(char* out, size_t capacity);   // u8 length, then the bytes
+    bool bytes(const uint8_t*& data, size_t length);
+    const uint8_t* rest(size_t* length);
+    size_t remaining() const { return length_ - pos_; }
+
+private:
+    const uint8_t* data_;
+    size_t length_;
+    size_t pos_ = 0;
+};
+
+// Encodes a response payload in place in the transport's TX buffer. Writes
+// past the end are dropped and remembered; the dispatcher then answers
+// RESP_ERROR instead of sending a truncated payload.
+class FrameWriter {
+public:
+    FrameWriter(uint8_t* data, size_t capacity) : data_(data), capacity_(capacity) {}
+
+    void u8(uint8_t value);
+    void u32(uint32_t value);
+    void str(const char* value);
+    void bytes(const uint8_t* data, size_t length);
+
+    // For encoders that fill the buffer themselves, e.g. listPayloads()
+    uint8_t* tail(size_t* capacity) { *capacity = capacity_ - pos_; return data_ + pos_; }
+    void advance(size_t length) { pos_ += length; }
+
+    size_t size() const { return pos_; }
+    bool overflowed() const { return overflow_; }
+
+private:
+    bool reserve(size_t length);
+
+    uint8_t* data_;
+    size_t capacity_;
+    size_t pos_ = 0;
+    bool overflow_ = false;
+};
+
+// A link that carries frames: BLE, WebSocket, or a loopback for testing.
+// The dispatcher encodes each response directly into the buffer returned
+// by txBuffer() and then asks the transport to send its first bytes.
+class CommandTransport {
+public:
+    virtual ~CommandTransport() = default;
+
+    virtual uint8_t* txBuffer(size_t* capacity) = 0;
+    virtual bool send(size_t length) = 0;
+};
+
+// Turns request frames into calls on PluginManager, StorageManager,
+// BootManager and friends, and encodes their answers.
+//
+// Transports hand over whatever they received; frames are validated and
+// read in place, and every complete one is answered before process()
+// returns. Handlers are looked up by opcode in a 256-entry table. One
+// frame is handled at a time, whichever transport it came in on, so
+// upload and OTA sessions see their chunks in order. The request payload
+// of each command is documented next to its handler.
+class CommandDispatcher {
+public:
+    static CommandDispatcher& getInstance() {
+        static CommandDispatcher instance;
+        return instance;
+    }
+
+    // Handles the complete frames at the start of data and returns the
+    // bytes consumed; the transport keeps the rest until more arrives
+    size_t process(const uint8_t* data, size_t length, CommandTransport& transport);
+
+    static frame_parse_t parseFrame(const uint8_t* data, size_t length,
+                                    CommandFrame& frame, size_t* frame_size);
+    static size_t encodeFrame(uint8_t* out, uint8_t opcode, uint8_t flags, uint8_t status,
+                              uint16_t request_id, size_t payload_length);
+
+#if CONFIG_DEZERO_PROTOCOL_BENCHMARK
+    void benchmark();
+#endif
+
+private:
+    CommandDispatcher();
+    ~CommandDispatcher() = default;
+    CommandDispatcher(const CommandDispatcher&) = delete;
+    CommandDispatcher& operator=(const CommandDispatcher&) = delete;
+
+    typedef response_code_t (CommandDispatcher::*handler_t)(FrameReader& in, FrameWriter& out);
+
+    // Runs once the response is on its way
+    typedef enum {
+        AFTER_NONE,
+        AFTER_REBOOT,
+        AFTER_APPLY_UPDATE
+    } after_send_t;
+
+    void dispatch(const CommandFrame& frame, CommandTransport& transport);
+
+    response_code_t handlePing(FrameReader& in, FrameWriter& out);
+    response_code_t handleGetInfo(FrameReader& in, FrameWriter& out);
+    response_code_t handleListPayloads(FrameReader& in, FrameWriter& out);
+    response_code_t handleUpload(FrameReader& in, FrameWriter& out);
+    response_code_t handleDelete(FrameReader& in, FrameWriter& out);
+    response_code_t handleExecute(FrameReader& in, FrameWriter& out);
+    response_code_t handleStop(FrameReader& in, FrameWriter& out);
+    response_code_t handleGetStatus(FrameReader& in, FrameWriter& out);
+    response_code_t handleGetLogs(FrameReader& in, FrameWriter& out);
+    response_code_t handleGetBootTimeline(FrameReader& in, FrameWriter& out);
+    response_code_t handleOtaBegin(FrameReader& in, FrameWriter& out);
+    response_code_t handleOtaWrite(FrameReader& in, FrameWriter& out);
+    response_code_t handleOtaEnd(FrameReader& in, FrameWriter& out);
+    response_code_t handleOtaAbort(FrameReader& in, FrameWriter& out);
+    response_code_t handleReboot(FrameReader& in, FrameWriter& out);
+
+    handler_t handlers_[256] = {};
+    SemaphoreHandle_t lock_ = nullptr;
+    bool ota_delta_ = false;
+    after_send_t after_send_ = AFTER_NONE;
+};
+
+#endif // COMMAND_DISPATCHER_H
@@ -2,9 +2,39 @@
 #include "esp_log.h"
 #include <cstring>
 #include "esp_http_server.h"
+#include "command_dispatcher.h"
 
 static const char* TAG = "WebSocketServer";
 
+// The server runs its handlers on one task, so one set of buffers does
+static uint8_t ws_rx[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+
+// Answers go back on the connection the request came in on
+class WebSocketTransport : public CommandTransport {
+public:
+    explicit WebSocketTransport(httpd_req_t* req) : req_(req) {}
+
+    uint8_t* txBuffer(size_t* capacity) override {
+        *capacity = sizeof(tx_);
+        return tx_;
+    }
+
+    bool send(size_t length) override {
+        httpd_ws_frame_t ws_pkt;
+        memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+        ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+        ws_pkt.payload = tx_;
+        ws_pkt.len = length;
+        return httpd_ws_send_frame(req_, &ws_pkt) == ESP_OK;
+    }
+
+private:
+    httpd_req_t* req_;
+    static uint8_t tx_[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+};
+
+uint8_t WebSocketTransport::tx_[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+
 bool WebSocketServer::initialize() {
     ESP_LOGI(TAG, "Initializing WebSocket Server");
     running_ = false;
@@ -18,12 +48,57 @@ bool WebSocketServer::start(int port) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = port;
     
-    if (httpd_start(&server_, &config) == ESP_OK) {
-        running_ = true;
-        return true;
+    if (httpd_start(&server_, &config) != ESP_OK) {
+        return false;
+    }
+    
+    httpd_uri_t ws_uri = {};
+    ws_uri.uri = "/ws";
+    ws_uri.method = HTTP_GET;
+    ws_uri.handler = &WebSocketServer::wsHandler;
+    ws_uri.is_websocket = true;
+    if (httpd_register_uri_handler(server_, &ws_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register /ws");
+        httpd_stop(server_);
+        server_ = NULL;
+        return false;
+    }
+    
+    running_ = true;
+    return true;
+}
+
+// Each binary message holds whole frames; a partial frame at the end of
+// a message is dropped rather than joined with the next message
+esp_err_t WebSocketServer::wsHandler(httpd_req_t* req) {
+    if (req->method == HTTP_GET) {
+        ESP_LOGI(TAG, "Client connected on fd %d", httpd_req_to_sockfd(req));
+        return ESP_OK;
+    }
+    
+    httpd_ws_frame_t ws_pkt;
+    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+    esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (ws_pkt.type != HTTPD_WS_TYPE_BINARY || ws_pkt.len == 0) {
+        return ESP_OK;
+    }
+    if (ws_pkt.len > sizeof(ws_rx)) {
+        ESP_LOGW(TAG, "Dropped %u byte message", (unsigned)ws_pkt.len);
+        return ESP_FAIL;
+    }
+    
+    ws_pkt.payload = ws_rx;
+    ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
+    if (ret != ESP_OK) {
+        return ret;
     }
     
-    return false;
+    WebSocketTransport transport(req);
+    CommandDispatcher::getInstance().process(ws_rx, ws_pkt.len, transport);
+    return ESP_OK;
 }
 
 bool WebSocketServer::stop() {
@@ -22,6 +22,9 @@ private:
     WebSocketServer(const WebSocketServer&) = delete;
     WebSocketServer& operator=(const WebSocketServer&) = delete;
     
+    // Binary messages on /ws carry command frames (CommandDispatcher)
+    static esp_err_t wsHandler(httpd_req_t* req);
+    
     httpd_handle_t server_;
     bool running_;
 };
@@ -1,30 +1,163 @@
 #include "wifi_manager.h"
 #include "esp_log.h"
-#include "esp_event.h"
-#include "nvs_flash.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include <cstring>
 
 static const char* TAG = "WiFiManager";
 
+static const char* WIFI_NVS_NAMESPACE = "wifi";
+static const char* WIFI_NVS_KEY = "sta_cache";
+static const uint32_t STATION_CACHE_MAGIC = 0x57494331;    // "WIC1"
+
+// Rejoin attempts that go straight to the cached AP, and the total before
+// giving up on a dropped link
+static const uint8_t FAST_RETRIES = 2;
+static const uint8_t MAX_RETRIES = 6;
+static const TickType_t DISCONNECT_WAIT = pdMS_TO_TICKS(1000);
+
+static const EventBits_t CONNECTED_BIT = 1 << 0;
+static const EventBits_t FAIL_BIT = 1 << 1;
+static const EventBits_t DISCONNECTED_BIT = 1 << 2;
+static const EventBits_t SCAN_DONE_BIT = 1 << 3;
+
 bool WiFiManager::initialize() {
+    if (state_ != WIFI_STATE_OFF) {
+        return true;
+    }
     ESP_LOGI(TAG, "Initializing WiFi Manager");
-    
-    ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
-    
-    esp_netif_create_default_wifi_ap();
-    esp_netif_create_default_wifi_sta();
-    
+
+    if (!lock_) {
+        lock_ = xSemaphoreCreateMutex();
+        events_ = xEventGroupCreate();
+        if (!lock_ || !events_) {
+            ESP_LOGE(TAG, "Failed to create WiFi locks");
+            return false;
+        }
+    }
+
+    if (!netif_ready_) {
+        esp_err_t err = esp_netif_init();
+        if (err == ESP_OK) {
+            err = esp_event_loop_create_default();
+        }
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+            ESP_LOGE(TAG, "Failed to set up networking: %s", esp_err_to_name(err));
+            return false;
+        }
+
+        esp_netif_create_default_wifi_ap();
+        esp_netif_create_default_wifi_sta();
+        netif_ready_ = true;
+    }
+
+    // Brought up on demand, so running out of memory here is not fatal
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-    
-    initialized_ = true;
+    esp_err_t err = esp_wifi_init(&cfg);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize WiFi: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    // The driver would otherwise rewrite its config in NVS on every
+    // connect; the station cache below is all that needs to persist
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+
+    err = esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &WiFiManager::eventHandler,
+                                              this, &wifi_handler_);
+    if (err == ESP_OK) {
+        err = esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &WiFiManager::eventHandler,
+                                                  this, &ip_handler_);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register WiFi events: %s", esp_err_to_name(err));
+        if (wifi_handler_) {
+            esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_handler_);
+            wifi_handler_ = nullptr;
+        }
+        esp_wifi_deinit();
+        return false;
+    }
+
+    loadCache();
+    xEventGroupClearBits(events_, CONNECTED_BIT | FAIL_BIT | DISCONNECTED_BIT | SCAN_DONE_BIT);
+    sta_enabled_ = false;
+    ap_enabled_ = false;
+    started_ = false;
+    state_ = WIFI_STATE_IDLE;
+    return true;
+}
+
+bool WiFiManager::deinitialize() {
+    if (state_ == WIFI_STATE_OFF) {
+        return true;
+    }
+    ESP_LOGI(TAG, "Shutting down WiFi");
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    user_disconnect_ = true;
+    esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_handler_);
+    esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, ip_handler_);
+    wifi_handler_ = nullptr;
+    ip_handler_ = nullptr;
+    saveCache();
+
+    esp_wifi_stop();
+    esp_err_t err = esp_wifi_deinit();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to deinitialize WiFi: %s", esp_err_to_name(err));
+    }
+
+    started_ = false;
+    sta_enabled_ = false;
+    ap_enabled_ = false;
+    state_ = WIFI_STATE_OFF;
+    xSemaphoreGive(lock_);
+    return err == ESP_OK;
+}
+
+// Puts the driver in the mode the active roles need; called with lock_ held
+bool WiFiManager::applyMode() {
+    wifi_mode_t mode = WIFI_MODE_NULL;
+    if (sta_enabled_ && ap_enabled_) {
+        mode = WIFI_MODE_APSTA;
+    } else if (sta_enabled_) {
+        mode = WIFI_MODE_STA;
+    } else if (ap_enabled_) {
+        mode = WIFI_MODE_AP;
+    }
+
+    if (mode == WIFI_MODE_NULL) {
+        if (started_) {
+            esp_wifi_stop();
+            started_ = false;
+        }
+        return true;
+    }
+
+    esp_err_t err = esp_wifi_set_mode(mode);
+    if (err == ESP_OK && !started_) {
+        err = esp_wifi_start();
+        started_ = (err == ESP_OK);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to switch WiFi mode: %s", esp_err_to_name(err));
+        return false;
+    }
     return true;
 }
 
 bool WiFiManager::startAP(const char* ssid, const char* password) {
+    if (!ssid || strlen(ssid) > 32 || !password || strlen(password) > 63 ||
+        (password[0] && strlen(password) < 8)) {
+        ESP_LOGE(TAG, "Invalid AP credentials");
+        return false;
+    }
+    if (state_ == WIFI_STATE_OFF) {
+        return false;
+    }
     ESP_LOGI(TAG, "Starting AP: %s", ssid);
-    
+
     wifi_config_t wifi_config = {};
     strcpy((char*)wifi_config.ap.ssid, ssid);
     strcpy((char*)wifi_config.ap.password, password);
@@ -32,39 +165,404 @@ bool WiFiManager::startAP(const char* ssid, const char* password) {
     wifi_config.ap.channel = 1;
     wifi_config.ap.max_connection = 4;
     wifi_config.ap.authmode = WIFI_AUTH_WPA_WPA2_PSK;
-    
+
     if (strlen(password) == 0) {
         wifi_config.ap.authmode = WIFI_AUTH_OPEN;
     }
-    
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    
-    return true;
+
+    // An associated station pins the radio to its channel; the AP follows
+    if (state_ == WIFI_STATE_CONNECTED) {
+        portENTER_CRITICAL(&cache_lock_);
+        wifi_config.ap.channel = cache_.channel ? cache_.channel : 1;
+        portEXIT_CRITICAL(&cache_lock_);
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool was_enabled = ap_enabled_;
+    ap_enabled_ = true;
+    bool ok = applyMode();
+    if (ok) {
+        esp_err_t err = esp_wifi_set_config(WIFI_IF_AP, &wifi_config);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to configure AP: %s", esp_err_to_name(err));
+            ok = false;
+        }
+    }
+    if (!ok) {
+        ap_enabled_ = was_enabled;
+        applyMode();
+    }
+    xSemaphoreGive(lock_);
+    return ok;
 }
 
 bool WiFiManager::stopAP() {
-    esp_wifi_stop();
-    return true;
+    if (state_ == WIFI_STATE_OFF) {
+        return true;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    ap_enabled_ = false;
+    bool ok = applyMode();
+    xSemaphoreGive(lock_);
+    return ok;
 }
 
-bool WiFiManager::connectSTA(const char* ssid, const char* password) {
+bool WiFiManager::enableStation() {
+    if (state_ == WIFI_STATE_OFF) {
+        return false;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool ok = true;
+    if (!sta_enabled_) {
+        sta_enabled_ = true;
+        ok = applyMode();
+        if (ok) {
+            state_ = WIFI_STATE_STARTED;
+        } else {
+            sta_enabled_ = false;
+        }
+    }
+    xSemaphoreGive(lock_);
+    return ok;
+}
+
+// Points the station at the cached AP if it is the one wanted, otherwise
+// at the strongest AP with the SSID found by a full scan
+void WiFiManager::setTarget(bool use_cache) {
+    wifi_config_t config;
+    portENTER_CRITICAL(&cache_lock_);
+    wifi_sta_config_t& sta = sta_config_.sta;
+    fast_attempt_ = use_cache && cache_.magic == STATION_CACHE_MAGIC && cache_.channel != 0 &&
+                    strncmp(cache_.ssid, (const char*)sta.ssid, sizeof(sta.ssid)) == 0;
+    if (fast_attempt_) {
+        sta.bssid_set = true;
+        memcpy(sta.bssid, cache_.bssid, sizeof(sta.bssid));
+        sta.channel = cache_.channel;
+        sta.scan_method = WIFI_FAST_SCAN;
+    } else {
+        sta.bssid_set = false;
+        sta.channel = 0;
+        sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+        sta.sort_method = WIFI_CONNECT_AP_BY_SIGNAL;
+    }
+    config = sta_config_;
+    portEXIT_CRITICAL(&cache_lock_);
+
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+}
+
+bool WiFiManager::connectSTA(const char* ssid, const char* password, uint32_t timeout_ms) {
+    if (!ssid || !ssid[0] || strlen(ssid) > 32 || (password && strlen(password) > 63)) {
+        ESP_LOGE(TAG, "Invalid station credentials");
+        return false;
+    }
+    if (state_ == WIFI_STATE_OFF || !enableStation()) {
+        return false;
+    }
     ESP_LOGI(TAG, "Connecting to: %s", ssid);
-    
-    wifi_config_t wifi_config = {};
-    strcpy((char*)wifi_config.sta.ssid, ssid);
-    strcpy((char*)wifi_config.sta.password, password);
-    
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_start());
-    ESP_ERROR_CHECK(esp_wifi_connect());
-    
-    return true;
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+
+    // Leave whatever network the station is on first
+    wifi_state_t state = state_;
+    if (state == WIFI_STATE_CONNECTING || state == WIFI_STATE_CONNECTED ||
+        state == WIFI_STATE_RECONNECTING) {
+        xEventGroupClearBits(events_, DISCONNECTED_BIT);
+        user_disconnect_ = true;
+        esp_wifi_disconnect();
+        xEventGroupWaitBits(events_, DISCONNECTED_BIT, pdFALSE, pdTRUE, DISCONNECT_WAIT);
+        state_ = WIFI_STATE_STARTED;
+    }
+
+    portENTER_CRITICAL(&cache_lock_);
+    memset(&sta_config_, 0, sizeof(sta_config_));
+    strncpy((char*)sta_config_.sta.ssid, ssid, sizeof(sta_config_.sta.ssid));
+    if (password) {
+        strncpy((char*)sta_config_.sta.password, password, sizeof(sta_config_.sta.password));
+    }
+    retries_ = 0;
+    portEXIT_CRITICAL(&cache_lock_);
+
+    // One attempt at the cached AP, then one with a full scan
+    bool connected = false;
+    bool use_cache = true;
+    while (true) {
+        setTarget(use_cache);
+        xEventGroupClearBits(events_, CONNECTED_BIT | FAIL_BIT);
+        user_disconnect_ = false;
+        connect_start_us_ = esp_timer_get_time();
+        state_ = WIFI_STATE_CONNECTING;
+
+        esp_err_t err = esp_wifi_connect();
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to start connecting: %s", esp_err_to_name(err));
+            state_ = WIFI_STATE_STARTED;
+            break;
+        }
+
+        EventBits_t bits = xEventGroupWaitBits(events_, CONNECTED_BIT | FAIL_BIT, pdFALSE, pdFALSE,
+                                               pdMS_TO_TICKS(timeout_ms));
+        if (bits & CONNECTED_BIT) {
+            connected = true;
+            break;
+        }
+        if (!(bits & FAIL_BIT)) {
+            // Timed out; stop the driver from retrying behind our back
+            xEventGroupClearBits(events_, DISCONNECTED_BIT);
+            user_disconnect_ = true;
+            esp_wifi_disconnect();
+            xEventGroupWaitBits(events_, DISCONNECTED_BIT, pdFALSE, pdTRUE, DISCONNECT_WAIT);
+            state_ = WIFI_STATE_STARTED;
+        }
+        if (!fast_attempt_) {
+            break;
+        }
+        ESP_LOGW(TAG, "Cached AP for %s not reachable, scanning", ssid);
+        use_cache = false;
+    }
+
+    if (connected) {
+        saveCache();
+    } else {
+        ESP_LOGE(TAG, "Failed to connect to %s", ssid);
+    }
+    xSemaphoreGive(lock_);
+    return connected;
 }
 
 bool WiFiManager::disconnect() {
-    esp_wifi_disconnect();
+    if (state_ == WIFI_STATE_OFF) {
+        return true;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    wifi_state_t state = state_;
+    if (state == WIFI_STATE_CONNECTING || state == WIFI_STATE_CONNECTED ||
+        state == WIFI_STATE_RECONNECTING) {
+        xEventGroupClearBits(events_, DISCONNECTED_BIT);
+        user_disconnect_ = true;
+        esp_wifi_disconnect();
+        xEventGroupWaitBits(events_, DISCONNECTED_BIT, pdFALSE, pdTRUE, DISCONNECT_WAIT);
+        state_ = WIFI_STATE_STARTED;
+    }
+    saveCache();
+    xSemaphoreGive(lock_);
     return true;
 }
+
+bool WiFiManager::scan(uint32_t timeout_ms) {
+    if (state_ == WIFI_STATE_OFF || !enableStation()) {
+        return false;
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    xEventGroupClearBits(events_, SCAN_DONE_BIT);
+
+    wifi_scan_config_t scan_config = {};
+    scan_config.show_hidden = true;
+
+    esp_err_t err = esp_wifi_scan_start(&scan_config, false);
+    bool ok = (err == ESP_OK);
+    if (ok) {
+        EventBits_t bits = xEventGroupWaitBits(events_, SCAN_DONE_BIT, pdFALSE, pdTRUE,
+                                               pdMS_TO_TICKS(timeout_ms));
+        ok = (bits & SCAN_DONE_BIT) != 0;
+        if (!ok) {
+            ESP_LOGW(TAG, "Scan timed out");
+            esp_wifi_scan_stop();
+        }
+    } else {
+        // Typically the station is busy joining an AP
+        ESP_LOGW(TAG, "Failed to start scan: %s", esp_err_to_name(err));
+    }
+    xSemaphoreGive(lock_);
+    return ok;
+}
+
+std::vector<wifi_ap_record_t> WiFiManager::getScanResults() {
+    std::vector<wifi_ap_record_t> results;
+    if (state_ == WIFI_STATE_OFF) {
+        return results;
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    uint16_t ap_count = 0;
+    esp_wifi_scan_get_ap_num(&ap_count);
+    if (ap_count > 0) {
+        results.resize(ap_count);
+        if (esp_wifi_scan_get_ap_records(&ap_count, results.data()) == ESP_OK) {
+            results.resize(ap_count);
+        } else {
+            results.clear();
+        }
+    }
+    xSemaphoreGive(lock_);
+    return results;
+}
+
+void WiFiManager::getStats(WiFiStats& stats) {
+    portENTER_CRITICAL(&cache_lock_);
+    stats = stats_;
+    portEXIT_CRITICAL(&cache_lock_);
+}
+
+// Runs on the default event loop task
+void WiFiManager::eventHandler(void* arg, esp_event_base_t base, int32_t id, void* data) {
+    WiFiManager* self = static_cast<WiFiManager*>(arg);
+
+    if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        self->onAddress();
+        return;
+    }
+    if (base != WIFI_EVENT) {
+        return;
+    }
+
+    switch (id) {
+        case WIFI_EVENT_STA_CONNECTED: {
+            // Remember where the AP is for the next join
+            const wifi_event_sta_connected_t* event = (const wifi_event_sta_connected_t*)data;
+            StationCache& cache = self->cache_;
+            size_t ssid_len = event->ssid_len < sizeof(cache.ssid) - 1 ? event->ssid_len : sizeof(cache.ssid) - 1;
+            portENTER_CRITICAL(&self->cache_lock_);
+            if (cache.magic != STATION_CACHE_MAGIC || cache.channel != event->channel ||
+                memcmp(cache.bssid, event->bssid, sizeof(cache.bssid)) != 0 ||
+                strncmp(cache.ssid, (const char*)event->ssid, sizeof(cache.ssid)) != 0) {
+                cache.magic = STATION_CACHE_MAGIC;
+                memset(cache.ssid, 0, sizeof(cache.ssid));
+                memcpy(cache.ssid, event->ssid, ssid_len);
+                memcpy(cache.bssid, event->bssid, sizeof(cache.bssid));
+                cache.channel = event->channel;
+                self->cache_dirty_ = true;
+            }
+            portEXIT_CRITICAL(&self->cache_lock_);
+            break;
+        }
+
+        case WIFI_EVENT_STA_DISCONNECTED:
+            self->onStationDisconnected();
+            break;
+
+        case WIFI_EVENT_SCAN_DONE:
+            xEventGroupSetBits(self->events_, SCAN_DONE_BIT);
+            break;
+
+        case WIFI_EVENT_AP_START:
+            ESP_LOGI(TAG, "AP started");
+            break;
+
+        case WIFI_EVENT_AP_STOP:
+            ESP_LOGI(TAG, "AP stopped");
+            break;
+
+        default:
+            break;
+    }
+}
+
+void WiFiManager::onStationDisconnected() {
+    wifi_state_t state = state_;
+
+    if (user_disconnect_) {
+        user_disconnect_ = false;
+        state_ = sta_enabled_ ? WIFI_STATE_STARTED : WIFI_STATE_IDLE;
+        xEventGroupSetBits(events_, DISCONNECTED_BIT);
+        return;
+    }
+
+    if (state == WIFI_STATE_CONNECTING) {
+        // connectSTA() decides whether to try again with a full scan
+        state_ = WIFI_STATE_STARTED;
+        xEventGroupSetBits(events_, FAIL_BIT);
+        return;
+    }
+    if (state != WIFI_STATE_CONNECTED && state != WIFI_STATE_RECONNECTING) {
+        return;
+    }
+
+    // The link dropped: rejoin the cached AP directly, then fall back to
+    // scanning for any AP with the SSID
+    if (state == WIFI_STATE_CONNECTED) {
+        ESP_LOGW(TAG, "Link lost, rejoining");
+        link_lost_us_ = esp_timer_get_time();
+        retries_ = 0;
+        state_ = WIFI_STATE_RECONNECTING;
+    }
+    if (++retries_ > MAX_RETRIES) {
+        ESP_LOGE(TAG, "Giving up rejoining after %u attempts", (unsigned)MAX_RETRIES);
+        state_ = WIFI_STATE_STARTED;
+        xEventGroupSetBits(events_, FAIL_BIT);
+        return;
+    }
+    setTarget(retries_ <= FAST_RETRIES);
+    esp_wifi_connect();
+}
+
+void WiFiManager::onAddress() {
+    int64_t now = esp_timer_get_time();
+    wifi_state_t prev = state_;
+    state_ = WIFI_STATE_CONNECTED;
+    retries_ = 0;
+
+    portENTER_CRITICAL(&cache_lock_);
+    const char* how = fast_attempt_ ? "cached AP" : "scan";
+    uint32_t ms;
+    if (prev == WIFI_STATE_RECONNECTING) {
+        ms = (uint32_t)((now - link_lost_us_) / 1000);
+        stats_.reconnects++;
+        stats_.last_reconnect_ms = ms;
+    } else {
+        ms = (uint32_t)((now - connect_start_us_) / 1000);
+        stats_.connects++;
+        stats_.last_connect_ms = ms;
+        if (fast_attempt_) {
+            stats_.fast_connects++;
+        }
+    }
+    portEXIT_CRITICAL(&cache_lock_);
+
+    ESP_LOGI(TAG, "%s in %u ms (%s)", prev == WIFI_STATE_RECONNECTING ? "Rejoined" : "Connected",
+             (unsigned)ms, how);
+    xEventGroupSetBits(events_, CONNECTED_BIT);
+}
+
+void WiFiManager::loadCache() {
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    StationCache cache;
+    size_t size = sizeof(cache);
+    esp_err_t err = nvs_get_blob(handle, WIFI_NVS_KEY, &cache, &size);
+    nvs_close(handle);
+    if (err != ESP_OK || size != sizeof(cache) || cache.magic != STATION_CACHE_MAGIC) {
+        return;
+    }
+
+    cache.ssid[sizeof(cache.ssid) - 1] = '\0';
+    portENTER_CRITICAL(&cache_lock_);
+    cache_ = cache;
+    cache_dirty_ = false;
+    portEXIT_CRITICAL(&cache_lock_);
+}
+
+// Writes the cache to NVS if it changed; called with lock_ held
+void WiFiManager::saveCache() {
+    StationCache cache;
+    portENTER_CRITICAL(&cache_lock_);
+    bool dirty = cache_dirty_;
+    cache = cache_;
+    cache_dirty_ = false;
+    portEXIT_CRITICAL(&cache_lock_);
+    if (!dirty) {
+        return;
+    }
+
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(handle, WIFI_NVS_KEY, &cache, sizeof(cache)) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
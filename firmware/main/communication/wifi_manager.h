@@ -1,28 +1,122 @@
 #ifndef WIFI_MANAGER_H
 #define WIFI_MANAGER_H
 
+#include <atomic>
+#include <vector>
 #include "esp_wifi.h"
+#include "esp_event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 
+#define WIFI_CONNECT_TIMEOUT_MS 10000
+#define WIFI_SCAN_TIMEOUT_MS 5000
+
+// Station side of the WiFi state machine; the AP and scans run alongside
+typedef enum {
+    WIFI_STATE_OFF = 0,         // Driver not initialized
+    WIFI_STATE_IDLE,            // Driver initialized, station not in use
+    WIFI_STATE_STARTED,         // Station on, not associated
+    WIFI_STATE_CONNECTING,
+    WIFI_STATE_CONNECTED,       // Associated and has an address
+    WIFI_STATE_RECONNECTING     // Link dropped, rejoining on its own
+} wifi_state_t;
+
+struct WiFiStats {
+    uint32_t connects;
+    uint32_t fast_connects;     // Joined straight from the cached BSSID/channel
+    uint32_t reconnects;        // Recovered after the link dropped
+    uint32_t last_connect_ms;   // connectSTA() to address assigned
+    uint32_t last_reconnect_ms; // Link lost to address assigned again
+};
+
+// Owns the one WiFi driver instance.
+//
+// Station, AP and scans are roles on the same driver; the radio mode is
+// derived from which are in use, so nothing calls esp_wifi_init() or
+// creates netifs twice. Driver events move the station through
+// wifi_state_t on the event loop task, and blocking calls wait for the
+// outcome on an event group.
+//
+// Every successful connection caches the AP's BSSID and channel, in RAM
+// and in NVS. A later connectSTA() to the same SSID, and the automatic
+// rejoin after a dropped link, go straight to that AP on that channel
+// instead of scanning every channel first; after repeated failures they
+// fall back to a full scan. Errors are returned, never aborted on.
 class WiFiManager {
 public:
     static WiFiManager& getInstance() {
         static WiFiManager instance;
         return instance;
     }
-    
+
+    // Brings the WiFi driver up or down; the netif layer, default event
+    // loop and default netifs are created once and kept
     bool initialize();
+    bool deinitialize();
+    bool isInitialized() const { return state_ != WIFI_STATE_OFF; }
+
     bool startAP(const char* ssid, const char* password);
     bool stopAP();
-    bool connectSTA(const char* ssid, const char* password);
+
+    // Turns the station role on without joining anything, e.g. to scan
+    bool enableStation();
+    bool connectSTA(const char* ssid, const char* password,
+                    uint32_t timeout_ms = WIFI_CONNECT_TIMEOUT_MS);
     bool disconnect();
-    
+
+    bool scan(uint32_t timeout_ms = WIFI_SCAN_TIMEOUT_MS);
+    std::vector<wifi_ap_record_t> getScanResults();
+
+    wifi_state_t getState() const { return state_; }
+    bool isConnected() const { return state_ == WIFI_STATE_CONNECTED; }
+    void getStats(WiFiStats& stats);
+
 private:
     WiFiManager() = default;
     ~WiFiManager() = default;
     WiFiManager(const WiFiManager&) = delete;
     WiFiManager& operator=(const WiFiManager&) = delete;
-    
-    bool initialized_;
+
+    // Last AP joined, kept in NVS across reboots
+    struct StationCache {
+        uint32_t magic;
+        char ssid[33];
+        uint8_t bssid[6];
+        uint8_t channel;
+    };
+
+    static void eventHandler(void* arg, esp_event_base_t base, int32_t id, void* data);
+    void onStationDisconnected();
+    void onAddress();
+    bool applyMode();
+    void setTarget(bool use_cache);
+    bool startConnect();
+    void loadCache();
+    void saveCache();
+
+    bool netif_ready_ = false;
+    SemaphoreHandle_t lock_ = nullptr;      // Serializes the blocking calls
+    EventGroupHandle_t events_ = nullptr;
+    esp_event_handler_instance_t wifi_handler_ = nullptr;
+    esp_event_handler_instance_t ip_handler_ = nullptr;
+
+    std::atomic<wifi_state_t> state_{WIFI_STATE_OFF};
+    bool sta_enabled_ = false;
+    bool ap_enabled_ = false;
+    bool started_ = false;
+    std::atomic<bool> user_disconnect_{false};
+
+    // Station target; also touched by the event handler, under cache_lock_
+    portMUX_TYPE cache_lock_ = portMUX_INITIALIZER_UNLOCKED;
+    wifi_config_t sta_config_ = {};
+    StationCache cache_ = {};
+    bool cache_dirty_ = false;
+    uint8_t retries_ = 0;
+    int64_t connect_start_us_ = 0;
+    int64_t link_lost_us_ = 0;
+    bool fast_attempt_ = false;
+    WiFiStats stats_ = {};
 };
 
 #endif // WIFI_MANAGER_H
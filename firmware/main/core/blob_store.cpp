@@ -0,0 +1,568 @@
+#include "blob_store.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "spi_flash_mmap.h"
+#include <stddef.h>
+#include <string.h>
+
+static const char* TAG = "BlobStore";
+
+static const uint32_t TABLE_MAGIC = 0x42505A44;  // "DZPB"
+static const uint16_t TABLE_VERSION = 2;
+static const uint32_t SECTOR_SIZE = SPI_FLASH_SEC_SIZE;
+static const int TABLE_SLOTS = 2;
+static const uint32_t DATA_START = TABLE_SLOTS * SECTOR_SIZE;
+
+static const char* UPLOAD_NVS_NAMESPACE = "blobs";
+static const char* UPLOAD_NVS_KEY = "uploads";
+static const uint32_t UPLOAD_CHECKPOINT_MAGIC = 0x50555A44;  // "DZUP"
+
+static uint32_t alignUp(uint32_t value) {
+    return (value + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+}
+
+bool BlobStore::initialize() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                          (esp_partition_subtype_t)BLOB_PARTITION_SUBTYPE,
+                                          BLOB_PARTITION_LABEL);
+    if (!partition_) {
+        ESP_LOGW(TAG, "No blob partition, payloads will be stored as files");
+        return false;
+    }
+
+    static_assert(sizeof(BlobTable) <= SPI_FLASH_SEC_SIZE, "Blob table must fit in one sector");
+    memset(pending_, 0, sizeof(pending_));
+
+    if (!loadTable()) {
+        ESP_LOGI(TAG, "Formatting blob partition table");
+        memset(&table_, 0, sizeof(table_));
+        table_slot_ = TABLE_SLOTS - 1;  // First save goes to slot 0
+        if (!saveTable()) {
+            partition_ = nullptr;
+            return false;
+        }
+    }
+
+    ESP_LOGI(TAG, "Blob partition: %u KB, %d blobs for %d payloads, %u KB free",
+             (unsigned)(partition_->size / 1024), table_.count, table_.ref_count,
+             (unsigned)(getFreeSpace() / 1024));
+    return true;
+}
+
+bool BlobStore::reserve(size_t size, BlobExtent& extent) {
+    if (!partition_ || size == 0) {
+        return false;
+    }
+
+    int pending_slot = -1;
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        if (pending_[i].size == 0) {
+            pending_slot = i;
+            break;
+        }
+    }
+    if (pending_slot < 0) {
+        ESP_LOGE(TAG, "Too many blob writes in progress");
+        return false;
+    }
+
+    // First fit: candidate starts are the data start and the end of every
+    // used extent; the lowest one that overlaps nothing wins
+    uint32_t length = alignUp(size);
+    uint32_t best = UINT32_MAX;
+    auto consider = [&](uint32_t start) {
+        if (start < best && start + length <= partition_->size && !overlaps(start, length)) {
+            best = start;
+        }
+    };
+
+    consider(DATA_START);
+    for (int i = 0; i < table_.count; i++) {
+        consider(alignUp(table_.records[i].offset + table_.records[i].size));
+    }
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        if (pending_[i].size) {
+            consider(alignUp(pending_[i].offset + pending_[i].size));
+        }
+    }
+
+    if (best == UINT32_MAX) {
+        ESP_LOGE(TAG, "No contiguous space for %u bytes", (unsigned)size);
+        return false;
+    }
+
+    extent.offset = best;
+    extent.size = size;
+    extent.erased = 0;
+    pending_[pending_slot] = extent;
+
+    // An upload checkpointed here before a reboot can no longer resume
+    dropCheckpoints(best, length);
+    return true;
+}
+
+bool BlobStore::write(BlobExtent& extent, size_t offset, const uint8_t* data, size_t length) {
+    if (!partition_ || offset + length > extent.size) {
+        return false;
+    }
+
+    // Erase sectors just ahead of the data, so an aborted upload costs
+    // only the sectors it reached
+    uint32_t end = offset + length;
+    if (end > extent.erased) {
+        uint32_t erase_to = alignUp(end);
+        esp_err_t ret = esp_partition_erase_range(partition_, extent.offset + extent.erased,
+                                                  erase_to - extent.erased);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Erase failed: %s", esp_err_to_name(ret));
+            return false;
+        }
+        extent.erased = erase_to;
+    }
+
+    esp_err_t ret = esp_partition_write(partition_, extent.offset + offset, data, length);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Write failed: %s", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
+
+bool BlobStore::commit(const char* payload_id, const BlobExtent& extent,
+                       const uint8_t digest[PAYLOAD_DIGEST_SIZE]) {
+    if (!partition_) {
+        return false;
+    }
+
+    // Identical content is already stored: keep that copy, drop this one
+    if (findBlob(digest, extent.size) >= 0) {
+        release(extent);
+        ESP_LOGI(TAG, "%s matches a stored blob, sharing it", payload_id);
+        return link(payload_id, digest, extent.size);
+    }
+
+    // The payload's old blob is dropped first so its record can be reused;
+    // nothing is final until the table is saved
+    int ref = findRef(payload_id);
+    if (ref < 0 && table_.ref_count >= MAX_PAYLOADS) {
+        ESP_LOGE(TAG, "Blob table full");
+        return false;
+    }
+
+    BlobRecord record = {};
+    memcpy(record.digest, digest, PAYLOAD_DIGEST_SIZE);
+    record.offset = extent.offset;
+    record.size = extent.size;
+    record.generation = table_.sequence + 1;
+
+    portENTER_CRITICAL(&lock_);
+    if (ref >= 0) {
+        dropRef(ref);
+    }
+    int index = table_.count++;
+    table_.records[index] = record;
+    portEXIT_CRITICAL(&lock_);
+
+    release(extent);
+    addRef(payload_id, index);
+    return saveTable();
+}
+
+void BlobStore::release(const BlobExtent& extent) {
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        if (pending_[i].size && pending_[i].offset == extent.offset) {
+            pending_[i] = BlobExtent();
+        }
+    }
+    dropCheckpoints(extent.offset, alignUp(extent.size));
+}
+
+bool BlobStore::read(const BlobExtent& extent, size_t offset, uint8_t* data, size_t length) {
+    if (!partition_ || offset + length > extent.size) {
+        return false;
+    }
+    return esp_partition_read(partition_, extent.offset + offset, data, length) == ESP_OK;
+}
+
+void BlobStore::checkpoint(const char* payload_id, const BlobExtent& extent, size_t written,
+                           const uint8_t* digest) {
+    if (!partition_) {
+        return;
+    }
+    UploadCheckpoint checkpoints[MAX_INSTALL_SESSIONS];
+    if (!loadCheckpoints(checkpoints)) {
+        memset(checkpoints, 0, sizeof(checkpoints));
+    }
+
+    // The slot of this extent, else a free one, else the first
+    int slot = -1;
+    for (int i = 0; i < MAX_INSTALL_SESSIONS && slot < 0; i++) {
+        if (checkpoints[i].magic == UPLOAD_CHECKPOINT_MAGIC && checkpoints[i].offset == extent.offset) {
+            slot = i;
+        }
+    }
+    for (int i = 0; i < MAX_INSTALL_SESSIONS && slot < 0; i++) {
+        if (checkpoints[i].magic != UPLOAD_CHECKPOINT_MAGIC) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        slot = 0;
+    }
+
+    // Only whole sectors count: a resumed upload erases the sector it
+    // continues in, so bytes written after this checkpoint never matter
+    UploadCheckpoint& checkpoint = checkpoints[slot];
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.magic = UPLOAD_CHECKPOINT_MAGIC;
+    checkpoint.offset = extent.offset;
+    checkpoint.size = extent.size;
+    checkpoint.written = written & ~(SECTOR_SIZE - 1);
+    strncpy(checkpoint.payload_id, payload_id, MAX_PAYLOAD_ID_LEN - 1);
+    if (digest) {
+        memcpy(checkpoint.digest, digest, PAYLOAD_DIGEST_SIZE);
+        checkpoint.has_digest = 1;
+    }
+    saveCheckpoints(checkpoints);
+}
+
+bool BlobStore::resume(const char* payload_id, size_t size, const uint8_t* digest,
+                       BlobExtent& extent, size_t* written) {
+    if (!partition_) {
+        return false;
+    }
+    UploadCheckpoint checkpoints[MAX_INSTALL_SESSIONS];
+    if (!loadCheckpoints(checkpoints)) {
+        return false;
+    }
+
+    int pending_slot = -1;
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        if (pending_[i].size == 0) {
+            pending_slot = i;
+            break;
+        }
+    }
+
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        const UploadCheckpoint& checkpoint = checkpoints[i];
+        if (checkpoint.magic != UPLOAD_CHECKPOINT_MAGIC || checkpoint.size != size ||
+            strncmp(checkpoint.payload_id, payload_id, MAX_PAYLOAD_ID_LEN) != 0) {
+            continue;
+        }
+        if (digest && checkpoint.has_digest &&
+            memcmp(checkpoint.digest, digest, PAYLOAD_DIGEST_SIZE) != 0) {
+            continue;
+        }
+        if (pending_slot < 0 || overlaps(checkpoint.offset, alignUp(checkpoint.size))) {
+            return false;
+        }
+
+        extent.offset = checkpoint.offset;
+        extent.size = checkpoint.size;
+        extent.erased = checkpoint.written;
+        pending_[pending_slot] = extent;
+        *written = checkpoint.written;
+        ESP_LOGI(TAG, "Resuming upload of %s at %u in blob at 0x%x", payload_id,
+                 (unsigned)checkpoint.written, (unsigned)checkpoint.offset);
+        return true;
+    }
+    return false;
+}
+
+bool BlobStore::loadCheckpoints(UploadCheckpoint* checkpoints) {
+    nvs_handle_t handle;
+    if (nvs_open(UPLOAD_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t size = sizeof(UploadCheckpoint) * MAX_INSTALL_SESSIONS;
+    esp_err_t err = nvs_get_blob(handle, UPLOAD_NVS_KEY, checkpoints, &size);
+    nvs_close(handle);
+    return err == ESP_OK && size == sizeof(UploadCheckpoint) * MAX_INSTALL_SESSIONS;
+}
+
+void BlobStore::saveCheckpoints(const UploadCheckpoint* checkpoints) {
+    nvs_handle_t handle;
+    if (nvs_open(UPLOAD_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(handle, UPLOAD_NVS_KEY, checkpoints,
+                     sizeof(UploadCheckpoint) * MAX_INSTALL_SESSIONS) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+// Forgets checkpointed uploads whose extent overlaps the given range
+void BlobStore::dropCheckpoints(uint32_t offset, uint32_t length) {
+    UploadCheckpoint checkpoints[MAX_INSTALL_SESSIONS];
+    if (!loadCheckpoints(checkpoints)) {
+        return;
+    }
+    bool changed = false;
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        UploadCheckpoint& checkpoint = checkpoints[i];
+        if (checkpoint.magic == UPLOAD_CHECKPOINT_MAGIC &&
+            offset < alignUp(checkpoint.offset + checkpoint.size) && checkpoint.offset < offset + length) {
+            memset(&checkpoint, 0, sizeof(checkpoint));
+            changed = true;
+        }
+    }
+    if (changed) {
+        saveCheckpoints(checkpoints);
+    }
+}
+
+bool BlobStore::contains(const uint8_t digest[PAYLOAD_DIGEST_SIZE], size_t size) {
+    portENTER_CRITICAL(&lock_);
+    bool found = findBlob(digest, size) >= 0;
+    portEXIT_CRITICAL(&lock_);
+    return found;
+}
+
+bool BlobStore::link(const char* payload_id, const uint8_t digest[PAYLOAD_DIGEST_SIZE], size_t size) {
+    if (!partition_) {
+        return false;
+    }
+
+    int index = findBlob(digest, size);
+    if (index < 0) {
+        return false;
+    }
+
+    int ref = findRef(payload_id);
+    if (ref >= 0 && table_.refs[ref].record == index) {
+        return true;  // Already points at this blob
+    }
+    if (ref < 0 && table_.ref_count >= MAX_PAYLOADS) {
+        ESP_LOGE(TAG, "Blob table full");
+        return false;
+    }
+
+    portENTER_CRITICAL(&lock_);
+    if (ref >= 0) {
+        dropRef(ref);
+        // Dropping the last reference to the old blob may have moved ours
+        index = findBlob(digest, size);
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    addRef(payload_id, index);
+    return saveTable();
+}
+
+bool BlobStore::remove(const char* payload_id) {
+    int ref = findRef(payload_id);
+    if (ref < 0) {
+        return false;
+    }
+
+    portENTER_CRITICAL(&lock_);
+    dropRef(ref);
+    portEXIT_CRITICAL(&lock_);
+
+    // A freed extent is just forgotten; it is erased when next reused
+    return saveTable();
+}
+
+bool BlobStore::find(const char* payload_id, size_t* size, uint32_t* generation) {
+    BlobRecord record;
+    if (!lookup(payload_id, record)) {
+        return false;
+    }
+    if (size) *size = record.size;
+    if (generation) *generation = record.generation;
+    return true;
+}
+
+bool BlobStore::map(const char* payload_id, PayloadImage& image) {
+    image = PayloadImage();
+    if (!partition_) {
+        return false;
+    }
+
+    BlobRecord record;
+    if (!lookup(payload_id, record)) {
+        return false;
+    }
+
+    const void* ptr = nullptr;
+    spi_flash_mmap_handle_t handle;
+    esp_err_t ret = esp_partition_mmap(partition_, record.offset, record.size,
+                                       SPI_FLASH_MMAP_DATA, &ptr, &handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map %s: %s", payload_id, esp_err_to_name(ret));
+        return false;
+    }
+
+    image.data = (const uint8_t*)ptr;
+    image.size = record.size;
+    image.handle = handle;
+    return true;
+}
+
+void BlobStore::unmap(PayloadImage& image) {
+    if (image.data) {
+        spi_flash_munmap(image.handle);
+    }
+    image = PayloadImage();
+}
+
+size_t BlobStore::getFreeSpace() {
+    if (!partition_) {
+        return 0;
+    }
+
+    size_t used = DATA_START;
+    for (int i = 0; i < table_.count; i++) {
+        used += alignUp(table_.records[i].size);
+    }
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        used += alignUp(pending_[i].size);
+    }
+    return used < partition_->size ? partition_->size - used : 0;
+}
+
+bool BlobStore::loadTable() {
+    // Pick the valid table copy with the highest sequence number
+    int best = -1;
+    uint32_t best_sequence = 0;
+    for (int slot = 0; slot < TABLE_SLOTS; slot++) {
+        if (readTable(slot, table_) && (best < 0 || table_.sequence > best_sequence)) {
+            best = slot;
+            best_sequence = table_.sequence;
+        }
+    }
+
+    if (best < 0) {
+        return false;
+    }
+
+    readTable(best, table_);
+    table_slot_ = best;
+    return true;
+}
+
+bool BlobStore::saveTable() {
+    // Write the other slot, so the current table survives a failed write
+    static BlobTable staged;
+    portENTER_CRITICAL(&lock_);
+    table_.magic = TABLE_MAGIC;
+    table_.version = TABLE_VERSION;
+    table_.sequence++;
+    staged = table_;
+    portEXIT_CRITICAL(&lock_);
+
+    staged.crc = 0;
+    staged.crc = esp_rom_crc32_le(0, (const uint8_t*)&staged, sizeof(staged));
+
+    int slot = (table_slot_ + 1) % TABLE_SLOTS;
+    esp_err_t ret = esp_partition_erase_range(partition_, slot * SECTOR_SIZE, SECTOR_SIZE);
+    if (ret == ESP_OK) {
+        ret = esp_partition_write(partition_, slot * SECTOR_SIZE, &staged, sizeof(staged));
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write blob table: %s", esp_err_to_name(ret));
+        return false;
+    }
+
+    table_slot_ = slot;
+    return true;
+}
+
+bool BlobStore::readTable(int slot, BlobTable& table) {
+    if (esp_partition_read(partition_, slot * SECTOR_SIZE, &table, sizeof(table)) != ESP_OK) {
+        return false;
+    }
+
+    uint32_t crc = table.crc;
+    table.crc = 0;
+    bool valid = table.magic == TABLE_MAGIC && table.version == TABLE_VERSION &&
+                 table.count <= MAX_PAYLOADS && table.ref_count <= MAX_PAYLOADS &&
+                 esp_rom_crc32_le(0, (const uint8_t*)&table, sizeof(table)) == crc;
+    table.crc = crc;
+    return valid;
+}
+
+int BlobStore::findRef(const char* payload_id) {
+    for (int i = 0; i < table_.ref_count; i++) {
+        if (strncmp(table_.refs[i].payload_id, payload_id, MAX_PAYLOAD_ID_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int BlobStore::findBlob(const uint8_t digest[PAYLOAD_DIGEST_SIZE], size_t size) {
+    for (int i = 0; i < table_.count; i++) {
+        if (table_.records[i].size == size &&
+            memcmp(table_.records[i].digest, digest, PAYLOAD_DIGEST_SIZE) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool BlobStore::lookup(const char* payload_id, BlobRecord& record) {
+    bool found = false;
+    portENTER_CRITICAL(&lock_);
+    int ref = findRef(payload_id);
+    if (ref >= 0) {
+        record = table_.records[table_.refs[ref].record];
+        found = true;
+    }
+    portEXIT_CRITICAL(&lock_);
+    return found;
+}
+
+void BlobStore::addRef(const char* payload_id, int record) {
+    BlobRef ref = {};
+    strncpy(ref.payload_id, payload_id, MAX_PAYLOAD_ID_LEN - 1);
+    ref.record = record;
+
+    portENTER_CRITICAL(&lock_);
+    table_.refs[table_.ref_count++] = ref;
+    table_.records[record].refs++;
+    portEXIT_CRITICAL(&lock_);
+}
+
+// Caller holds lock_
+void BlobStore::dropRef(int ref) {
+    int record = table_.refs[ref].record;
+    table_.refs[ref] = table_.refs[--table_.ref_count];
+    memset(&table_.refs[table_.ref_count], 0, sizeof(BlobRef));
+
+    if (--table_.records[record].refs > 0) {
+        return;
+    }
+
+    // Last reference gone: move the final record into the hole and
+    // repoint the references that followed it
+    int last = --table_.count;
+    table_.records[record] = table_.records[last];
+    memset(&table_.records[last], 0, sizeof(BlobRecord));
+    for (int i = 0; i < table_.ref_count; i++) {
+        if (table_.refs[i].record == last) {
+            table_.refs[i].record = record;
+        }
+    }
+}
+
+bool BlobStore::overlaps(uint32_t offset, uint32_t length) {
+    uint32_t end = offset + length;
+    for (int i = 0; i < table_.count; i++) {
+        uint32_t start = table_.records[i].offset;
+        if (offset < alignUp(start + table_.records[i].size) && start < end) {
+            return true;
+        }
+    }
+    for (int i = 0; i < MAX_INSTALL_SESSIONS; i++) {
+        const BlobExtent& pending = pending_[i];
+        if (pending.size &&
+            offset < alignUp(pending.offset + pending.size) && pending.offset < end) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,146 @@
+#ifndef BLOB_STORE_H
+#define BLOB_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "../include/types.h"
+
+#define BLOB_PARTITION_LABEL "blobs"
+#define BLOB_PARTITION_SUBTYPE 0x40
+
+// Contiguous flash extent being written by an install session
+struct BlobExtent {
+    uint32_t offset;            // Partition offset, sector aligned
+    uint32_t size;              // Payload size in bytes
+    uint32_t erased;            // Bytes from offset already erased
+};
+
+// Payload binary mapped read-only into the data address space
+struct PayloadImage {
+    const uint8_t* data;
+    size_t size;
+    uint32_t handle;
+};
+
+// Payload binaries stored contiguously in a raw flash partition.
+//
+// Each blob occupies one sector-aligned extent, found first-fit, so the
+// loaders can map it with esp_partition_mmap and execute or interpret it
+// in place instead of copying it into RAM. Blobs are addressed by the
+// SHA-256 of their stored bytes and reference counted: payloads with
+// identical binaries share one extent, and installing content that is
+// already stored only adds a reference. The table of blobs and payload
+// references lives in the first two sectors of the partition and is
+// written alternately, with a sequence number and CRC, so a power loss
+// during an update leaves the previous table intact. Space is not
+// compacted; a payload that does not fit in any gap fails to install.
+class BlobStore {
+public:
+    static BlobStore& getInstance() {
+        static BlobStore instance;
+        return instance;
+    }
+
+    bool initialize();
+    bool isAvailable() const { return partition_ != nullptr; }
+
+    // Writing: reserve an extent, write it front to back, then commit it
+    // under the payload id (replacing its previous blob) or release it.
+    // A commit whose digest is already stored drops the new copy.
+    bool reserve(size_t size, BlobExtent& extent);
+    bool write(BlobExtent& extent, size_t offset, const uint8_t* data, size_t length);
+    bool commit(const char* payload_id, const BlobExtent& extent,
+                const uint8_t digest[PAYLOAD_DIGEST_SIZE]);
+    void release(const BlobExtent& extent);
+    bool read(const BlobExtent& extent, size_t offset, uint8_t* data, size_t length);
+
+    // Uploads survive a reboot: an install session checkpoints its extent
+    // and how much of it is written, and resume() hands the same extent
+    // back to a new session for the same payload and size
+    void checkpoint(const char* payload_id, const BlobExtent& extent, size_t written,
+                    const uint8_t* digest);
+    bool resume(const char* payload_id, size_t size, const uint8_t* digest,
+                BlobExtent& extent, size_t* written);
+
+    // Content already stored: point the payload at it without writing data
+    bool contains(const uint8_t digest[PAYLOAD_DIGEST_SIZE], size_t size);
+    bool link(const char* payload_id, const uint8_t digest[PAYLOAD_DIGEST_SIZE], size_t size);
+
+    // Drops the payload's reference; the blob is freed with its last one
+    bool remove(const char* payload_id);
+    bool find(const char* payload_id, size_t* size, uint32_t* generation);
+
+    bool map(const char* payload_id, PayloadImage& image);
+    static void unmap(PayloadImage& image);
+
+    size_t getFreeSpace();
+
+private:
+    BlobStore() = default;
+    ~BlobStore() = default;
+    BlobStore(const BlobStore&) = delete;
+    BlobStore& operator=(const BlobStore&) = delete;
+
+    struct BlobRecord {
+        uint8_t digest[PAYLOAD_DIGEST_SIZE];
+        uint32_t offset;
+        uint32_t size;
+        uint32_t generation;
+        uint16_t refs;
+        uint16_t reserved;
+    };
+
+    struct BlobRef {
+        char payload_id[MAX_PAYLOAD_ID_LEN];
+        uint8_t record;         // Index into records
+        uint8_t reserved[3];
+    };
+
+    struct BlobTable {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t count;         // Blobs in records
+        uint16_t ref_count;     // Payloads in refs
+        uint16_t reserved;
+        uint32_t sequence;
+        uint32_t crc;
+        BlobRecord records[MAX_PAYLOADS];
+        BlobRef refs[MAX_PAYLOADS];
+    };
+
+    // Saved to NVS, one slot per install session
+    struct UploadCheckpoint {
+        uint32_t magic;
+        uint32_t offset;
+        uint32_t size;
+        uint32_t written;       // Sector aligned; later bytes are sent again
+        char payload_id[MAX_PAYLOAD_ID_LEN];
+        uint8_t digest[PAYLOAD_DIGEST_SIZE];
+        uint8_t has_digest;
+        uint8_t reserved[3];
+    };
+
+    bool loadCheckpoints(UploadCheckpoint* checkpoints);
+    void saveCheckpoints(const UploadCheckpoint* checkpoints);
+    void dropCheckpoints(uint32_t offset, uint32_t length);
+
+    bool loadTable();
+    bool saveTable();
+    bool readTable(int slot, BlobTable& table);
+    int findRef(const char* payload_id);
+    int findBlob(const uint8_t digest[PAYLOAD_DIGEST_SIZE], size_t size);
+    bool lookup(const char* payload_id, BlobRecord& record);
+    void addRef(const char* payload_id, int record);
+    void dropRef(int ref);
+    bool overlaps(uint32_t offset, uint32_t length);
+
+    const esp_partition_t* partition_ = nullptr;
+    BlobTable table_ = {};
+    int table_slot_ = 0;
+    BlobExtent pending_[MAX_INSTALL_SESSIONS] = {};
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif // BLOB_STORE_H
@@ -1,12 +1,26 @@
 #include "boot_manager.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_app_format.h"
+#include "nvs.h"
+#include "spi_flash_mmap.h"
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 static const char* TAG = "BootManager";
 
+static const char* OTA_NVS_NAMESPACE = "ota";
+static const char* OTA_NVS_KEY = "session";
+static const uint32_t OTA_CHECKPOINT_MAGIC = 0x4F54415A;  // "ZATO"
+static const size_t SECTOR_SIZE = SPI_FLASH_SEC_SIZE;
+
+static size_t alignSector(size_t value) {
+    return (value + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+}
+
 bool BootManager::initialize() {
     ESP_LOGI(TAG, "Initializing Boot Manager");
     
@@ -67,6 +81,10 @@ bool BootManager::applyUpdate() {
         ESP_LOGE(TAG, "No update partition available");
         return false;
     }
+    if (ota_in_progress_) {
+        ESP_LOGE(TAG, "OTA update still in progress");
+        return false;
+    }
     
     // Validate update partition
     if (!validatePartition(update_partition_)) {
@@ -119,3 +137,454 @@ bool BootManager::validatePartition(const esp_partition_t* partition) {
     ESP_LOGI(TAG, "Partition validation successful");
     return true;
 }
+
+// ============================================================================
+// OTA session
+// ============================================================================
+
+bool BootManager::beginOta(size_t image_size, const uint8_t* digest, size_t* resume_offset) {
+    if (!update_partition_ || !digest) {
+        return false;
+    }
+    if (image_size == 0 || image_size > update_partition_->size) {
+        ESP_LOGE(TAG, "Invalid image size: %u", (unsigned)image_size);
+        return false;
+    }
+
+    // Same image restarted after the link dropped: keep going
+    if (resume_offset && ota_in_progress_ && !ota_failed_ && ota_size_ == image_size &&
+        memcmp(ota_digest_, digest, PAYLOAD_DIGEST_SIZE) == 0) {
+        *resume_offset = ota_received_;
+        ESP_LOGI(TAG, "Resuming OTA at %u/%u", (unsigned)ota_received_, (unsigned)image_size);
+        return true;
+    }
+    abortOta();
+
+    if (!startPipeline()) {
+        return false;
+    }
+
+    // Sectors are erased by the writer as it goes, not all up front
+    esp_err_t err = esp_ota_begin(update_partition_, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        finishOta();
+        return false;
+    }
+
+    mbedtls_sha256_init(&ota_sha_);
+    mbedtls_sha256_starts(&ota_sha_, 0);
+    memcpy(ota_digest_, digest, PAYLOAD_DIGEST_SIZE);
+    ota_size_ = image_size;
+    ota_in_progress_ = true;
+
+    // An update interrupted by a reboot resumes from its last checkpoint
+    size_t committed = 0;
+    OtaCheckpoint checkpoint;
+    if (resume_offset && loadCheckpoint(checkpoint) &&
+        checkpoint.partition_address == update_partition_->address &&
+        checkpoint.image_size == image_size && checkpoint.committed < image_size &&
+        memcmp(checkpoint.digest, digest, PAYLOAD_DIGEST_SIZE) == 0) {
+        if (rehash(checkpoint.committed)) {
+            committed = checkpoint.committed;
+        } else {
+            mbedtls_sha256_starts(&ota_sha_, 0);
+        }
+    }
+
+    ota_received_ = committed;
+    ota_written_ = committed;
+    ota_erased_ = committed;
+    ota_checkpointed_ = committed;
+    ota_failed_ = false;
+    erase_stall_us_ = 0;
+    filling_ = -1;
+    ota_start_us_ = esp_timer_get_time();
+    erase_target_ = alignSector(image_size);
+
+    if (resume_offset) *resume_offset = committed;
+    ESP_LOGI(TAG, "OTA to %s: %u bytes, starting at %u", update_partition_->label,
+             (unsigned)image_size, (unsigned)committed);
+    return true;
+}
+
+bool BootManager::writeOta(size_t offset, const uint8_t* data, size_t length) {
+    if (!ota_in_progress_ || ota_failed_) {
+        return false;
+    }
+    if (offset > ota_received_) {
+        ESP_LOGE(TAG, "Gap in OTA: chunk at %u, have %u", (unsigned)offset, (unsigned)ota_received_);
+        return false;
+    }
+    if (offset + length > ota_size_) {
+        ESP_LOGE(TAG, "Chunk past end of image");
+        return false;
+    }
+
+    // Skip the part of a retransmitted chunk that was already received
+    size_t skip = ota_received_ - offset;
+    if (skip >= length) {
+        return true;
+    }
+    data += skip;
+    length -= skip;
+
+    if (ota_received_ == 0 && data[0] != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "Not an app image (magic 0x%02x)", data[0]);
+        return false;
+    }
+
+    while (length > 0) {
+        if (filling_ < 0) {
+            // Blocks only while the writer still has both slots
+            uint8_t index;
+            xQueueReceive(free_queue_, &index, portMAX_DELAY);
+            filling_ = index;
+            slots_[index].offset = ota_received_;
+            slots_[index].length = 0;
+        }
+
+        OtaSlot& slot = slots_[filling_];
+        size_t n = OTA_SLOT_SIZE - slot.length;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(slot.data + slot.length, data, n);
+        slot.length += n;
+        ota_received_ += n;
+        data += n;
+        length -= n;
+
+        if (slot.length == OTA_SLOT_SIZE || ota_received_ == ota_size_) {
+            submitSlot();
+        }
+    }
+    return !ota_failed_;
+}
+
+bool BootManager::endOta() {
+    if (!ota_in_progress_) {
+        return false;
+    }
+    if (ota_received_ != ota_size_) {
+        ESP_LOGE(TAG, "Incomplete image: %u/%u", (unsigned)ota_received_, (unsigned)ota_size_);
+        return false;
+    }
+
+    drainPipeline();
+    bool ok = !ota_failed_ && ota_written_ == ota_size_;
+
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    if (ok && (mbedtls_sha256_finish(&ota_sha_, digest) != 0 ||
+               memcmp(digest, ota_digest_, PAYLOAD_DIGEST_SIZE) != 0)) {
+        ESP_LOGE(TAG, "OTA image digest mismatch");
+        ok = false;
+    }
+
+    // esp_ota_end() validates the image itself; the handle is released
+    // either way
+    if (ok) {
+        esp_err_t err = esp_ota_end(ota_handle_);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Image validation failed: %s", esp_err_to_name(err));
+            ok = false;
+        }
+    } else {
+        esp_ota_abort(ota_handle_);
+    }
+    ota_handle_ = 0;
+
+    if (ok) {
+        int64_t elapsed_us = esp_timer_get_time() - ota_start_us_;
+        ESP_LOGI(TAG, "OTA image written: %u bytes in %u ms (%u KB/s), %u ms waiting on erase",
+                 (unsigned)ota_size_, (unsigned)(elapsed_us / 1000),
+                 elapsed_us > 0 ? (unsigned)((uint64_t)ota_size_ * 1000000 / elapsed_us / 1024) : 0,
+                 (unsigned)(erase_stall_us_ / 1000));
+    }
+
+    // A failed image is not worth resuming
+    clearCheckpoint();
+    finishOta();
+    return ok;
+}
+
+void BootManager::abortOta() {
+    if (delta_active_) {
+        delta_active_ = false;
+        delta_.reset();
+    }
+    if (!ota_in_progress_) {
+        return;
+    }
+
+    // The half-filled slot is dropped; whatever the writer already has
+    // is finished so the checkpoint stays valid for a later resume
+    if (filling_ >= 0) {
+        uint8_t index = filling_;
+        xQueueSend(free_queue_, &index, portMAX_DELAY);
+        filling_ = -1;
+    }
+    drainPipeline();
+
+    esp_ota_abort(ota_handle_);
+    ota_handle_ = 0;
+    ESP_LOGW(TAG, "OTA aborted at %u/%u", (unsigned)ota_received_, (unsigned)ota_size_);
+    finishOta();
+}
+
+bool BootManager::beginDeltaOta(size_t patch_size) {
+    if (!current_partition_ || !update_partition_ || patch_size <= sizeof(DeltaHeader)) {
+        return false;
+    }
+    abortOta();
+    if (!delta_.begin(current_partition_, &BootManager::deltaOutput, this)) {
+        return false;
+    }
+    delta_active_ = true;
+    delta_size_ = patch_size;
+    delta_received_ = 0;
+    ESP_LOGI(TAG, "Delta OTA: %u byte patch against %s", (unsigned)patch_size, current_partition_->label);
+    return true;
+}
+
+bool BootManager::writeDeltaOta(size_t offset, const uint8_t* data, size_t length) {
+    if (!delta_active_) {
+        return false;
+    }
+    if (offset > delta_received_) {
+        ESP_LOGE(TAG, "Gap in delta: chunk at %u, have %u", (unsigned)offset, (unsigned)delta_received_);
+        return false;
+    }
+    if (offset + length > delta_size_) {
+        ESP_LOGE(TAG, "Chunk past end of delta");
+        return false;
+    }
+
+    size_t skip = delta_received_ - offset;
+    if (skip >= length) {
+        return true;
+    }
+    if (!delta_.write(data + skip, length - skip)) {
+        abortOta();
+        return false;
+    }
+    delta_received_ += length - skip;
+    return true;
+}
+
+bool BootManager::endDeltaOta() {
+    if (!delta_active_) {
+        return false;
+    }
+    if (delta_received_ != delta_size_ || !delta_.finish() || !ota_in_progress_) {
+        abortOta();
+        return false;
+    }
+    delta_active_ = false;
+    delta_.reset();
+    return endOta();
+}
+
+// Reconstructed bytes arrive here; the first ones open the OTA session
+// now that the header has named the new image's size and digest
+bool BootManager::deltaOutput(const uint8_t* data, size_t length, void* arg) {
+    BootManager* boot = (BootManager*)arg;
+    if (!boot->ota_in_progress_) {
+        const DeltaHeader& header = boot->delta_.header();
+        if (header.new_size > boot->update_partition_->size) {
+            ESP_LOGE(TAG, "Patched image does not fit %s", boot->update_partition_->label);
+            return false;
+        }
+        // beginOta() would abort the delta session; start the pipeline directly
+        bool active = boot->delta_active_;
+        boot->delta_active_ = false;
+        bool ok = boot->beginOta(header.new_size, header.new_digest, nullptr);
+        boot->delta_active_ = active;
+        if (!ok) {
+            return false;
+        }
+    }
+    return boot->writeOta(boot->ota_received_, data, length);
+}
+
+void BootManager::otaWriterTask(void* arg) {
+    BootManager* boot = (BootManager*)arg;
+
+    while (true) {
+        // Erase ahead while there is nothing to program; with nothing left
+        // to erase, sleep until the next slot arrives
+        bool erase_ahead = !boot->ota_failed_ && boot->ota_erased_ < boot->erase_target_;
+        uint8_t index;
+        if (xQueueReceive(boot->full_queue_, &index, erase_ahead ? 0 : portMAX_DELAY) == pdTRUE) {
+            xSemaphoreTake(boot->ota_lock_, portMAX_DELAY);
+            boot->programSlot(boot->slots_[index]);
+            xSemaphoreGive(boot->ota_lock_);
+            xQueueSend(boot->free_queue_, &index, portMAX_DELAY);
+        } else {
+            xSemaphoreTake(boot->ota_lock_, portMAX_DELAY);
+            if (boot->ota_erased_ < boot->erase_target_) {
+                boot->eraseTo(boot->ota_erased_ + SECTOR_SIZE);
+            }
+            xSemaphoreGive(boot->ota_lock_);
+        }
+    }
+}
+
+bool BootManager::startPipeline() {
+    if (!writer_task_) {
+        full_queue_ = xQueueCreate(OTA_SLOT_COUNT, sizeof(uint8_t));
+        free_queue_ = xQueueCreate(OTA_SLOT_COUNT, sizeof(uint8_t));
+        ota_lock_ = xSemaphoreCreateMutex();
+        if (!full_queue_ || !free_queue_ || !ota_lock_ ||
+            xTaskCreate(otaWriterTask, "ota_writer", 4096, this, 5, &writer_task_) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to start OTA writer");
+            return false;
+        }
+    }
+
+    xQueueReset(full_queue_);
+    xQueueReset(free_queue_);
+    for (uint8_t i = 0; i < OTA_SLOT_COUNT; i++) {
+        slots_[i].data = (uint8_t*)malloc(OTA_SLOT_SIZE);
+        if (!slots_[i].data) {
+            ESP_LOGE(TAG, "No memory for OTA buffers");
+            finishOta();
+            return false;
+        }
+        xQueueSend(free_queue_, &i, 0);
+    }
+    return true;
+}
+
+void BootManager::submitSlot() {
+    uint8_t index = filling_;
+    filling_ = -1;
+    xQueueSend(full_queue_, &index, portMAX_DELAY);
+}
+
+void BootManager::drainPipeline() {
+    // Every slot coming back through the free queue means the writer is
+    // done with it; the lock waits out an erase still in progress
+    erase_target_ = 0;
+    uint8_t held[OTA_SLOT_COUNT];
+    int outstanding = OTA_SLOT_COUNT - (filling_ >= 0 ? 1 : 0);
+    for (int i = 0; i < outstanding; i++) {
+        xQueueReceive(free_queue_, &held[i], portMAX_DELAY);
+    }
+    for (int i = 0; i < outstanding; i++) {
+        xQueueSend(free_queue_, &held[i], 0);
+    }
+    xSemaphoreTake(ota_lock_, portMAX_DELAY);
+    xSemaphoreGive(ota_lock_);
+}
+
+void BootManager::programSlot(const OtaSlot& slot) {
+    if (ota_failed_) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    size_t erased = ota_erased_;
+    bool ok = eraseTo(slot.offset + slot.length);
+    if (ota_erased_ != erased) {
+        erase_stall_us_ += esp_timer_get_time() - start;
+    }
+
+    esp_err_t err = ok ? esp_ota_write_with_offset(ota_handle_, slot.data, slot.length, slot.offset) : ESP_FAIL;
+    if (err != ESP_OK || mbedtls_sha256_update(&ota_sha_, slot.data, slot.length) != 0) {
+        ESP_LOGE(TAG, "OTA write failed at %u: %s", (unsigned)slot.offset, esp_err_to_name(err));
+        ota_failed_ = true;
+        return;
+    }
+
+    size_t written = slot.offset + slot.length;
+    ota_written_ = written;
+    if (written < ota_size_ && written - ota_checkpointed_ >= OTA_CHECKPOINT_INTERVAL) {
+        saveCheckpoint(written);
+        ota_checkpointed_ = written;
+    }
+}
+
+bool BootManager::eraseTo(size_t end) {
+    end = alignSector(end);
+    if (ota_erased_ >= end) {
+        return true;
+    }
+    esp_err_t err = esp_partition_erase_range(update_partition_, ota_erased_, end - ota_erased_);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Erase failed at %u: %s", (unsigned)ota_erased_, esp_err_to_name(err));
+        ota_failed_ = true;
+        return false;
+    }
+    ota_erased_ = end;
+    return true;
+}
+
+bool BootManager::rehash(size_t length) {
+    uint8_t* buf = slots_[0].data;
+    for (size_t offset = 0; offset < length; offset += OTA_SLOT_SIZE) {
+        size_t n = length - offset < OTA_SLOT_SIZE ? length - offset : OTA_SLOT_SIZE;
+        if (esp_partition_read(update_partition_, offset, buf, n) != ESP_OK ||
+            mbedtls_sha256_update(&ota_sha_, buf, n) != 0) {
+            ESP_LOGW(TAG, "Could not re-read partial image, starting over");
+            return false;
+        }
+    }
+    return true;
+}
+
+void BootManager::finishOta() {
+    if (ota_in_progress_) {
+        mbedtls_sha256_free(&ota_sha_);
+    }
+    for (int i = 0; i < OTA_SLOT_COUNT; i++) {
+        free(slots_[i].data);
+        slots_[i].data = nullptr;
+    }
+    if (free_queue_) {
+        xQueueReset(free_queue_);
+    }
+    erase_target_ = 0;
+    filling_ = -1;
+    ota_in_progress_ = false;
+}
+
+bool BootManager::loadCheckpoint(OtaCheckpoint& checkpoint) {
+    nvs_handle_t handle;
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t size = sizeof(checkpoint);
+    esp_err_t err = nvs_get_blob(handle, OTA_NVS_KEY, &checkpoint, &size);
+    nvs_close(handle);
+    return err == ESP_OK && size == sizeof(checkpoint) && checkpoint.magic == OTA_CHECKPOINT_MAGIC;
+}
+
+void BootManager::saveCheckpoint(size_t committed) {
+    OtaCheckpoint checkpoint;
+    checkpoint.magic = OTA_CHECKPOINT_MAGIC;
+    checkpoint.partition_address = update_partition_->address;
+    checkpoint.image_size = ota_size_;
+    checkpoint.committed = committed;
+    memcpy(checkpoint.digest, ota_digest_, PAYLOAD_DIGEST_SIZE);
+
+    nvs_handle_t handle;
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(handle, OTA_NVS_KEY, &checkpoint, sizeof(checkpoint)) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+void BootManager::clearCheckpoint() {
+    nvs_handle_t handle;
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_erase_key(handle, OTA_NVS_KEY) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
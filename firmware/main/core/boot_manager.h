@@ -1,34 +1,133 @@
 #ifndef BOOT_MANAGER_H
 #define BOOT_MANAGER_H
 
+#include <atomic>
 #include "esp_ota_ops.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "delta_patcher.h"
 #include "../include/types.h"
 
+#define OTA_SLOT_SIZE 4096              // One flash sector per pipeline slot
+#define OTA_SLOT_COUNT 2
+#define OTA_CHECKPOINT_INTERVAL (64 * 1024)
+
+// Boot partition management and streaming firmware updates.
+//
+// An OTA session (beginOta/writeOta/endOta) streams an image into the
+// inactive app partition. Incoming chunks are copied into one of two
+// sector-sized slots while a writer task programs the other, so the
+// transport keeps receiving while flash is busy. The writer hashes the
+// image as it goes and, whenever it has nothing to program, erases the
+// sectors ahead of the write position so programming rarely waits on an
+// erase. Every 64 KB the committed offset is saved to NVS; after a dropped
+// link or a reboot, beginOta() for the same image (size and SHA-256)
+// reports that offset and re-hashes what is already on flash instead of
+// starting over. endOta() checks the digest and the image; applyUpdate()
+// then boots it.
+//
+// A delta session (beginDeltaOta/writeDeltaOta/endDeltaOta) carries a
+// patch against the running image instead (tools/make_delta.py). The
+// patch is applied as it streams in and its output goes through the same
+// pipeline, so the result is checked against the new image's digest the
+// same way. Delta sessions restart from the beginning after a drop.
 class BootManager {
 public:
     static BootManager& getInstance() {
         static BootManager instance;
         return instance;
     }
-    
+
     bool initialize();
     bool checkForUpdate();
     bool applyUpdate();
     const char* getFirmwareVersion();
     const esp_app_desc_t* getAppDescription();
-    
+
+    // digest is the SHA-256 of the whole image and is required
+    bool beginOta(size_t image_size, const uint8_t* digest, size_t* resume_offset);
+    bool writeOta(size_t offset, const uint8_t* data, size_t length);
+    bool endOta();
+    void abortOta();
+
+    bool beginDeltaOta(size_t patch_size);
+    bool writeDeltaOta(size_t offset, const uint8_t* data, size_t length);
+    bool endDeltaOta();
+
+    bool isOtaInProgress() const { return ota_in_progress_; }
+    size_t getOtaReceived() const { return ota_received_; }
+    size_t getOtaSize() const { return ota_size_; }
+
 private:
     BootManager() = default;
     ~BootManager() = default;
     BootManager(const BootManager&) = delete;
     BootManager& operator=(const BootManager&) = delete;
-    
+
+    struct OtaSlot {
+        uint8_t* data;
+        size_t offset;
+        size_t length;
+    };
+
+    // Saved to NVS so an interrupted update can resume after a reboot
+    struct OtaCheckpoint {
+        uint32_t magic;
+        uint32_t partition_address;
+        uint32_t image_size;
+        uint32_t committed;
+        uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    };
+
     bool validatePartition(const esp_partition_t* partition);
-    
-    const esp_partition_t* current_partition_;
-    const esp_partition_t* update_partition_;
-    esp_ota_handle_t ota_handle_;
-    bool ota_in_progress_;
+
+    static void otaWriterTask(void* arg);
+    static bool deltaOutput(const uint8_t* data, size_t length, void* arg);
+    bool startPipeline();
+    void submitSlot();
+    void drainPipeline();
+    void programSlot(const OtaSlot& slot);
+    bool eraseTo(size_t end);
+    bool rehash(size_t length);
+    void finishOta();
+    bool loadCheckpoint(OtaCheckpoint& checkpoint);
+    void saveCheckpoint(size_t committed);
+    void clearCheckpoint();
+
+    const esp_partition_t* current_partition_ = nullptr;
+    const esp_partition_t* update_partition_ = nullptr;
+    esp_ota_handle_t ota_handle_ = 0;
+    bool ota_in_progress_ = false;
+
+    // Receiving side, used by the caller's task
+    uint8_t ota_digest_[PAYLOAD_DIGEST_SIZE] = {};
+    size_t ota_size_ = 0;
+    size_t ota_received_ = 0;
+    int filling_ = -1;                  // Slot being filled, or -1
+    int64_t ota_start_us_ = 0;
+
+    // Writer side; ota_lock_ is held while it touches flash
+    OtaSlot slots_[OTA_SLOT_COUNT] = {};
+    QueueHandle_t full_queue_ = nullptr;
+    QueueHandle_t free_queue_ = nullptr;
+    TaskHandle_t writer_task_ = nullptr;
+    SemaphoreHandle_t ota_lock_ = nullptr;
+    mbedtls_sha256_context ota_sha_;
+    size_t ota_erased_ = 0;             // Erased up to here
+    size_t ota_checkpointed_ = 0;
+    std::atomic<size_t> erase_target_{0};
+    std::atomic<size_t> ota_written_{0};
+    std::atomic<bool> ota_failed_{false};
+    uint32_t erase_stall_us_ = 0;       // Erasing a slot had to wait for
+
+    // Delta session; its output feeds the session above
+    DeltaPatcher delta_;
+    bool delta_active_ = false;
+    size_t delta_size_ = 0;
+    size_t delta_received_ = 0;
 };
 
 #endif // BOOT_MANAGER_H
@@ -0,0 +1,179 @@
+#include "boot_sequence.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char* TAG = "BootSequence";
+
+// Event group bits 24..31 are reserved by FreeRTOS
+static const EventBits_t WORKER_DONE_BIT = 1u << 23;
+static const uint32_t WORKER_STACK_SIZE = 8192;
+static const UBaseType_t WORKER_PRIORITY = 1;     // Same as app_main
+
+static const char* const STATUS_NAMES[] = {"pending", "ok", "FAILED", "skipped"};
+
+static uint32_t nowUs() {
+    return (uint32_t)esp_timer_get_time();
+}
+
+bool BootSequence::run(const BootStage* stages, size_t count) {
+    if (count == 0 || count > BOOT_MAX_STAGES) {
+        ESP_LOGE(TAG, "Invalid stage count %u", (unsigned)count);
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if ((stages[i].deps | stages[i].after) & ~(BOOT_STAGE_BIT(i) - 1)) {
+            ESP_LOGE(TAG, "Stage %s depends on a later stage", stages[i].name);
+            return false;
+        }
+    }
+
+    done_ = xEventGroupCreate();
+    if (!done_) {
+        ESP_LOGE(TAG, "Failed to create event group");
+        return false;
+    }
+    stages_ = stages;
+    count_ = count;
+    failed_ = 0;
+    for (size_t i = 0; i < count; i++) {
+        records_[i] = {stages[i].name, 0, 0, 0, BOOT_STAGE_PENDING};
+    }
+
+    int own_core = xPortGetCoreID();
+    bool worker = false;
+    if (portNUM_PROCESSORS > 1) {
+        worker = xTaskCreatePinnedToCore(&BootSequence::workerTask, "boot_worker", WORKER_STACK_SIZE,
+                                         this, WORKER_PRIORITY, nullptr, own_core ^ 1) == pdPASS;
+        if (!worker) {
+            ESP_LOGW(TAG, "No boot worker, running all stages on core %d", own_core);
+        }
+    }
+
+    runCore(worker ? own_core : -1);
+    if (worker) {
+        xEventGroupWaitBits(done_, WORKER_DONE_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+    vEventGroupDelete(done_);
+    done_ = nullptr;
+
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        if (stages[i].required && records_[i].status != BOOT_STAGE_OK) {
+            ESP_LOGE(TAG, "Required stage %s %s", stages[i].name, STATUS_NAMES[records_[i].status]);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void BootSequence::workerTask(void* arg) {
+    BootSequence* self = static_cast<BootSequence*>(arg);
+    self->runCore(xPortGetCoreID());
+    xEventGroupSetBits(self->done_, WORKER_DONE_BIT);
+    vTaskDelete(nullptr);
+}
+
+// Runs this core's stages in table order; core -1 runs all of them
+void BootSequence::runCore(int core) {
+    for (size_t i = 0; i < count_; i++) {
+        const BootStage& stage = stages_[i];
+        if (core >= 0 && stage.core % portNUM_PROCESSORS != core) {
+            continue;
+        }
+
+        EventBits_t wait = stage.deps | stage.after;
+        if (wait) {
+            xEventGroupWaitBits(done_, wait, pdFALSE, pdTRUE, portMAX_DELAY);
+        }
+
+        StageRecord& record = records_[i];
+        record.core = xPortGetCoreID();
+        record.start_us = nowUs();
+        uint8_t status;
+        if (failed_ & stage.deps) {
+            status = BOOT_STAGE_SKIPPED;
+        } else {
+            status = stage.run() ? BOOT_STAGE_OK : BOOT_STAGE_FAILED;
+        }
+        record.end_us = nowUs();
+        record.status = status;
+
+        if (status != BOOT_STAGE_OK) {
+            ESP_LOGW(TAG, "Stage %s %s", stage.name, STATUS_NAMES[status]);
+            portENTER_CRITICAL(&lock_);
+            failed_ |= BOOT_STAGE_BIT(i);
+            portEXIT_CRITICAL(&lock_);
+        }
+        xEventGroupSetBits(done_, BOOT_STAGE_BIT(i));
+    }
+}
+
+void BootSequence::mark(boot_milestone_t milestone) {
+    if (milestone >= BOOT_MILESTONE_COUNT) {
+        return;
+    }
+    uint32_t now = nowUs();
+    bool first = false;
+    portENTER_CRITICAL(&lock_);
+    if (milestones_[milestone] == 0) {
+        milestones_[milestone] = now;
+        first = true;
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    if (first) {
+        ESP_LOGI(TAG, "%s at %u ms", milestone == BOOT_MILESTONE_READY ? "Ready" : "First connection",
+                 (unsigned)(now / 1000));
+    }
+}
+
+// CMD_GET_BOOT_TIMELINE response, little endian:
+//   u32 ready_us, u32 first_connection_us, u8 count
+//   count x { str name, u8 core, u8 status, u32 start_us, u32 end_us }
+// Times are microseconds since boot, 0 for milestones not reached yet; str
+// is a u8 length followed by the bytes. Stages that do not fit are left out.
+size_t BootSequence::getTimeline(uint8_t* out, size_t capacity) const {
+    static const size_t HEADER_SIZE = 9;
+    if (capacity < HEADER_SIZE) {
+        return 0;
+    }
+
+    uint32_t milestones[BOOT_MILESTONE_COUNT];
+    portENTER_CRITICAL(&lock_);
+    memcpy(milestones, milestones_, sizeof(milestones));
+    portEXIT_CRITICAL(&lock_);
+
+    memcpy(out, &milestones[BOOT_MILESTONE_READY], 4);
+    memcpy(out + 4, &milestones[BOOT_MILESTONE_FIRST_CONNECTION], 4);
+    size_t pos = HEADER_SIZE;
+    uint8_t written = 0;
+    for (size_t i = 0; i < count_; i++) {
+        const StageRecord& record = records_[i];
+        size_t name_len = strlen(record.name);
+        if (pos + 1 + name_len + 10 > capacity) {
+            break;
+        }
+        out[pos++] = (uint8_t)name_len;
+        memcpy(out + pos, record.name, name_len);
+        pos += name_len;
+        out[pos++] = record.core;
+        out[pos++] = record.status;
+        memcpy(out + pos, &record.start_us, 4);
+        memcpy(out + pos + 4, &record.end_us, 4);
+        pos += 8;
+        written++;
+    }
+    out[8] = written;
+    return pos;
+}
+
+void BootSequence::logTimeline() const {
+    for (size_t i = 0; i < count_; i++) {
+        const StageRecord& record = records_[i];
+        ESP_LOGI(TAG, "  %-10s core %u %7u .. %7u us (%6u us) %s", record.name, record.core,
+                 (unsigned)record.start_us, (unsigned)record.end_us,
+                 (unsigned)(record.end_us - record.start_us), STATUS_NAMES[record.status]);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef BOOT_SEQUENCE_H
+#define BOOT_SEQUENCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#define BOOT_MAX_STAGES 16
+#define BOOT_STAGE_BIT(stage) (1u << (stage))
+
+typedef bool (*boot_stage_fn_t)();
+
+// One init step, run on `core`. deps and after are masks of
+// BOOT_STAGE_BIT()s of earlier stages in the same table: the stage waits
+// for all of them to finish, and is skipped if one of its deps failed or
+// was skipped (after only orders). A failed required stage fails the boot.
+struct BootStage {
+    const char* name;
+    boot_stage_fn_t run;
+    uint32_t deps;
+    uint32_t after;
+    int core;
+    bool required;
+};
+
+typedef enum {
+    BOOT_STAGE_PENDING = 0,
+    BOOT_STAGE_OK,
+    BOOT_STAGE_FAILED,
+    BOOT_STAGE_SKIPPED
+} boot_stage_status_t;
+
+typedef enum {
+    BOOT_MILESTONE_READY = 0,           // "Ready" is on the display
+    BOOT_MILESTONE_FIRST_CONNECTION,    // First BLE central connected
+    BOOT_MILESTONE_COUNT
+} boot_milestone_t;
+
+// Runs the boot stage graph and keeps its timeline.
+//
+// Each core gets one worker (the calling task for its own core, a
+// temporary task for the other) that walks the table in order and runs the
+// stages placed on it, waiting for their dependencies to be set in an
+// event group. Because dependencies must point backwards in the table, the
+// workers can never wait on each other in a cycle. Stage start and end
+// times, and the milestones marked later, are in microseconds since boot.
+class BootSequence {
+public:
+    static BootSequence& getInstance() {
+        static BootSequence instance;
+        return instance;
+    }
+
+    // Returns once every stage finished; false if a required stage failed
+    bool run(const BootStage* stages, size_t count);
+
+    // Records the first time a milestone is reached
+    void mark(boot_milestone_t milestone);
+
+    size_t getTimeline(uint8_t* out, size_t capacity) const;
+    void logTimeline() const;
+
+private:
+    BootSequence() = default;
+    ~BootSequence() = default;
+    BootSequence(const BootSequence&) = delete;
+    BootSequence& operator=(const BootSequence&) = delete;
+
+    struct StageRecord {
+        const char* name;
+        uint32_t start_us;
+        uint32_t end_us;
+        uint8_t core;
+        uint8_t status;
+    };
+
+    static void workerTask(void* arg);
+    void runCore(int core);
+
+    const BootStage* stages_ = nullptr;
+    size_t count_ = 0;
+    EventGroupHandle_t done_ = nullptr;
+    volatile uint32_t failed_ = 0;      // Stages that failed or were skipped
+    StageRecord records_[BOOT_MAX_STAGES] = {};
+    uint32_t milestones_[BOOT_MILESTONE_COUNT] = {};
+    mutable portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif // BOOT_SEQUENCE_H
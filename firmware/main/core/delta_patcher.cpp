@@ -0,0 +1,292 @@
+#include "delta_patcher.h"
+#include "esp_log.h"
+#include "esp32/rom/miniz.h"
+#include "mbedtls/sha256.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "DeltaPatcher";
+
+static const size_t HASH_CHUNK = 4096;
+
+DeltaPatcher::~DeltaPatcher() {
+    reset();
+}
+
+bool DeltaPatcher::begin(const esp_partition_t* base, delta_output_fn_t output, void* arg) {
+    reset();
+    if (!base || !output) {
+        return false;
+    }
+    base_ = base;
+    output_ = output;
+    output_arg_ = arg;
+    return true;
+}
+
+void DeltaPatcher::reset() {
+    free(decomp_);
+    free(window_);
+    decomp_ = nullptr;
+    window_ = nullptr;
+    window_size_ = 0;
+    window_pos_ = 0;
+    stream_done_ = false;
+
+    base_ = nullptr;
+    output_ = nullptr;
+    output_arg_ = nullptr;
+    failed_ = false;
+    header_ = {};
+    header_len_ = 0;
+    state_ = STATE_COMMAND;
+    command_len_ = 0;
+    diff_left_ = 0;
+    extra_left_ = 0;
+    seek_ = 0;
+    base_pos_ = 0;
+    produced_ = 0;
+}
+
+bool DeltaPatcher::write(const uint8_t* data, size_t length) {
+    if (failed_ || !base_) {
+        return false;
+    }
+
+    if (!hasHeader()) {
+        size_t n = sizeof(header_) - header_len_;
+        if (n > length) {
+            n = length;
+        }
+        memcpy((uint8_t*)&header_ + header_len_, data, n);
+        header_len_ += n;
+        data += n;
+        length -= n;
+        if (!hasHeader()) {
+            return true;
+        }
+        if (!checkHeader()) {
+            failed_ = true;
+            return false;
+        }
+    }
+    if (length == 0) {
+        return true;
+    }
+
+    bool ok = header_.codec == DELTA_CODEC_ZLIB ? inflate(data, length) : apply(data, length);
+    if (!ok) {
+        failed_ = true;
+    }
+    return ok;
+}
+
+bool DeltaPatcher::finish() {
+    if (failed_ || !hasHeader()) {
+        return false;
+    }
+    if (header_.codec == DELTA_CODEC_ZLIB && !stream_done_) {
+        ESP_LOGE(TAG, "Delta stream truncated");
+        return false;
+    }
+    if (state_ != STATE_COMMAND || command_len_ != 0 || produced_ != header_.new_size) {
+        ESP_LOGE(TAG, "Delta ended early: %u/%u bytes", (unsigned)produced_, (unsigned)header_.new_size);
+        return false;
+    }
+    return true;
+}
+
+bool DeltaPatcher::checkHeader() {
+    if (header_.magic != DELTA_MAGIC || header_.version != DELTA_VERSION ||
+        (header_.codec != DELTA_CODEC_NONE && header_.codec != DELTA_CODEC_ZLIB)) {
+        ESP_LOGE(TAG, "Not a supported firmware delta");
+        return false;
+    }
+    if (header_.old_size == 0 || header_.old_size > base_->size || header_.new_size == 0) {
+        ESP_LOGE(TAG, "Invalid delta sizes: %u -> %u", (unsigned)header_.old_size,
+                 (unsigned)header_.new_size);
+        return false;
+    }
+
+    // The delta only reproduces the new image from the exact base it was
+    // computed against
+    uint8_t* buf = (uint8_t*)malloc(HASH_CHUNK);
+    if (!buf) {
+        return false;
+    }
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    bool ok = true;
+    for (size_t offset = 0; ok && offset < header_.old_size; offset += HASH_CHUNK) {
+        size_t n = header_.old_size - offset < HASH_CHUNK ? header_.old_size - offset : HASH_CHUNK;
+        ok = esp_partition_read(base_, offset, buf, n) == ESP_OK &&
+             mbedtls_sha256_update(&sha, buf, n) == 0;
+    }
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    ok = ok && mbedtls_sha256_finish(&sha, digest) == 0;
+    mbedtls_sha256_free(&sha);
+    free(buf);
+
+    if (!ok || memcmp(digest, header_.old_digest, PAYLOAD_DIGEST_SIZE) != 0) {
+        ESP_LOGE(TAG, "Delta was made for a different base image than %s", base_->label);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Applying delta against %s: %u -> %u bytes", base_->label,
+             (unsigned)header_.old_size, (unsigned)header_.new_size);
+    return true;
+}
+
+bool DeltaPatcher::startInflate(uint8_t cmf) {
+    // Same bounded window as compressed payloads: whatever the encoder used
+    if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7) {
+        ESP_LOGE(TAG, "Unsupported zlib header in delta");
+        return false;
+    }
+    window_size_ = (size_t)1 << ((cmf >> 4) + 8);
+
+    decomp_ = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+    window_ = (uint8_t*)malloc(window_size_);
+    if (!decomp_ || !window_) {
+        ESP_LOGE(TAG, "No memory for %u byte inflate window", (unsigned)window_size_);
+        return false;
+    }
+    tinfl_init(decomp_);
+    return true;
+}
+
+bool DeltaPatcher::inflate(const uint8_t* data, size_t length) {
+    if (stream_done_) {
+        ESP_LOGE(TAG, "Data past the end of the delta");
+        return false;
+    }
+    if (!decomp_ && !startInflate(data[0])) {
+        return false;
+    }
+
+    // Input arrives in transport-sized pieces, so tinfl is always told
+    // more may follow; the zlib trailer tells it where the stream ends
+    while (true) {
+        size_t in_bytes = length;
+        size_t out_bytes = window_size_ - window_pos_;
+        tinfl_status status = tinfl_decompress(decomp_, data, &in_bytes, window_, window_ + window_pos_,
+                                               &out_bytes, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        length -= in_bytes;
+
+        if (out_bytes > 0 && !apply(window_ + window_pos_, out_bytes)) {
+            return false;
+        }
+        window_pos_ = (window_pos_ + out_bytes) & (window_size_ - 1);
+
+        if (status == TINFL_STATUS_DONE) {
+            stream_done_ = true;
+            if (length > 0) {
+                ESP_LOGE(TAG, "Data past the end of the delta");
+                return false;
+            }
+            return true;
+        }
+        if (status < TINFL_STATUS_DONE) {
+            ESP_LOGE(TAG, "Corrupt delta stream (%d)", (int)status);
+            return false;
+        }
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT && length == 0) {
+            return true;
+        }
+    }
+}
+
+bool DeltaPatcher::apply(const uint8_t* data, size_t length) {
+    while (length > 0) {
+        size_t n = 0;
+        switch (state_) {
+            case STATE_COMMAND:
+                n = COMMAND_SIZE - command_len_;
+                if (n > length) {
+                    n = length;
+                }
+                memcpy(command_ + command_len_, data, n);
+                command_len_ += n;
+                if (command_len_ == COMMAND_SIZE) {
+                    memcpy(&diff_left_, command_, 4);
+                    memcpy(&extra_left_, command_ + 4, 4);
+                    memcpy(&seek_, command_ + 8, 4);
+                    command_len_ = 0;
+                    if (base_pos_ + diff_left_ > header_.old_size ||
+                        produced_ + diff_left_ + extra_left_ > header_.new_size) {
+                        ESP_LOGE(TAG, "Delta command out of range at %u", (unsigned)produced_);
+                        return false;
+                    }
+                    state_ = STATE_DIFF;
+                    if (diff_left_ == 0 && !endCommand()) {
+                        return false;
+                    }
+                }
+                break;
+
+            case STATE_DIFF:
+                // New byte = base byte + diff byte
+                n = diff_left_ < length ? diff_left_ : length;
+                if (n > BASE_CHUNK) {
+                    n = BASE_CHUNK;
+                }
+                if (esp_partition_read(base_, base_pos_, base_buf_, n) != ESP_OK) {
+                    ESP_LOGE(TAG, "Base read failed at %u", (unsigned)base_pos_);
+                    return false;
+                }
+                for (size_t i = 0; i < n; i++) {
+                    base_buf_[i] += data[i];
+                }
+                if (!emit(base_buf_, n)) {
+                    return false;
+                }
+                base_pos_ += n;
+                diff_left_ -= n;
+                if (diff_left_ == 0 && !endCommand()) {
+                    return false;
+                }
+                break;
+
+            case STATE_EXTRA:
+                n = extra_left_ < length ? extra_left_ : length;
+                if (!emit(data, n)) {
+                    return false;
+                }
+                extra_left_ -= n;
+                if (extra_left_ == 0 && !endCommand()) {
+                    return false;
+                }
+                break;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Called when the current part of a command is done; moves to the next
+bool DeltaPatcher::endCommand() {
+    if (state_ == STATE_DIFF && extra_left_ > 0) {
+        state_ = STATE_EXTRA;
+        return true;
+    }
+
+    int64_t next = (int64_t)base_pos_ + seek_;
+    if (next < 0 || next > (int64_t)header_.old_size) {
+        ESP_LOGE(TAG, "Delta seek out of range at %u", (unsigned)produced_);
+        return false;
+    }
+    base_pos_ = (size_t)next;
+    state_ = STATE_COMMAND;
+    return true;
+}
+
+bool DeltaPatcher::emit(const uint8_t* data, size_t length) {
+    if (!output_(data, length, output_arg_)) {
+        return false;
+    }
+    produced_ += length;
+    return true;
+}
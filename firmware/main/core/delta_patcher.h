@@ -0,0 +1,99 @@
+#ifndef DELTA_PATCHER_H
+#define DELTA_PATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+#include "../include/types.h"
+
+#define DELTA_MAGIC 0x4C445A44          // "DZDL"
+#define DELTA_VERSION 1
+#define DELTA_CODEC_NONE 0
+#define DELTA_CODEC_ZLIB 1
+
+struct tinfl_decompressor_tag;
+
+// Header in front of a firmware delta (see tools/make_delta.py). The body
+// that follows, zlib-compressed unless codec is DELTA_CODEC_NONE, is a
+// sequence of bsdiff-style commands:
+//
+//   u32 diff_len, u32 extra_len, i32 seek
+//   diff_len bytes added to the base image from the current base offset
+//   extra_len bytes copied as is
+//   then the base offset moves on by seek
+struct DeltaHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t codec;
+    uint8_t reserved;
+    uint32_t old_size;
+    uint32_t new_size;
+    uint8_t old_digest[PAYLOAD_DIGEST_SIZE];    // SHA-256 of the base image
+    uint8_t new_digest[PAYLOAD_DIGEST_SIZE];    // SHA-256 of the result
+};
+
+typedef bool (*delta_output_fn_t)(const uint8_t* data, size_t length, void* arg);
+
+// Applies a delta against the image in a partition as the delta streams
+// in. Patch bytes are pushed with write() in order; reconstructed bytes
+// are handed to the output function as soon as they are known, so only
+// the inflate window (the delta's own zlib window, at most 32 KB) and a
+// small base read buffer are held in RAM. The base image is checked
+// against the header's digest before anything is produced.
+class DeltaPatcher {
+public:
+    DeltaPatcher() = default;
+    ~DeltaPatcher();
+
+    bool begin(const esp_partition_t* base, delta_output_fn_t output, void* arg);
+    bool write(const uint8_t* data, size_t length);
+    // True once the whole delta was applied and produced new_size bytes
+    bool finish();
+    void reset();
+
+    bool hasHeader() const { return header_len_ == sizeof(header_); }
+    const DeltaHeader& header() const { return header_; }
+    size_t produced() const { return produced_; }
+
+private:
+    DeltaPatcher(const DeltaPatcher&) = delete;
+    DeltaPatcher& operator=(const DeltaPatcher&) = delete;
+
+    enum State { STATE_COMMAND, STATE_DIFF, STATE_EXTRA };
+
+    static constexpr size_t COMMAND_SIZE = 12;
+    static constexpr size_t BASE_CHUNK = 256;
+
+    bool checkHeader();
+    bool startInflate(uint8_t cmf);
+    bool inflate(const uint8_t* data, size_t length);
+    bool apply(const uint8_t* data, size_t length);
+    bool endCommand();
+    bool emit(const uint8_t* data, size_t length);
+
+    const esp_partition_t* base_ = nullptr;
+    delta_output_fn_t output_ = nullptr;
+    void* output_arg_ = nullptr;
+    bool failed_ = false;
+
+    DeltaHeader header_ = {};
+    size_t header_len_ = 0;
+
+    tinfl_decompressor_tag* decomp_ = nullptr;
+    uint8_t* window_ = nullptr;
+    size_t window_size_ = 0;
+    size_t window_pos_ = 0;
+    bool stream_done_ = false;
+
+    State state_ = STATE_COMMAND;
+    uint8_t command_[COMMAND_SIZE] = {};
+    size_t command_len_ = 0;
+    uint32_t diff_left_ = 0;
+    uint32_t extra_left_ = 0;
+    int32_t seek_ = 0;
+    size_t base_pos_ = 0;
+    size_t produced_ = 0;
+    uint8_t base_buf_[BASE_CHUNK];
+};
+
+#endif // DELTA_PATCHER_H
@@ -0,0 +1,17 @@
+#include "fs_backend.h"
+#include "sdkconfig.h"
+
+#if CONFIG_DEZERO_STORAGE_LITTLEFS
+#include "littlefs_backend.h"
+#else
+#include "spiffs_backend.h"
+#endif
+
+FsBackend& FsBackend::get() {
+#if CONFIG_DEZERO_STORAGE_LITTLEFS
+    static LittleFsBackend backend;
+#else
+    static SpiffsBackend backend;
+#endif
+    return backend;
+}
@@ -0,0 +1,35 @@
+#ifndef FS_BACKEND_H
+#define FS_BACKEND_H
+
+#include <stddef.h>
+
+// Filesystem that StorageManager mounts under STORAGE_BASE_PATH.
+//
+// All file I/O goes through the VFS (fopen/stat/readdir) whatever the
+// backend, so a backend only mounts and unmounts the partition, reports
+// usage, and describes the semantics StorageManager has to work around.
+// The backend is chosen at build time with CONFIG_DEZERO_STORAGE_*.
+class FsBackend {
+public:
+    virtual ~FsBackend() = default;
+
+    virtual const char* name() const = 0;
+    virtual bool mount(const char* base_path, const char* partition_label, int max_files) = 0;
+    virtual void unmount() = 0;
+    virtual bool getInfo(size_t* total, size_t* used) = 0;
+
+    // False for flat filesystems (SPIFFS), where "a/b" is just a file name
+    // and mkdir/rmdir are unsupported
+    virtual bool hasDirectories() const = 0;
+
+    // True if rename() atomically replaces an existing destination
+    virtual bool renameReplaces() const = 0;
+
+    // Unit the filesystem reads and programs in; streamed I/O is sized in
+    // multiples of it
+    virtual size_t ioBlockSize() const = 0;
+
+    static FsBackend& get();
+};
+
+#endif // FS_BACKEND_H
@@ -0,0 +1,403 @@
+#include "install_session.h"
+#include "storage_manager.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "InstallSession";
+
+static const size_t REHASH_CHUNK_SIZE = 1024;
+
+// Written next to a part file when it is created: which upload it belongs
+// to, so a later session only resumes a part file of the same upload
+static const uint32_t PART_CHECKPOINT_MAGIC = 0x54505A44;  // "DZPT"
+
+struct PartCheckpoint {
+    uint32_t magic;
+    uint32_t size;
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    uint8_t has_digest;
+    uint8_t reserved[3];
+};
+
+InstallSession::~InstallSession() {
+    abort();
+}
+
+bool InstallSession::begin(const char* payload_id, size_t total_size,
+                           const uint8_t* digest, size_t* resume_offset) {
+    if (strlen(payload_id) >= MAX_PAYLOAD_ID_LEN) {
+        ESP_LOGE(TAG, "Payload id too long: %s", payload_id);
+        return false;
+    }
+    if (total_size == 0 || total_size > MAX_PAYLOAD_SIZE) {
+        ESP_LOGE(TAG, "Invalid payload size: %u", (unsigned)total_size);
+        return false;
+    }
+
+    last_used_us_ = esp_timer_get_time();
+
+    // Same upload restarted after a drop: keep going from where it stopped
+    if (resume_offset && isActive() && isFor(payload_id) && total_size_ == total_size) {
+        if (resume_offset) *resume_offset = received_;
+        ESP_LOGI(TAG, "Resuming %s at %u/%u", payload_id, (unsigned)received_, (unsigned)total_size);
+        return true;
+    }
+    abort();
+
+    auto& storage = StorageManager::getInstance();
+    std::string payload_dir = storage.getPayloadPath(payload_id);
+    if (!storage.createDirectory(payload_dir.c_str())) {
+        ESP_LOGE(TAG, "Failed to create payload directory");
+        return false;
+    }
+
+    strncpy(payload_id_, payload_id, MAX_PAYLOAD_ID_LEN - 1);
+    payload_id_[MAX_PAYLOAD_ID_LEN - 1] = '\0';
+    total_size_ = total_size;
+    received_ = 0;
+    checkpointed_ = 0;
+    linked_ = false;
+    has_manifest_ = false;
+    has_digest_ = digest != nullptr;
+    if (digest) {
+        memcpy(digest_, digest, PAYLOAD_DIGEST_SIZE);
+    }
+
+    auto& blobs = BlobStore::getInstance();
+    if (blobs.isAvailable() && digest && blobs.contains(digest, total_size)) {
+        // Content already stored: nothing to transfer
+        to_blob_ = true;
+        linked_ = true;
+        active_ = true;
+        received_ = total_size;
+        if (resume_offset) *resume_offset = received_;
+        ESP_LOGI(TAG, "Install session for %s: content already stored", payload_id);
+        return true;
+    }
+
+    if (blobs.isAvailable()) {
+        to_blob_ = true;
+        mbedtls_sha256_init(&sha_);
+        mbedtls_sha256_starts(&sha_, 0);
+
+        // An upload interrupted by a reboot continues in its old extent;
+        // what it wrote before is hashed again from flash
+        size_t written = 0;
+        bool resumed = resume_offset && blobs.resume(payload_id, total_size, digest, extent_, &written);
+        if (resumed && !rehash(written)) {
+            blobs.release(extent_);
+            mbedtls_sha256_starts(&sha_, 0);
+            written = 0;
+            resumed = false;
+        }
+        if (!resumed && !blobs.reserve(total_size, extent_)) {
+            mbedtls_sha256_free(&sha_);
+            return false;
+        }
+
+        active_ = true;
+        received_ = written;
+        checkpointed_ = written;
+        if (resume_offset) *resume_offset = received_;
+        ESP_LOGI(TAG, "Install session for %s: %u bytes into blob at 0x%x, starting at %u",
+                 payload_id, (unsigned)total_size, (unsigned)extent_.offset, (unsigned)received_);
+        return true;
+    }
+
+    // A part file left by an earlier session (or a reboot) is resumed only
+    // if its checkpoint names the same upload, and its contents are hashed
+    // again so commit can still check the announced digest
+    std::string part_path = storage.getPayloadPartPath(payload_id);
+    std::string checkpoint_path = storage.getPayloadPartCheckpointPath(payload_id);
+    size_t existing = 0;
+    PartCheckpoint checkpoint;
+    if (!resume_offset || !storage.getFileInfo(part_path.c_str(), &existing, nullptr) ||
+        existing > total_size ||
+        storage.readFile(checkpoint_path.c_str(), (uint8_t*)&checkpoint, sizeof(checkpoint)) !=
+            (int)sizeof(checkpoint) ||
+        checkpoint.magic != PART_CHECKPOINT_MAGIC || checkpoint.size != total_size ||
+        (digest && checkpoint.has_digest && memcmp(checkpoint.digest, digest, PAYLOAD_DIGEST_SIZE) != 0)) {
+        existing = 0;
+    }
+
+    to_blob_ = false;
+    mbedtls_sha256_init(&sha_);
+    mbedtls_sha256_starts(&sha_, 0);
+    if (existing && !rehash(existing)) {
+        mbedtls_sha256_starts(&sha_, 0);
+        existing = 0;
+    }
+    if (!existing) {
+        memset(&checkpoint, 0, sizeof(checkpoint));
+        checkpoint.magic = PART_CHECKPOINT_MAGIC;
+        checkpoint.size = total_size;
+        if (digest) {
+            memcpy(checkpoint.digest, digest, PAYLOAD_DIGEST_SIZE);
+            checkpoint.has_digest = 1;
+        }
+        if (!storage.writeFile(checkpoint_path.c_str(), (const uint8_t*)&checkpoint, sizeof(checkpoint))) {
+            mbedtls_sha256_free(&sha_);
+            return false;
+        }
+    }
+
+    if (!storage.openWrite(part_path.c_str(), part_, existing != 0)) {
+        mbedtls_sha256_free(&sha_);
+        return false;
+    }
+
+    active_ = true;
+    received_ = existing;
+    checkpointed_ = existing;
+
+    if (resume_offset) *resume_offset = received_;
+    ESP_LOGI(TAG, "Install session for %s: %u bytes, starting at %u", payload_id,
+             (unsigned)total_size, (unsigned)received_);
+    return true;
+}
+
+bool InstallSession::write(size_t offset, const uint8_t* data, size_t length) {
+    if (!isActive()) {
+        return false;
+    }
+    last_used_us_ = esp_timer_get_time();
+    if (offset > received_) {
+        ESP_LOGE(TAG, "Gap in upload: chunk at %u, have %u", (unsigned)offset, (unsigned)received_);
+        return false;
+    }
+    if (offset + length > total_size_) {
+        ESP_LOGE(TAG, "Chunk past end of payload");
+        return false;
+    }
+
+    // Skip the part of a retransmitted chunk that is already on flash
+    size_t skip = received_ - offset;
+    if (skip >= length) {
+        return true;
+    }
+    data += skip;
+    length -= skip;
+
+    if (to_blob_) {
+        if (!BlobStore::getInstance().write(extent_, received_, data, length) ||
+            mbedtls_sha256_update(&sha_, data, length) != 0) {
+            return false;
+        }
+    } else if (!part_.write(data, length) || mbedtls_sha256_update(&sha_, data, length) != 0) {
+        ESP_LOGE(TAG, "Write failed at %u", (unsigned)received_);
+        return false;
+    }
+    received_ += length;
+
+    if (received_ < total_size_ && received_ - checkpointed_ >= INSTALL_CHECKPOINT_INTERVAL) {
+        return checkpoint();
+    }
+    return true;
+}
+
+// Written aside until commit, so a failed upload never replaces the
+// manifest of the installed version
+bool InstallSession::writeManifest(const uint8_t* manifest, size_t length) {
+    if (!isActive()) {
+        return false;
+    }
+    last_used_us_ = esp_timer_get_time();
+    auto& storage = StorageManager::getInstance();
+    std::string manifest_part = storage.getPayloadManifestPartPath(payload_id_);
+    if (!storage.writeFile(manifest_part.c_str(), manifest, length)) {
+        ESP_LOGE(TAG, "Failed to store the manifest of %s", payload_id_);
+        storage.deleteFile(manifest_part.c_str());
+        has_manifest_ = false;
+        return false;
+    }
+    has_manifest_ = true;
+    return true;
+}
+
+// Makes everything received so far survive a reboot
+bool InstallSession::checkpoint() {
+    if (to_blob_) {
+        BlobStore::getInstance().checkpoint(payload_id_, extent_, received_,
+                                            has_digest_ ? digest_ : nullptr);
+    } else if (!part_.flush()) {
+        ESP_LOGE(TAG, "Flush failed at %u", (unsigned)received_);
+        return false;
+    }
+    checkpointed_ = received_;
+    return true;
+}
+
+static bool hashChunk(const uint8_t* data, size_t length, void* arg) {
+    return mbedtls_sha256_update((mbedtls_sha256_context*)arg, data, length) == 0;
+}
+
+// Hashes what an earlier session already stored: the start of the blob
+// extent, or the whole part file
+bool InstallSession::rehash(size_t length) {
+    uint8_t* buf = (uint8_t*)malloc(REHASH_CHUNK_SIZE);
+    if (!buf) {
+        return false;
+    }
+    bool ok = true;
+    if (to_blob_) {
+        for (size_t offset = 0; ok && offset < length; offset += REHASH_CHUNK_SIZE) {
+            size_t n = length - offset < REHASH_CHUNK_SIZE ? length - offset : REHASH_CHUNK_SIZE;
+            ok = BlobStore::getInstance().read(extent_, offset, buf, n) &&
+                 mbedtls_sha256_update(&sha_, buf, n) == 0;
+        }
+    } else {
+        auto& storage = StorageManager::getInstance();
+        std::string part_path = storage.getPayloadPartPath(payload_id_);
+        StorageIoStats stats;
+        ok = storage.streamFile(part_path.c_str(), buf, REHASH_CHUNK_SIZE, hashChunk, &sha_, &stats) &&
+             stats.bytes == length;
+    }
+    free(buf);
+    if (!ok) {
+        ESP_LOGW(TAG, "Could not re-read partial upload, starting over");
+    }
+    return ok;
+}
+
+bool InstallSession::commit() {
+    if (!isActive()) {
+        return false;
+    }
+    if (received_ != total_size_) {
+        ESP_LOGE(TAG, "Incomplete upload: %u/%u", (unsigned)received_, (unsigned)total_size_);
+        return false;
+    }
+    if (!has_manifest_) {
+        ESP_LOGE(TAG, "Upload of %s has no manifest", payload_id_);
+        return false;
+    }
+
+    auto& storage = StorageManager::getInstance();
+    std::string data_path = storage.getPayloadDataPath(payload_id_);
+
+    if (to_blob_) {
+        auto& blobs = BlobStore::getInstance();
+        bool ok;
+        if (linked_) {
+            ok = blobs.link(payload_id_, digest_, total_size_);
+        } else {
+            uint8_t digest[PAYLOAD_DIGEST_SIZE];
+            ok = mbedtls_sha256_finish(&sha_, digest) == 0;
+            if (ok && has_digest_ && memcmp(digest, digest_, PAYLOAD_DIGEST_SIZE) != 0) {
+                ESP_LOGE(TAG, "Upload of %s does not match its announced digest", payload_id_);
+                ok = false;
+            }
+            ok = ok && blobs.commit(payload_id_, extent_, digest);
+        }
+        if (!ok) {
+            return false;
+        }
+        closeBlob();
+        // Drop a copy left from before the payload moved to the blob store
+        if (storage.fileExists(data_path.c_str())) {
+            storage.deleteFile(data_path.c_str());
+        }
+        return publishManifest();
+    }
+
+    std::string part_path = storage.getPayloadPartPath(payload_id_);
+    std::string checkpoint_path = storage.getPayloadPartCheckpointPath(payload_id_);
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    if (mbedtls_sha256_finish(&sha_, digest) != 0 ||
+        (has_digest_ && memcmp(digest, digest_, PAYLOAD_DIGEST_SIZE) != 0)) {
+        ESP_LOGE(TAG, "Upload of %s does not match its announced digest", payload_id_);
+        abort();
+        return false;
+    }
+    storage.deleteFile(checkpoint_path.c_str());
+    if (!close()) {
+        ESP_LOGE(TAG, "Failed to write the end of %s", part_path.c_str());
+        storage.deleteFile(part_path.c_str());
+        discardManifest();
+        return false;
+    }
+    if (!storage.renameFile(part_path.c_str(), data_path.c_str())) {
+        ESP_LOGE(TAG, "Failed to move %s into place", part_path.c_str());
+        storage.deleteFile(part_path.c_str());
+        discardManifest();
+        return false;
+    }
+    return publishManifest();
+}
+
+// Last step of commit(): the data is in place, now the manifest
+bool InstallSession::publishManifest() {
+    auto& storage = StorageManager::getInstance();
+    std::string manifest_part = storage.getPayloadManifestPartPath(payload_id_);
+    std::string manifest_path = storage.getPayloadManifestPath(payload_id_);
+    has_manifest_ = false;
+    if (!storage.renameFile(manifest_part.c_str(), manifest_path.c_str())) {
+        ESP_LOGE(TAG, "Failed to move the manifest of %s into place", payload_id_);
+        storage.deleteFile(manifest_part.c_str());
+        return false;
+    }
+    return true;
+}
+
+void InstallSession::abort() {
+    if (!isActive()) {
+        return;
+    }
+
+    discardManifest();
+
+    if (to_blob_) {
+        if (!linked_) {
+            BlobStore::getInstance().release(extent_);
+        }
+        closeBlob();
+        ESP_LOGI(TAG, "Install of %s aborted", payload_id_);
+        return;
+    }
+
+    close();
+
+    auto& storage = StorageManager::getInstance();
+    std::string part_path = storage.getPayloadPartPath(payload_id_);
+    std::string checkpoint_path = storage.getPayloadPartCheckpointPath(payload_id_);
+    storage.deleteFile(part_path.c_str());
+    storage.deleteFile(checkpoint_path.c_str());
+    ESP_LOGI(TAG, "Install of %s aborted", payload_id_);
+}
+
+void InstallSession::discardManifest() {
+    if (has_manifest_) {
+        auto& storage = StorageManager::getInstance();
+        std::string manifest_part = storage.getPayloadManifestPartPath(payload_id_);
+        storage.deleteFile(manifest_part.c_str());
+        has_manifest_ = false;
+    }
+}
+
+bool InstallSession::isFor(const char* payload_id) const {
+    return strncmp(payload_id_, payload_id, MAX_PAYLOAD_ID_LEN) == 0;
+}
+
+void InstallSession::closeBlob() {
+    if (!linked_) {
+        mbedtls_sha256_free(&sha_);
+    }
+    linked_ = false;
+    active_ = false;
+}
+
+// Flushes the buffered tail of the part file and closes it
+bool InstallSession::close() {
+    mbedtls_sha256_free(&sha_);
+    bool ok = true;
+    if (part_.isOpen()) {
+        const StorageIoStats& stats = part_.stats();
+        ESP_LOGI(TAG, "Wrote %u bytes of %s at %u B/s", (unsigned)stats.bytes, payload_id_,
+                 (unsigned)stats.bytesPerSecond());
+        ok = part_.close();
+    }
+    active_ = false;
+    return ok;
+}
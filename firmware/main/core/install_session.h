@@ -0,0 +1,87 @@
+#ifndef INSTALL_SESSION_H
+#define INSTALL_SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../include/types.h"
+#include "blob_store.h"
+#include "storage_manager.h"
+#include "mbedtls/sha256.h"
+
+// Received data is made durable this often (and on commit), so a reboot
+// loses at most this much of an upload
+#define INSTALL_CHECKPOINT_INTERVAL (64 * 1024)
+
+// One in-progress payload upload.
+//
+// Chunks are written straight into a reserved extent of the blob partition
+// as they arrive (or appended to <payload dir>/payload.part on devices
+// without one), so the payload never has to fit in RAM. Writes are checked against the current
+// offset: a retransmitted chunk is acknowledged without rewriting, and a
+// gap is rejected. If the transport drops, begin() for the same payload
+// reports how much was already received so the client can resume there,
+// also after a reboot, from the last checkpoint; begin() without
+// resume_offset always starts over. Data kept from before a reboot is only
+// reused for an upload of the same size (and digest, when both announce
+// one), and is hashed again. commit() publishes the
+// new blob, or renames the part file over the payload file, in one step.
+//
+// The manifest travels with the upload: writeManifest() stores it as
+// <payload dir>/manifest.json.part, and commit() refuses to publish a
+// payload without one, then renames it over manifest.json once the data
+// is in place.
+//
+// Uploads are hashed as they arrive, so commit() rejects one that does not
+// match the digest announced to begin(), and blobs with identical content
+// are stored once. A client that announces the digest up front skips the transfer
+// entirely when that content is already stored: begin() reports the
+// whole payload as received and commit() only adds a reference.
+class InstallSession {
+public:
+    InstallSession() = default;
+    ~InstallSession();
+
+    // digest (SHA-256 of the bytes to be uploaded) may be nullptr
+    bool begin(const char* payload_id, size_t total_size,
+               const uint8_t* digest, size_t* resume_offset);
+    bool write(size_t offset, const uint8_t* data, size_t length);
+    bool writeManifest(const uint8_t* manifest, size_t length);
+    bool commit();
+    void abort();
+
+    bool isActive() const { return active_; }
+    bool isLinked() const { return linked_; }
+    bool isFor(const char* payload_id) const;
+    const char* payloadId() const { return payload_id_; }
+    size_t received() const { return received_; }
+    size_t totalSize() const { return total_size_; }
+    int64_t lastUsed() const { return last_used_us_; }
+
+private:
+    InstallSession(const InstallSession&) = delete;
+    InstallSession& operator=(const InstallSession&) = delete;
+
+    bool checkpoint();
+    bool publishManifest();
+    void discardManifest();
+    bool rehash(size_t length);
+    bool close();
+    void closeBlob();
+
+    char payload_id_[MAX_PAYLOAD_ID_LEN] = {};
+    bool active_ = false;
+    bool to_blob_ = false;
+    bool linked_ = false;
+    bool has_digest_ = false;
+    bool has_manifest_ = false;
+    uint8_t digest_[PAYLOAD_DIGEST_SIZE] = {};
+    mbedtls_sha256_context sha_;
+    BlobExtent extent_ = {};
+    StorageFile part_;
+    size_t total_size_ = 0;
+    size_t received_ = 0;
+    size_t checkpointed_ = 0;
+    int64_t last_used_us_ = 0;
+};
+
+#endif // INSTALL_SESSION_H
@@ -0,0 +1,47 @@
+#include "littlefs_backend.h"
+#include "esp_littlefs.h"
+#include "esp_log.h"
+
+static const char* TAG = "LittleFsBackend";
+
+bool LittleFsBackend::mount(const char* base_path, const char* partition_label, int max_files) {
+    // LittleFS keeps no global open-file table, so max_files does not apply
+    (void)max_files;
+
+    esp_vfs_littlefs_conf_t conf = {};
+    conf.base_path = base_path;
+    conf.partition_label = partition_label;
+    conf.format_if_mount_failed = true;
+    conf.dont_mount = false;
+
+    esp_err_t ret = esp_vfs_littlefs_register(&conf);
+    if (ret != ESP_OK) {
+        if (ret == ESP_FAIL) {
+            ESP_LOGE(TAG, "Failed to mount or format filesystem");
+        } else if (ret == ESP_ERR_NOT_FOUND) {
+            ESP_LOGE(TAG, "Failed to find LittleFS partition");
+        } else {
+            ESP_LOGE(TAG, "Failed to initialize LittleFS: %s", esp_err_to_name(ret));
+        }
+        return false;
+    }
+
+    label_ = partition_label;
+    return true;
+}
+
+void LittleFsBackend::unmount() {
+    if (label_) {
+        esp_vfs_littlefs_unregister(label_);
+        label_ = nullptr;
+    }
+}
+
+bool LittleFsBackend::getInfo(size_t* total, size_t* used) {
+    esp_err_t ret = esp_littlefs_info(label_, total, used);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get LittleFS partition info: %s", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
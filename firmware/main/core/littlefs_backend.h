@@ -0,0 +1,23 @@
+#ifndef LITTLEFS_BACKEND_H
+#define LITTLEFS_BACKEND_H
+
+#include "fs_backend.h"
+#include "sdkconfig.h"
+
+// Power-loss safe, with real directories and wear levelling; metadata
+// lookups do not slow down with the number of files the way SPIFFS does
+class LittleFsBackend : public FsBackend {
+public:
+    const char* name() const override { return "LittleFS"; }
+    bool mount(const char* base_path, const char* partition_label, int max_files) override;
+    void unmount() override;
+    bool getInfo(size_t* total, size_t* used) override;
+    bool hasDirectories() const override { return true; }
+    bool renameReplaces() const override { return true; }
+    size_t ioBlockSize() const override { return CONFIG_LITTLEFS_PAGE_SIZE; }
+
+private:
+    const char* label_ = nullptr;
+};
+
+#endif // LITTLEFS_BACKEND_H
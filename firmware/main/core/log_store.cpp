@@ -0,0 +1,524 @@
+#include "log_store.h"
+#include "payload_arena.h"
+#include "../include/payload_api.h"
+#include "../include/deferred_log.h"
+#include "esp_cpu.h"
+#include "spi_flash_mmap.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* TAG = "LogStore";
+
+static const uint32_t SECTOR_SIZE = SPI_FLASH_SEC_SIZE;
+static const uint16_t LOG_END = 0xFFFF;
+
+bool LogStore::initialize() {
+    partition_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                          (esp_partition_subtype_t)LOG_PARTITION_SUBTYPE,
+                                          LOG_PARTITION_LABEL);
+    if (!partition_) {
+        ESP_LOGE(TAG, "Log partition not found");
+        return false;
+    }
+
+    flash_lock_ = xSemaphoreCreateMutex();
+    if (!flash_lock_ || !recover()) {
+        return false;
+    }
+
+    if (xTaskCreate(flushTask, "log_flush", 3072, this, 1, &flush_task_) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create flush task");
+        return false;
+    }
+
+    // Everything logged from here on is captured; UART output is unchanged
+    previous_vprintf_ = esp_log_set_vprintf(&LogStore::logVprintf);
+
+    ESP_LOGI(TAG, "Log store: %u KB flash, next record %u",
+             (unsigned)(partition_->size / 1024), (unsigned)next_seq_);
+#if CONFIG_DEZERO_LOG_BENCHMARK
+    benchmark();
+#endif
+    return true;
+}
+
+void LogStore::append(esp_log_level_t level, const void* data, size_t length, uint8_t flags) {
+    if (length > MAX_TEXT) {
+        length = MAX_TEXT;
+    }
+
+    LogRecordHeader header;
+    header.length = (uint16_t)length;
+    header.level = (uint8_t)level;
+    header.time_ms = esp_log_timestamp();
+    size_t record_size = sizeof(header) + length;
+
+    // Only copies under the lock: a full ring drops the line rather than
+    // making the caller wait for flash
+    bool wake = false;
+    portENTER_CRITICAL(&lock_);
+    if (ring_used_ + record_size > RING_SIZE) {
+        dropped_++;
+        portEXIT_CRITICAL(&lock_);
+        return;
+    }
+    header.seq = next_seq_++;
+    header.flags = flags | (boot_marked_ ? 0 : LOG_FLAG_BOOT);
+    boot_marked_ = true;
+
+    size_t tail = (ring_head_ + ring_used_) % RING_SIZE;
+    const uint8_t* parts[2] = { (const uint8_t*)&header, (const uint8_t*)data };
+    size_t sizes[2] = { sizeof(header), length };
+    for (int p = 0; p < 2; p++) {
+        size_t first = RING_SIZE - tail < sizes[p] ? RING_SIZE - tail : sizes[p];
+        memcpy(ring_ + tail, parts[p], first);
+        memcpy(ring_, parts[p] + first, sizes[p] - first);
+        tail = (tail + sizes[p]) % RING_SIZE;
+    }
+    wake = ring_used_ < PAGE_SIZE && ring_used_ + record_size >= PAGE_SIZE;
+    ring_used_ += record_size;
+    portEXIT_CRITICAL(&lock_);
+
+    // The flush task is only woken once per page's worth of records
+    if (wake && flush_task_) {
+        xTaskNotifyGive(flush_task_);
+    }
+}
+
+void LogStore::flush() {
+    if (!partition_) {
+        return;
+    }
+    xSemaphoreTake(flash_lock_, portMAX_DELAY);
+    while (writePage()) {
+    }
+    xSemaphoreGive(flash_lock_);
+}
+
+size_t LogStore::read(uint32_t cursor, uint8_t* out, size_t capacity, uint32_t* next_cursor) {
+    size_t used = 0;
+    uint32_t next = cursor;
+
+    if (!partition_ || !out) {
+        if (next_cursor) *next_cursor = next;
+        return 0;
+    }
+
+    xSemaphoreTake(flash_lock_, portMAX_DELAY);
+
+    // Walk the flash circle from the oldest sector up to the write
+    // position, skipping whole sectors that end before the cursor
+    uint32_t size = partition_->size;
+    uint32_t sectors = size / SECTOR_SIZE;
+    uint32_t current = write_offset_ / SECTOR_SIZE;
+    uint32_t first_sector = (write_offset_ % SECTOR_SIZE == 0) ? current : (current + 1) % sectors;
+    bool full = false;
+
+    for (uint32_t i = 0; i < sectors && !full; i++) {
+        uint32_t sector = (first_sector + i) % sectors;
+        bool empty;
+        sectorFirstSeq(sector, &empty);
+        if (empty) {
+            continue;
+        }
+        if (i + 1 < sectors) {
+            uint32_t next_first = sectorFirstSeq((sector + 1) % sectors, &empty);
+            if (!empty && (int32_t)(next_first - cursor) <= 0) {
+                continue;
+            }
+        }
+
+        for (uint32_t page = 0; page < SECTOR_SIZE / PAGE_SIZE; page++) {
+            uint32_t offset = sector * SECTOR_SIZE + page * PAGE_SIZE;
+            if (offset == write_offset_ && (i > 0 || page > 0)) {
+                break;
+            }
+            if (!readPageRecords(offset, cursor, out, capacity, used, next)) {
+                full = true;
+                break;
+            }
+        }
+    }
+
+    // Then the records still waiting in RAM, which are all newer
+    if (!full) {
+        portENTER_CRITICAL(&lock_);
+        size_t pos = ring_head_;
+        size_t remaining = ring_used_;
+        while (remaining >= sizeof(LogRecordHeader)) {
+            LogRecordHeader header;
+            ringCopy(pos, &header, sizeof(header));
+            size_t record_size = sizeof(header) + header.length;
+            if ((int32_t)(header.seq - cursor) >= 0) {
+                if (used + record_size > capacity) {
+                    break;
+                }
+                ringCopy(pos, out + used, record_size);
+                used += record_size;
+                next = header.seq + 1;
+            }
+            pos = (pos + record_size) % RING_SIZE;
+            remaining -= record_size;
+        }
+        portEXIT_CRITICAL(&lock_);
+    }
+
+    xSemaphoreGive(flash_lock_);
+
+    if (next_cursor) *next_cursor = next;
+    return used;
+}
+
+uint32_t LogStore::getFirstSeq() {
+    if (!partition_) {
+        return 0;
+    }
+
+    xSemaphoreTake(flash_lock_, portMAX_DELAY);
+    uint32_t sectors = partition_->size / SECTOR_SIZE;
+    uint32_t current = write_offset_ / SECTOR_SIZE;
+    uint32_t first = next_seq_;
+    for (uint32_t i = 0; i < sectors; i++) {
+        uint32_t sector = (current + 1 + i) % sectors;
+        bool empty;
+        uint32_t seq = sectorFirstSeq(sector, &empty);
+        if (!empty) {
+            first = seq;
+            break;
+        }
+    }
+    xSemaphoreGive(flash_lock_);
+    return first;
+}
+
+int LogStore::logVprintf(const char* format, va_list args) {
+    auto& store = getInstance();
+
+    va_list copy;
+    va_copy(copy, args);
+    char line[MAX_TEXT + 32];
+    int n = vsnprintf(line, sizeof(line), format, copy);
+    va_end(copy);
+
+    int ret = store.previous_vprintf_ ? store.previous_vprintf_(format, args) : vprintf(format, args);
+    if (n <= 0) {
+        return ret;
+    }
+
+    // "\033[0;31mE (1234) TAG: text\033[0m\n" -> level E, "TAG: text"
+    size_t length = (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1;
+    const char* text = line;
+    if (text[0] == '\033') {
+        const char* m = strchr(text, 'm');
+        text = m ? m + 1 : text;
+    }
+
+    esp_log_level_t level = ESP_LOG_INFO;
+    switch (text[0]) {
+        case 'E': level = ESP_LOG_ERROR; break;
+        case 'W': level = ESP_LOG_WARN; break;
+        case 'I': level = ESP_LOG_INFO; break;
+        case 'D': level = ESP_LOG_DEBUG; break;
+        case 'V': level = ESP_LOG_VERBOSE; break;
+        default: break;
+    }
+    if (text[0] && text[1] == ' ' && text[2] == '(') {
+        const char* close = strstr(text, ") ");
+        if (close) {
+            text = close + 2;
+        }
+    }
+
+    const char* end = line + length;
+    while (end > text && (end[-1] == '\n' || end[-1] == '\r')) {
+        end--;
+    }
+    if (end - text >= 4 && memcmp(end - 4, "\033[0m", 4) == 0) {
+        end -= 4;
+    }
+    if (end > text) {
+        store.append(level, text, end - text);
+    }
+    return ret;
+}
+
+void LogStore::flushTask(void* arg) {
+    LogStore* store = (LogStore*)arg;
+
+    while (true) {
+        // Woken per page's worth of records; after an idle delay, whatever
+        // is pending is written even if it leaves the page part empty
+        bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FLUSH_DELAY_MS)) > 0;
+
+        xSemaphoreTake(store->flash_lock_, portMAX_DELAY);
+        while (true) {
+            portENTER_CRITICAL(&store->lock_);
+            size_t pending = store->ring_used_;
+            portEXIT_CRITICAL(&store->lock_);
+            if (pending == 0 || (woken && pending < PAGE_SIZE) || !store->writePage()) {
+                break;
+            }
+        }
+        xSemaphoreGive(store->flash_lock_);
+    }
+}
+
+#if CONFIG_DEZERO_LOG_BENCHMARK
+// Cycles per call for the same line formatted through ESP_LOG and stored
+// deferred. UART output is muted for the text path so both only measure
+// what the caller pays to get the line into the store.
+void LogStore::benchmark() {
+    static const int CALLS = 32;
+    const char* ssid = "DeZer0-Bench";
+
+    flush();
+    vprintf_like_t uart = previous_vprintf_;
+    previous_vprintf_ = [](const char*, va_list) { return 0; };
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < CALLS; i++) {
+        ESP_LOGI(TAG, "SSID: %s, RSSI: %d, Channel: %d", ssid, -40 - i, i % 13 + 1);
+    }
+    uint32_t text_cycles = (esp_cpu_get_cycle_count() - start) / CALLS;
+    previous_vprintf_ = uart;
+
+    flush();
+    start = esp_cpu_get_cycle_count();
+    for (int i = 0; i < CALLS; i++) {
+        DEFERRED_LOG(ESP_LOG_INFO, TAG, "SSID: %s, RSSI: %d, Channel: %d", ssid, -40 - i, i % 13 + 1);
+    }
+    uint32_t deferred_cycles = (esp_cpu_get_cycle_count() - start) / CALLS;
+    flush();
+
+    ESP_LOGI(TAG, "Cycles per log call: text %u, deferred %u",
+             (unsigned)text_cycles, (unsigned)deferred_cycles);
+}
+#endif
+
+bool LogStore::recover() {
+    uint32_t sectors = partition_->size / SECTOR_SIZE;
+    bool found = false;
+    bool garbage = false;
+    uint32_t newest = 0;
+    uint32_t newest_seq = 0;
+
+    for (uint32_t sector = 0; sector < sectors; sector++) {
+        LogRecordHeader header;
+        if (esp_partition_read(partition_, sector * SECTOR_SIZE, &header, sizeof(header)) != ESP_OK) {
+            return false;
+        }
+        if (header.length == LOG_END) {
+            continue;
+        }
+        if (header.length > MAX_TEXT) {
+            garbage = true;
+            continue;
+        }
+        if (!found || (int32_t)(header.seq - newest_seq) > 0) {
+            newest = sector;
+            newest_seq = header.seq;
+            found = true;
+        }
+    }
+
+    // A partition that was never used holds whatever was in flash before
+    if (!found) {
+        if (garbage) {
+            ESP_LOGW(TAG, "Erasing uninitialized log partition");
+            if (esp_partition_erase_range(partition_, 0, partition_->size) != ESP_OK) {
+                return false;
+            }
+        }
+        write_offset_ = 0;
+        next_seq_ = 0;
+        return true;
+    }
+
+    // Resume after the last programmed page of the newest sector
+    next_seq_ = newest_seq;
+    write_offset_ = ((newest + 1) % sectors) * SECTOR_SIZE;
+    for (uint32_t page = 0; page < SECTOR_SIZE / PAGE_SIZE; page++) {
+        uint32_t offset = newest * SECTOR_SIZE + page * PAGE_SIZE;
+        uint8_t buf[PAGE_SIZE];
+        if (esp_partition_read(partition_, offset, buf, sizeof(buf)) != ESP_OK) {
+            return false;
+        }
+
+        LogRecordHeader header;
+        memcpy(&header, buf, sizeof(header));
+        if (header.length == LOG_END) {
+            write_offset_ = offset;
+            break;
+        }
+        for (size_t pos = 0; pos + sizeof(header) <= PAGE_SIZE;) {
+            memcpy(&header, buf + pos, sizeof(header));
+            if (header.length == LOG_END || header.length > MAX_TEXT) {
+                break;
+            }
+            next_seq_ = header.seq + 1;
+            pos += sizeof(header) + header.length;
+        }
+    }
+    return true;
+}
+
+bool LogStore::writePage() {
+    uint8_t page[PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+
+    portENTER_CRITICAL(&lock_);
+    size_t head = ring_head_;
+    size_t available = ring_used_;
+    portEXIT_CRITICAL(&lock_);
+
+    // Records are only ever appended past the tail, so the unflushed ones
+    // can be copied out without holding the lock
+    size_t used = 0;
+    while (available - used >= sizeof(LogRecordHeader)) {
+        LogRecordHeader header;
+        ringCopy((head + used) % RING_SIZE, &header, sizeof(header));
+        size_t record_size = sizeof(header) + header.length;
+        if (used + record_size > PAGE_SIZE) {
+            break;
+        }
+        ringCopy((head + used) % RING_SIZE, page + used, record_size);
+        used += record_size;
+    }
+    if (used == 0) {
+        return false;
+    }
+
+    // The oldest sector is erased when the writer wraps onto it
+    esp_err_t ret = ESP_OK;
+    if (write_offset_ % SECTOR_SIZE == 0) {
+        ret = esp_partition_erase_range(partition_, write_offset_, SECTOR_SIZE);
+    }
+    if (ret == ESP_OK) {
+        ret = esp_partition_write(partition_, write_offset_, page, sizeof(page));
+    }
+
+    // A failed page is dropped rather than retried forever
+    portENTER_CRITICAL(&lock_);
+    ring_head_ = (ring_head_ + used) % RING_SIZE;
+    ring_used_ -= used;
+    portEXIT_CRITICAL(&lock_);
+
+    write_offset_ = (write_offset_ + PAGE_SIZE) % partition_->size;
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write log page: %s", esp_err_to_name(ret));
+    }
+    return true;
+}
+
+bool LogStore::readPageRecords(uint32_t page, uint32_t cursor, uint8_t* out, size_t capacity,
+                               size_t& used, uint32_t& next) {
+    uint8_t buf[PAGE_SIZE];
+    if (esp_partition_read(partition_, page, buf, sizeof(buf)) != ESP_OK) {
+        return true;
+    }
+
+    for (size_t pos = 0; pos + sizeof(LogRecordHeader) <= PAGE_SIZE;) {
+        LogRecordHeader header;
+        memcpy(&header, buf + pos, sizeof(header));
+        size_t record_size = sizeof(header) + header.length;
+        if (header.length == LOG_END || header.length > MAX_TEXT || pos + record_size > PAGE_SIZE) {
+            break;
+        }
+        if ((int32_t)(header.seq - cursor) >= 0) {
+            if (used + record_size > capacity) {
+                return false;
+            }
+            memcpy(out + used, buf + pos, record_size);
+            used += record_size;
+            next = header.seq + 1;
+        }
+        pos += record_size;
+    }
+    return true;
+}
+
+uint32_t LogStore::sectorFirstSeq(uint32_t sector, bool* empty) {
+    LogRecordHeader header;
+    if (esp_partition_read(partition_, sector * SECTOR_SIZE, &header, sizeof(header)) != ESP_OK ||
+        header.length == LOG_END || header.length > MAX_TEXT) {
+        *empty = true;
+        return 0;
+    }
+    *empty = false;
+    return header.seq;
+}
+
+void LogStore::ringCopy(size_t pos, void* dst, size_t length) {
+    size_t first = RING_SIZE - pos < length ? RING_SIZE - pos : length;
+    memcpy(dst, ring_ + pos, first);
+    memcpy((uint8_t*)dst + first, ring_, length - first);
+}
+
+// ============================================================================
+// Payload API logging functions
+// ============================================================================
+
+// Payload output goes through ESP_LOG like everything else, tagged with the
+// payload id, so it reaches both UART and the log store
+
+static void payloadLog(esp_log_level_t level, const char* format, va_list args) {
+    PayloadContext* context = (PayloadContext*)pvTaskGetThreadLocalStoragePointer(NULL, PAYLOAD_TLS_INDEX);
+    const char* tag = context ? context->payload_id : "payload";
+
+    char message[128];
+    vsnprintf(message, sizeof(message), format, args);
+    ESP_LOG_LEVEL(level, tag, "%s", message);
+
+    if (context && context->log_callback) {
+        context->log_callback(message);
+    }
+}
+
+void dezero_log_info(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    payloadLog(ESP_LOG_INFO, format, args);
+    va_end(args);
+}
+
+void dezero_log_warn(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    payloadLog(ESP_LOG_WARN, format, args);
+    va_end(args);
+}
+
+void dezero_log_error(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    payloadLog(ESP_LOG_ERROR, format, args);
+    va_end(args);
+}
+
+void dezero_log_debug(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    payloadLog(ESP_LOG_DEBUG, format, args);
+    va_end(args);
+}
+
+void dezero_log_deferred(int level, const uint8_t* record, size_t length) {
+    // Payload records are packed without a tag; the payload id goes in
+    // here, the one place that knows it
+    PayloadContext* context = (PayloadContext*)pvTaskGetThreadLocalStoragePointer(NULL, PAYLOAD_TLS_INDEX);
+    if (!context || length < 5 || record[4] != 0) {
+        LogStore::getInstance().append((esp_log_level_t)level, record, length, LOG_FLAG_DEFERRED);
+        return;
+    }
+
+    uint8_t tagged[DEFERRED_LOG_MAX_RECORD];
+    size_t tag_len = strnlen(context->payload_id, DEFERRED_LOG_MAX_STRING);
+    size_t rest = length - 5;
+    if (5 + tag_len + rest > sizeof(tagged)) {
+        rest = sizeof(tagged) - 5 - tag_len;
+    }
+    memcpy(tagged, record, 4);
+    tagged[4] = (uint8_t)tag_len;
+    memcpy(tagged + 5, context->payload_id, tag_len);
+    memcpy(tagged + 5 + tag_len, record + 5, rest);
+    LogStore::getInstance().append((esp_log_level_t)level, tagged, 5 + tag_len + rest, LOG_FLAG_DEFERRED);
+}
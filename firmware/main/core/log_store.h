@@ -0,0 +1,102 @@
+#ifndef LOG_STORE_H
+#define LOG_STORE_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#define LOG_PARTITION_LABEL "logs"
+#define LOG_PARTITION_SUBTYPE 0x41
+
+#define LOG_FLAG_BOOT 0x01          // First record after a reset
+#define LOG_FLAG_DEFERRED 0x02      // Body is a deferred_log.h record, not text
+
+// Record header as stored in flash and sent to clients; the message text
+// (not NUL-terminated) or deferred record follows it
+struct LogRecordHeader {
+    uint16_t length;                // Text bytes; 0xFFFF marks erased flash
+    uint8_t level;                  // esp_log_level_t
+    uint8_t flags;
+    uint32_t seq;
+    uint32_t time_ms;               // Since boot
+};
+
+// Persistent log of ESP_LOG output and payload log calls.
+//
+// Every log line is captured by an esp_log vprintf hook (which still
+// forwards to UART) and appended as a sequence-numbered record to a RAM
+// ring. Appending only copies under a spinlock and never waits: if the
+// ring is full the line is dropped and counted. A low-priority task packs
+// whole records into 256-byte pages and programs one page at a time into
+// the "logs" partition, either once a page's worth is pending or after a
+// short idle delay. The partition is used as a circle of sectors; the
+// oldest sector is erased when the writer reaches it. Clients read
+// incrementally: read() returns the records from a cursor sequence number
+// on, across flash and the RAM ring, plus the cursor to pass next time.
+class LogStore {
+public:
+    static LogStore& getInstance() {
+        static LogStore instance;
+        return instance;
+    }
+
+    bool initialize();
+
+    void append(esp_log_level_t level, const void* data, size_t length, uint8_t flags = 0);
+    void flush();
+
+    // Copies records with seq >= cursor into out (header + text each) and
+    // returns the bytes written; next_cursor is where the next call starts
+    size_t read(uint32_t cursor, uint8_t* out, size_t capacity, uint32_t* next_cursor);
+
+    uint32_t getFirstSeq();
+    uint32_t getNextSeq() const { return next_seq_; }
+    uint32_t getDropped() const { return dropped_; }
+
+private:
+    LogStore() = default;
+    ~LogStore() = default;
+    LogStore(const LogStore&) = delete;
+    LogStore& operator=(const LogStore&) = delete;
+
+    static constexpr size_t RING_SIZE = 8192;
+    static constexpr size_t PAGE_SIZE = 256;
+    static constexpr size_t MAX_TEXT = 160;
+    static constexpr uint32_t FLUSH_DELAY_MS = 5000;
+
+    static int logVprintf(const char* format, va_list args);
+    static void flushTask(void* arg);
+#if CONFIG_DEZERO_LOG_BENCHMARK
+    void benchmark();
+#endif
+
+    bool recover();
+    bool writePage();
+    bool readPageRecords(uint32_t page, uint32_t cursor, uint8_t* out, size_t capacity,
+                         size_t& used, uint32_t& next);
+    uint32_t sectorFirstSeq(uint32_t sector, bool* empty);
+    void ringCopy(size_t pos, void* dst, size_t length);
+
+    const esp_partition_t* partition_ = nullptr;
+    uint32_t write_offset_ = 0;     // Next page to program in the partition
+    TaskHandle_t flush_task_ = nullptr;
+    SemaphoreHandle_t flash_lock_ = nullptr;
+    vprintf_like_t previous_vprintf_ = nullptr;
+
+    // RAM ring of records not yet in flash
+    uint8_t ring_[RING_SIZE];
+    size_t ring_head_ = 0;          // Oldest unflushed byte
+    size_t ring_used_ = 0;
+    uint32_t next_seq_ = 0;
+    uint32_t dropped_ = 0;
+    bool boot_marked_ = false;
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif // LOG_STORE_H
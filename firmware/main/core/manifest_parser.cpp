@@ -0,0 +1,737 @@
+#include "manifest_parser.h"
+#include "esp_log.h"
+#include <string.h>
+#include <stdlib.h>
+
+static const char* TAG = "ManifestParser";
+
+// ============================================================================
+// Compile-time perfect hashing
+// ============================================================================
+
+namespace {
+
+constexpr uint32_t hashName(uint32_t seed, const char* s, size_t len) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+constexpr size_t constLength(const char* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+struct HashEntry {
+    const char* name;
+    int value;
+};
+
+template <size_t Size>
+struct PerfectHashTable {
+    static_assert((Size & (Size - 1)) == 0, "Table size must be a power of two");
+
+    uint32_t seed;
+    HashEntry slots[Size];
+    bool collision;
+
+    // One hash and one compare per lookup; unknown names fall through
+    int lookup(const char* s, int fallback) const {
+        size_t len = strlen(s);
+        const HashEntry& entry = slots[hashName(seed, s, len) & (Size - 1)];
+        if (entry.name && strcmp(entry.name, s) == 0) {
+            return entry.value;
+        }
+        return fallback;
+    }
+};
+
+template <size_t Size, size_t N>
+constexpr PerfectHashTable<Size> makeTable(uint32_t seed, const HashEntry (&entries)[N]) {
+    PerfectHashTable<Size> table = {};
+    table.seed = seed;
+    for (size_t i = 0; i < N; i++) {
+        size_t slot = hashName(seed, entries[i].name, constLength(entries[i].name)) & (Size - 1);
+        if (table.slots[slot].name) {
+            table.collision = true;
+        }
+        table.slots[slot] = entries[i];
+    }
+    return table;
+}
+
+enum ManifestKey {
+    KEY_UNKNOWN = -1,
+    KEY_ID,
+    KEY_NAME,
+    KEY_VERSION,
+    KEY_AUTHOR,
+    KEY_DESCRIPTION,
+    KEY_CATEGORY,
+    KEY_PAYLOAD,
+    KEY_REQUIREMENTS,
+    KEY_PERMISSIONS,
+    KEY_PARAMETERS,
+    KEY_TYPE,
+    KEY_RUNTIME,
+    KEY_ENTRY,
+    KEY_CHECKSUM,
+    KEY_SIZE,
+    KEY_MIN_FIRMWARE_VERSION,
+    KEY_APIS,
+    KEY_MEMORY_KB,
+    KEY_STORAGE_KB,
+    KEY_LABEL,
+    KEY_REQUIRED,
+    KEY_DEFAULT,
+    KEY_STACK_KB,
+    KEY_PRIORITY
+};
+
+constexpr HashEntry KEY_ENTRIES[] = {
+    {"id", KEY_ID},
+    {"name", KEY_NAME},
+    {"version", KEY_VERSION},
+    {"author", KEY_AUTHOR},
+    {"description", KEY_DESCRIPTION},
+    {"category", KEY_CATEGORY},
+    {"payload", KEY_PAYLOAD},
+    {"requirements", KEY_REQUIREMENTS},
+    {"permissions", KEY_PERMISSIONS},
+    {"parameters", KEY_PARAMETERS},
+    {"type", KEY_TYPE},
+    {"runtime", KEY_RUNTIME},
+    {"entry", KEY_ENTRY},
+    {"checksum", KEY_CHECKSUM},
+    {"size", KEY_SIZE},
+    {"min_firmware_version", KEY_MIN_FIRMWARE_VERSION},
+    {"apis", KEY_APIS},
+    {"memory_kb", KEY_MEMORY_KB},
+    {"storage_kb", KEY_STORAGE_KB},
+    {"label", KEY_LABEL},
+    {"required", KEY_REQUIRED},
+    {"default", KEY_DEFAULT},
+    {"stack_kb", KEY_STACK_KB},
+    {"priority", KEY_PRIORITY},
+};
+
+constexpr HashEntry PAYLOAD_TYPE_ENTRIES[] = {
+    {"native", PAYLOAD_TYPE_NATIVE},
+    {"micropython", PAYLOAD_TYPE_MICROPYTHON},
+    {"lua", PAYLOAD_TYPE_LUA},
+    {"builtin", PAYLOAD_TYPE_BUILTIN},
+};
+
+constexpr HashEntry RUNTIME_ENTRIES[] = {
+    {"native", RUNTIME_NATIVE},
+    {"micropython", RUNTIME_MICROPYTHON},
+    {"lua", RUNTIME_LUA},
+    {"builtin", RUNTIME_BUILTIN},
+};
+
+constexpr HashEntry PRIORITY_ENTRIES[] = {
+    {"low", PAYLOAD_PRIORITY_LOW},
+    {"normal", PAYLOAD_PRIORITY_NORMAL},
+    {"high", PAYLOAD_PRIORITY_HIGH},
+};
+
+constexpr HashEntry PERMISSION_ENTRIES[] = {
+    {"wifi_scan", PERM_WIFI_SCAN},
+    {"wifi_inject", PERM_WIFI_INJECT},
+    {"ble_scan", PERM_BLE_SCAN},
+    {"ble_advertise", PERM_BLE_ADVERTISE},
+    {"gpio_read", PERM_GPIO_READ},
+    {"gpio_write", PERM_GPIO_WRITE},
+    {"display_write", PERM_DISPLAY_WRITE},
+    {"storage_read", PERM_STORAGE_READ},
+    {"storage_write", PERM_STORAGE_WRITE},
+    {"network", PERM_NETWORK},
+};
+
+// Seeds found offline so that every name lands in its own slot
+constexpr auto KEY_TABLE = makeTable<32>(355168, KEY_ENTRIES);
+constexpr auto PAYLOAD_TYPE_TABLE = makeTable<4>(20, PAYLOAD_TYPE_ENTRIES);
+constexpr auto RUNTIME_TABLE = makeTable<4>(20, RUNTIME_ENTRIES);
+constexpr auto PRIORITY_TABLE = makeTable<4>(0, PRIORITY_ENTRIES);
+constexpr auto PERMISSION_TABLE = makeTable<16>(29, PERMISSION_ENTRIES);
+
+static_assert(!KEY_TABLE.collision, "Manifest key table seed is not collision-free");
+static_assert(!PAYLOAD_TYPE_TABLE.collision, "Payload type table seed is not collision-free");
+static_assert(!RUNTIME_TABLE.collision, "Runtime table seed is not collision-free");
+static_assert(!PRIORITY_TABLE.collision, "Priority table seed is not collision-free");
+static_assert(!PERMISSION_TABLE.collision, "Permission table seed is not collision-free");
+
+} // namespace
+
+// ============================================================================
+// ManifestParser
+// ============================================================================
+
+bool ManifestParser::parseFile(const char* path, PayloadManifest& manifest) {
+    // chunk_ is the only buffer; stdio buffering would add a copy
+    StorageFile file;
+    if (!StorageManager::getInstance().openRead(path, file, 0)) {
+        ESP_LOGE(TAG, "Failed to open manifest: %s", path);
+        return false;
+    }
+
+    ManifestParser parser(file);
+    bool ok = parser.parse(manifest);
+    file.close();
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to parse manifest: %s", path);
+    }
+    return ok;
+}
+
+ManifestParser::ManifestParser(StorageFile& file)
+    : file_(file), pos_(0), len_(0), offset_(0) {
+}
+
+bool ManifestParser::parse(PayloadManifest& manifest) {
+    manifest = PayloadManifest();
+    manifest.payload.type = PAYLOAD_TYPE_NATIVE;
+    manifest.payload.runtime = RUNTIME_NATIVE;
+    manifest.payload.size = 0;
+    manifest.requirements.memory_kb = 0;
+    manifest.requirements.storage_kb = 0;
+    manifest.requirements.stack_kb = DEFAULT_PAYLOAD_STACK_KB;
+    manifest.requirements.priority = PAYLOAD_PRIORITY_NORMAL;
+    manifest.permissions = 0;
+
+    return parseRoot(manifest);
+}
+
+// ----------------------------------------------------------------------------
+// Character stream
+// ----------------------------------------------------------------------------
+
+int ManifestParser::peek() {
+    if (pos_ >= len_) {
+        len_ = file_.read(chunk_, CHUNK_SIZE);
+        pos_ = 0;
+        if (len_ == 0) {
+            return EOF;
+        }
+    }
+    return chunk_[pos_];
+}
+
+int ManifestParser::get() {
+    int c = peek();
+    if (c != EOF) {
+        pos_++;
+        offset_++;
+    }
+    return c;
+}
+
+void ManifestParser::skipWhitespace() {
+    int c = peek();
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        get();
+        c = peek();
+    }
+}
+
+bool ManifestParser::expect(char c) {
+    skipWhitespace();
+    if (get() != c) {
+        char what[] = "expected 'x'";
+        what[10] = c;
+        return fail(what);
+    }
+    return true;
+}
+
+bool ManifestParser::fail(const char* what) {
+    ESP_LOGE(TAG, "Parse error at byte %u: %s", (unsigned)offset_, what);
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+// Scalars
+// ----------------------------------------------------------------------------
+
+static int hexValue(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decodes one JSON string. Characters go to `out` (capped at
+// MAX_STRING_LEN), or to the fixed `buf` (truncated), or are discarded
+// when both are null.
+bool ManifestParser::readStringImpl(std::string* out, char* buf, size_t buf_size) {
+    if (!expect('"')) {
+        return false;
+    }
+
+    size_t buf_len = 0;
+    bool truncated = false;
+
+    auto emit = [&](char ch) {
+        if (out) {
+            if (out->size() < MAX_STRING_LEN) {
+                out->push_back(ch);
+            } else {
+                truncated = true;
+            }
+        } else if (buf) {
+            if (buf_len + 1 < buf_size) {
+                buf[buf_len++] = ch;
+            }
+        }
+    };
+
+    while (true) {
+        int c = get();
+        if (c == EOF) {
+            return fail("unterminated string");
+        }
+        if (c == '"') {
+            break;
+        }
+        if (c != '\\') {
+            emit((char)c);
+            continue;
+        }
+
+        c = get();
+        switch (c) {
+            case '"':  emit('"'); break;
+            case '\\': emit('\\'); break;
+            case '/':  emit('/'); break;
+            case 'b':  emit('\b'); break;
+            case 'f':  emit('\f'); break;
+            case 'n':  emit('\n'); break;
+            case 'r':  emit('\r'); break;
+            case 't':  emit('\t'); break;
+            case 'u': {
+                uint32_t cp = 0;
+                for (int i = 0; i < 4; i++) {
+                    int v = hexValue(get());
+                    if (v < 0) {
+                        return fail("bad \\u escape");
+                    }
+                    cp = (cp << 4) | v;
+                }
+                // Encode as UTF-8; lone surrogates become '?'
+                if (cp < 0x80) {
+                    emit((char)cp);
+                } else if (cp < 0x800) {
+                    emit((char)(0xC0 | (cp >> 6)));
+                    emit((char)(0x80 | (cp & 0x3F)));
+                } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+                    emit('?');
+                } else {
+                    emit((char)(0xE0 | (cp >> 12)));
+                    emit((char)(0x80 | ((cp >> 6) & 0x3F)));
+                    emit((char)(0x80 | (cp & 0x3F)));
+                }
+                break;
+            }
+            default:
+                return fail("bad escape");
+        }
+    }
+
+    if (buf && buf_size > 0) {
+        buf[buf_len] = '\0';
+    }
+    if (truncated) {
+        ESP_LOGW(TAG, "String truncated to %u bytes", (unsigned)MAX_STRING_LEN);
+    }
+    return true;
+}
+
+bool ManifestParser::readString(std::string& out) {
+    out.clear();
+    return readStringImpl(&out, nullptr, 0);
+}
+
+bool ManifestParser::readShortString(char* out, size_t out_size) {
+    return readStringImpl(nullptr, out, out_size);
+}
+
+bool ManifestParser::readUint(uint32_t& out) {
+    skipWhitespace();
+
+    // Tolerate numbers written as strings, e.g. "memory_kb": "64"
+    if (peek() == '"') {
+        char text[16];
+        if (!readShortString(text, sizeof(text))) {
+            return false;
+        }
+        out = strtoul(text, nullptr, 10);
+        return true;
+    }
+
+    int c = peek();
+    if (c < '0' || c > '9') {
+        return fail("expected unsigned number");
+    }
+
+    uint64_t value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        if (value > UINT32_MAX) {
+            value = UINT32_MAX;
+        }
+        get();
+        c = peek();
+    }
+
+    // Drop any fraction or exponent
+    while (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-' || (c >= '0' && c <= '9')) {
+        get();
+        c = peek();
+    }
+
+    out = (uint32_t)value;
+    return true;
+}
+
+bool ManifestParser::readBool(bool& out) {
+    std::string text;
+    if (!readScalarText(text)) {
+        return false;
+    }
+    out = (text == "true" || text == "1");
+    return true;
+}
+
+bool ManifestParser::readScalarText(std::string& out) {
+    skipWhitespace();
+    if (peek() == '"') {
+        return readString(out);
+    }
+
+    out.clear();
+    int c = peek();
+    while ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E') {
+        out.push_back((char)get());
+        c = peek();
+    }
+
+    if (out.empty()) {
+        return fail("expected scalar value");
+    }
+    if (out == "null") {
+        out.clear();
+    }
+    return true;
+}
+
+bool ManifestParser::skipValue() {
+    skipWhitespace();
+    int c = peek();
+
+    if (c == '"') {
+        return readStringImpl(nullptr, nullptr, 0);
+    }
+
+    if (c != '{' && c != '[') {
+        std::string ignored;
+        return readScalarText(ignored);
+    }
+
+    // Skip a nested container by bracket depth; strings are skipped whole
+    // so brackets inside them are not counted
+    int depth = 0;
+    do {
+        c = peek();
+        if (c == EOF) {
+            return fail("unterminated container");
+        }
+        if (c == '"') {
+            if (!readStringImpl(nullptr, nullptr, 0)) {
+                return false;
+            }
+            continue;
+        }
+        get();
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        }
+    } while (depth > 0);
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Containers
+// ----------------------------------------------------------------------------
+
+bool ManifestParser::beginObject() {
+    return expect('{');
+}
+
+bool ManifestParser::nextMember(bool& first, int& key_id, bool& done) {
+    skipWhitespace();
+    if (peek() == '}') {
+        get();
+        done = true;
+        return true;
+    }
+
+    if (!first && !expect(',')) {
+        return false;
+    }
+    first = false;
+
+    char key[MAX_KEY_LEN];
+    if (!readShortString(key, sizeof(key)) || !expect(':')) {
+        return false;
+    }
+
+    key_id = KEY_TABLE.lookup(key, KEY_UNKNOWN);
+    done = false;
+    return true;
+}
+
+bool ManifestParser::beginArray() {
+    return expect('[');
+}
+
+bool ManifestParser::nextElement(bool& first, bool& done) {
+    skipWhitespace();
+    if (peek() == ']') {
+        get();
+        done = true;
+        return true;
+    }
+
+    if (!first && !expect(',')) {
+        return false;
+    }
+    first = false;
+    done = false;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// Manifest sections
+// ----------------------------------------------------------------------------
+
+bool ManifestParser::parseRoot(PayloadManifest& manifest) {
+    if (!beginObject()) {
+        return false;
+    }
+
+    bool runtime_set = false;
+    bool first = true;
+    bool done = false;
+    int key;
+
+    while (nextMember(first, key, done) && !done) {
+        bool ok;
+        switch (key) {
+            case KEY_ID:            ok = readString(manifest.id); break;
+            case KEY_NAME:          ok = readString(manifest.name); break;
+            case KEY_VERSION:       ok = readString(manifest.version); break;
+            case KEY_AUTHOR:        ok = readString(manifest.author); break;
+            case KEY_DESCRIPTION:   ok = readString(manifest.description); break;
+            case KEY_CATEGORY:      ok = readString(manifest.category); break;
+            case KEY_PAYLOAD:       ok = parsePayloadInfo(manifest, runtime_set); break;
+            case KEY_REQUIREMENTS:  ok = parseRequirements(manifest); break;
+            case KEY_PERMISSIONS:   ok = parsePermissions(manifest); break;
+            case KEY_PARAMETERS:    ok = parseParameters(manifest); break;
+            default:                ok = skipValue(); break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    if (!done) {
+        return false;
+    }
+
+    // Runtime defaults to the one matching the payload type
+    if (!runtime_set) {
+        manifest.payload.runtime = (runtime_type_t)manifest.payload.type;
+    }
+    return true;
+}
+
+bool ManifestParser::parsePayloadInfo(PayloadManifest& manifest, bool& runtime_set) {
+    if (!beginObject()) {
+        return false;
+    }
+
+    bool first = true;
+    bool done = false;
+    int key;
+    char value[16];
+
+    while (nextMember(first, key, done) && !done) {
+        bool ok = true;
+        switch (key) {
+            case KEY_TYPE: {
+                ok = readShortString(value, sizeof(value));
+                int type = ok ? PAYLOAD_TYPE_TABLE.lookup(value, -1) : -1;
+                if (ok && type < 0) {
+                    return fail("unknown payload type");
+                }
+                manifest.payload.type = (payload_type_t)type;
+                break;
+            }
+            case KEY_RUNTIME: {
+                ok = readShortString(value, sizeof(value));
+                int runtime = ok ? RUNTIME_TABLE.lookup(value, -1) : -1;
+                if (ok && runtime < 0) {
+                    return fail("unknown runtime");
+                }
+                manifest.payload.runtime = (runtime_type_t)runtime;
+                runtime_set = true;
+                break;
+            }
+            case KEY_ENTRY:     ok = readString(manifest.payload.entry); break;
+            case KEY_CHECKSUM:  ok = readString(manifest.payload.checksum); break;
+            case KEY_SIZE: {
+                uint32_t size = 0;
+                ok = readUint(size);
+                manifest.payload.size = size;
+                break;
+            }
+            default:            ok = skipValue(); break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return done;
+}
+
+bool ManifestParser::parseRequirements(PayloadManifest& manifest) {
+    if (!beginObject()) {
+        return false;
+    }
+
+    bool first = true;
+    bool done = false;
+    int key;
+
+    while (nextMember(first, key, done) && !done) {
+        bool ok = true;
+        switch (key) {
+            case KEY_MIN_FIRMWARE_VERSION:
+                ok = readString(manifest.requirements.min_firmware_version);
+                break;
+            case KEY_APIS: {
+                if (!beginArray()) {
+                    return false;
+                }
+                bool first_api = true;
+                bool apis_done = false;
+                while (nextElement(first_api, apis_done) && !apis_done) {
+                    manifest.requirements.apis.emplace_back();
+                    if (!readString(manifest.requirements.apis.back())) {
+                        return false;
+                    }
+                }
+                ok = apis_done;
+                break;
+            }
+            case KEY_MEMORY_KB:     ok = readUint(manifest.requirements.memory_kb); break;
+            case KEY_STORAGE_KB:    ok = readUint(manifest.requirements.storage_kb); break;
+            case KEY_STACK_KB:      ok = readUint(manifest.requirements.stack_kb); break;
+            case KEY_PRIORITY: {
+                char value[16];
+                ok = readShortString(value, sizeof(value));
+                int priority = ok ? PRIORITY_TABLE.lookup(value, -1) : -1;
+                if (ok && priority < 0) {
+                    return fail("unknown priority class");
+                }
+                manifest.requirements.priority = (payload_priority_t)priority;
+                break;
+            }
+            default:                ok = skipValue(); break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return done;
+}
+
+bool ManifestParser::parsePermissions(PayloadManifest& manifest) {
+    if (!beginArray()) {
+        return false;
+    }
+
+    bool first = true;
+    bool done = false;
+    char name[MAX_KEY_LEN];
+
+    while (nextElement(first, done) && !done) {
+        if (!readShortString(name, sizeof(name))) {
+            return false;
+        }
+        int flag = PERMISSION_TABLE.lookup(name, 0);
+        if (flag == 0) {
+            ESP_LOGW(TAG, "Unknown permission: %s", name);
+        }
+        manifest.permissions |= flag;
+    }
+
+    return done;
+}
+
+bool ManifestParser::parseParameters(PayloadManifest& manifest) {
+    if (!beginArray()) {
+        return false;
+    }
+
+    bool first = true;
+    bool done = false;
+
+    while (nextElement(first, done) && !done) {
+        manifest.parameters.emplace_back();
+        if (!parseParameter(manifest.parameters.back())) {
+            return false;
+        }
+    }
+
+    return done;
+}
+
+bool ManifestParser::parseParameter(PayloadManifest::Parameter& param) {
+    if (!beginObject()) {
+        return false;
+    }
+
+    param.required = false;
+
+    bool first = true;
+    bool done = false;
+    int key;
+
+    while (nextMember(first, key, done) && !done) {
+        bool ok;
+        switch (key) {
+            case KEY_NAME:      ok = readString(param.name); break;
+            case KEY_TYPE:      ok = readString(param.type); break;
+            case KEY_LABEL:     ok = readString(param.label); break;
+            case KEY_REQUIRED:  ok = readBool(param.required); break;
+            case KEY_DEFAULT:   ok = readScalarText(param.default_value); break;
+            default:            ok = skipValue(); break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    return done;
+}
@@ -0,0 +1,64 @@
+#ifndef MANIFEST_PARSER_H
+#define MANIFEST_PARSER_H
+
+#include <string>
+#include "../include/types.h"
+#include "storage_manager.h"
+
+// Streaming manifest.json decoder.
+//
+// Reads the file unbuffered, one filesystem block at a time, and fills a
+// PayloadManifest as tokens arrive, so no DOM is built and the manifest
+// size is not bounded by any buffer. Keys and enum strings (payload type,
+// runtime, permissions) are resolved through compile-time perfect-hash
+// tables instead of strcmp chains.
+class ManifestParser {
+public:
+    static bool parseFile(const char* path, PayloadManifest& manifest);
+
+    explicit ManifestParser(StorageFile& file);
+    bool parse(PayloadManifest& manifest);
+
+private:
+    static constexpr size_t CHUNK_SIZE = 256;
+    static constexpr size_t MAX_KEY_LEN = 32;
+    static constexpr size_t MAX_STRING_LEN = 1024;
+
+    // Character stream
+    int peek();
+    int get();
+    void skipWhitespace();
+    bool expect(char c);
+    bool fail(const char* what);
+
+    // Scalars
+    bool readStringImpl(std::string* out, char* buf, size_t buf_size);
+    bool readString(std::string& out);
+    bool readShortString(char* out, size_t out_size);
+    bool readUint(uint32_t& out);
+    bool readBool(bool& out);
+    bool readScalarText(std::string& out);
+    bool skipValue();
+
+    // Containers
+    bool beginObject();
+    bool nextMember(bool& first, int& key_id, bool& done);
+    bool beginArray();
+    bool nextElement(bool& first, bool& done);
+
+    // Manifest sections
+    bool parseRoot(PayloadManifest& manifest);
+    bool parsePayloadInfo(PayloadManifest& manifest, bool& runtime_set);
+    bool parseRequirements(PayloadManifest& manifest);
+    bool parsePermissions(PayloadManifest& manifest);
+    bool parseParameters(PayloadManifest& manifest);
+    bool parseParameter(PayloadManifest::Parameter& param);
+
+    StorageFile& file_;
+    uint8_t chunk_[CHUNK_SIZE];
+    size_t pos_;
+    size_t len_;
+    size_t offset_;
+};
+
+#endif // MANIFEST_PARSER_H
@@ -0,0 +1,242 @@
+#include "payload_arena.h"
+#include "payload_supervisor.h"
+#include "payload_api.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "PayloadArena";
+
+// The limit is enforced by accounting the usable size of each block, so
+// the region also needs room for the multi_heap control structure and a
+// header per block. Runtime heaps are mostly small objects; the region is
+// sized for a limit's worth of blocks of ARENA_EXPECTED_BLOCK_BYTES.
+static const size_t ARENA_CONTROL_BYTES = 4096;
+static const size_t ARENA_BLOCK_HEADER_BYTES = 8;   // Header plus alignment
+static const size_t ARENA_EXPECTED_BLOCK_BYTES = 32;
+
+static size_t regionSizeFor(size_t limit) {
+    size_t blocks = (limit + ARENA_EXPECTED_BLOCK_BYTES - 1) / ARENA_EXPECTED_BLOCK_BYTES;
+    return limit + ARENA_CONTROL_BYTES + blocks * ARENA_BLOCK_HEADER_BYTES;
+}
+
+PayloadArena::~PayloadArena() {
+    destroy();
+}
+
+bool PayloadArena::create(PayloadContext* context, size_t limit) {
+    destroy();
+
+    region_size_ = regionSizeFor(limit);
+    region_ = (uint8_t*)heap_caps_malloc(region_size_, MALLOC_CAP_8BIT);
+    if (!region_) {
+        ESP_LOGE(TAG, "Failed to reserve %u byte arena", (unsigned)region_size_);
+        region_size_ = 0;
+        return false;
+    }
+
+    context_ = context;
+    limit_ = limit;
+    reset();
+
+    if (!heap_) {
+        ESP_LOGE(TAG, "Failed to initialize arena heap");
+        destroy();
+        return false;
+    }
+
+    return true;
+}
+
+void PayloadArena::destroy() {
+    if (region_) {
+        heap_caps_free(region_);
+    }
+    region_ = nullptr;
+    region_size_ = 0;
+    heap_ = nullptr;
+    context_ = nullptr;
+    used_ = 0;
+    peak_ = 0;
+    region_failures_ = 0;
+}
+
+void PayloadArena::reset() {
+    if (!region_) {
+        return;
+    }
+
+    // Re-registering the region discards every block in one step
+    heap_ = multi_heap_register(region_, region_size_);
+
+    // Slots are reused, so the high-water mark starts over with each run
+    portENTER_CRITICAL(&lock_);
+    used_ = 0;
+    peak_ = 0;
+    region_failures_ = 0;
+    portEXIT_CRITICAL(&lock_);
+
+    if (context_) {
+        context_->memory_allocated = 0;
+        context_->memory_peak = 0;
+    }
+}
+
+void* PayloadArena::alloc(size_t size) {
+    if (!heap_ || !reserve(size)) {
+        return nullptr;
+    }
+
+    void* ptr = multi_heap_malloc(heap_, size);
+    if (!ptr) {
+        regionExhausted(size);
+        return nullptr;
+    }
+
+    size_t actual = multi_heap_get_allocated_size(heap_, ptr);
+    if (used_ + actual > limit_) {
+        multi_heap_free(heap_, ptr);
+        breach(size);
+        return nullptr;
+    }
+
+    account(0, actual);
+    return ptr;
+}
+
+void* PayloadArena::calloc(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return nullptr;
+    }
+
+    void* ptr = alloc(count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void* PayloadArena::realloc(void* ptr, size_t size) {
+    if (!ptr) {
+        return alloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return nullptr;
+    }
+    if (!heap_) {
+        return nullptr;
+    }
+
+    size_t old_actual = multi_heap_get_allocated_size(heap_, ptr);
+    if (size > old_actual && !reserve(size - old_actual)) {
+        return nullptr;
+    }
+
+    void* new_ptr = multi_heap_realloc(heap_, ptr, size);
+    if (!new_ptr) {
+        regionExhausted(size);
+        return nullptr;
+    }
+
+    account(old_actual, multi_heap_get_allocated_size(heap_, new_ptr));
+    return new_ptr;
+}
+
+void PayloadArena::free(void* ptr) {
+    if (!ptr || !heap_) {
+        return;
+    }
+
+    size_t actual = multi_heap_get_allocated_size(heap_, ptr);
+    multi_heap_free(heap_, ptr);
+    account(actual, 0);
+}
+
+bool PayloadArena::contains(const void* ptr) const {
+    return region_ && (const uint8_t*)ptr >= region_ && (const uint8_t*)ptr < region_ + region_size_;
+}
+
+PayloadArena* PayloadArena::current() {
+    PayloadContext* context = (PayloadContext*)pvTaskGetThreadLocalStoragePointer(NULL, PAYLOAD_TLS_INDEX);
+    return context ? context->arena : nullptr;
+}
+
+bool PayloadArena::reserve(size_t size) {
+    if (used_ + size > limit_) {
+        breach(size);
+        return false;
+    }
+    return true;
+}
+
+void PayloadArena::account(size_t freed, size_t allocated) {
+    portENTER_CRITICAL(&lock_);
+    used_ = used_ - freed + allocated;
+    if (used_ > peak_) {
+        peak_ = used_;
+    }
+    size_t used = used_;
+    size_t peak = peak_;
+    portEXIT_CRITICAL(&lock_);
+
+    if (context_) {
+        context_->memory_allocated = used;
+        context_->memory_peak = peak;
+    }
+}
+
+void PayloadArena::breach(size_t requested) {
+    ESP_LOGW(TAG, "Allocation of %u bytes exceeds limit (%u/%u used)",
+             (unsigned)requested, (unsigned)used_, (unsigned)limit_);
+    if (context_) {
+        PayloadSupervisor::getInstance().notifyMemoryExceeded(context_);
+    }
+}
+
+// Within the limit but no block fits, from fragmentation or blocks smaller
+// than the region was sized for. The allocation fails like any malloc
+// would; the payload is not over its limit, so it is not stopped for it.
+void PayloadArena::regionExhausted(size_t requested) {
+    portENTER_CRITICAL(&lock_);
+    region_failures_++;
+    portEXIT_CRITICAL(&lock_);
+    ESP_LOGW(TAG, "Arena region exhausted allocating %u bytes (%u/%u used, %u free)",
+             (unsigned)requested, (unsigned)used_, (unsigned)limit_,
+             (unsigned)multi_heap_free_size(heap_));
+}
+
+// ============================================================================
+// Payload API memory functions
+// ============================================================================
+
+// Payload tasks allocate from their arena; system tasks fall back to the heap
+
+void* dezero_malloc(size_t size) {
+    PayloadArena* arena = PayloadArena::current();
+    return arena ? arena->alloc(size) : malloc(size);
+}
+
+void* dezero_calloc(size_t count, size_t size) {
+    PayloadArena* arena = PayloadArena::current();
+    return arena ? arena->calloc(count, size) : ::calloc(count, size);
+}
+
+void* dezero_realloc(void* ptr, size_t size) {
+    PayloadArena* arena = PayloadArena::current();
+    if (arena && (!ptr || arena->contains(ptr))) {
+        return arena->realloc(ptr, size);
+    }
+    return ::realloc(ptr, size);
+}
+
+void dezero_free(void* ptr) {
+    PayloadArena* arena = PayloadArena::current();
+    if (arena && arena->contains(ptr)) {
+        arena->free(ptr);
+    } else {
+        ::free(ptr);
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef PAYLOAD_ARENA_H
+#define PAYLOAD_ARENA_H
+
+#include <stddef.h>
+#include "multi_heap.h"
+#include "freertos/FreeRTOS.h"
+#include "../include/types.h"
+
+// Thread-local storage slot holding the PayloadContext of a payload task
+#define PAYLOAD_TLS_INDEX 1
+
+// Private heap for one payload run.
+//
+// The whole arena is a single block taken from the system heap when the
+// payload starts and returned when it ends, so payload allocations never
+// interleave with (and fragment) the system heap. Inside, a multi_heap
+// instance serves malloc/free/realloc. Usage is accounted exactly against
+// the payload's memory limit; a request that would exceed it fails and is
+// reported to the supervisor. A request within the limit that the region
+// cannot place fails without a report and is counted in regionFailures().
+class PayloadArena {
+public:
+    PayloadArena() = default;
+    ~PayloadArena();
+
+    bool create(PayloadContext* context, size_t limit);
+    void destroy();
+
+    // Drops every allocation at once; O(1), no per-block frees
+    void reset();
+
+    void* alloc(size_t size);
+    void* calloc(size_t count, size_t size);
+    void* realloc(void* ptr, size_t size);
+    void free(void* ptr);
+    bool contains(const void* ptr) const;
+
+    size_t used() const { return used_; }
+    size_t peak() const { return peak_; }
+    size_t limit() const { return limit_; }
+    size_t regionSize() const { return region_size_; }
+    uint32_t regionFailures() const { return region_failures_; }
+
+    // Arena of the payload task calling this, or nullptr from system tasks
+    static PayloadArena* current();
+
+private:
+    PayloadArena(const PayloadArena&) = delete;
+    PayloadArena& operator=(const PayloadArena&) = delete;
+
+    bool reserve(size_t size);
+    void account(size_t freed, size_t allocated);
+    void breach(size_t requested);
+    void regionExhausted(size_t requested);
+
+    PayloadContext* context_ = nullptr;
+    uint8_t* region_ = nullptr;
+    size_t region_size_ = 0;
+    multi_heap_handle_t heap_ = nullptr;
+    size_t limit_ = 0;
+    size_t used_ = 0;
+    size_t peak_ = 0;
+    uint32_t region_failures_ = 0;
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif // PAYLOAD_ARENA_H
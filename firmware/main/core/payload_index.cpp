@@ -0,0 +1,276 @@
+#include "payload_index.h"
+#include "storage_manager.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+static const char* TAG = "PayloadIndex";
+
+static const uint32_t INDEX_MAGIC = 0x58505A44;  // "DZPX"
+static const uint16_t INDEX_VERSION = 3;  // v3: stack_kb and priority
+
+struct IndexHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t body_crc;
+};
+
+// ============================================================================
+// Encoding helpers (little-endian, native layout on ESP32)
+// ============================================================================
+
+static void putBytes(std::vector<uint8_t>& out, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    out.insert(out.end(), p, p + len);
+}
+
+template <typename T>
+static void putValue(std::vector<uint8_t>& out, T value) {
+    putBytes(out, &value, sizeof(value));
+}
+
+static void putString(std::vector<uint8_t>& out, const std::string& str) {
+    uint16_t len = str.size() > 0xFFFF ? 0xFFFF : (uint16_t)str.size();
+    putValue(out, len);
+    putBytes(out, str.data(), len);
+}
+
+template <typename T>
+static bool getValue(const uint8_t*& data, const uint8_t* end, T& value) {
+    if ((size_t)(end - data) < sizeof(T)) return false;
+    memcpy(&value, data, sizeof(T));
+    data += sizeof(T);
+    return true;
+}
+
+static bool getString(const uint8_t*& data, const uint8_t* end, std::string& str) {
+    uint16_t len;
+    if (!getValue(data, end, len)) return false;
+    if ((size_t)(end - data) < len) return false;
+    str.assign((const char*)data, len);
+    data += len;
+    return true;
+}
+
+// ============================================================================
+// PayloadIndex
+// ============================================================================
+
+bool PayloadIndex::load() {
+    entries_.clear();
+    dirty_ = false;
+
+    auto& storage = StorageManager::getInstance();
+    size_t file_size = 0;
+    if (!storage.getFileInfo(PAYLOAD_INDEX_PATH, &file_size, nullptr)) {
+        ESP_LOGI(TAG, "No payload index found");
+        return false;
+    }
+
+    if (file_size < sizeof(IndexHeader)) {
+        ESP_LOGW(TAG, "Payload index truncated");
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(file_size);
+    int size = storage.readFile(PAYLOAD_INDEX_PATH, buffer.data(), buffer.size());
+    if (size != (int)file_size) {
+        ESP_LOGE(TAG, "Failed to read payload index");
+        return false;
+    }
+
+    IndexHeader header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (header.magic != INDEX_MAGIC || header.version != INDEX_VERSION) {
+        ESP_LOGW(TAG, "Payload index format mismatch, ignoring");
+        return false;
+    }
+
+    const uint8_t* data = buffer.data() + sizeof(header);
+    const uint8_t* end = buffer.data() + buffer.size();
+
+    if (esp_rom_crc32_le(0, data, end - data) != header.body_crc) {
+        ESP_LOGW(TAG, "Payload index CRC mismatch, ignoring");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        std::string payload_id;
+        PayloadIndexEntry entry;
+        if (!deserialize(data, end, payload_id, entry)) {
+            ESP_LOGW(TAG, "Corrupt payload index entry %lu", (unsigned long)i);
+            entries_.clear();
+            return false;
+        }
+        entries_[payload_id] = std::move(entry);
+    }
+
+    ESP_LOGI(TAG, "Loaded payload index: %d entries", (int)entries_.size());
+    return true;
+}
+
+bool PayloadIndex::save() {
+    std::vector<uint8_t> buffer(sizeof(IndexHeader));
+    for (const auto& pair : entries_) {
+        serialize(pair.first, pair.second, buffer);
+    }
+
+    IndexHeader header = {};
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.count = entries_.size();
+    header.body_crc = esp_rom_crc32_le(0, buffer.data() + sizeof(header), buffer.size() - sizeof(header));
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    // Write to a temp file first so a power loss never leaves a half-written index
+    auto& storage = StorageManager::getInstance();
+    std::string tmp_path = std::string(PAYLOAD_INDEX_PATH) + ".tmp";
+    if (!storage.writeFile(tmp_path.c_str(), buffer.data(), buffer.size())) {
+        ESP_LOGE(TAG, "Failed to write payload index");
+        return false;
+    }
+
+    if (!storage.renameFile(tmp_path.c_str(), PAYLOAD_INDEX_PATH)) {
+        storage.deleteFile(tmp_path.c_str());
+        return false;
+    }
+
+    dirty_ = false;
+    return true;
+}
+
+PayloadIndexEntry* PayloadIndex::find(const std::string& payload_id) {
+    auto it = entries_.find(payload_id);
+    return it != entries_.end() ? &it->second : nullptr;
+}
+
+const PayloadIndexEntry* PayloadIndex::find(const std::string& payload_id) const {
+    auto it = entries_.find(payload_id);
+    return it != entries_.end() ? &it->second : nullptr;
+}
+
+void PayloadIndex::put(const std::string& payload_id, const ManifestStamp& stamp, const PayloadManifest& manifest) {
+    PayloadIndexEntry& entry = entries_[payload_id];
+    entry.stamp = stamp;
+    entry.manifest = manifest;
+    dirty_ = true;
+}
+
+bool PayloadIndex::remove(const std::string& payload_id) {
+    if (entries_.erase(payload_id) == 0) {
+        return false;
+    }
+    dirty_ = true;
+    return true;
+}
+
+void PayloadIndex::clear() {
+    if (!entries_.empty()) {
+        dirty_ = true;
+    }
+    entries_.clear();
+}
+
+void PayloadIndex::serialize(const std::string& payload_id, const PayloadIndexEntry& entry, std::vector<uint8_t>& out) {
+    const PayloadManifest& m = entry.manifest;
+
+    putString(out, payload_id);
+    putValue(out, entry.stamp.mtime);
+    putValue(out, entry.stamp.size);
+
+    putString(out, m.id);
+    putString(out, m.name);
+    putString(out, m.version);
+    putString(out, m.author);
+    putString(out, m.description);
+    putString(out, m.category);
+
+    putValue(out, (uint8_t)m.payload.type);
+    putValue(out, (uint8_t)m.payload.runtime);
+    putString(out, m.payload.entry);
+    putString(out, m.payload.checksum);
+    putValue(out, (uint32_t)m.payload.size);
+
+    putString(out, m.requirements.min_firmware_version);
+    putValue(out, (uint16_t)m.requirements.apis.size());
+    for (const auto& api : m.requirements.apis) {
+        putString(out, api);
+    }
+    putValue(out, m.requirements.memory_kb);
+    putValue(out, m.requirements.storage_kb);
+    putValue(out, m.requirements.stack_kb);
+    putValue(out, (uint8_t)m.requirements.priority);
+
+    putValue(out, m.permissions);
+
+    putValue(out, (uint16_t)m.parameters.size());
+    for (const auto& param : m.parameters) {
+        putString(out, param.name);
+        putString(out, param.type);
+        putString(out, param.label);
+        putValue(out, (uint8_t)param.required);
+        putString(out, param.default_value);
+    }
+}
+
+bool PayloadIndex::deserialize(const uint8_t*& data, const uint8_t* end, std::string& payload_id, PayloadIndexEntry& entry) {
+    PayloadManifest& m = entry.manifest;
+    uint8_t type, runtime, priority, required;
+    uint32_t payload_size;
+    uint16_t count;
+
+    if (!getString(data, end, payload_id) ||
+        !getValue(data, end, entry.stamp.mtime) ||
+        !getValue(data, end, entry.stamp.size) ||
+        !getString(data, end, m.id) ||
+        !getString(data, end, m.name) ||
+        !getString(data, end, m.version) ||
+        !getString(data, end, m.author) ||
+        !getString(data, end, m.description) ||
+        !getString(data, end, m.category) ||
+        !getValue(data, end, type) ||
+        !getValue(data, end, runtime) ||
+        !getString(data, end, m.payload.entry) ||
+        !getString(data, end, m.payload.checksum) ||
+        !getValue(data, end, payload_size) ||
+        !getString(data, end, m.requirements.min_firmware_version) ||
+        !getValue(data, end, count)) {
+        return false;
+    }
+
+    m.payload.type = (payload_type_t)type;
+    m.payload.runtime = (runtime_type_t)runtime;
+    m.payload.size = payload_size;
+
+    m.requirements.apis.resize(count);
+    for (auto& api : m.requirements.apis) {
+        if (!getString(data, end, api)) return false;
+    }
+
+    if (!getValue(data, end, m.requirements.memory_kb) ||
+        !getValue(data, end, m.requirements.storage_kb) ||
+        !getValue(data, end, m.requirements.stack_kb) ||
+        !getValue(data, end, priority) ||
+        !getValue(data, end, m.permissions) ||
+        !getValue(data, end, count)) {
+        return false;
+    }
+
+    m.requirements.priority = (payload_priority_t)priority;
+
+    m.parameters.resize(count);
+    for (auto& param : m.parameters) {
+        if (!getString(data, end, param.name) ||
+            !getString(data, end, param.type) ||
+            !getString(data, end, param.label) ||
+            !getValue(data, end, required) ||
+            !getString(data, end, param.default_value)) {
+            return false;
+        }
+        param.required = required != 0;
+    }
+
+    return true;
+}
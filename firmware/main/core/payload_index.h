@@ -0,0 +1,52 @@
+#ifndef PAYLOAD_INDEX_H
+#define PAYLOAD_INDEX_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "../include/types.h"
+
+// Identifies the manifest.json revision an index entry was parsed from
+struct ManifestStamp {
+    int64_t mtime;
+    uint32_t size;
+
+    bool operator==(const ManifestStamp& other) const {
+        return mtime == other.mtime && size == other.size;
+    }
+    bool operator!=(const ManifestStamp& other) const {
+        return !(*this == other);
+    }
+};
+
+struct PayloadIndexEntry {
+    ManifestStamp stamp;
+    PayloadManifest manifest;
+};
+
+// Persistent binary cache of parsed manifests, stored at PAYLOAD_INDEX_PATH.
+// The whole index is read with a single readFile() at boot and rewritten
+// (temp file + rename) whenever an entry is added or removed.
+class PayloadIndex {
+public:
+    bool load();
+    bool save();
+
+    PayloadIndexEntry* find(const std::string& payload_id);
+    const PayloadIndexEntry* find(const std::string& payload_id) const;
+    void put(const std::string& payload_id, const ManifestStamp& stamp, const PayloadManifest& manifest);
+    bool remove(const std::string& payload_id);
+    void clear();
+
+    const std::map<std::string, PayloadIndexEntry>& entries() const { return entries_; }
+    bool isDirty() const { return dirty_; }
+
+private:
+    static void serialize(const std::string& payload_id, const PayloadIndexEntry& entry, std::vector<uint8_t>& out);
+    static bool deserialize(const uint8_t*& data, const uint8_t* end, std::string& payload_id, PayloadIndexEntry& entry);
+
+    std::map<std::string, PayloadIndexEntry> entries_;
+    bool dirty_ = false;
+};
+
+#endif // PAYLOAD_INDEX_H
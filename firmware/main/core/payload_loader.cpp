@@ -1,5 +1,8 @@
 #include "payload_loader.h"
 #include "storage_manager.h"
+#include "payload_scheduler.h"
+#include "blob_store.h"
+#include "payload_stream.h"
 #include "../runtimes/native_loader.h"
 #include "../runtimes/micropython_vm.h"
 #include "../runtimes/lua_vm.h"
@@ -7,6 +10,8 @@
 
 static const char* TAG = "PayloadLoader";
 
+static const uint32_t STOP_GRACE_MS = 500;
+
 bool PayloadLoader::loadAndExecute(const char* payload_id, PayloadContext* context,
                                    const std::map<std::string, std::string>& params) {
     
@@ -15,44 +20,79 @@ bool PayloadLoader::loadAndExecute(const char* payload_id, PayloadContext* conte
         return false;
     }
     
-    ESP_LOGI(TAG, "Loading payload: %s (type: %d)", payload_id, context->manifest.payload.type);
-    
-    context->status = PAYLOAD_STATUS_LOADING;
+    ESP_LOGI(TAG, "Loading payload: %s (type: %d)", payload_id, context->manifest->payload.type);
     
-    bool success = false;
-    
-    switch (context->manifest.payload.type) {
+    switch (context->manifest->payload.type) {
         case PAYLOAD_TYPE_NATIVE:
-            success = loadNative(payload_id, context, params);
-            break;
-            
         case PAYLOAD_TYPE_MICROPYTHON:
-            success = loadMicroPython(payload_id, context, params);
-            break;
-            
         case PAYLOAD_TYPE_LUA:
-            success = loadLua(payload_id, context, params);
             break;
             
         case PAYLOAD_TYPE_BUILTIN:
             ESP_LOGW(TAG, "Built-in payloads not yet implemented");
-            success = false;
-            break;
+            context->status = PAYLOAD_STATUS_ERROR;
+            return false;
             
         default:
-            ESP_LOGE(TAG, "Unknown payload type: %d", context->manifest.payload.type);
-            success = false;
+            ESP_LOGE(TAG, "Unknown payload type: %d", context->manifest->payload.type);
+            context->status = PAYLOAD_STATUS_ERROR;
+            return false;
     }
     
-    if (success) {
-        context->status = PAYLOAD_STATUS_RUNNING;
-        ESP_LOGI(TAG, "Payload loaded and executing");
-    } else {
+    // Map the binary so the runtime reads it from flash instead of RAM.
+    // Compressed blobs cannot run in place; like payloads kept as files
+    // they are read by the runtime through a PayloadStream.
+    PayloadImage image;
+    if (BlobStore::getInstance().map(payload_id, image)) {
+        if (PayloadStream::isPacked(image.data, image.size, nullptr)) {
+            BlobStore::unmap(image);
+        } else {
+            context->image = image.data;
+            context->image_size = image.size;
+            context->image_handle = image.handle;
+        }
+    }
+    
+    // Mark running before the task exists so a payload that finishes
+    // immediately is not overwritten back to RUNNING
+    context->status = PAYLOAD_STATUS_RUNNING;
+    
+    // params is owned by the caller's context slot and outlives the task
+    if (!PayloadScheduler::getInstance().spawn(payload_id, context, &PayloadLoader::runPayload,
+                                               (void*)&params, nullptr)) {
         context->status = PAYLOAD_STATUS_ERROR;
-        ESP_LOGE(TAG, "Failed to load payload");
+        ESP_LOGE(TAG, "Failed to start payload task");
+        return false;
     }
     
-    return success;
+    ESP_LOGI(TAG, "Payload task started");
+    return true;
+}
+
+void PayloadLoader::runPayload(PayloadContext* context, void* arg) {
+    const auto& params = *(const std::map<std::string, std::string>*)arg;
+    
+    if (!getInstance().runRuntime(context->payload_id, context, params)) {
+        context->status = PAYLOAD_STATUS_ERROR;
+        ESP_LOGE(TAG, "Payload failed: %s", context->payload_id);
+    }
+}
+
+bool PayloadLoader::runRuntime(const char* payload_id, PayloadContext* context,
+                               const std::map<std::string, std::string>& params) {
+    switch (context->manifest->payload.type) {
+        case PAYLOAD_TYPE_NATIVE:
+            return loadNative(payload_id, context, params);
+            
+        case PAYLOAD_TYPE_MICROPYTHON:
+            return loadMicroPython(payload_id, context, params);
+            
+        case PAYLOAD_TYPE_LUA:
+            return loadLua(payload_id, context, params);
+            
+        default:
+            return false;
+    }
 }
 
 bool PayloadLoader::stop(const char* payload_id, PayloadContext* context) {
@@ -62,7 +102,7 @@ bool PayloadLoader::stop(const char* payload_id, PayloadContext* context) {
     
     ESP_LOGI(TAG, "Stopping payload: %s", payload_id);
     
-    switch (context->manifest.payload.type) {
+    switch (context->manifest->payload.type) {
         case PAYLOAD_TYPE_NATIVE:
             NativeLoader::getInstance().stop(context);
             break;
@@ -79,6 +119,9 @@ bool PayloadLoader::stop(const char* payload_id, PayloadContext* context) {
             break;
     }
     
+    // Give the runtime a chance to unwind before the task is deleted
+    PayloadScheduler::getInstance().terminate(context, pdMS_TO_TICKS(STOP_GRACE_MS));
+    
     context->status = PAYLOAD_STATUS_COMPLETED;
     return true;
 }
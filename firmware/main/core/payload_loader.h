@@ -12,6 +12,7 @@ public:
         return instance;
     }
     
+    // params must stay valid until the payload task has exited
     bool loadAndExecute(const char* payload_id, PayloadContext* context,
                        const std::map<std::string, std::string>& params);
     bool stop(const char* payload_id, PayloadContext* context);
@@ -22,6 +23,11 @@ private:
     PayloadLoader(const PayloadLoader&) = delete;
     PayloadLoader& operator=(const PayloadLoader&) = delete;
     
+    // Payload task body
+    static void runPayload(PayloadContext* context, void* arg);
+    bool runRuntime(const char* payload_id, PayloadContext* context,
+                    const std::map<std::string, std::string>& params);
+    
     bool loadNative(const char* payload_id, PayloadContext* context,
                    const std::map<std::string, std::string>& params);
     bool loadMicroPython(const char* payload_id, PayloadContext* context,
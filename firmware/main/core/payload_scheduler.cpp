@@ -0,0 +1,240 @@
+#include "payload_scheduler.h"
+#include "payload_supervisor.h"
+#include "payload_arena.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <string.h>
+
+static const char* TAG = "PayloadScheduler";
+
+// Core running the WiFi and Bluedroid host tasks
+#ifdef CONFIG_BT_BLUEDROID_PINNED_TO_CORE
+static const int RADIO_STACK_CORE = CONFIG_BT_BLUEDROID_PINNED_TO_CORE;
+#else
+static const int RADIO_STACK_CORE = 0;
+#endif
+
+// Priority classes sit above app_main (1) and well below the radio,
+// esp_timer and IPC tasks
+static const UBaseType_t TASK_PRIORITY[] = { 3, 5, 8 };
+static const uint32_t LOAD_WEIGHT[] = { 1, 2, 4 };
+
+static const uint32_t MIN_PAYLOAD_STACK_KB = 4;
+
+bool PayloadScheduler::spawn(const char* payload_id, PayloadContext* context,
+                             payload_task_fn_t fn, void* arg, payload_release_fn_t release) {
+    const PayloadManifest& manifest = *context->manifest;
+    int priority = manifest.requirements.priority;
+    if (priority < PAYLOAD_PRIORITY_LOW || priority > PAYLOAD_PRIORITY_HIGH) {
+        priority = PAYLOAD_PRIORITY_NORMAL;
+    }
+
+    uint32_t stack_kb = manifest.requirements.stack_kb;
+    if (stack_kb == 0) stack_kb = DEFAULT_PAYLOAD_STACK_KB;
+    if (stack_kb < MIN_PAYLOAD_STACK_KB) stack_kb = MIN_PAYLOAD_STACK_KB;
+    if (stack_kb > MAX_PAYLOAD_STACK_KB) stack_kb = MAX_PAYLOAD_STACK_KB;
+
+    int core = pickCore(manifest);
+
+    TaskSlot* slot = nullptr;
+    portENTER_CRITICAL(&lock_);
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (!slots_[i].context) {
+            slot = &slots_[i];
+            slot->context = context;
+            slot->task = nullptr;
+            slot->waiter = nullptr;
+            slot->fn = fn;
+            slot->arg = arg;
+            slot->release = release;
+            slot->weight = LOAD_WEIGHT[priority];
+            slot->core = core;
+            core_load_[core] += slot->weight;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    if (!slot) {
+        ESP_LOGE(TAG, "No free task slot for %s", payload_id);
+        if (release) release(arg);
+        return false;
+    }
+
+    context->core_id = core;
+
+    // FreeRTOS stores the handle before the task can first run, so the
+    // slot is complete by the time taskEntry reads it
+    BaseType_t ret = xTaskCreatePinnedToCore(&PayloadScheduler::taskEntry, payload_id,
+                                             stack_kb * 1024, slot, TASK_PRIORITY[priority],
+                                             &slot->task, core);
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create task for %s", payload_id);
+        portENTER_CRITICAL(&lock_);
+        core_load_[core] -= slot->weight;
+        slot->context = nullptr;
+        portEXIT_CRITICAL(&lock_);
+        context->core_id = -1;
+        if (release) release(arg);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Started %s on core %d (prio %d, stack %lu KB)",
+             payload_id, core, (int)TASK_PRIORITY[priority], (unsigned long)stack_kb);
+    return true;
+}
+
+bool PayloadScheduler::terminate(PayloadContext* context, TickType_t grace) {
+    TaskSlot* slot = nullptr;
+
+    portENTER_CRITICAL(&lock_);
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (slots_[i].context == context) {
+            slot = &slots_[i];
+            slot->waiter = xTaskGetCurrentTaskHandle();
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    if (!slot) {
+        return true;  // Already exited
+    }
+
+    if (slot->task == xTaskGetCurrentTaskHandle()) {
+        ESP_LOGE(TAG, "Payload task cannot terminate itself");
+        return false;
+    }
+
+    // A notification only means "look again": one left over from a task
+    // that exited after an earlier terminate() timed out must not end this
+    // wait, so the slot decides. Once the task has claimed its own exit it
+    // is only running its release callback, which is waited out in full.
+    TickType_t start = xTaskGetTickCount();
+    TaskHandle_t task;
+    void* arg;
+    payload_release_fn_t release;
+    for (;;) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        portENTER_CRITICAL(&lock_);
+        bool exited = (slot->context != context);
+        bool exiting = !exited && slot->task == nullptr;
+        bool reclaim = !exited && !exiting && waited >= grace;
+        task = slot->task;
+        arg = slot->arg;
+        release = slot->release;
+        if (reclaim) {
+            // Grace period expired: take the slot back from the task
+            core_load_[slot->core] -= slot->weight;
+            slot->context = nullptr;
+            slot->task = nullptr;
+        }
+        portEXIT_CRITICAL(&lock_);
+
+        if (exited) {
+            return true;
+        }
+        if (reclaim) {
+            break;
+        }
+        ulTaskNotifyTake(pdTRUE, exiting ? portMAX_DELAY : grace - waited);
+    }
+
+    ESP_LOGW(TAG, "Payload task did not exit in time, deleting it");
+    vTaskDelete(task);
+    context->task_handle = nullptr;
+    context->core_id = -1;
+    if (release) release(arg);
+    return true;
+}
+
+uint32_t PayloadScheduler::getCoreLoad(int core) {
+    if (core < 0 || core >= portNUM_PROCESSORS) {
+        return 0;
+    }
+    portENTER_CRITICAL(&lock_);
+    uint32_t load = core_load_[core];
+    portEXIT_CRITICAL(&lock_);
+    return load;
+}
+
+bool PayloadScheduler::isRadioHeavy(const PayloadManifest& manifest) {
+    const uint32_t radio_perms = PERM_WIFI_SCAN | PERM_WIFI_INJECT |
+                                 PERM_BLE_SCAN | PERM_BLE_ADVERTISE | PERM_NETWORK;
+    if (manifest.permissions & radio_perms) {
+        return true;
+    }
+
+    for (const auto& api : manifest.requirements.apis) {
+        if (api == "wifi" || api == "ble") {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PayloadScheduler::taskEntry(void* param) {
+    TaskSlot* slot = (TaskSlot*)param;
+    PayloadContext* context = slot->context;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    context->task_handle = self;
+    vTaskSetThreadLocalStoragePointer(NULL, PAYLOAD_TLS_INDEX, context);
+    slot->fn(context, slot->arg);
+
+    if (context->status == PAYLOAD_STATUS_RUNNING) {
+        context->status = PAYLOAD_STATUS_COMPLETED;
+    }
+
+    // Claim the exit first, so terminate() stops trying to delete us, and
+    // give the slot up only after release has run
+    auto& scheduler = getInstance();
+    portENTER_CRITICAL(&scheduler.lock_);
+    bool owned = (slot->task == self);
+    void* arg = slot->arg;
+    payload_release_fn_t release = slot->release;
+    if (owned) {
+        slot->task = nullptr;
+    }
+    portEXIT_CRITICAL(&scheduler.lock_);
+
+    if (!owned) {
+        // terminate() already reclaimed the slot and is about to delete us
+        vTaskSuspend(NULL);
+    }
+
+    context->task_handle = nullptr;
+    if (release) release(arg);
+
+    portENTER_CRITICAL(&scheduler.lock_);
+    TaskHandle_t waiter = slot->waiter;
+    scheduler.core_load_[slot->core] -= slot->weight;
+    slot->context = nullptr;
+    portEXIT_CRITICAL(&scheduler.lock_);
+
+    if (waiter) {
+        xTaskNotifyGive(waiter);
+    } else {
+        PayloadSupervisor::getInstance().notifyCompleted(context);
+    }
+
+    vTaskDelete(NULL);
+}
+
+int PayloadScheduler::pickCore(const PayloadManifest& manifest) {
+#if CONFIG_FREERTOS_UNICORE
+    return 0;
+#else
+    const int app_core = RADIO_STACK_CORE ^ 1;
+
+    if (isRadioHeavy(manifest)) {
+        return app_core;
+    }
+
+    // Least loaded core; ties go to the core without the radio stacks
+    portENTER_CRITICAL(&lock_);
+    int core = core_load_[RADIO_STACK_CORE] < core_load_[app_core] ? RADIO_STACK_CORE : app_core;
+    portEXIT_CRITICAL(&lock_);
+    return core;
+#endif
+}
@@ -0,0 +1,60 @@
+#ifndef PAYLOAD_SCHEDULER_H
+#define PAYLOAD_SCHEDULER_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "../include/types.h"
+
+typedef void (*payload_task_fn_t)(PayloadContext* context, void* arg);
+typedef void (*payload_release_fn_t)(void* arg);
+
+// Runs each payload in its own pinned FreeRTOS task.
+//
+// Placement picks the core with the lowest accumulated load, except that
+// payloads using the radios are kept off RADIO_STACK_CORE, where the WiFi
+// and Bluedroid host tasks run, so a busy scan loop cannot starve them.
+class PayloadScheduler {
+public:
+    static PayloadScheduler& getInstance() {
+        static PayloadScheduler instance;
+        return instance;
+    }
+
+    // Starts `fn` in a new task. `release` (optional) is called exactly once
+    // with `arg`, either when the task returns or when it is forcibly terminated.
+    bool spawn(const char* payload_id, PayloadContext* context,
+               payload_task_fn_t fn, void* arg, payload_release_fn_t release);
+
+    // Waits up to `grace` for the payload task to exit, then deletes it. A
+    // task that is already running its release callback is waited for.
+    bool terminate(PayloadContext* context, TickType_t grace);
+
+    uint32_t getCoreLoad(int core);
+    static bool isRadioHeavy(const PayloadManifest& manifest);
+
+private:
+    PayloadScheduler() = default;
+    ~PayloadScheduler() = default;
+    PayloadScheduler(const PayloadScheduler&) = delete;
+    PayloadScheduler& operator=(const PayloadScheduler&) = delete;
+
+    struct TaskSlot {
+        PayloadContext* context;
+        TaskHandle_t task;
+        TaskHandle_t waiter;
+        payload_task_fn_t fn;
+        void* arg;
+        payload_release_fn_t release;
+        uint32_t weight;
+        int core;
+    };
+
+    static void taskEntry(void* param);
+    int pickCore(const PayloadManifest& manifest);
+
+    TaskSlot slots_[MAX_PAYLOADS] = {};
+    uint32_t core_load_[portNUM_PROCESSORS] = {};
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif // PAYLOAD_SCHEDULER_H
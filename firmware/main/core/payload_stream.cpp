@@ -0,0 +1,275 @@
+#include "payload_stream.h"
+#include "storage_manager.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp32/rom/miniz.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "PayloadStream";
+
+PayloadStream::~PayloadStream() {
+    close();
+}
+
+bool PayloadStream::open(const char* payload_id) {
+    close();
+
+    strncpy(payload_id_, payload_id, MAX_PAYLOAD_ID_LEN - 1);
+    payload_id_[MAX_PAYLOAD_ID_LEN - 1] = '\0';
+
+    PayloadPackHeader header;
+    bool packed = false;
+
+    if (BlobStore::getInstance().map(payload_id, image_)) {
+        stored_size_ = image_.size;
+        packed = isPacked(image_.data, image_.size, nullptr);
+        if (packed) {
+            memcpy(&header, image_.data, sizeof(header));
+        }
+    } else {
+        // Reads are block-sized already, so the file is opened unbuffered
+        auto& storage = StorageManager::getInstance();
+        std::string data_path = storage.getPayloadDataPath(payload_id);
+        if (!storage.openRead(data_path.c_str(), file_, 0)) {
+            return false;
+        }
+        stored_size_ = file_.size();
+        size_t len = file_.read((uint8_t*)&header, sizeof(header));
+        packed = isPacked((const uint8_t*)&header, len, nullptr);
+        if (!packed && !file_.seek(0)) {
+            return false;
+        }
+    }
+
+    if (!packed) {
+        raw_size_ = stored_size_;
+        return true;
+    }
+
+    stored_pos_ = sizeof(header);
+    raw_size_ = header.raw_size;
+    if (!startInflate()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void PayloadStream::close() {
+    if (decomp_ && atEnd() && !failed_) {
+        uint32_t kbps = decode_us_ > 0 ? (uint32_t)((uint64_t)raw_size_ * 1000000 / decode_us_ / 1024) : 0;
+        ESP_LOGI(TAG, "Inflated %s: %u -> %u bytes (%u%%), %u KB/s", payload_id_,
+                 (unsigned)stored_size_, (unsigned)raw_size_,
+                 raw_size_ ? (unsigned)((uint64_t)stored_size_ * 100 / raw_size_) : 0,
+                 (unsigned)kbps);
+    }
+
+    free(decomp_);
+    free(window_);
+    free(in_buf_);
+    decomp_ = nullptr;
+    window_ = nullptr;
+    in_buf_ = nullptr;
+
+    file_.close();
+    if (image_.data) {
+        BlobStore::unmap(image_);
+    }
+    image_ = {};
+
+    stored_size_ = 0;
+    stored_pos_ = 0;
+    raw_size_ = 0;
+    produced_ = 0;
+    window_size_ = 0;
+    window_pos_ = 0;
+    pending_pos_ = 0;
+    pending_ = 0;
+    in_ptr_ = nullptr;
+    in_avail_ = 0;
+    done_ = false;
+    failed_ = false;
+    decode_us_ = 0;
+}
+
+size_t PayloadStream::read(uint8_t* buf, size_t length) {
+    if (failed_) {
+        return 0;
+    }
+    if (!decomp_) {
+        return readStored(buf, length);
+    }
+
+    size_t total = 0;
+    while (total < length) {
+        if (pending_ > 0) {
+            size_t n = pending_ < length - total ? pending_ : length - total;
+            memcpy(buf + total, window_ + pending_pos_, n);
+            pending_pos_ += n;
+            pending_ -= n;
+            total += n;
+            continue;
+        }
+        if (done_ || !inflateMore()) {
+            break;
+        }
+    }
+    return failed_ ? 0 : total;
+}
+
+PayloadStreamStats PayloadStream::stats() const {
+    PayloadStreamStats stats;
+    stats.stored_size = stored_size_;
+    stats.raw_size = raw_size_;
+    stats.decode_us = (uint32_t)decode_us_;
+    return stats;
+}
+
+bool PayloadStream::isPacked(const uint8_t* data, size_t length, uint32_t* raw_size) {
+    PayloadPackHeader header;
+    if (!data || length < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != PAYLOAD_PACK_MAGIC || header.version != PAYLOAD_PACK_VERSION ||
+        header.codec != PAYLOAD_CODEC_ZLIB) {
+        return false;
+    }
+    if (raw_size) *raw_size = header.raw_size;
+    return true;
+}
+
+bool PayloadStream::startInflate() {
+    if (raw_size_ == 0 || raw_size_ > MAX_PAYLOAD_SIZE) {
+        ESP_LOGE(TAG, "Invalid inflated size for %s: %u", payload_id_, (unsigned)raw_size_);
+        return false;
+    }
+
+    if (file_.isOpen()) {
+        in_buf_ = (uint8_t*)malloc(FILE_CHUNK_SIZE);
+        if (!in_buf_) {
+            return false;
+        }
+    }
+    if (!fillInput() || in_avail_ < 2) {
+        ESP_LOGE(TAG, "Truncated stream in %s", payload_id_);
+        return false;
+    }
+
+    // The zlib header names the window the encoder used; the ring buffer
+    // only has to cover that much history
+    uint8_t cmf = in_ptr_[0];
+    if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7) {
+        ESP_LOGE(TAG, "Unsupported zlib header in %s", payload_id_);
+        return false;
+    }
+    window_size_ = (size_t)1 << ((cmf >> 4) + 8);
+
+    decomp_ = (tinfl_decompressor*)malloc(sizeof(tinfl_decompressor));
+    window_ = (uint8_t*)malloc(window_size_);
+    if (!decomp_ || !window_) {
+        ESP_LOGE(TAG, "No memory for %u byte inflate window", (unsigned)window_size_);
+        return false;
+    }
+    tinfl_init(decomp_);
+    return true;
+}
+
+size_t PayloadStream::readStored(uint8_t* buf, size_t length) {
+    size_t remaining = stored_size_ - stored_pos_;
+    if (length > remaining) {
+        length = remaining;
+    }
+
+    size_t n = length;
+    if (image_.data) {
+        memcpy(buf, image_.data + stored_pos_, length);
+    } else if (file_.isOpen()) {
+        n = file_.read(buf, length);
+        if (n != length) {
+            ESP_LOGE(TAG, "Read error in %s at %u", payload_id_, (unsigned)stored_pos_);
+            failed_ = true;
+            return 0;
+        }
+    }
+
+    stored_pos_ += n;
+    produced_ += n;
+    return n;
+}
+
+bool PayloadStream::fillInput() {
+    if (in_avail_ > 0) {
+        return true;
+    }
+    if (stored_pos_ >= stored_size_) {
+        return false;
+    }
+
+    if (image_.data) {
+        // Mapped: the rest of the blob is one input buffer
+        in_ptr_ = image_.data + stored_pos_;
+        in_avail_ = stored_size_ - stored_pos_;
+    } else {
+        size_t want = stored_size_ - stored_pos_;
+        if (want > FILE_CHUNK_SIZE) {
+            want = FILE_CHUNK_SIZE;
+        }
+        in_avail_ = file_.read(in_buf_, want);
+        in_ptr_ = in_buf_;
+        if (in_avail_ != want) {
+            ESP_LOGE(TAG, "Read error in %s at %u", payload_id_, (unsigned)stored_pos_);
+            failed_ = true;
+            return false;
+        }
+    }
+    stored_pos_ += in_avail_;
+    return true;
+}
+
+bool PayloadStream::inflateMore() {
+    fillInput();
+    if (failed_) {
+        return false;
+    }
+
+    bool more_input = stored_pos_ < stored_size_;
+    mz_uint32 flags = TINFL_FLAG_PARSE_ZLIB_HEADER | (more_input ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+    size_t in_bytes = in_avail_;
+    size_t out_bytes = window_size_ - window_pos_;
+
+    int64_t start = esp_timer_get_time();
+    tinfl_status status = tinfl_decompress(decomp_, in_ptr_, &in_bytes, window_,
+                                           window_ + window_pos_, &out_bytes, flags);
+    decode_us_ += esp_timer_get_time() - start;
+
+    in_ptr_ += in_bytes;
+    in_avail_ -= in_bytes;
+
+    // New output sits in the ring from window_pos_; the next call may
+    // overwrite it, so read() drains it first
+    pending_pos_ = window_pos_;
+    pending_ = out_bytes;
+    window_pos_ = (window_pos_ + out_bytes) & (window_size_ - 1);
+    produced_ += out_bytes;
+
+    if (produced_ > raw_size_) {
+        ESP_LOGE(TAG, "%s inflates past its declared size", payload_id_);
+        failed_ = true;
+    } else if (status == TINFL_STATUS_DONE) {
+        done_ = true;
+        if (produced_ != raw_size_) {
+            ESP_LOGE(TAG, "%s inflated to %u bytes, expected %u", payload_id_,
+                     (unsigned)produced_, (unsigned)raw_size_);
+            failed_ = true;
+        }
+    } else if (status < TINFL_STATUS_DONE) {
+        ESP_LOGE(TAG, "Corrupt compressed data in %s (%d)", payload_id_, (int)status);
+        failed_ = true;
+    } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && !more_input && in_avail_ == 0) {
+        ESP_LOGE(TAG, "Truncated stream in %s", payload_id_);
+        failed_ = true;
+    }
+    return !failed_;
+}
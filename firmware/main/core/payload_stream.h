@@ -0,0 +1,95 @@
+#ifndef PAYLOAD_STREAM_H
+#define PAYLOAD_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "blob_store.h"
+#include "storage_manager.h"
+#include "../include/types.h"
+
+#define PAYLOAD_PACK_MAGIC 0x5A505A44  // "DZPZ"
+#define PAYLOAD_PACK_VERSION 1
+#define PAYLOAD_CODEC_ZLIB 1
+
+struct tinfl_decompressor_tag;
+
+// Header in front of a compressed payload; the zlib stream follows it
+struct PayloadPackHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t codec;
+    uint8_t reserved;
+    uint32_t raw_size;          // Size of the payload once inflated
+};
+
+// Stored vs. inflated size and time spent inflating one full pass
+struct PayloadStreamStats {
+    uint32_t stored_size;
+    uint32_t raw_size;
+    uint32_t decode_us;
+};
+
+// Sequential reader over a stored payload, compressed or not.
+//
+// Payloads may be uploaded as a PayloadPackHeader followed by a zlib
+// stream (see tools/pack_payload.py). Those are inflated on the fly with
+// the ROM tinfl decoder into a ring buffer the size of the stream's own
+// window (CINFO, at most 32 KB), so a payload is never inflated into RAM
+// as a whole. Input comes straight from the mapped blob or through a
+// small buffer read from the file unbuffered. Plain payloads are passed
+// through unchanged.
+class PayloadStream {
+public:
+    PayloadStream() = default;
+    ~PayloadStream();
+
+    bool open(const char* payload_id);
+    void close();
+
+    // Returns the bytes read; 0 at the end of the payload or on error
+    size_t read(uint8_t* buf, size_t length);
+
+    bool isCompressed() const { return decomp_ != nullptr; }
+    bool failed() const { return failed_; }
+    bool atEnd() const { return produced_ == raw_size_; }
+    size_t rawSize() const { return raw_size_; }
+    PayloadStreamStats stats() const;
+
+    // True if data starts with a supported pack header
+    static bool isPacked(const uint8_t* data, size_t length, uint32_t* raw_size);
+
+private:
+    PayloadStream(const PayloadStream&) = delete;
+    PayloadStream& operator=(const PayloadStream&) = delete;
+
+    static constexpr size_t FILE_CHUNK_SIZE = 512;
+
+    bool startInflate();
+    size_t readStored(uint8_t* buf, size_t length);
+    bool fillInput();
+    bool inflateMore();
+
+    char payload_id_[MAX_PAYLOAD_ID_LEN] = {};
+    PayloadImage image_ = {};
+    StorageFile file_;
+    size_t stored_size_ = 0;
+    size_t stored_pos_ = 0;     // Next stored byte not yet consumed
+    size_t raw_size_ = 0;
+    size_t produced_ = 0;
+
+    // Inflate state; input is either the mapped image or in_buf_
+    tinfl_decompressor_tag* decomp_ = nullptr;
+    uint8_t* window_ = nullptr;
+    size_t window_size_ = 0;
+    size_t window_pos_ = 0;
+    size_t pending_pos_ = 0;    // Inflated bytes not yet handed out
+    size_t pending_ = 0;
+    uint8_t* in_buf_ = nullptr;
+    const uint8_t* in_ptr_ = nullptr;
+    size_t in_avail_ = 0;
+    bool done_ = false;
+    bool failed_ = false;
+    int64_t decode_us_ = 0;
+};
+
+#endif // PAYLOAD_STREAM_H
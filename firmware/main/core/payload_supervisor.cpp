@@ -0,0 +1,228 @@
+#include "payload_supervisor.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char* TAG = "PayloadSupervisor";
+
+bool PayloadSupervisor::initialize() {
+    ESP_LOGI(TAG, "Initializing Payload Supervisor");
+
+    if (!event_queue_) {
+        event_queue_ = xQueueCreate(MAX_PAYLOADS * 2, sizeof(QueuedEvent));
+        if (!event_queue_) {
+            ESP_LOGE(TAG, "Failed to create event queue");
+            return false;
+        }
+    }
+
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        WatchSlot& ws = slots_[i];
+        if (ws.timer) {
+            esp_timer_stop(ws.timer);
+        } else {
+            esp_timer_create_args_t args = {};
+            args.callback = &PayloadSupervisor::deadlineCallback;
+            args.arg = (void*)(uintptr_t)i;
+            args.dispatch_method = ESP_TIMER_TASK;
+            args.name = "payload_deadline";
+
+            if (esp_timer_create(&args, &ws.timer) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to create deadline timer");
+                return false;
+            }
+        }
+        ws.payload_id[0] = '\0';
+        ws.context = nullptr;
+        ws.generation = 0;
+        ws.completed = false;
+    }
+
+    return true;
+}
+
+bool PayloadSupervisor::watch(const char* payload_id, PayloadContext* context) {
+    if (!event_queue_ || !context) {
+        return false;
+    }
+
+    unwatch(payload_id);
+
+    int slot = -1;
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (!slots_[i].context) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        ESP_LOGE(TAG, "No free supervision slot for %s", payload_id);
+        return false;
+    }
+
+    WatchSlot& ws = slots_[slot];
+    strncpy(ws.payload_id, payload_id, MAX_PAYLOAD_ID_LEN - 1);
+    ws.payload_id[MAX_PAYLOAD_ID_LEN - 1] = '\0';
+
+    portENTER_CRITICAL(&lock_);
+    ws.context = context;
+    ws.generation++;
+    ws.completed = false;
+    portEXIT_CRITICAL(&lock_);
+
+    uint64_t now_ms = esp_timer_get_time() / 1000;
+    uint64_t deadline_ms = context->start_time + context->cpu_time_limit;
+    uint64_t remaining_ms = deadline_ms > now_ms ? deadline_ms - now_ms : 0;
+
+    esp_timer_start_once(ws.timer, remaining_ms > 0 ? remaining_ms * 1000 : 1);
+
+    ESP_LOGI(TAG, "Watching %s (deadline in %llu ms)", payload_id, (unsigned long long)remaining_ms);
+    return true;
+}
+
+void PayloadSupervisor::unwatch(const char* payload_id) {
+    int slot = findSlot(payload_id);
+    if (slot < 0) {
+        return;
+    }
+
+    WatchSlot& ws = slots_[slot];
+    esp_timer_stop(ws.timer);
+
+    portENTER_CRITICAL(&lock_);
+    ws.context = nullptr;
+    ws.generation++;
+    ws.completed = false;
+    portEXIT_CRITICAL(&lock_);
+
+    ws.payload_id[0] = '\0';
+}
+
+void PayloadSupervisor::notifyMemoryExceeded(PayloadContext* context) {
+    notify(SUPERVISOR_EVENT_MEMORY_EXCEEDED, context);
+}
+
+void PayloadSupervisor::notifyCompleted(PayloadContext* context) {
+    notify(SUPERVISOR_EVENT_COMPLETED, context);
+}
+
+void PayloadSupervisor::notify(supervisor_event_reason_t reason, PayloadContext* context) {
+    int slot = -1;
+    uint8_t generation = 0;
+
+    portENTER_CRITICAL(&lock_);
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (slots_[i].context == context) {
+            slot = i;
+            generation = slots_[i].generation;
+            if (reason == SUPERVISOR_EVENT_COMPLETED) {
+                slots_[i].completed = true;
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    if (slot >= 0) {
+        post(reason, slot, generation);
+    }
+}
+
+bool PayloadSupervisor::waitForEvent(SupervisorEvent& event, TickType_t timeout) {
+    if (!event_queue_) {
+        // Keeps a caller looping on this from starving its core
+        vTaskDelay(timeout);
+        return false;
+    }
+
+    // A completion whose wakeup did not fit in the queue is found here
+    if (takeCompleted(event)) {
+        return true;
+    }
+
+    QueuedEvent queued;
+    while (xQueueReceive(event_queue_, &queued, timeout) == pdTRUE) {
+        if (queued.reason == SUPERVISOR_EVENT_COMPLETED) {
+            if (takeCompleted(event)) {
+                return true;
+            }
+            continue;
+        }
+
+        portENTER_CRITICAL(&lock_);
+        bool current = slots_[queued.slot].context &&
+                       slots_[queued.slot].generation == queued.generation;
+        portEXIT_CRITICAL(&lock_);
+
+        // Drop events for payloads that were stopped after the event fired
+        if (!current) {
+            continue;
+        }
+
+        event.reason = (supervisor_event_reason_t)queued.reason;
+        memcpy(event.payload_id, slots_[queued.slot].payload_id, MAX_PAYLOAD_ID_LEN);
+        return true;
+    }
+
+    return false;
+}
+
+bool PayloadSupervisor::takeCompleted(SupervisorEvent& event) {
+    int slot = -1;
+    portENTER_CRITICAL(&lock_);
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (slots_[i].context && slots_[i].completed) {
+            slots_[i].completed = false;
+            slot = i;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    if (slot < 0) {
+        return false;
+    }
+    event.reason = SUPERVISOR_EVENT_COMPLETED;
+    memcpy(event.payload_id, slots_[slot].payload_id, MAX_PAYLOAD_ID_LEN);
+    return true;
+}
+
+void PayloadSupervisor::deadlineCallback(void* arg) {
+    auto& supervisor = getInstance();
+    int slot = (int)(uintptr_t)arg;
+    uint64_t now_ms = esp_timer_get_time() / 1000;
+
+    // A firing that raced with unwatch() may land after the slot was reused;
+    // only an occupant whose deadline has actually passed is timed out
+    portENTER_CRITICAL(&supervisor.lock_);
+    PayloadContext* context = supervisor.slots_[slot].context;
+    uint8_t generation = supervisor.slots_[slot].generation;
+    bool expired = context && now_ms >= context->start_time + context->cpu_time_limit;
+    portEXIT_CRITICAL(&supervisor.lock_);
+
+    if (expired) {
+        supervisor.post(SUPERVISOR_EVENT_TIMEOUT, slot, generation);
+    }
+}
+
+void PayloadSupervisor::post(supervisor_event_reason_t reason, int slot, uint8_t generation) {
+    QueuedEvent queued;
+    queued.reason = reason;
+    queued.slot = slot;
+    queued.generation = generation;
+
+    // A full queue already has the main task awake; a completion is still
+    // picked up from its slot flag on the next waitForEvent()
+    if (xQueueSend(event_queue_, &queued, 0) != pdTRUE) {
+        ESP_LOGW(TAG, "Supervisor event queue full, dropping event");
+    }
+}
+
+int PayloadSupervisor::findSlot(const char* payload_id) {
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (slots_[i].context && strncmp(slots_[i].payload_id, payload_id, MAX_PAYLOAD_ID_LEN) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
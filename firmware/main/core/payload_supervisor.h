@@ -0,0 +1,81 @@
+#ifndef PAYLOAD_SUPERVISOR_H
+#define PAYLOAD_SUPERVISOR_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+#include "../include/types.h"
+
+typedef enum {
+    SUPERVISOR_EVENT_TIMEOUT,
+    SUPERVISOR_EVENT_MEMORY_EXCEEDED,
+    SUPERVISOR_EVENT_COMPLETED
+} supervisor_event_reason_t;
+
+struct SupervisorEvent {
+    supervisor_event_reason_t reason;
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+};
+
+// Enforces payload resource limits without polling.
+//
+// Each running payload gets a one-shot esp_timer armed for its execution
+// deadline, and the allocator reports memory limit breaches directly.
+// Both post to a queue that the main task blocks on, so enforcement is
+// immediate and nothing wakes while no payload is running. Payload tasks
+// that finish on their own flag their slot and post a wakeup the same
+// way; the flag is what counts, so a completion is never lost to a full
+// queue. Timers are created once per slot, so watching a payload does not
+// allocate.
+class PayloadSupervisor {
+public:
+    static PayloadSupervisor& getInstance() {
+        static PayloadSupervisor instance;
+        return instance;
+    }
+
+    bool initialize();
+
+    bool watch(const char* payload_id, PayloadContext* context);
+    void unwatch(const char* payload_id);
+
+    // Safe to call from any task (e.g. the payload's own allocator)
+    void notifyMemoryExceeded(PayloadContext* context);
+    void notifyCompleted(PayloadContext* context);
+
+    // Blocks until a limit is hit, a payload finishes or the timeout
+    // expires; before initialize() it just sleeps for the timeout
+    bool waitForEvent(SupervisorEvent& event, TickType_t timeout);
+
+private:
+    PayloadSupervisor() = default;
+    ~PayloadSupervisor() = default;
+    PayloadSupervisor(const PayloadSupervisor&) = delete;
+    PayloadSupervisor& operator=(const PayloadSupervisor&) = delete;
+
+    struct WatchSlot {
+        char payload_id[MAX_PAYLOAD_ID_LEN];
+        PayloadContext* context;
+        esp_timer_handle_t timer;
+        uint8_t generation;
+        bool completed;                 // Set by the payload task, cleared when reported
+    };
+
+    struct QueuedEvent {
+        uint8_t reason;
+        uint8_t slot;
+        uint8_t generation;
+    };
+
+    static void deadlineCallback(void* arg);
+    void notify(supervisor_event_reason_t reason, PayloadContext* context);
+    void post(supervisor_event_reason_t reason, int slot, uint8_t generation);
+    int findSlot(const char* payload_id);
+    bool takeCompleted(SupervisorEvent& event);
+
+    WatchSlot slots_[MAX_PAYLOADS];
+    QueueHandle_t event_queue_ = nullptr;
+    portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif // PAYLOAD_SUPERVISOR_H
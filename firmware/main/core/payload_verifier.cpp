@@ -0,0 +1,232 @@
+#include "payload_verifier.h"
+#include "storage_manager.h"
+#include "blob_store.h"
+#include "payload_stream.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char* TAG = "PayloadVerifier";
+
+static const uint32_t DIGEST_MAGIC = 0x56505A44;  // "DZPV"
+static const uint16_t DIGEST_VERSION = 2;
+
+// Stored at <payload dir>/payload.sha256
+struct DigestRecord {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t size;              // Stored size, compressed or not
+    int64_t mtime;
+    uint32_t raw_size;
+    uint32_t decode_us;
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    uint32_t crc;
+};
+
+static bool checkSize(const char* payload_id, const PayloadManifest& manifest, size_t raw_size) {
+    if (manifest.payload.size && raw_size != manifest.payload.size) {
+        ESP_LOGE(TAG, "Size mismatch for %s: %u, expected %u", payload_id,
+                 (unsigned)raw_size, (unsigned)manifest.payload.size);
+        return false;
+    }
+    return true;
+}
+
+static bool loadRecord(const char* path, DigestRecord& record) {
+    auto& storage = StorageManager::getInstance();
+    size_t record_size = 0;
+    if (!storage.getFileInfo(path, &record_size, nullptr) || record_size != sizeof(record)) {
+        return false;
+    }
+    if (storage.readFile(path, (uint8_t*)&record, sizeof(record)) != (int)sizeof(record)) {
+        return false;
+    }
+
+    if (record.magic != DIGEST_MAGIC || record.version != DIGEST_VERSION ||
+        esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(DigestRecord, crc)) != record.crc) {
+        ESP_LOGW(TAG, "Discarding invalid digest record %s", path);
+        return false;
+    }
+    return true;
+}
+
+bool PayloadVerifier::verify(const char* payload_id, const PayloadManifest& manifest) {
+    uint8_t expected[PAYLOAD_DIGEST_SIZE];
+    if (manifest.payload.checksum.empty()) {
+        ESP_LOGW(TAG, "Payload %s has no checksum, skipping verification", payload_id);
+        return true;
+    }
+    if (!parseChecksum(manifest.payload.checksum, expected)) {
+        ESP_LOGE(TAG, "Unsupported checksum for %s: %s", payload_id, manifest.payload.checksum.c_str());
+        return false;
+    }
+
+    auto& storage = StorageManager::getInstance();
+    std::string data_path = storage.getPayloadDataPath(payload_id);
+    std::string cache_path = storage.getPayloadDigestPath(payload_id);
+
+    // Blobs are stamped with their commit generation instead of an mtime
+    size_t size = 0;
+    int64_t mtime = 0;
+    uint32_t generation = 0;
+    if (BlobStore::getInstance().find(payload_id, &size, &generation)) {
+        mtime = generation;
+    } else if (!storage.getFileInfo(data_path.c_str(), &size, &mtime)) {
+        ESP_LOGE(TAG, "Payload data missing: %s", data_path.c_str());
+        return false;
+    }
+
+    // Unchanged since the last successful check: compare against the record
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    PayloadStreamStats stats;
+    if (readCache(cache_path.c_str(), size, mtime, digest, &stats)) {
+        if (checkSize(payload_id, manifest, stats.raw_size) &&
+            memcmp(digest, expected, PAYLOAD_DIGEST_SIZE) == 0) {
+            return true;
+        }
+        // Manifest changed to a different checksum; fall through and re-hash
+    }
+
+    // The checksum covers the payload as the runtime sees it, so
+    // compressed payloads are hashed while they are inflated
+    PayloadStream stream;
+    if (!stream.open(payload_id)) {
+        return false;
+    }
+    if (!checkSize(payload_id, manifest, stream.rawSize())) {
+        return false;
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (!hashStream(stream, digest)) {
+        return false;
+    }
+    stats = stream.stats();
+    ESP_LOGI(TAG, "Hashed %s (%u bytes) in %lld ms", payload_id, (unsigned)stats.raw_size,
+             (long long)((esp_timer_get_time() - start) / 1000));
+
+    if (memcmp(digest, expected, PAYLOAD_DIGEST_SIZE) != 0) {
+        ESP_LOGE(TAG, "Checksum mismatch for %s", payload_id);
+        storage.deleteFile(cache_path.c_str());
+        return false;
+    }
+
+    writeCache(cache_path.c_str(), mtime, digest, stats);
+    return true;
+}
+
+bool PayloadVerifier::getStats(const char* payload_id, PayloadStreamStats& stats) {
+    auto& storage = StorageManager::getInstance();
+    std::string cache_path = storage.getPayloadDigestPath(payload_id);
+    DigestRecord record;
+    if (!loadRecord(cache_path.c_str(), record)) {
+        return false;
+    }
+    stats.stored_size = record.size;
+    stats.raw_size = record.raw_size;
+    stats.decode_us = record.decode_us;
+    return true;
+}
+
+void PayloadVerifier::invalidate(const char* payload_id) {
+    auto& storage = StorageManager::getInstance();
+    std::string cache_path = storage.getPayloadDigestPath(payload_id);
+    if (storage.fileExists(cache_path.c_str())) {
+        storage.deleteFile(cache_path.c_str());
+    }
+}
+
+bool PayloadVerifier::hashStream(PayloadStream& stream, uint8_t digest[PAYLOAD_DIGEST_SIZE]) {
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+
+    uint8_t chunk[CHUNK_SIZE];
+    bool ok = true;
+    size_t len;
+    while ((len = stream.read(chunk, sizeof(chunk))) > 0) {
+        if (mbedtls_sha256_update(&ctx, chunk, len) != 0) {
+            ok = false;
+            break;
+        }
+    }
+    if (stream.failed() || !stream.atEnd()) {
+        ok = false;
+    }
+
+    if (ok && mbedtls_sha256_finish(&ctx, digest) != 0) {
+        ok = false;
+    }
+    mbedtls_sha256_free(&ctx);
+    return ok;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool PayloadVerifier::parseChecksum(const std::string& checksum, uint8_t digest[PAYLOAD_DIGEST_SIZE]) {
+    static const char PREFIX[] = "sha256:";
+    static const size_t PREFIX_LEN = sizeof(PREFIX) - 1;
+
+    if (checksum.size() != PREFIX_LEN + PAYLOAD_DIGEST_SIZE * 2 ||
+        checksum.compare(0, PREFIX_LEN, PREFIX) != 0) {
+        return false;
+    }
+
+    const char* hex = checksum.c_str() + PREFIX_LEN;
+    for (size_t i = 0; i < PAYLOAD_DIGEST_SIZE; i++) {
+        int hi = hexValue(hex[i * 2]);
+        int lo = hexValue(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        digest[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return true;
+}
+
+bool PayloadVerifier::readCache(const char* path, uint32_t size, int64_t mtime,
+                                uint8_t digest[PAYLOAD_DIGEST_SIZE], PayloadStreamStats* stats) {
+    DigestRecord record;
+    if (!loadRecord(path, record)) {
+        return false;
+    }
+
+    if (record.size != size || record.mtime != mtime) {
+        return false;
+    }
+
+    memcpy(digest, record.digest, PAYLOAD_DIGEST_SIZE);
+    stats->stored_size = record.size;
+    stats->raw_size = record.raw_size;
+    stats->decode_us = record.decode_us;
+    return true;
+}
+
+bool PayloadVerifier::writeCache(const char* path, int64_t mtime, const uint8_t digest[PAYLOAD_DIGEST_SIZE],
+                                 const PayloadStreamStats& stats) {
+    DigestRecord record = {};
+    record.magic = DIGEST_MAGIC;
+    record.version = DIGEST_VERSION;
+    record.size = stats.stored_size;
+    record.mtime = mtime;
+    record.raw_size = stats.raw_size;
+    record.decode_us = stats.decode_us;
+    memcpy(record.digest, digest, PAYLOAD_DIGEST_SIZE);
+    record.crc = esp_rom_crc32_le(0, (const uint8_t*)&record, offsetof(DigestRecord, crc));
+
+    if (!StorageManager::getInstance().writeFile(path, (const uint8_t*)&record, sizeof(record))) {
+        ESP_LOGW(TAG, "Failed to store digest record %s", path);
+        return false;
+    }
+    return true;
+}
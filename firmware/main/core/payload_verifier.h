@@ -0,0 +1,40 @@
+#ifndef PAYLOAD_VERIFIER_H
+#define PAYLOAD_VERIFIER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "../include/types.h"
+#include "payload_stream.h"
+
+// Checks payload binaries against the manifest's "sha256:<hex>" checksum
+// and size, both of which describe the payload as the runtime sees it.
+//
+// The payload is hashed as a stream through a small fixed buffer, inflated
+// on the way if it was stored compressed (SHA-256 via mbedTLS, which uses
+// the ESP32 SHA accelerator). A verified digest is stored next to the
+// payload together with the stored size and mtime, so later launches only
+// stat the payload and read that record; it is re-hashed only when it
+// changed. The record also keeps the inflated size and inflate time for
+// reporting.
+class PayloadVerifier {
+public:
+    static bool verify(const char* payload_id, const PayloadManifest& manifest);
+    static void invalidate(const char* payload_id);
+
+    // Sizes and inflate time recorded by the last successful verification
+    static bool getStats(const char* payload_id, PayloadStreamStats& stats);
+
+    static bool hashStream(PayloadStream& stream, uint8_t digest[PAYLOAD_DIGEST_SIZE]);
+    static bool parseChecksum(const std::string& checksum, uint8_t digest[PAYLOAD_DIGEST_SIZE]);
+
+private:
+    static constexpr size_t CHUNK_SIZE = 512;
+
+    static bool readCache(const char* path, uint32_t size, int64_t mtime,
+                          uint8_t digest[PAYLOAD_DIGEST_SIZE], PayloadStreamStats* stats);
+    static bool writeCache(const char* path, int64_t mtime, const uint8_t digest[PAYLOAD_DIGEST_SIZE],
+                           const PayloadStreamStats& stats);
+};
+
+#endif // PAYLOAD_VERIFIER_H
@@ -1,108 +1,459 @@
 #include "plugin_manager.h"
 #include "storage_manager.h"
 #include "payload_loader.h"
+#include "manifest_parser.h"
+#include "payload_supervisor.h"
+#include "payload_arena.h"
+#include "payload_verifier.h"
+#include "blob_store.h"
+#include "subsystem_manager.h"
+#include "mbedtls/sha256.h"
 #include "esp_log.h"
 #include <string.h>
 #include "esp_timer.h"
-#include "cJSON.h"
 #include "esp_system.h"
 
 static const char* TAG = "PluginManager";
 
 bool PluginManager::initialize() {
     ESP_LOGI(TAG, "Initializing Plugin Manager");
-    manifests_.clear();
-    contexts_.clear();
-    return true;
+    
+    if (!write_lock_) {
+        write_lock_ = xSemaphoreCreateRecursiveMutex();
+        if (!write_lock_) {
+            ESP_LOGE(TAG, "Failed to create registry lock");
+            return false;
+        }
+    }
+    
+    BlobStore::getInstance().initialize();
+    
+    lockWriter();
+    index_.clear();
+    for (auto& slot : contexts_) {
+        releaseResources(slot.context.payload_id, slot.context);
+        slot.context = PayloadContext();
+        slot.params.clear();
+    }
+    publishCatalog();
+    portENTER_CRITICAL(&status_lock_);
+    status_seq_.fetch_add(1, std::memory_order_relaxed);
+    memset(status_, 0, sizeof(status_));
+    status_seq_.fetch_add(1, std::memory_order_release);
+    portEXIT_CRITICAL(&status_lock_);
+    unlockWriter();
+    
+    return PayloadSupervisor::getInstance().initialize();
 }
 
-int PluginManager::scanPayloads() {
+int PluginManager::scanPayloads(bool force_rescan) {
+    lockWriter();
+    
+    // Fast path: trust the persisted index, which install/uninstall keep current
+    if (!force_rescan && index_.load()) {
+        int count = index_.entries().size();
+        publishCatalog();
+        unlockWriter();
+        ESP_LOGI(TAG, "Found %d valid payloads (from index)", count);
+        return count;
+    }
+    
     ESP_LOGI(TAG, "Scanning for payloads...");
     
     auto& storage = StorageManager::getInstance();
     auto payload_dirs = storage.listDirectory(PAYLOAD_BASE_PATH);
     
+    // Drop index entries whose payload directory no longer exists
+    std::vector<std::string> stale;
+    for (const auto& pair : index_.entries()) {
+        bool found = false;
+        for (const auto& dir : payload_dirs) {
+            if (dir == pair.first) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            stale.push_back(pair.first);
+        }
+    }
+    for (const auto& id : stale) {
+        index_.remove(id);
+    }
+    
+    // Only re-parse manifests whose mtime/size changed since they were indexed
     int count = 0;
     for (const auto& dir : payload_dirs) {
+        ManifestStamp stamp;
+        if (dir.size() >= MAX_PAYLOAD_ID_LEN || !readManifestStamp(dir.c_str(), stamp)) {
+            index_.remove(dir);
+            continue;
+        }
+        
+        const PayloadIndexEntry* entry = index_.find(dir);
+        if (entry && entry->stamp == stamp) {
+            count++;
+            continue;
+        }
+        
+        // A manifest that no longer parses must not keep its old entry
         PayloadManifest manifest;
-        if (loadManifest(dir.c_str(), manifest)) {
-            if (validateManifest(manifest)) {
-                manifests_[dir] = manifest;
-                count++;
-                ESP_LOGI(TAG, "Loaded payload: %s (%s)", manifest.name.c_str(), dir.c_str());
-            } else {
-                ESP_LOGW(TAG, "Invalid manifest for payload: %s", dir.c_str());
-            }
+        if (!loadManifest(dir.c_str(), manifest)) {
+            index_.remove(dir);
+            continue;
         }
+        if (validateManifest(manifest)) {
+            index_.put(dir, stamp, manifest);
+            count++;
+            ESP_LOGI(TAG, "Loaded payload: %s (%s)", manifest.name.c_str(), dir.c_str());
+        } else {
+            index_.remove(dir);
+            ESP_LOGW(TAG, "Invalid manifest for payload: %s", dir.c_str());
+        }
+    }
+    
+    if (index_.isDirty()) {
+        index_.save();
     }
+    publishCatalog();
+    unlockWriter();
     
     ESP_LOGI(TAG, "Found %d valid payloads", count);
     return count;
 }
 
-std::vector<PayloadManifest> PluginManager::getAvailablePayloads() {
-    std::vector<PayloadManifest> payloads;
-    for (const auto& pair : manifests_) {
-        payloads.push_back(pair.second);
+bool PluginManager::refreshPayload(const char* payload_id) {
+    ManifestStamp stamp;
+    PayloadManifest manifest;
+    
+    if (!readManifestStamp(payload_id, stamp) ||
+        !loadManifest(payload_id, manifest) ||
+        !validateManifest(manifest)) {
+        if (index_.remove(payload_id)) {
+            index_.save();
+            publishCatalog();
+        }
+        return false;
+    }
+    
+    // Always replace the entry: an install can rewrite the manifest with
+    // one of the same size within the mtime's one-second resolution
+    index_.put(payload_id, stamp, manifest);
+    index_.save();
+    publishCatalog();
+    ESP_LOGI(TAG, "Indexed payload: %s (%s)", manifest.name.c_str(), payload_id);
+    return true;
+}
+
+bool PluginManager::readManifestStamp(const char* payload_id, ManifestStamp& stamp) {
+    auto& storage = StorageManager::getInstance();
+    std::string manifest_path = storage.getPayloadManifestPath(payload_id);
+    
+    size_t size = 0;
+    int64_t mtime = 0;
+    if (!storage.getFileInfo(manifest_path.c_str(), &size, &mtime)) {
+        return false;
+    }
+    
+    stamp.mtime = mtime;
+    stamp.size = size;
+    return true;
+}
+
+PayloadCatalogRef PluginManager::getCatalog() {
+    // Only the reference count is touched inside the critical section
+    portENTER_CRITICAL(&catalog_lock_);
+    PayloadCatalogRef catalog = catalog_;
+    portEXIT_CRITICAL(&catalog_lock_);
+    
+    if (!catalog) {
+        static const PayloadCatalogRef empty = std::make_shared<const PayloadCatalog>();
+        return empty;
     }
-    return payloads;
+    return catalog;
 }
 
-PayloadManifest* PluginManager::getPayloadManifest(const char* payload_id) {
-    auto it = manifests_.find(payload_id);
-    if (it != manifests_.end()) {
-        return &it->second;
+PayloadManifestRef PluginManager::getPayloadManifest(const char* payload_id) {
+    PayloadCatalogRef catalog = getCatalog();
+    auto it = catalog->manifests.find(payload_id);
+    if (it == catalog->manifests.end()) {
+        return nullptr;
     }
-    return nullptr;
+    // Aliases the catalog, so the manifest stays valid after the next publish
+    return PayloadManifestRef(catalog, &it->second);
+}
+
+void PluginManager::forEachPayload(payload_visitor_t visitor, void* arg) {
+    PayloadCatalogRef catalog = getCatalog();
+    for (const auto& summary : catalog->summaries) {
+        if (!visitor(summary, arg)) {
+            break;
+        }
+    }
+}
+
+// CMD_LIST_PAYLOADS response page, little endian:
+//   u16 total, u16 count, u8 more
+//   count x { str id, str name, str version, str category, u8 type, u32 size }
+// where str is a u8 length followed by the bytes. The client passes the id of
+// the last entry it received as after_id to fetch the next page; ids are
+// sorted, so paging stays consistent across installs and uninstalls.
+size_t PluginManager::listPayloads(const char* after_id, uint8_t* out, size_t capacity) {
+    static const size_t HEADER_SIZE = 5;
+    if (capacity < HEADER_SIZE) {
+        return 0;
+    }
+    
+    PayloadCatalogRef catalog = getCatalog();
+    const auto& summaries = catalog->summaries;
+    
+    // First entry with an id greater than the cursor
+    size_t lo = 0;
+    size_t hi = summaries.size();
+    if (after_id && after_id[0]) {
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (strncmp(summaries[mid].id, after_id, MAX_PAYLOAD_ID_LEN) <= 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+    
+    size_t pos = HEADER_SIZE;
+    size_t count = 0;
+    size_t i = lo;
+    for (; i < summaries.size(); i++) {
+        const PayloadSummary& summary = summaries[i];
+        const char* fields[] = { summary.id, summary.name, summary.version, summary.category };
+        size_t lengths[4];
+        size_t record_size = 1 + 4;
+        for (int f = 0; f < 4; f++) {
+            lengths[f] = strnlen(fields[f], MAX_PAYLOAD_ID_LEN);
+            record_size += 1 + lengths[f];
+        }
+        if (pos + record_size > capacity) {
+            break;
+        }
+        
+        for (int f = 0; f < 4; f++) {
+            out[pos++] = (uint8_t)lengths[f];
+            memcpy(out + pos, fields[f], lengths[f]);
+            pos += lengths[f];
+        }
+        out[pos++] = summary.type;
+        out[pos++] = summary.size & 0xFF;
+        out[pos++] = (summary.size >> 8) & 0xFF;
+        out[pos++] = (summary.size >> 16) & 0xFF;
+        out[pos++] = (summary.size >> 24) & 0xFF;
+        count++;
+    }
+    
+    size_t total = summaries.size();
+    out[0] = total & 0xFF;
+    out[1] = (total >> 8) & 0xFF;
+    out[2] = count & 0xFF;
+    out[3] = (count >> 8) & 0xFF;
+    out[4] = i < summaries.size() ? 1 : 0;
+    return pos;
 }
 
-bool PluginManager::installPayload(const char* payload_id, const uint8_t* data, size_t size) {
-    ESP_LOGI(TAG, "Installing payload: %s (%d bytes)", payload_id, size);
+bool PluginManager::beginInstall(const char* payload_id, size_t total_size,
+                                 const uint8_t* digest, size_t* resume_offset) {
+    ESP_LOGI(TAG, "Installing payload: %s (%u bytes)", payload_id, (unsigned)total_size);
     
+    // Space already taken by a partial upload counts towards the budget;
+    // content that is already stored needs none
     auto& storage = StorageManager::getInstance();
+    auto& blobs = BlobStore::getInstance();
+    size_t available = 0;
+    if (blobs.isAvailable() && digest && blobs.contains(digest, total_size)) {
+        available = total_size;
+    } else if (blobs.isAvailable()) {
+        available = blobs.getFreeSpace();
+    } else {
+        std::string part_path = storage.getPayloadPartPath(payload_id);
+        size_t partial = 0;
+        storage.getFileInfo(part_path.c_str(), &partial, nullptr);
+        available = storage.getFreeSpace() + partial;
+    }
+    if (total_size > available) {
+        ESP_LOGE(TAG, "Not enough storage for %s", payload_id);
+        return false;
+    }
     
-    // Create payload directory
-    std::string payload_dir = storage.getPayloadPath(payload_id);
-    if (!storage.createDirectory(payload_dir.c_str())) {
-        ESP_LOGE(TAG, "Failed to create payload directory");
+    lockWriter();
+    
+    // A running payload may be executing from its stored image
+    ContextSlot* slot = findContext(payload_id);
+    if (slot && isActive(slot->context)) {
+        ESP_LOGE(TAG, "Stop %s before reinstalling it", payload_id);
+        unlockWriter();
         return false;
     }
     
-    // Write payload data
-    std::string payload_path = storage.getPayloadDataPath(payload_id);
-    if (!storage.writeFile(payload_path.c_str(), data, size)) {
-        ESP_LOGE(TAG, "Failed to write payload data");
+    InstallSession* session = findSession(payload_id);
+    if (!session) {
+        // Take an idle session, or the least recently used one if every
+        // session is busy
+        for (auto& candidate : sessions_) {
+            if (!candidate.isActive()) {
+                session = &candidate;
+                break;
+            }
+            if (!session || candidate.lastUsed() < session->lastUsed()) {
+                session = &candidate;
+            }
+        }
+        if (session->isActive()) {
+            ESP_LOGW(TAG, "Dropping stalled upload of %s", session->payloadId());
+            session->abort();
+        }
+    }
+    
+    bool ok = session->begin(payload_id, total_size, digest, resume_offset);
+    unlockWriter();
+    return ok;
+}
+
+bool PluginManager::writeInstallChunk(const char* payload_id, size_t offset, const uint8_t* data, size_t length) {
+    lockWriter();
+    InstallSession* session = findSession(payload_id);
+    bool ok = session && session->write(offset, data, length);
+    unlockWriter();
+    return ok;
+}
+
+bool PluginManager::writeInstallManifest(const char* payload_id, const uint8_t* manifest, size_t length) {
+    lockWriter();
+    InstallSession* session = findSession(payload_id);
+    bool ok = session && session->writeManifest(manifest, length);
+    unlockWriter();
+    return ok;
+}
+
+bool PluginManager::commitInstall(const char* payload_id) {
+    lockWriter();
+    
+    InstallSession* session = findSession(payload_id);
+    bool linked = session && session->isLinked();
+    if (!session || !session->commit()) {
+        ESP_LOGE(TAG, "Failed to commit upload of %s", payload_id);
+        unlockWriter();
+        return false;
+    }
+    
+    // Index just this payload instead of rescanning everything. A linked
+    // blob keeps its generation, so an unchanged reinstall keeps its digest.
+    auto& storage = StorageManager::getInstance();
+    if (!linked) {
+        PayloadVerifier::invalidate(payload_id);
+    }
+    bool ok = refreshPayload(payload_id);
+    if (!ok) {
+        ESP_LOGE(TAG, "Payload has no valid manifest, removing");
+    } else {
+        // Hash once now so the first launch finds a verified digest
+        const PayloadIndexEntry* entry = index_.find(payload_id);
+        ok = entry && PayloadVerifier::verify(payload_id, entry->manifest);
+        if (!ok) {
+            ESP_LOGE(TAG, "Payload failed verification, removing");
+        }
+    }
+    if (!ok) {
+        std::string payload_dir = storage.getPayloadPath(payload_id);
         storage.deleteDirectory(payload_dir.c_str());
+        BlobStore::getInstance().remove(payload_id);
+        if (index_.remove(payload_id)) {
+            index_.save();
+            publishCatalog();
+        }
+        unlockWriter();
         return false;
     }
     
-    ESP_LOGI(TAG, "Payload installed successfully");
+    unlockWriter();
     
-    // Rescan to load manifest
-    scanPayloads();
+    ESP_LOGI(TAG, "Payload installed successfully");
+    return true;
+}
+
+void PluginManager::abortInstall(const char* payload_id) {
+    lockWriter();
+    InstallSession* session = findSession(payload_id);
+    if (session) {
+        session->abort();
+    }
+    unlockWriter();
+}
+
+bool PluginManager::installPayload(const char* payload_id, const char* manifest_json,
+                                   const uint8_t* data, size_t size) {
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    if (mbedtls_sha256(data, size, digest, 0) != 0) {
+        return false;
+    }
     
+    if (!beginInstall(payload_id, size, digest, nullptr)) {
+        return false;
+    }
+    if (!writeInstallManifest(payload_id, (const uint8_t*)manifest_json, strlen(manifest_json)) ||
+        !writeInstallChunk(payload_id, 0, data, size) || !commitInstall(payload_id)) {
+        abortInstall(payload_id);
+        return false;
+    }
     return true;
 }
 
+InstallSession* PluginManager::findSession(const char* payload_id) {
+    for (auto& session : sessions_) {
+        if (session.isActive() && session.isFor(payload_id)) {
+            return &session;
+        }
+    }
+    return nullptr;
+}
+
 bool PluginManager::uninstallPayload(const char* payload_id) {
     ESP_LOGI(TAG, "Uninstalling payload: %s", payload_id);
     
-    // Stop if running
-    if (getPayloadStatus(payload_id) == PAYLOAD_STATUS_RUNNING) {
+    lockWriter();
+    
+    // Stop if running, and drop any upload in progress
+    ContextSlot* slot = findContext(payload_id);
+    if (slot && isActive(slot->context)) {
         stopPayload(payload_id);
     }
+    InstallSession* session = findSession(payload_id);
+    if (session) {
+        session->abort();
+    }
+    
+    // Release the binary; shared content stays for its other payloads.
+    // Only the manifest and digest record remain in the directory.
+    BlobStore::getInstance().remove(payload_id);
     
-    // Delete from storage
     auto& storage = StorageManager::getInstance();
     std::string payload_dir = storage.getPayloadPath(payload_id);
     if (!storage.deleteDirectory(payload_dir.c_str())) {
         ESP_LOGE(TAG, "Failed to delete payload directory");
+        unlockWriter();
         return false;
     }
     
-    // Remove from manifests
-    manifests_.erase(payload_id);
-    contexts_.erase(payload_id);
+    // Remove from index
+    if (index_.remove(payload_id)) {
+        index_.save();
+        publishCatalog();
+    }
+    if (slot) {
+        slot->context = PayloadContext();
+        slot->params.clear();
+    }
+    clearStatus(payload_id);
+    
+    unlockWriter();
     
     ESP_LOGI(TAG, "Payload uninstalled successfully");
     return true;
@@ -112,18 +463,12 @@ bool PluginManager::executePayload(const char* payload_id, const std::map<std::s
     ESP_LOGI(TAG, "Executing payload: %s", payload_id);
     
     // Get manifest
-    PayloadManifest* manifest = getPayloadManifest(payload_id);
+    PayloadManifestRef manifest = getPayloadManifest(payload_id);
     if (!manifest) {
         ESP_LOGE(TAG, "Payload not found: %s", payload_id);
         return false;
     }
     
-    // Check if already running
-    if (getPayloadStatus(payload_id) == PAYLOAD_STATUS_RUNNING) {
-        ESP_LOGW(TAG, "Payload already running: %s", payload_id);
-        return false;
-    }
-    
     // Check requirements
     if (!checkRequirements(*manifest)) {
         ESP_LOGE(TAG, "Requirements check failed");
@@ -136,28 +481,112 @@ bool PluginManager::executePayload(const char* payload_id, const std::map<std::s
         return false;
     }
     
-    // Create context
-    PayloadContext context;
-    context.manifest = *manifest;
-    context.status = PAYLOAD_STATUS_LOADING;
-    context.runtime_handle = nullptr;
-    context.user_data = nullptr;
-    context.memory_allocated = 0;
-    context.memory_limit = manifest->requirements.memory_kb * 1024;
-    context.start_time = esp_timer_get_time() / 1000;
-    context.cpu_time_limit = MAX_EXECUTION_TIME_MS;
+    // Verify the binary; a stat and a small record read unless it changed
+    if (!PayloadVerifier::verify(payload_id, *manifest)) {
+        ESP_LOGE(TAG, "Payload verification failed");
+        return false;
+    }
     
-    contexts_[payload_id] = context;
+    lockWriter();
     
-    // Load and execute payload
-    bool success = PayloadLoader::getInstance().loadAndExecute(payload_id, &contexts_[payload_id], params);
+    // Check if already running, or finished but not yet reaped by supervise()
+    ContextSlot* slot = findContext(payload_id);
+    if (slot && isActive(slot->context)) {
+        ESP_LOGW(TAG, "Payload already running: %s", payload_id);
+        unlockWriter();
+        return false;
+    }
+    if (!slot) {
+        slot = claimContext();
+    }
+    if (!slot) {
+        ESP_LOGE(TAG, "Too many active payloads");
+        unlockWriter();
+        return false;
+    }
+    
+    // Memory limit: manifest value, defaulted and capped
+    size_t memory_limit = manifest->requirements.memory_kb * 1024;
+    if (memory_limit == 0) memory_limit = DEFAULT_PAYLOAD_MEMORY_KB * 1024;
+    if (memory_limit > MAX_MEMORY_PER_PAYLOAD) memory_limit = MAX_MEMORY_PER_PAYLOAD;
+    
+    // Reset the slot in place; the manifest is shared with the catalog
+    PayloadContext& ctx = slot->context;
+    ctx.status = PAYLOAD_STATUS_LOADING;
+    ctx.core_id = -1;
+    ctx.task_handle = nullptr;
+    ctx.arena = nullptr;
+    ctx.memory_allocated = 0;
+    ctx.memory_peak = 0;
+    ctx.memory_limit = memory_limit;
+    ctx.start_time = esp_timer_get_time() / 1000;
+    ctx.cpu_time_limit = MAX_EXECUTION_TIME_MS;
+    ctx.runtime_handle = nullptr;
+    strncpy(ctx.payload_id, payload_id, MAX_PAYLOAD_ID_LEN - 1);
+    ctx.payload_id[MAX_PAYLOAD_ID_LEN - 1] = '\0';
+    ctx.manifest = std::move(manifest);
+    ctx.image = nullptr;
+    ctx.image_size = 0;
+    ctx.image_handle = 0;
+    ctx.subsystems = 0;
+    ctx.user_data = nullptr;
+    ctx.log_callback = nullptr;
+    ctx.status_callback = nullptr;
+    ctx.output_callback = nullptr;
+    
+    // Reserve the payload's private heap
+    ctx.arena = &slot->arena;
+    if (!ctx.arena->create(&ctx, memory_limit)) {
+        ESP_LOGE(TAG, "Failed to reserve payload memory");
+        releaseResources(payload_id, ctx);
+        ctx.status = PAYLOAD_STATUS_ERROR;
+        publishStatus(payload_id, ctx);
+        unlockWriter();
+        return false;
+    }
+    
+    // Bring up the radios and peripherals the manifest asks for; they are
+    // shut down again once no running payload holds them
+    uint32_t subsystems = SubsystemManager::maskForManifest(*ctx.manifest);
+    if (!SubsystemManager::getInstance().acquireMask(subsystems)) {
+        ESP_LOGE(TAG, "Failed to start the APIs %s needs", payload_id);
+        releaseResources(payload_id, ctx);
+        ctx.status = PAYLOAD_STATUS_ERROR;
+        publishStatus(payload_id, ctx);
+        unlockWriter();
+        return false;
+    }
+    ctx.subsystems = subsystems;
+    
+    // Arm the execution deadline before the task starts, so a payload that
+    // finishes immediately still has its completion event delivered. A
+    // payload never runs without its deadline.
+    if (!PayloadSupervisor::getInstance().watch(payload_id, &ctx)) {
+        ESP_LOGE(TAG, "Failed to supervise %s", payload_id);
+        releaseResources(payload_id, ctx);
+        ctx.status = PAYLOAD_STATUS_ERROR;
+        publishStatus(payload_id, ctx);
+        unlockWriter();
+        return false;
+    }
+    
+    // Load and execute payload; the slot keeps params alive for the task
+    slot->params = params;
+    bool success = PayloadLoader::getInstance().loadAndExecute(payload_id, &ctx, slot->params);
     
     if (!success) {
         ESP_LOGE(TAG, "Failed to execute payload");
-        contexts_[payload_id].status = PAYLOAD_STATUS_ERROR;
+        PayloadSupervisor::getInstance().unwatch(payload_id);
+        releaseResources(payload_id, ctx);
+        ctx.status = PAYLOAD_STATUS_ERROR;
+        publishStatus(payload_id, ctx);
+        unlockWriter();
         return false;
     }
     
+    publishStatus(payload_id, ctx);
+    unlockWriter();
+    
     ESP_LOGI(TAG, "Payload execution started successfully");
     return true;
 }
@@ -165,153 +594,275 @@ bool PluginManager::executePayload(const char* payload_id, const std::map<std::s
 bool PluginManager::stopPayload(const char* payload_id) {
     ESP_LOGI(TAG, "Stopping payload: %s", payload_id);
     
-    auto it = contexts_.find(payload_id);
-    if (it == contexts_.end()) {
+    lockWriter();
+    
+    ContextSlot* slot = findContext(payload_id);
+    if (!slot) {
         ESP_LOGW(TAG, "Payload context not found: %s", payload_id);
+        unlockWriter();
         return false;
     }
     
-    PayloadLoader::getInstance().stop(payload_id, &it->second);
-    it->second.status = PAYLOAD_STATUS_COMPLETED;
+    PayloadSupervisor::getInstance().unwatch(payload_id);
+    PayloadLoader::getInstance().stop(payload_id, &slot->context);
+    releaseResources(payload_id, slot->context);
+    slot->context.status = PAYLOAD_STATUS_COMPLETED;
+    publishStatus(payload_id, slot->context);
+    
+    unlockWriter();
     
     ESP_LOGI(TAG, "Payload stopped");
     return true;
 }
 
-PayloadContext* PluginManager::getPayloadContext(const char* payload_id) {
-    auto it = contexts_.find(payload_id);
-    if (it != contexts_.end()) {
-        return &it->second;
-    }
-    return nullptr;
-}
-
 payload_status_t PluginManager::getPayloadStatus(const char* payload_id) {
-    PayloadContext* ctx = getPayloadContext(payload_id);
-    return ctx ? ctx->status : PAYLOAD_STATUS_IDLE;
+    PayloadStatusEntry entry;
+    return getPayloadStatusEntry(payload_id, entry) ? entry.status : PAYLOAD_STATUS_IDLE;
 }
 
-void PluginManager::update() {
-    // Check running payloads for timeouts and errors
-    for (auto& pair : contexts_) {
-        PayloadContext& ctx = pair.second;
+bool PluginManager::getPayloadStatusEntry(const char* payload_id, PayloadStatusEntry& entry) {
+    // Seqlock read: never blocks, retries if a publish overlapped the copy
+    while (true) {
+        uint32_t seq = status_seq_.load(std::memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
         
-        if (ctx.status == PAYLOAD_STATUS_RUNNING) {
-            uint64_t elapsed = (esp_timer_get_time() / 1000) - ctx.start_time;
-            
-            // Check execution time limit
-            if (elapsed > ctx.cpu_time_limit) {
-                ESP_LOGW(TAG, "Payload timeout: %s", pair.first.c_str());
-                stopPayload(pair.first.c_str());
-            }
-            
-            // Check memory limit
-            if (ctx.memory_allocated > ctx.memory_limit) {
-                ESP_LOGW(TAG, "Payload memory exceeded: %s", pair.first.c_str());
-                stopPayload(pair.first.c_str());
+        bool found = false;
+        for (int i = 0; i < MAX_PAYLOADS; i++) {
+            if (strncmp(status_[i].payload_id, payload_id, MAX_PAYLOAD_ID_LEN) == 0) {
+                memcpy(&entry, &status_[i], sizeof(entry));
+                found = true;
+                break;
             }
         }
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (status_seq_.load(std::memory_order_relaxed) == seq) {
+            return found && entry.payload_id[0] != '\0';
+        }
     }
 }
 
-bool PluginManager::loadManifest(const char* payload_id, PayloadManifest& manifest) {
-    auto& storage = StorageManager::getInstance();
-    std::string manifest_path = storage.getPayloadManifestPath(payload_id);
-    
-    // Check if manifest exists
-    if (!storage.fileExists(manifest_path.c_str())) {
-        ESP_LOGW(TAG, "Manifest not found: %s", manifest_path.c_str());
-        return false;
+bool PluginManager::getPayloadStorageStats(const char* payload_id, PayloadStreamStats& stats) {
+    // Recorded by the last verification, which inflates the whole payload
+    return PayloadVerifier::getStats(payload_id, stats);
+}
+
+void PluginManager::supervise(TickType_t timeout) {
+    SupervisorEvent event;
+    if (!PayloadSupervisor::getInstance().waitForEvent(event, timeout)) {
+        return;
     }
     
-    // Read manifest file
-    uint8_t buffer[4096];
-    int size = storage.readFile(manifest_path.c_str(), buffer, sizeof(buffer));
-    if (size <= 0) {
-        ESP_LOGE(TAG, "Failed to read manifest: %s", manifest_path.c_str());
-        return false;
-    }
+    lockWriter();
     
-    buffer[size] = '\0';
+    ContextSlot* slot = findContext(event.payload_id);
+    if (!slot) {
+        unlockWriter();
+        return;
+    }
     
-    // Parse JSON
-    cJSON* root = cJSON_Parse((const char*)buffer);
-    if (!root) {
-        ESP_LOGE(TAG, "Failed to parse manifest JSON");
-        return false;
+    if (event.reason == SUPERVISOR_EVENT_COMPLETED) {
+        ESP_LOGI(TAG, "Payload finished: %s", event.payload_id);
+        PayloadSupervisor::getInstance().unwatch(event.payload_id);
+        releaseResources(event.payload_id, slot->context);
+        publishStatus(event.payload_id, slot->context);
+        unlockWriter();
+        return;
     }
     
-    // Extract fields
-    cJSON* id = cJSON_GetObjectItem(root, "id");
-    cJSON* name = cJSON_GetObjectItem(root, "name");
-    cJSON* version = cJSON_GetObjectItem(root, "version");
+    if (slot->context.status != PAYLOAD_STATUS_RUNNING) {
+        unlockWriter();
+        return;
+    }
     
-    if (!id || !name || !version) {
-        ESP_LOGE(TAG, "Missing required fields in manifest");
-        cJSON_Delete(root);
-        return false;
+    switch (event.reason) {
+        case SUPERVISOR_EVENT_TIMEOUT:
+            ESP_LOGW(TAG, "Payload timeout: %s", event.payload_id);
+            break;
+        case SUPERVISOR_EVENT_MEMORY_EXCEEDED:
+            ESP_LOGW(TAG, "Payload memory exceeded: %s", event.payload_id);
+            break;
+        default:
+            break;
     }
     
-    manifest.id = id->valuestring;
-    manifest.name = name->valuestring;
-    manifest.version = version->valuestring;
+    stopPayload(event.payload_id);
+    unlockWriter();
+}
+
+void PluginManager::releaseResources(const char* payload_id, PayloadContext& context) {
+    if (context.image) {
+        PayloadImage image = { context.image, context.image_size, context.image_handle };
+        BlobStore::unmap(image);
+        context.image = nullptr;
+        context.image_size = 0;
+    }
     
-    // Optional fields
-    cJSON* author = cJSON_GetObjectItem(root, "author");
-    if (author) manifest.author = author->valuestring;
+    if (context.subsystems) {
+        SubsystemManager::getInstance().releaseMask(context.subsystems);
+        context.subsystems = 0;
+    }
     
-    cJSON* description = cJSON_GetObjectItem(root, "description");
-    if (description) manifest.description = description->valuestring;
+    if (!context.arena) {
+        return;
+    }
     
-    cJSON* category = cJSON_GetObjectItem(root, "category");
-    if (category) manifest.category = category->valuestring;
+    ESP_LOGI(TAG, "Payload %s memory: peak %u of %u bytes", payload_id,
+             (unsigned)context.memory_peak, (unsigned)context.memory_limit);
+    if (context.arena->regionFailures()) {
+        ESP_LOGW(TAG, "Payload %s: %u allocations within its limit found no room in the arena",
+                 payload_id, (unsigned)context.arena->regionFailures());
+    }
     
-    // Payload info
-    cJSON* payload_obj = cJSON_GetObjectItem(root, "payload");
-    if (payload_obj) {
-        cJSON* type = cJSON_GetObjectItem(payload_obj, "type");
-        if (type && strcmp(type->valuestring, "native") == 0) {
-            manifest.payload.type = PAYLOAD_TYPE_NATIVE;
-        } else if (type && strcmp(type->valuestring, "micropython") == 0) {
-            manifest.payload.type = PAYLOAD_TYPE_MICROPYTHON;
-        } else if (type && strcmp(type->valuestring, "lua") == 0) {
-            manifest.payload.type = PAYLOAD_TYPE_LUA;
+    // The whole arena goes back to the heap as one block
+    context.arena->destroy();
+    context.arena = nullptr;
+    context.memory_allocated = 0;
+}
+
+bool PluginManager::isActive(const PayloadContext& context) {
+    // The arena is held until supervise() reaps the payload task, so a
+    // context that still owns one must not be reused or erased yet
+    return context.status == PAYLOAD_STATUS_LOADING ||
+           context.status == PAYLOAD_STATUS_RUNNING ||
+           context.arena != nullptr;
+}
+
+PluginManager::ContextSlot* PluginManager::findContext(const char* payload_id) {
+    for (auto& slot : contexts_) {
+        if (slot.context.payload_id[0] &&
+            strncmp(slot.context.payload_id, payload_id, MAX_PAYLOAD_ID_LEN) == 0) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+PluginManager::ContextSlot* PluginManager::claimContext() {
+    // Prefer a never-used slot so finished runs keep their state longest
+    ContextSlot* idle = nullptr;
+    for (auto& slot : contexts_) {
+        if (!slot.context.payload_id[0]) {
+            return &slot;
         }
+        if (!idle && !isActive(slot.context)) {
+            idle = &slot;
+        }
+    }
+    if (idle) {
+        idle->context = PayloadContext();
+    }
+    return idle;
+}
+
+void PluginManager::lockWriter() {
+    xSemaphoreTakeRecursive(write_lock_, portMAX_DELAY);
+}
+
+void PluginManager::unlockWriter() {
+    xSemaphoreGiveRecursive(write_lock_);
+}
+
+void PluginManager::publishCatalog() {
+    auto catalog = std::make_shared<PayloadCatalog>();
+    catalog->summaries.reserve(index_.entries().size());
+    for (const auto& pair : index_.entries()) {
+        const PayloadManifest& manifest = pair.second.manifest;
+        catalog->manifests.emplace(pair.first, manifest);
         
-        cJSON* entry = cJSON_GetObjectItem(payload_obj, "entry");
-        if (entry) manifest.payload.entry = entry->valuestring;
+        PayloadSummary summary = {};
+        strncpy(summary.id, pair.first.c_str(), sizeof(summary.id) - 1);
+        strncpy(summary.name, manifest.name.c_str(), sizeof(summary.name) - 1);
+        strncpy(summary.version, manifest.version.c_str(), sizeof(summary.version) - 1);
+        strncpy(summary.category, manifest.category.c_str(), sizeof(summary.category) - 1);
+        summary.type = manifest.payload.type;
+        summary.size = manifest.payload.size;
+        catalog->summaries.push_back(summary);
     }
     
-    // Requirements
-    cJSON* requirements = cJSON_GetObjectItem(root, "requirements");
-    if (requirements) {
-        cJSON* memory = cJSON_GetObjectItem(requirements, "memory_kb");
-        if (memory) manifest.requirements.memory_kb = memory->valueint;
-        
-        cJSON* storage = cJSON_GetObjectItem(requirements, "storage_kb");
-        if (storage) manifest.requirements.storage_kb = storage->valueint;
-    }
-    
-    // Permissions
-    cJSON* permissions = cJSON_GetObjectItem(root, "permissions");
-    if (permissions) {
-        manifest.permissions = 0;
-        cJSON* perm = permissions->child;
-        while (perm) {
-            if (strcmp(perm->valuestring, "wifi_scan") == 0) {
-                manifest.permissions |= PERM_WIFI_SCAN;
-            } else if (strcmp(perm->valuestring, "wifi_inject") == 0) {
-                manifest.permissions |= PERM_WIFI_INJECT;
-            } else if (strcmp(perm->valuestring, "ble_scan") == 0) {
-                manifest.permissions |= PERM_BLE_SCAN;
-            } else if (strcmp(perm->valuestring, "gpio_write") == 0) {
-                manifest.permissions |= PERM_GPIO_WRITE;
-            }
-            perm = perm->next;
+    PayloadCatalogRef next = catalog;
+    portENTER_CRITICAL(&catalog_lock_);
+    catalog_.swap(next);
+    portEXIT_CRITICAL(&catalog_lock_);
+    // The previous catalog is freed here, outside the critical section,
+    // unless a reader still holds it
+}
+
+void PluginManager::publishStatus(const char* payload_id, const PayloadContext& context) {
+    // Reuse this payload's entry, else a free one, else one that is not running
+    int slot = -1;
+    int free_slot = -1;
+    int idle_slot = -1;
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (strncmp(status_[i].payload_id, payload_id, MAX_PAYLOAD_ID_LEN) == 0) {
+            slot = i;
+            break;
         }
+        if (status_[i].payload_id[0] == '\0') {
+            if (free_slot < 0) free_slot = i;
+        } else if (idle_slot < 0 && status_[i].status != PAYLOAD_STATUS_LOADING &&
+                   status_[i].status != PAYLOAD_STATUS_RUNNING) {
+            idle_slot = i;
+        }
+    }
+    if (slot < 0) slot = free_slot >= 0 ? free_slot : idle_slot;
+    if (slot < 0) {
+        ESP_LOGW(TAG, "Status table full, not publishing %s", payload_id);
+        return;
+    }
+    
+    PayloadStatusEntry entry = {};
+    strncpy(entry.payload_id, payload_id, MAX_PAYLOAD_ID_LEN - 1);
+    entry.status = context.status;
+    entry.core_id = context.core_id;
+    entry.start_time = context.start_time;
+    
+    // The critical section keeps the writer from being preempted mid-update,
+    // so a reader on the same core can never spin on an odd sequence
+    portENTER_CRITICAL(&status_lock_);
+    status_seq_.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    status_[slot] = entry;
+    status_seq_.fetch_add(1, std::memory_order_release);
+    portEXIT_CRITICAL(&status_lock_);
+}
+
+void PluginManager::clearStatus(const char* payload_id) {
+    for (int i = 0; i < MAX_PAYLOADS; i++) {
+        if (strncmp(status_[i].payload_id, payload_id, MAX_PAYLOAD_ID_LEN) == 0) {
+            portENTER_CRITICAL(&status_lock_);
+            status_seq_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            memset(&status_[i], 0, sizeof(status_[i]));
+            status_seq_.fetch_add(1, std::memory_order_release);
+            portEXIT_CRITICAL(&status_lock_);
+            return;
+        }
+    }
+}
+
+bool PluginManager::loadManifest(const char* payload_id, PayloadManifest& manifest) {
+    auto& storage = StorageManager::getInstance();
+    std::string manifest_path = storage.getPayloadManifestPath(payload_id);
+    
+    // Check if manifest exists
+    if (!storage.fileExists(manifest_path.c_str())) {
+        ESP_LOGW(TAG, "Manifest not found: %s", manifest_path.c_str());
+        return false;
+    }
+    
+    // Decode straight from the file; no read buffer or JSON tree needed
+    if (!ManifestParser::parseFile(manifest_path.c_str(), manifest)) {
+        return false;
+    }
+    
+    if (manifest.id.empty() || manifest.name.empty() || manifest.version.empty()) {
+        ESP_LOGE(TAG, "Missing required fields in manifest");
+        return false;
     }
     
-    cJSON_Delete(root);
     return true;
 }
 
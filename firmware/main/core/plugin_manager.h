@@ -4,7 +4,46 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <atomic>
 #include "../include/types.h"
+#include "payload_index.h"
+#include "payload_arena.h"
+#include "install_session.h"
+#include "payload_stream.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Fixed-size listing view of one manifest; longer strings are truncated
+struct PayloadSummary {
+    char id[MAX_PAYLOAD_ID_LEN];
+    char name[32];
+    char version[16];
+    char category[16];
+    uint8_t type;               // payload_type_t
+    uint32_t size;
+};
+
+// Immutable snapshot of the installed payloads. A new catalog is published
+// on every install/uninstall/scan; readers keep the one they fetched alive
+// for as long as they hold the reference.
+struct PayloadCatalog {
+    std::map<std::string, PayloadManifest> manifests;
+    std::vector<PayloadSummary> summaries;  // Contiguous, sorted by id
+};
+typedef std::shared_ptr<const PayloadCatalog> PayloadCatalogRef;
+
+// Return false to stop iterating
+typedef bool (*payload_visitor_t)(const PayloadSummary& summary, void* arg);
+typedef std::shared_ptr<const PayloadManifest> PayloadManifestRef;
+
+// Published run state of one payload, copied out by lock-free readers
+struct PayloadStatusEntry {
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+    payload_status_t status;
+    int core_id;
+    uint64_t start_time;
+};
 
 class PluginManager {
 public:
@@ -16,22 +55,41 @@ public:
     bool initialize();
     
     // Payload discovery
-    int scanPayloads();
-    std::vector<PayloadManifest> getAvailablePayloads();
-    PayloadManifest* getPayloadManifest(const char* payload_id);
+    int scanPayloads(bool force_rescan = false);
+    PayloadCatalogRef getCatalog();
+    void forEachPayload(payload_visitor_t visitor, void* arg);
+    size_t listPayloads(const char* after_id, uint8_t* out, size_t capacity);
+    PayloadManifestRef getPayloadManifest(const char* payload_id);
     
-    // Payload installation
-    bool installPayload(const char* payload_id, const uint8_t* data, size_t size);
+    // Payload installation. Uploads stream through an install session:
+    // begin, write chunks at increasing offsets and the manifest, then
+    // commit or abort. Commit fails until the manifest has been written.
+    // Passing resume_offset to beginInstall continues an interrupted upload.
+    // With the upload's SHA-256 as digest, content that is already stored
+    // is not transferred again; resume_offset then comes back as total_size.
+    bool beginInstall(const char* payload_id, size_t total_size,
+                      const uint8_t* digest, size_t* resume_offset);
+    bool writeInstallChunk(const char* payload_id, size_t offset, const uint8_t* data, size_t length);
+    bool writeInstallManifest(const char* payload_id, const uint8_t* manifest, size_t length);
+    bool commitInstall(const char* payload_id);
+    void abortInstall(const char* payload_id);
+    bool installPayload(const char* payload_id, const char* manifest_json,
+                        const uint8_t* data, size_t size);
     bool uninstallPayload(const char* payload_id);
     
     // Payload execution
     bool executePayload(const char* payload_id, const std::map<std::string, std::string>& params);
     bool stopPayload(const char* payload_id);
-    PayloadContext* getPayloadContext(const char* payload_id);
+    
+    // Lock-free status reads; safe from any task
     payload_status_t getPayloadStatus(const char* payload_id);
+    bool getPayloadStatusEntry(const char* payload_id, PayloadStatusEntry& entry);
+    
+    // Stored vs. inflated size and inflate time of a verified payload
+    bool getPayloadStorageStats(const char* payload_id, PayloadStreamStats& stats);
     
-    // Update loop
-    void update();
+    // Supervision: blocks until a payload hits a limit or the timeout expires
+    void supervise(TickType_t timeout);
     
 private:
     PluginManager() = default;
@@ -39,13 +97,45 @@ private:
     PluginManager(const PluginManager&) = delete;
     PluginManager& operator=(const PluginManager&) = delete;
     
+    bool refreshPayload(const char* payload_id);
+    InstallSession* findSession(const char* payload_id);
+    bool readManifestStamp(const char* payload_id, ManifestStamp& stamp);
     bool loadManifest(const char* payload_id, PayloadManifest& manifest);
     bool validateManifest(const PayloadManifest& manifest);
     bool checkPermissions(const PayloadManifest& manifest);
     bool checkRequirements(const PayloadManifest& manifest);
+    // Run state for one payload. Slots are fixed so starting a payload
+    // does not allocate and the context never moves under its task.
+    struct ContextSlot {
+        PayloadContext context;
+        PayloadArena arena;
+        std::map<std::string, std::string> params;
+    };
+    
+    ContextSlot* findContext(const char* payload_id);
+    ContextSlot* claimContext();
+    void releaseResources(const char* payload_id, PayloadContext& context);
+    bool isActive(const PayloadContext& context);
+    
+    // Writer side: install/uninstall/start/stop/scan all hold write_lock_
+    void lockWriter();
+    void unlockWriter();
+    void publishCatalog();
+    void publishStatus(const char* payload_id, const PayloadContext& context);
+    void clearStatus(const char* payload_id);
+    
+    PayloadIndex index_;
+    ContextSlot contexts_[MAX_PAYLOADS];
+    InstallSession sessions_[MAX_INSTALL_SESSIONS];
+    SemaphoreHandle_t write_lock_ = nullptr;
+    
+    PayloadCatalogRef catalog_;
+    portMUX_TYPE catalog_lock_ = portMUX_INITIALIZER_UNLOCKED;
     
-    std::map<std::string, PayloadManifest> manifests_;
-    std::map<std::string, PayloadContext> contexts_;
+    // Seqlock over status_: odd while a writer is mid-update
+    PayloadStatusEntry status_[MAX_PAYLOADS] = {};
+    std::atomic<uint32_t> status_seq_{0};
+    portMUX_TYPE status_lock_ = portMUX_INITIALIZER_UNLOCKED;
 };
 
 #endif // PLUGIN_MANAGER_H
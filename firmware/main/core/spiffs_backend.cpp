@@ -0,0 +1,45 @@
+#include "spiffs_backend.h"
+#include "esp_spiffs.h"
+#include "esp_log.h"
+
+static const char* TAG = "SpiffsBackend";
+
+bool SpiffsBackend::mount(const char* base_path, const char* partition_label, int max_files) {
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = base_path,
+        .partition_label = partition_label,
+        .max_files = (size_t)max_files,
+        .format_if_mount_failed = true
+    };
+
+    esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    if (ret != ESP_OK) {
+        if (ret == ESP_FAIL) {
+            ESP_LOGE(TAG, "Failed to mount or format filesystem");
+        } else if (ret == ESP_ERR_NOT_FOUND) {
+            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
+        } else {
+            ESP_LOGE(TAG, "Failed to initialize SPIFFS: %s", esp_err_to_name(ret));
+        }
+        return false;
+    }
+
+    label_ = partition_label;
+    return true;
+}
+
+void SpiffsBackend::unmount() {
+    if (label_) {
+        esp_vfs_spiffs_unregister(label_);
+        label_ = nullptr;
+    }
+}
+
+bool SpiffsBackend::getInfo(size_t* total, size_t* used) {
+    esp_err_t ret = esp_spiffs_info(label_, total, used);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to get SPIFFS partition info: %s", esp_err_to_name(ret));
+        return false;
+    }
+    return true;
+}
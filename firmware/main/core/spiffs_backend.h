@@ -0,0 +1,21 @@
+#ifndef SPIFFS_BACKEND_H
+#define SPIFFS_BACKEND_H
+
+#include "fs_backend.h"
+#include "sdkconfig.h"
+
+class SpiffsBackend : public FsBackend {
+public:
+    const char* name() const override { return "SPIFFS"; }
+    bool mount(const char* base_path, const char* partition_label, int max_files) override;
+    void unmount() override;
+    bool getInfo(size_t* total, size_t* used) override;
+    bool hasDirectories() const override { return false; }
+    bool renameReplaces() const override { return false; }
+    size_t ioBlockSize() const override { return CONFIG_SPIFFS_PAGE_SIZE; }
+
+private:
+    const char* label_ = nullptr;
+};
+
+#endif // SPIFFS_BACKEND_H
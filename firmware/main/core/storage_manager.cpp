@@ -1,46 +1,52 @@
 #include "storage_manager.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <sys/stat.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 static const char* TAG = "StorageManager";
-static const char* BASE_PATH = "/spiffs";
+static const char* PARTITION_LABEL = "storage";
+static const int MAX_OPEN_FILES = 10;
+
+// Cache bounds; a full cache is simply emptied and refilled
+static const size_t MAX_CACHED_STATS = 64;
+static const size_t MAX_CACHED_LISTINGS = 8;
+
+// Listing keys carry the collapse flag in front of the path
+static const char LIST_KEY_FLAT = '-';
+static const char LIST_KEY_COLLAPSED = '+';
+
+// True if path is dir itself or lies below it
+static bool isWithin(const std::string& path, const char* dir, size_t dir_len) {
+    return path.compare(0, dir_len, dir) == 0 &&
+           (path.size() == dir_len || path[dir_len] == '/');
+}
 
 bool StorageManager::initialize() {
-    ESP_LOGI(TAG, "Initializing SPIFFS storage");
-    
-    esp_vfs_spiffs_conf_t conf = {
-        .base_path = BASE_PATH,
-        .partition_label = "storage",
-        .max_files = 10,
-        .format_if_mount_failed = true
-    };
-    
-    esp_err_t ret = esp_vfs_spiffs_register(&conf);
-    
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE(TAG, "Failed to mount or format filesystem");
-        } else if (ret == ESP_ERR_NOT_FOUND) {
-            ESP_LOGE(TAG, "Failed to find SPIFFS partition");
-        } else {
-            ESP_LOGE(TAG, "Failed to initialize SPIFFS: %s", esp_err_to_name(ret));
+    if (!cache_lock_) {
+        cache_lock_ = xSemaphoreCreateMutex();
+        if (!cache_lock_) {
+            ESP_LOGE(TAG, "Failed to create cache lock");
+            return false;
         }
+    }
+    
+    backend_ = &FsBackend::get();
+    ESP_LOGI(TAG, "Initializing %s storage", backend_->name());
+    
+    if (!backend_->mount(STORAGE_BASE_PATH, PARTITION_LABEL, MAX_OPEN_FILES)) {
         return false;
     }
     
     // Get partition info
     size_t total = 0, used = 0;
-    ret = esp_spiffs_info("storage", &total, &used);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to get SPIFFS partition info: %s", esp_err_to_name(ret));
-    } else {
-        total_bytes_ = total;
-        used_bytes_ = used;
-        ESP_LOGI(TAG, "SPIFFS: Total=%d bytes, Used=%d bytes, Free=%d bytes", 
-                 total, used, total - used);
+    if (readUsage(&total, &used)) {
+        ESP_LOGI(TAG, "%s: Total=%d bytes, Used=%d bytes, Free=%d bytes", 
+                 backend_->name(), total, used, total - used);
     }
     
     // Create payloads directory if it doesn't exist
@@ -52,49 +58,114 @@ bool StorageManager::initialize() {
 
 void StorageManager::deinit() {
     if (mounted_) {
-        esp_vfs_spiffs_unregister("storage");
+        backend_->unmount();
         mounted_ = false;
     }
+    
+    xSemaphoreTake(cache_lock_, portMAX_DELAY);
+    stat_cache_.clear();
+    list_cache_.clear();
+    usage_valid_ = false;
+    xSemaphoreGive(cache_lock_);
 }
 
 bool StorageManager::fileExists(const char* path) {
-    struct stat st;
-    return (stat(path, &st) == 0);
+    CachedStat st;
+    return statPath(path, st);
 }
 
 int StorageManager::readFile(const char* path, uint8_t* buffer, size_t max_size) {
-    FILE* f = fopen(path, "rb");
-    if (!f) {
-        ESP_LOGE(TAG, "Failed to open file for reading: %s", path);
+    // One transfer into the caller's buffer; stdio buffering would only
+    // add a copy
+    StorageFile file;
+    if (!openRead(path, file, 0)) {
         return -1;
     }
     
-    size_t bytes_read = fread(buffer, 1, max_size, f);
-    fclose(f);
-    
-    return bytes_read;
+    return file.read(buffer, max_size);
 }
 
 bool StorageManager::writeFile(const char* path, const uint8_t* data, size_t size) {
-    FILE* f = fopen(path, "wb");
-    if (!f) {
-        ESP_LOGE(TAG, "Failed to open file for writing: %s", path);
+    StorageFile file;
+    if (!openWrite(path, file, false, 0)) {
         return false;
     }
     
-    size_t bytes_written = fwrite(data, 1, size, f);
-    fclose(f);
+    bool ok = file.write(data, size);
+    ok = file.close() && ok;
     
-    if (bytes_written != size) {
-        ESP_LOGE(TAG, "Write incomplete: %d of %d bytes", bytes_written, size);
+    if (!ok) {
+        ESP_LOGE(TAG, "Write incomplete: %d of %d bytes", file.stats().bytes, size);
         return false;
     }
     
     return true;
 }
 
+bool StorageManager::openRead(const char* path, StorageFile& file, size_t buffer_size) {
+    if (!openFile(path, "rb", file, buffer_size)) {
+        return false;
+    }
+    getFileInfo(path, &file.size_, nullptr);
+    file.writing_ = false;
+    return true;
+}
+
+bool StorageManager::openWrite(const char* path, StorageFile& file, bool append, size_t buffer_size) {
+    size_t existing = 0;
+    if (append) {
+        getFileInfo(path, &existing, nullptr);
+    }
+    if (!openFile(path, append ? "ab" : "wb", file, buffer_size)) {
+        return false;
+    }
+    invalidate(path);
+    file.size_ = existing;
+    file.writing_ = true;
+    return true;
+}
+
+bool StorageManager::streamFile(const char* path, uint8_t* chunk, size_t chunk_size,
+                                storage_chunk_fn_t fn, void* arg, StorageIoStats* stats) {
+    // The caller's chunk is the only buffer: whole filesystem blocks go
+    // straight into it
+    size_t block = ioBlockSize();
+    if (chunk_size >= block) {
+        chunk_size -= chunk_size % block;
+    }
+    
+    StorageFile file;
+    if (!openRead(path, file, 0)) {
+        return false;
+    }
+    
+    bool ok = true;
+    size_t len;
+    while ((len = file.read(chunk, chunk_size)) > 0) {
+        if (!fn(chunk, len, arg)) {
+            ok = false;
+            break;
+        }
+    }
+    if (file.error_) {
+        ESP_LOGE(TAG, "Read error while streaming %s", path);
+        ok = false;
+    }
+    
+    if (stats) *stats = file.stats();
+    ESP_LOGD(TAG, "Streamed %s: %u bytes at %u B/s", path, (unsigned)file.stats().bytes,
+             (unsigned)file.stats().bytesPerSecond());
+    return ok;
+}
+
+size_t StorageManager::ioBlockSize() const {
+    return backend_ ? backend_->ioBlockSize() : 256;
+}
+
 bool StorageManager::deleteFile(const char* path) {
-    if (unlink(path) != 0) {
+    int ret = unlink(path);
+    invalidate(path);
+    if (ret != 0) {
         ESP_LOGE(TAG, "Failed to delete file: %s", path);
         return false;
     }
@@ -102,20 +173,54 @@ bool StorageManager::deleteFile(const char* path) {
 }
 
 size_t StorageManager::getFileSize(const char* path) {
-    struct stat st;
-    if (stat(path, &st) != 0) {
+    CachedStat st;
+    if (!statPath(path, st)) {
         return 0;
     }
-    return st.st_size;
+    return st.size;
+}
+
+bool StorageManager::getFileInfo(const char* path, size_t* size, int64_t* mtime) {
+    CachedStat st;
+    if (!statPath(path, st)) {
+        return false;
+    }
+    if (size) *size = st.size;
+    if (mtime) *mtime = st.mtime;
+    return true;
+}
+
+bool StorageManager::renameFile(const char* from, const char* to) {
+    // SPIFFS rename fails if the destination exists
+    CachedStat st;
+    if (!backend_->renameReplaces() && statPath(to, st)) {
+        unlink(to);
+    }
+    
+    int ret = rename(from, to);
+    invalidate(from);
+    invalidate(to);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to rename %s -> %s", from, to);
+        return false;
+    }
+    return true;
 }
 
 bool StorageManager::createDirectory(const char* path) {
-    struct stat st;
-    if (stat(path, &st) == 0) {
+    // Flat filesystems create "directories" implicitly with their files
+    if (!backend_->hasDirectories()) {
+        return true;
+    }
+    
+    CachedStat st;
+    if (statPath(path, st)) {
         return true; // Already exists
     }
     
-    if (mkdir(path, 0755) != 0) {
+    int ret = mkdir(path, 0755);
+    invalidate(path);
+    if (ret != 0) {
         ESP_LOGE(TAG, "Failed to create directory: %s", path);
         return false;
     }
@@ -124,14 +229,22 @@ bool StorageManager::createDirectory(const char* path) {
 }
 
 bool StorageManager::deleteDirectory(const char* path) {
-    // Delete all files in directory first
-    auto files = listDirectory(path);
+    // Delete all files in directory first; on a flat filesystem this is
+    // every file under the prefix, which also removes the "directory"
+    auto files = listEntries(path, false);
     for (const auto& file : files) {
         std::string full_path = std::string(path) + "/" + file;
         deleteFile(full_path.c_str());
     }
     
-    if (rmdir(path) != 0) {
+    if (!backend_->hasDirectories()) {
+        invalidate(path);
+        return true;
+    }
+    
+    int ret = rmdir(path);
+    invalidate(path);
+    if (ret != 0) {
         ESP_LOGE(TAG, "Failed to delete directory: %s", path);
         return false;
     }
@@ -140,11 +253,30 @@ bool StorageManager::deleteDirectory(const char* path) {
 }
 
 std::vector<std::string> StorageManager::listDirectory(const char* path) {
+    return listEntries(path, !backend_->hasDirectories());
+}
+
+std::vector<std::string> StorageManager::listEntries(const char* path, bool collapse) {
+    std::string key = std::string(1, collapse ? LIST_KEY_COLLAPSED : LIST_KEY_FLAT) + path;
+    
+    xSemaphoreTake(cache_lock_, portMAX_DELAY);
+    auto cached = list_cache_.find(key);
+    if (cached != list_cache_.end()) {
+        std::vector<std::string> files = cached->second;
+        cache_stats_.list_hits++;
+        cache_stats_.saved_us += list_miss_us_ / cache_stats_.list_misses;
+        xSemaphoreGive(cache_lock_);
+        return files;
+    }
+    
+    // Read under the lock so a concurrent write cannot be missed
+    int64_t start = esp_timer_get_time();
     std::vector<std::string> files;
     
     DIR* dir = opendir(path);
     if (!dir) {
         ESP_LOGE(TAG, "Failed to open directory: %s", path);
+        xSemaphoreGive(cache_lock_);
         return files;
     }
     
@@ -154,27 +286,179 @@ std::vector<std::string> StorageManager::listDirectory(const char* path) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
+        
+        // A flat filesystem returns "child/file" for nested files; report
+        // each first-level name once, as a real directory listing would
+        if (collapse) {
+            const char* slash = strchr(entry->d_name, '/');
+            std::string name = slash ? std::string(entry->d_name, slash - entry->d_name)
+                                     : std::string(entry->d_name);
+            bool seen = false;
+            for (const auto& existing : files) {
+                if (existing == name) {
+                    seen = true;
+                    break;
+                }
+            }
+            if (!seen) {
+                files.push_back(name);
+            }
+            continue;
+        }
+        
         files.push_back(entry->d_name);
     }
     
     closedir(dir);
+    
+    if (list_cache_.size() >= MAX_CACHED_LISTINGS) {
+        list_cache_.clear();
+    }
+    list_cache_[key] = files;
+    recordMiss(cache_stats_.list_misses, list_miss_us_, start);
+    xSemaphoreGive(cache_lock_);
     return files;
 }
 
 size_t StorageManager::getTotalSpace() {
     size_t total = 0, used = 0;
-    esp_spiffs_info("storage", &total, &used);
+    readUsage(&total, &used);
     return total;
 }
 
 size_t StorageManager::getUsedSpace() {
     size_t total = 0, used = 0;
-    esp_spiffs_info("storage", &total, &used);
+    readUsage(&total, &used);
     return used;
 }
 
 size_t StorageManager::getFreeSpace() {
-    return getTotalSpace() - getUsedSpace();
+    size_t total = 0, used = 0;
+    readUsage(&total, &used);
+    return total > used ? total - used : 0;
+}
+
+bool StorageManager::openFile(const char* path, const char* mode, StorageFile& file, size_t buffer_size) {
+    file.close();
+    
+    FILE* f = fopen(path, mode);
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open %s (%s)", path, mode);
+        return false;
+    }
+    
+    char* buffer = nullptr;
+    if (buffer_size == 0) {
+        setvbuf(f, nullptr, _IONBF, 0);
+    } else {
+        size_t block = ioBlockSize();
+        buffer_size = (buffer_size + block - 1) / block * block;
+        buffer = (char*)malloc(buffer_size);
+        // Without memory for a buffer, stdio keeps its default one
+        if (buffer) {
+            setvbuf(f, buffer, _IOFBF, buffer_size);
+        }
+    }
+    
+    file.file_ = f;
+    file.buffer_ = buffer;
+    file.path_ = path;
+    file.error_ = false;
+    file.size_ = 0;
+    file.stats_ = StorageIoStats();
+    return true;
+}
+
+void StorageManager::invalidate(const char* path) {
+    xSemaphoreTake(cache_lock_, portMAX_DELAY);
+    invalidateLocked(path);
+    xSemaphoreGive(cache_lock_);
+}
+
+void StorageManager::getCacheStats(StorageCacheStats& stats) {
+    xSemaphoreTake(cache_lock_, portMAX_DELAY);
+    stats = cache_stats_;
+    xSemaphoreGive(cache_lock_);
+}
+
+bool StorageManager::statPath(const char* path, CachedStat& out) {
+    xSemaphoreTake(cache_lock_, portMAX_DELAY);
+    auto cached = stat_cache_.find(path);
+    if (cached != stat_cache_.end()) {
+        out = cached->second;
+        cache_stats_.stat_hits++;
+        cache_stats_.saved_us += stat_miss_us_ / cache_stats_.stat_misses;
+        xSemaphoreGive(cache_lock_);
+        return out.exists;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    struct stat st;
+    out = CachedStat();
+    if (stat(path, &st) == 0) {
+        out.exists = true;
+        out.is_dir = S_ISDIR(st.st_mode);
+        out.size = st.st_size;
+        out.mtime = (int64_t)st.st_mtime;
+    }
+    
+    if (stat_cache_.size() >= MAX_CACHED_STATS) {
+        stat_cache_.clear();
+    }
+    stat_cache_[path] = out;
+    recordMiss(cache_stats_.stat_misses, stat_miss_us_, start);
+    xSemaphoreGive(cache_lock_);
+    return out.exists;
+}
+
+bool StorageManager::readUsage(size_t* total, size_t* used) {
+    bool ok = true;
+    xSemaphoreTake(cache_lock_, portMAX_DELAY);
+    if (usage_valid_) {
+        cache_stats_.usage_hits++;
+        cache_stats_.saved_us += usage_miss_us_ / cache_stats_.usage_misses;
+    } else {
+        int64_t start = esp_timer_get_time();
+        ok = backend_->getInfo(&total_bytes_, &used_bytes_);
+        usage_valid_ = ok;
+        recordMiss(cache_stats_.usage_misses, usage_miss_us_, start);
+    }
+    *total = total_bytes_;
+    *used = used_bytes_;
+    xSemaphoreGive(cache_lock_);
+    return ok;
+}
+
+void StorageManager::invalidateLocked(const char* path) {
+    size_t len = strlen(path);
+    
+    // The entry itself, anything below it (a removed or renamed directory)
+    // and every listing of a directory that contains it
+    for (auto it = stat_cache_.begin(); it != stat_cache_.end();) {
+        if (isWithin(it->first, path, len)) {
+            it = stat_cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    std::string changed(path);
+    for (auto it = list_cache_.begin(); it != list_cache_.end();) {
+        std::string dir = it->first.substr(1);
+        if (isWithin(changed, dir.c_str(), dir.size()) || isWithin(dir, path, len)) {
+            it = list_cache_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    
+    usage_valid_ = false;
+}
+
+void StorageManager::recordMiss(uint32_t& misses, uint64_t& miss_us, int64_t start) {
+    uint64_t elapsed = esp_timer_get_time() - start;
+    misses++;
+    miss_us += elapsed;
+    cache_stats_.miss_us += elapsed;
 }
 
 std::string StorageManager::getPayloadPath(const char* payload_id) {
@@ -185,6 +469,108 @@ std::string StorageManager::getPayloadManifestPath(const char* payload_id) {
     return getPayloadPath(payload_id) + "/manifest.json";
 }
 
+std::string StorageManager::getPayloadManifestPartPath(const char* payload_id) {
+    return getPayloadPath(payload_id) + "/manifest.json.part";
+}
+
 std::string StorageManager::getPayloadDataPath(const char* payload_id) {
     return getPayloadPath(payload_id) + "/payload";
 }
+
+std::string StorageManager::getPayloadDigestPath(const char* payload_id) {
+    return getPayloadPath(payload_id) + "/payload.sha256";
+}
+
+std::string StorageManager::getPayloadPartPath(const char* payload_id) {
+    return getPayloadPath(payload_id) + "/payload.part";
+}
+
+std::string StorageManager::getPayloadPartCheckpointPath(const char* payload_id) {
+    return getPayloadPath(payload_id) + "/payload.part.ckpt";
+}
+
+// ============================================================================
+// StorageFile
+// ============================================================================
+
+StorageFile::~StorageFile() {
+    close();
+}
+
+size_t StorageFile::read(uint8_t* buf, size_t length) {
+    if (!file_ || writing_) {
+        return 0;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    size_t n = fread(buf, 1, length, file_);
+    stats_.elapsed_us += esp_timer_get_time() - start;
+    stats_.bytes += n;
+    
+    if (n < length && ferror(file_)) {
+        error_ = true;
+    }
+    return n;
+}
+
+bool StorageFile::write(const uint8_t* data, size_t length) {
+    if (!file_ || !writing_) {
+        return false;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    size_t n = fwrite(data, 1, length, file_);
+    stats_.elapsed_us += esp_timer_get_time() - start;
+    stats_.bytes += n;
+    size_ += n;
+    
+    if (n != length) {
+        error_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool StorageFile::seek(size_t offset) {
+    if (!file_ || fseek(file_, (long)offset, SEEK_SET) != 0) {
+        return false;
+    }
+    return true;
+}
+
+bool StorageFile::flush() {
+    if (!file_ || !writing_) {
+        return file_ != nullptr;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    if (fflush(file_) != 0) {
+        error_ = true;
+    }
+    stats_.elapsed_us += esp_timer_get_time() - start;
+    
+    // The data is on the filesystem now, so cached sizes are stale
+    StorageManager::getInstance().invalidate(path_.c_str());
+    return !error_;
+}
+
+bool StorageFile::close() {
+    if (!file_) {
+        return !error_;
+    }
+    
+    int64_t start = esp_timer_get_time();
+    if (fclose(file_) != 0) {
+        error_ = true;
+    }
+    stats_.elapsed_us += esp_timer_get_time() - start;
+    file_ = nullptr;
+    
+    free(buffer_);
+    buffer_ = nullptr;
+    
+    if (writing_) {
+        StorageManager::getInstance().invalidate(path_.c_str());
+    }
+    return !error_;
+}
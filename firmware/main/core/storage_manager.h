@@ -1,11 +1,82 @@
 #ifndef STORAGE_MANAGER_H
 #define STORAGE_MANAGER_H
 
+#include <stdio.h>
 #include <string>
 #include <vector>
-#include "esp_spiffs.h"
+#include <map>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "fs_backend.h"
+#include "sdkconfig.h"
 #include "../include/types.h"
 
+// Metadata cache counters; saved_us estimates the flash time avoided by
+// hits from the average cost of a miss of the same kind
+struct StorageCacheStats {
+    uint32_t stat_hits;
+    uint32_t stat_misses;
+    uint32_t list_hits;
+    uint32_t list_misses;
+    uint32_t usage_hits;
+    uint32_t usage_misses;
+    uint64_t miss_us;
+    uint64_t saved_us;
+};
+
+// Transfer counters of one streamed file; elapsed_us covers the time
+// spent inside read/write calls, not in the caller's processing
+struct StorageIoStats {
+    size_t bytes;
+    int64_t elapsed_us;
+    
+    uint32_t bytesPerSecond() const {
+        return elapsed_us > 0 ? (uint32_t)((uint64_t)bytes * 1000000 / elapsed_us) : 0;
+    }
+};
+
+// Called for each chunk while a file streams through; return false to stop
+typedef bool (*storage_chunk_fn_t)(const uint8_t* data, size_t length, void* arg);
+
+// Open file handle from StorageManager::openRead/openWrite. Owns its stdio
+// buffer; closing a written file refreshes the manager's metadata cache.
+class StorageFile {
+public:
+    StorageFile() = default;
+    ~StorageFile();
+    
+    bool isOpen() const { return file_ != nullptr; }
+    size_t size() const { return size_; }      // Size at open, plus anything written
+    
+    size_t read(uint8_t* buf, size_t length);
+    bool write(const uint8_t* data, size_t length);
+    bool seek(size_t offset);
+    bool flush();
+    bool close();
+    
+    const StorageIoStats& stats() const { return stats_; }
+    
+private:
+    friend class StorageManager;
+    StorageFile(const StorageFile&) = delete;
+    StorageFile& operator=(const StorageFile&) = delete;
+    
+    FILE* file_ = nullptr;
+    char* buffer_ = nullptr;
+    std::string path_;
+    bool writing_ = false;
+    bool error_ = false;
+    size_t size_ = 0;
+    StorageIoStats stats_ = {};
+};
+
+// Payload filesystem access.
+//
+// stat results (including "does not exist"), directory listings and
+// partition usage are cached in RAM, so repeated existence checks, scans
+// and free-space checks do not walk flash metadata. Every write, delete,
+// rename and mkdir made through the manager drops the entries it affects.
+// Code that writes files directly (e.g. an open upload) calls invalidate().
 class StorageManager {
 public:
     static StorageManager& getInstance() {
@@ -22,6 +93,19 @@ public:
     bool writeFile(const char* path, const uint8_t* data, size_t size);
     bool deleteFile(const char* path);
     size_t getFileSize(const char* path);
+    bool getFileInfo(const char* path, size_t* size, int64_t* mtime);
+    bool renameFile(const char* from, const char* to);
+    
+    // Streaming I/O. buffer_size is the stdio buffer, rounded up to the
+    // filesystem I/O block; 0 opens the file unbuffered for callers that
+    // already transfer whole blocks.
+    bool openRead(const char* path, StorageFile& file,
+                  size_t buffer_size = CONFIG_DEZERO_STORAGE_IO_BUFFER_SIZE);
+    bool openWrite(const char* path, StorageFile& file, bool append,
+                   size_t buffer_size = CONFIG_DEZERO_STORAGE_IO_BUFFER_SIZE);
+    bool streamFile(const char* path, uint8_t* chunk, size_t chunk_size,
+                    storage_chunk_fn_t fn, void* arg, StorageIoStats* stats);
+    size_t ioBlockSize() const;
     
     // Directory operations
     bool createDirectory(const char* path);
@@ -33,10 +117,18 @@ public:
     size_t getUsedSpace();
     size_t getFreeSpace();
     
+    // Metadata cache
+    void invalidate(const char* path);
+    void getCacheStats(StorageCacheStats& stats);
+    
     // Payload-specific paths
     std::string getPayloadPath(const char* payload_id);
     std::string getPayloadManifestPath(const char* payload_id);
+    std::string getPayloadManifestPartPath(const char* payload_id);
     std::string getPayloadDataPath(const char* payload_id);
+    std::string getPayloadDigestPath(const char* payload_id);
+    std::string getPayloadPartPath(const char* payload_id);
+    std::string getPayloadPartCheckpointPath(const char* payload_id);
     
 private:
     StorageManager() = default;
@@ -44,9 +136,33 @@ private:
     StorageManager(const StorageManager&) = delete;
     StorageManager& operator=(const StorageManager&) = delete;
     
+    struct CachedStat {
+        bool exists;
+        bool is_dir;
+        size_t size;
+        int64_t mtime;
+    };
+    
+    std::vector<std::string> listEntries(const char* path, bool collapse);
+    bool statPath(const char* path, CachedStat& out);
+    bool readUsage(size_t* total, size_t* used);
+    bool openFile(const char* path, const char* mode, StorageFile& file, size_t buffer_size);
+    void invalidateLocked(const char* path);
+    void recordMiss(uint32_t& misses, uint64_t& miss_us, int64_t start);
+    
+    FsBackend* backend_ = nullptr;
     bool mounted_;
     size_t total_bytes_;
     size_t used_bytes_;
+    
+    SemaphoreHandle_t cache_lock_ = nullptr;
+    std::map<std::string, CachedStat> stat_cache_;
+    std::map<std::string, std::vector<std::string>> list_cache_;
+    bool usage_valid_ = false;
+    StorageCacheStats cache_stats_ = {};
+    uint64_t stat_miss_us_ = 0;
+    uint64_t list_miss_us_ = 0;
+    uint64_t usage_miss_us_ = 0;
 };
 
 #endif // STORAGE_MANAGER_H
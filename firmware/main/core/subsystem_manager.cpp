@@ -0,0 +1,173 @@
+#include "subsystem_manager.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "../hal/wifi_api.h"
+#include "../hal/ble_api.h"
+#include "../hal/display_api.h"
+#include "../hal/gpio_api.h"
+#include "../communication/wifi_manager.h"
+#include "../communication/ble_server.h"
+#include "../communication/websocket_server.h"
+
+static const char* TAG = "Subsystems";
+
+// Start and stop functions, run with the manager's lock held
+
+// The WebSocket command transport lives exactly as long as the WiFi stack
+static bool startWifi() {
+    return WiFiManager::getInstance().initialize() && WiFiAPI::getInstance().initialize() &&
+           WebSocketServer::getInstance().initialize() &&
+           WebSocketServer::getInstance().start(CONFIG_DEZERO_WEBSOCKET_PORT);
+}
+
+static void stopWifi() {
+    WebSocketServer::getInstance().stop();
+    WiFiAPI::getInstance().deinit();
+    WiFiManager::getInstance().deinitialize();
+}
+
+static bool startBle() {
+    return BLEServer::getInstance().initialize() && BLEAPI::getInstance().initialize();
+}
+
+static void stopBle() {
+    BLEAPI::getInstance().deinit();
+    BLEServer::getInstance().deinitialize();
+}
+
+static bool startDisplay() {
+    return DisplayAPI::getInstance().initialize();
+}
+
+static void stopDisplay() {
+    DisplayAPI::getInstance().deinit();
+}
+
+static bool startGpio() {
+    return GPIOAPI::getInstance().initialize();
+}
+
+static void stopGpio() {
+}
+
+// stop() also undoes a start() that failed halfway
+struct Subsystem {
+    const char* api;            // Name used in requirements.apis
+    bool (*start)();
+    void (*stop)();
+};
+
+static const Subsystem SUBSYSTEMS[SUBSYSTEM_COUNT] = {
+    {"wifi",    startWifi,    stopWifi},
+    {"ble",     startBle,     stopBle},
+    {"display", startDisplay, stopDisplay},
+    {"gpio",    startGpio,    stopGpio},
+};
+
+bool SubsystemManager::initialize() {
+    if (!lock_) {
+        lock_ = xSemaphoreCreateMutex();
+        if (!lock_) {
+            ESP_LOGE(TAG, "Failed to create lock");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SubsystemManager::acquire(subsystem_t subsystem) {
+    if (subsystem >= SUBSYSTEM_COUNT || !lock_) {
+        return false;
+    }
+
+    // Held across start() so a second user waits for the bring-up to finish
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool ok = true;
+    if (refs_[subsystem] == 0) {
+        const Subsystem& s = SUBSYSTEMS[subsystem];
+        uint32_t heap_before = esp_get_free_heap_size();
+        int64_t start = esp_timer_get_time();
+        ok = s.start();
+        if (ok) {
+            ESP_LOGI(TAG, "%s up in %d ms, free heap %u -> %u", s.api,
+                     (int)((esp_timer_get_time() - start) / 1000),
+                     (unsigned)heap_before, (unsigned)esp_get_free_heap_size());
+        } else {
+            ESP_LOGE(TAG, "Failed to start %s", s.api);
+            s.stop();
+        }
+    }
+    if (ok) {
+        refs_[subsystem]++;
+    }
+    xSemaphoreGive(lock_);
+    return ok;
+}
+
+void SubsystemManager::release(subsystem_t subsystem) {
+    if (subsystem >= SUBSYSTEM_COUNT || !lock_) {
+        return;
+    }
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (refs_[subsystem] == 0) {
+        ESP_LOGW(TAG, "Unbalanced release of %s", SUBSYSTEMS[subsystem].api);
+    } else if (--refs_[subsystem] == 0) {
+        const Subsystem& s = SUBSYSTEMS[subsystem];
+        uint32_t heap_before = esp_get_free_heap_size();
+        s.stop();
+        ESP_LOGI(TAG, "%s down, free heap %u -> %u", s.api,
+                 (unsigned)heap_before, (unsigned)esp_get_free_heap_size());
+    }
+    xSemaphoreGive(lock_);
+}
+
+bool SubsystemManager::acquireMask(uint32_t mask) {
+    for (int i = 0; i < SUBSYSTEM_COUNT; i++) {
+        if (!(mask & SUBSYSTEM_BIT(i))) {
+            continue;
+        }
+        if (!acquire((subsystem_t)i)) {
+            releaseMask(mask & (SUBSYSTEM_BIT(i) - 1));
+            return false;
+        }
+    }
+    return true;
+}
+
+void SubsystemManager::releaseMask(uint32_t mask) {
+    for (int i = SUBSYSTEM_COUNT - 1; i >= 0; i--) {
+        if (mask & SUBSYSTEM_BIT(i)) {
+            release((subsystem_t)i);
+        }
+    }
+}
+
+uint32_t SubsystemManager::getActiveMask() {
+    uint32_t mask = 0;
+    if (!lock_) {
+        return mask;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    for (int i = 0; i < SUBSYSTEM_COUNT; i++) {
+        if (refs_[i]) {
+            mask |= SUBSYSTEM_BIT(i);
+        }
+    }
+    xSemaphoreGive(lock_);
+    return mask;
+}
+
+uint32_t SubsystemManager::maskForManifest(const PayloadManifest& manifest) {
+    uint32_t mask = 0;
+    for (const auto& api : manifest.requirements.apis) {
+        for (int i = 0; i < SUBSYSTEM_COUNT; i++) {
+            if (api == SUBSYSTEMS[i].api) {
+                mask |= SUBSYSTEM_BIT(i);
+                break;
+            }
+        }
+    }
+    return mask;
+}
@@ -0,0 +1,57 @@
+#ifndef SUBSYSTEM_MANAGER_H
+#define SUBSYSTEM_MANAGER_H
+
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "../include/types.h"
+
+typedef enum {
+    SUBSYSTEM_WIFI = 0,
+    SUBSYSTEM_BLE,
+    SUBSYSTEM_DISPLAY,
+    SUBSYSTEM_GPIO,
+    SUBSYSTEM_COUNT
+} subsystem_t;
+
+#define SUBSYSTEM_BIT(subsystem) (1u << (subsystem))
+
+// Reference-counted bring-up of the radios and peripherals.
+//
+// Nothing is started at boot unless something holds a reference: the BLE
+// command transport holds BLE and the status screen holds the display, and
+// each running payload holds what its manifest lists in requirements.apis
+// ("wifi", "ble", "display", "gpio"). The first acquire starts a subsystem
+// and the last release shuts it down and returns its memory to the heap,
+// so the WiFi stack only exists while a payload uses it.
+class SubsystemManager {
+public:
+    static SubsystemManager& getInstance() {
+        static SubsystemManager instance;
+        return instance;
+    }
+
+    bool initialize();
+
+    bool acquire(subsystem_t subsystem);
+    void release(subsystem_t subsystem);
+
+    // All or nothing: on failure, whatever was acquired is released again
+    bool acquireMask(uint32_t mask);
+    void releaseMask(uint32_t mask);
+
+    uint32_t getActiveMask();
+
+    static uint32_t maskForManifest(const PayloadManifest& manifest);
+
+private:
+    SubsystemManager() = default;
+    ~SubsystemManager() = default;
+    SubsystemManager(const SubsystemManager&) = delete;
+    SubsystemManager& operator=(const SubsystemManager&) = delete;
+
+    SemaphoreHandle_t lock_ = nullptr;
+    uint16_t refs_[SUBSYSTEM_COUNT] = {};
+};
+
+#endif // SUBSYSTEM_MANAGER_H
@@ -9,6 +9,10 @@ bool BLEAPI::initialize() {
     return true;
 }
 
+void BLEAPI::deinit() {
+    initialized_ = false;
+}
+
 bool BLEAPI::startScan(int duration_ms) {
     ESP_LOGI(TAG, "Starting BLE scan for %d ms", duration_ms);
     return true;
@@ -19,6 +23,6 @@ bool BLEAPI::stopScan() {
     return true;
 }
 
-std::vector<ble_device_t> BLEAPI::getScanResults() {
-    return std::vector<ble_device_t>();
+std::vector<ble_scan_result_t> BLEAPI::getScanResults() {
+    return std::vector<ble_scan_result_t>();
 }
\ No newline at end of file
@@ -12,9 +12,10 @@ public:
     }
     
     bool initialize();
+    void deinit();
     bool startScan(int duration_ms);
     bool stopScan();
-    std::vector<ble_device_t> getScanResults();
+    std::vector<ble_scan_result_t> getScanResults();
     
 private:
     BLEAPI() = default;
@@ -22,7 +23,7 @@ private:
     BLEAPI(const BLEAPI&) = delete;
     BLEAPI& operator=(const BLEAPI&) = delete;
     
-    bool initialized_;
+    bool initialized_ = false;
 };
 
 #endif // BLE_API_H
\ No newline at end of file
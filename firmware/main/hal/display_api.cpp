@@ -59,6 +59,7 @@ bool DisplayAPI::initialize() {
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize SPI bus: %s", esp_err_to_name(ret));
         free(framebuffer_);
+        framebuffer_ = nullptr;
         return false;
     }
     
@@ -74,6 +75,7 @@ bool DisplayAPI::initialize() {
         ESP_LOGE(TAG, "Failed to add SPI device: %s", esp_err_to_name(ret));
         spi_bus_free(SPI2_HOST);
         free(framebuffer_);
+        framebuffer_ = nullptr;
         return false;
     }
     
@@ -127,9 +129,11 @@ bool DisplayAPI::initialize() {
 
 void DisplayAPI::deinit() {
     if (initialized_) {
+        sendCommand(SSD1306_DISPLAYOFF);
         spi_bus_remove_device(spi_);
         spi_bus_free(SPI2_HOST);
         free(framebuffer_);
+        framebuffer_ = nullptr;
         initialized_ = false;
     }
 }
@@ -156,7 +160,7 @@ void DisplayAPI::update() {
 }
 
 void DisplayAPI::drawPixel(int x, int y, bool color) {
-    if (x < 0 || x >= width_ || y < 0 || y >= height_) {
+    if (!framebuffer_ || x < 0 || x >= width_ || y < 0 || y >= height_) {
         return;
     }
     
@@ -1,74 +1,55 @@
 #include "wifi_api.h"
 #include "esp_log.h"
-#include "esp_event.h"
-#include <cstring>
+#include "../communication/wifi_manager.h"
 
 static const char* TAG = "WiFiAPI";
 
+// Payload-facing station calls. The driver itself belongs to WiFiManager,
+// which SubsystemManager brings up before this is initialized.
+
 bool WiFiAPI::initialize() {
     ESP_LOGI(TAG, "Initializing WiFi API");
     
-    esp_netif_create_default_wifi_sta();
-    
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
-    ESP_ERROR_CHECK(esp_wifi_init(&cfg));
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-    ESP_ERROR_CHECK(esp_wifi_start());
+    if (!WiFiManager::getInstance().enableStation()) {
+        ESP_LOGE(TAG, "Failed to start station");
+        return false;
+    }
     
     initialized_ = true;
-    connected_ = false;
-    
     return true;
 }
 
+void WiFiAPI::deinit() {
+    if (initialized_) {
+        WiFiManager::getInstance().disconnect();
+    }
+    initialized_ = false;
+}
+
 bool WiFiAPI::startScan() {
     if (!initialized_) return false;
     
-    wifi_scan_config_t scan_config = {};
-    scan_config.show_hidden = true;
-    
-    esp_err_t err = esp_wifi_scan_start(&scan_config, true);
-    return (err == ESP_OK);
+    return WiFiManager::getInstance().scan();
 }
 
 std::vector<wifi_ap_record_t> WiFiAPI::getScanResults() {
-    std::vector<wifi_ap_record_t> results;
-    
-    uint16_t ap_count = 0;
-    esp_wifi_scan_get_ap_num(&ap_count);
+    if (!initialized_) return std::vector<wifi_ap_record_t>();
     
-    if (ap_count > 0) {
-        wifi_ap_record_t* ap_records = new wifi_ap_record_t[ap_count];
-        esp_wifi_scan_get_ap_records(&ap_count, ap_records);
-        
-        for (int i = 0; i < ap_count; i++) {
-            results.push_back(ap_records[i]);
-        }
-        
-        delete[] ap_records;
-    }
-    
-    return results;
+    return WiFiManager::getInstance().getScanResults();
 }
 
 bool WiFiAPI::connect(const char* ssid, const char* password) {
-    wifi_config_t wifi_config = {};
-    strcpy((char*)wifi_config.sta.ssid, ssid);
-    strcpy((char*)wifi_config.sta.password, password);
-    
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_connect());
+    if (!initialized_) return false;
     
-    connected_ = true;
-    return true;
+    return WiFiManager::getInstance().connectSTA(ssid, password);
 }
 
 bool WiFiAPI::disconnect() {
-    esp_wifi_disconnect();
-    connected_ = false;
-    return true;
+    if (!initialized_) return false;
+    
+    return WiFiManager::getInstance().disconnect();
 }
 
 bool WiFiAPI::isConnected() {
-    return connected_;
+    return initialized_ && WiFiManager::getInstance().isConnected();
 }
@@ -13,6 +13,7 @@ public:
     }
     
     bool initialize();
+    void deinit();
     bool startScan();
     std::vector<wifi_ap_record_t> getScanResults();
     bool connect(const char* ssid, const char* password);
@@ -25,8 +26,7 @@ private:
     WiFiAPI(const WiFiAPI&) = delete;
     WiFiAPI& operator=(const WiFiAPI&) = delete;
     
-    bool initialized_;
-    bool connected_;
+    bool initialized_ = false;
 };
 
 #endif // WIFI_API_H
@@ -0,0 +1,145 @@
+#ifndef DEZERO_DEFERRED_LOG_H
+#define DEZERO_DEFERRED_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+#include "payload_api.h"
+
+#if __has_include("sdkconfig.h")
+#include "sdkconfig.h"
+#include "esp_log.h"
+#endif
+
+// Deferred logging in the style of defmt.
+//
+// A DZ_LOG* / DEZERO_LOG* call does not format anything on the device. The
+// format string is reduced at compile time to a 32-bit FNV-1a id, and the
+// record stored is that id plus the raw arguments, packed by C++ type:
+//
+//   u32 format id, u8 tag length, tag, then per argument
+//     integers up to 32 bits, pointers   4 bytes little-endian
+//     64-bit integers, float/double      8 bytes (floats widened to double)
+//     strings                            u8 length + bytes (at most 32)
+//
+// tools/log_decode.py builds the id -> format table from the sources at
+// build time (build/log_ids.json) and turns fetched records back into
+// text. The format string must be a literal so it can be found there;
+// the compiler still checks it against the arguments.
+//
+// DZ_LOG* is for firmware hot paths and falls back to ESP_LOG when
+// CONFIG_DEZERO_LOG_DEFERRED is off. DEZERO_LOG* is the payload variant:
+// records are tagged with the calling payload's id on the device.
+
+#define DEFERRED_LOG_MAX_RECORD 160
+#define DEFERRED_LOG_MAX_STRING 32
+
+namespace deferred_log {
+
+constexpr uint32_t formatId(const char* format) {
+    uint32_t hash = 2166136261u;
+    for (; *format; format++) {
+        hash = (hash ^ (uint8_t)*format) * 16777619u;
+    }
+    return hash;
+}
+
+class Packer {
+public:
+    Packer(uint32_t id, const char* tag) {
+        raw(&id, sizeof(id));
+        str(tag);
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+    put(T value) {
+        if (sizeof(T) > 4) {
+            uint64_t wide = (uint64_t)value;
+            raw(&wide, sizeof(wide));
+        } else {
+            uint32_t narrow = (uint32_t)value;
+            raw(&narrow, sizeof(narrow));
+        }
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    put(T value) {
+        double wide = (double)value;
+        raw(&wide, sizeof(wide));
+    }
+
+    void put(const char* value) { str(value); }
+    void put(char* value) { str(value); }
+
+    template <typename T>
+    void put(const T* value) {
+        uint32_t address = (uint32_t)(uintptr_t)value;
+        raw(&address, sizeof(address));
+    }
+
+    const uint8_t* data() const { return buf_; }
+    size_t size() const { return len_; }
+
+private:
+    void raw(const void* data, size_t length) {
+        if (len_ + length > sizeof(buf_)) {
+            length = sizeof(buf_) - len_;
+        }
+        memcpy(buf_ + len_, data, length);
+        len_ += length;
+    }
+
+    void str(const char* value) {
+        size_t length = value ? strnlen(value, DEFERRED_LOG_MAX_STRING) : 0;
+        uint8_t prefix = (uint8_t)length;
+        raw(&prefix, 1);
+        if (length) {
+            raw(value, length);
+        }
+    }
+
+    uint8_t buf_[DEFERRED_LOG_MAX_RECORD];
+    size_t len_ = 0;
+};
+
+template <typename... Args>
+inline void write(int level, uint32_t id, const char* tag, const Args&... args) {
+    Packer packer(id, tag);
+    (packer.put(args), ...);
+    dezero_log_deferred(level, packer.data(), packer.size());
+}
+
+} // namespace deferred_log
+
+// printf() under if (0) generates no code but keeps -Wformat checking
+#define DEFERRED_LOG(level, tag, format, ...) do {                            \
+        constexpr uint32_t dz_format_id_ = deferred_log::formatId(format);    \
+        if (0) printf(format, ##__VA_ARGS__);                                  \
+        deferred_log::write(level, dz_format_id_, tag, ##__VA_ARGS__);         \
+    } while (0)
+
+#define DEZERO_LOGE(format, ...) DEFERRED_LOG(1, nullptr, format, ##__VA_ARGS__)
+#define DEZERO_LOGW(format, ...) DEFERRED_LOG(2, nullptr, format, ##__VA_ARGS__)
+#define DEZERO_LOGI(format, ...) DEFERRED_LOG(3, nullptr, format, ##__VA_ARGS__)
+#define DEZERO_LOGD(format, ...) DEFERRED_LOG(4, nullptr, format, ##__VA_ARGS__)
+
+#ifdef CONFIG_DEZERO_LOG_DEFERRED
+#define DZ_LOG_LEVEL(level, tag, format, ...) do {                             \
+        if (LOG_LOCAL_LEVEL >= level) {                                        \
+            DEFERRED_LOG(level, tag, format, ##__VA_ARGS__);                   \
+        }                                                                      \
+    } while (0)
+#else
+#define DZ_LOG_LEVEL(level, tag, format, ...) ESP_LOG_LEVEL_LOCAL(level, tag, format, ##__VA_ARGS__)
+#endif
+
+#define DZ_LOGE(tag, format, ...) DZ_LOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DZ_LOGW(tag, format, ...) DZ_LOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DZ_LOGI(tag, format, ...) DZ_LOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define DZ_LOGD(tag, format, ...) DZ_LOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+#endif // DEZERO_DEFERRED_LOG_H
@@ -17,13 +17,13 @@ typedef struct {
     int8_t rssi;
     uint8_t channel;
     uint8_t auth_mode;
-} wifi_ap_record_t;
+} dezero_wifi_ap_t;
 
 // Start WiFi scan
 int dezero_wifi_scan_start();
 
-// Get scan results
-int dezero_wifi_scan_get_results(wifi_ap_record_t* results, int max_results);
+// Copies up to max_results records into the caller's array
+int dezero_wifi_scan_get_results(dezero_wifi_ap_t* results, int max_results);
 
 // Set WiFi mode (STA/AP)
 int dezero_wifi_set_mode(int mode);
@@ -49,13 +49,13 @@ typedef struct {
     int8_t rssi;
     char name[32];
     uint8_t addr_type;
-} ble_device_t;
+} dezero_ble_device_t;
 
 // Start BLE scan
 int dezero_ble_scan_start(int duration_ms);
 
-// Get BLE scan results
-int dezero_ble_scan_get_results(ble_device_t* results, int max_results);
+// Copies up to max_results records into the caller's array
+int dezero_ble_scan_get_results(dezero_ble_device_t* results, int max_results);
 
 // Stop BLE scan
 int dezero_ble_scan_stop();
@@ -123,12 +123,34 @@ int dezero_storage_write(int fd, const uint8_t* buffer, int size);
 // Delete file (requires PERM_STORAGE_WRITE)
 int dezero_storage_delete(const char* path);
 
-// List directory
+// List directory; each entry is allocated from the payload's arena, free
+// it with dezero_free()
 int dezero_storage_list(const char* path, char** entries, int max_entries);
 
 // Get file info
 int dezero_storage_stat(const char* path, size_t* size, uint64_t* mtime);
 
+// Names from before the dezero_ prefix, kept for existing payload sources.
+// They clash with ESP-IDF's own wifi_ap_record_t inside the firmware, which
+// uses the prefixed names only.
+#ifndef DEZERO_FIRMWARE_BUILD
+typedef dezero_wifi_ap_t wifi_ap_record_t;
+typedef dezero_ble_device_t ble_device_t;
+#endif
+
+// ============================================================================
+// Memory API
+// ============================================================================
+
+// Allocations come from the calling payload's private arena and count
+// against its requirements.memory_kb limit. Every API above that hands
+// out memory (dezero_storage_list) allocates it the same way; results of
+// the scan APIs go into caller buffers.
+void* dezero_malloc(size_t size);
+void* dezero_calloc(size_t count, size_t size);
+void* dezero_realloc(void* ptr, size_t size);
+void dezero_free(void* ptr);
+
 // ============================================================================
 // Logging API
 // ============================================================================
@@ -138,6 +160,10 @@ void dezero_log_warn(const char* format, ...);
 void dezero_log_error(const char* format, ...);
 void dezero_log_debug(const char* format, ...);
 
+// Stores a record packed by the DEZERO_LOG* macros (deferred_log.h) without
+// formatting it on the device
+void dezero_log_deferred(int level, const uint8_t* record, size_t length);
+
 // ============================================================================
 // System API
 // ============================================================================
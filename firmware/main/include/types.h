@@ -5,6 +5,10 @@
 #include <stdbool.h>
 #include <string>
 #include <vector>
+#include <memory>
+
+#define MAX_PAYLOAD_ID_LEN 32
+#define PAYLOAD_DIGEST_SIZE 32  // SHA-256
 
 // Payload types
 typedef enum {
@@ -32,8 +36,15 @@ typedef enum {
     RUNTIME_BUILTIN
 } runtime_type_t;
 
-// BLE device structure
-struct ble_device_t {
+// Payload scheduling priority class
+typedef enum {
+    PAYLOAD_PRIORITY_LOW,
+    PAYLOAD_PRIORITY_NORMAL,
+    PAYLOAD_PRIORITY_HIGH
+} payload_priority_t;
+
+// BLE device seen by a scan (payloads get dezero_ble_device_t)
+struct ble_scan_result_t {
     uint8_t address[6];        // MAC address
     int8_t rssi;               // Signal strength
     std::string name;          // Device name
@@ -77,6 +88,8 @@ struct PayloadManifest {
         std::vector<std::string> apis;
         uint32_t memory_kb;
         uint32_t storage_kb;
+        uint32_t stack_kb;
+        payload_priority_t priority;
     } requirements;
     
     uint32_t permissions;
@@ -91,19 +104,32 @@ struct PayloadManifest {
     std::vector<Parameter> parameters;
 };
 
-// Payload execution context
+class PayloadArena;
+
+// Payload execution context. Fields read by status checks and the
+// supervisor come first; the manifest is shared with the payload catalog
+// rather than copied into every run.
 struct PayloadContext {
-    PayloadManifest manifest;
+    // Hot: status, limits and handles
     payload_status_t status;
-    void* runtime_handle;
-    void* user_data;
-    uint32_t task_handle;
-    
-    // Resource limits
+    int core_id;                // Core the payload task is pinned to
+    void* task_handle;          // FreeRTOS TaskHandle_t of the payload task
+    PayloadArena* arena;        // Private heap all payload allocations come from
     size_t memory_allocated;
+    size_t memory_peak;
     size_t memory_limit;
     uint64_t start_time;
     uint64_t cpu_time_limit;
+    void* runtime_handle;
+    
+    // Cold
+    char payload_id[MAX_PAYLOAD_ID_LEN];
+    std::shared_ptr<const PayloadManifest> manifest;
+    const uint8_t* image;       // Payload binary mapped from flash, or nullptr
+    size_t image_size;
+    uint32_t image_handle;
+    uint32_t subsystems;        // SUBSYSTEM_BIT()s held while the payload runs
+    void* user_data;
     
     // Callbacks
     void (*log_callback)(const char* message);
@@ -122,9 +148,11 @@ typedef enum {
     CMD_STOP_PAYLOAD        = 0x07,
     CMD_GET_PAYLOAD_STATUS  = 0x08,
     CMD_GET_LOGS            = 0x09,
+    CMD_GET_BOOT_TIMELINE   = 0x0A,
     CMD_OTA_BEGIN           = 0x10,
     CMD_OTA_WRITE           = 0x11,
     CMD_OTA_END             = 0x12,
+    CMD_OTA_ABORT           = 0x13,
     CMD_REBOOT              = 0xFF
 } command_type_t;
 
@@ -138,15 +166,24 @@ typedef enum {
     RESP_NOT_FOUND          = 0x05,
     RESP_ALREADY_RUNNING    = 0x06,
     RESP_OUT_OF_MEMORY      = 0x07,
-    RESP_STORAGE_FULL       = 0x08
+    RESP_STORAGE_FULL       = 0x08,
+    RESP_BAD_FRAME          = 0x09     // Frame payload failed its CRC check
 } response_code_t;
 
 // System configuration
 #define DEZERO_VERSION "2.0.0"
 #define MAX_PAYLOAD_SIZE (512 * 1024)  // 512KB max payload
 #define MAX_PAYLOADS 32
-#define PAYLOAD_BASE_PATH "/spiffs/payloads"
+#define MAX_INSTALL_SESSIONS 2
+#ifndef STORAGE_BASE_PATH
+#define STORAGE_BASE_PATH "/storage"  // Host tests point this at a scratch directory
+#endif
+#define PAYLOAD_BASE_PATH STORAGE_BASE_PATH "/payloads"
+#define PAYLOAD_INDEX_PATH STORAGE_BASE_PATH "/payload_index.bin"
 #define MAX_EXECUTION_TIME_MS (60 * 1000)  // 60 seconds
 #define MAX_MEMORY_PER_PAYLOAD (128 * 1024)  // 128KB
+#define DEFAULT_PAYLOAD_MEMORY_KB 32
+#define DEFAULT_PAYLOAD_STACK_KB 8
+#define MAX_PAYLOAD_STACK_KB 32
 
 #endif // DEZERO_TYPES_H
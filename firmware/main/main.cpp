@@ -8,85 +8,151 @@
 #include "nvs_flash.h"
 
 #include "core/boot_manager.h"
+#include "core/boot_sequence.h"
 #include "core/storage_manager.h"
+#include "core/log_store.h"
+#include "core/subsystem_manager.h"
 #include "core/plugin_manager.h"
 #include "hal/display_api.h"
 #include "communication/ble_server.h"
-#include "communication/wifi_manager.h"
+#include "communication/command_dispatcher.h"
 
 static const char* TAG = "MAIN";
 
-extern "C" void app_main(void) {
-    ESP_LOGI(TAG, "DeZero Firmware v%s Starting...", DEZERO_VERSION);
-    
-    // Initialize NVS
+// Boot stages, in an order where dependencies always come first. BLE runs
+// on core 0 next to its host task; storage, the payload scan and the
+// display run on core 1 meanwhile, so "Ready" does not wait for the radio.
+// WiFi is not started at boot at all: SubsystemManager brings it up, with
+// the WebSocket command server, when a payload that lists the "wifi" API runs.
+enum {
+    STAGE_NVS,
+    STAGE_STORAGE,
+    STAGE_DISPLAY,
+    STAGE_BOOT,
+    STAGE_BLE,
+    STAGE_PLUGINS,
+    STAGE_READY,
+    STAGE_BLE_STATUS,
+    STAGE_COUNT
+};
+
+static bool initNvs() {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
         ESP_ERROR_CHECK(nvs_flash_erase());
         ret = nvs_flash_init();
     }
-    ESP_ERROR_CHECK(ret);
+    return ret == ESP_OK;
+}
+
+static bool initStorage() {
+    return StorageManager::getInstance().initialize();
+}
+
+static bool display_ready = false;
+
+// The status screen keeps the display up for as long as the device runs
+static bool initDisplay() {
+    if (!SubsystemManager::getInstance().acquire(SUBSYSTEM_DISPLAY)) {
+        return false;
+    }
+    DisplayAPI& display = DisplayAPI::getInstance();
+    display_ready = true;
+    display.clear();
+    display.drawText(0, 0, "DeZero v2.0", 2);
+    display.drawText(0, 20, "Initializing...", 1);
+    display.update();
+    return true;
+}
+
+static bool initBootManager() {
+    return BootManager::getInstance().initialize();
+}
+
+// The app connects over BLE, so the command transport holds it permanently
+static bool initBle() {
+    return SubsystemManager::getInstance().acquire(SUBSYSTEM_BLE) && BLEServer::getInstance().start();
+}
+
+static bool initPlugins() {
+    if (!PluginManager::getInstance().initialize()) {
+        return false;
+    }
+    int payload_count = PluginManager::getInstance().scanPayloads();
+    ESP_LOGI(TAG, "Found %d payloads", payload_count);
+    return true;
+}
+
+static bool showReady() {
+    if (display_ready) {
+        DisplayAPI& display = DisplayAPI::getInstance();
+        display.clear();
+        display.drawText(0, 0, "DeZero v2.0", 2);
+        display.drawText(0, 20, "Ready", 1);
+        display.drawText(0, 40, "BLE: Starting", 1);
+        display.update();
+    }
+    BootSequence::getInstance().mark(BOOT_MILESTONE_READY);
+    return true;
+}
+
+static bool showBleStatus() {
+    if (!display_ready) {
+        return true;
+    }
+    DisplayAPI& display = DisplayAPI::getInstance();
+    display.drawRect(0, 40, display.getWidth(), 8, true, false);
+    display.drawText(0, 40, "BLE: Active", 1);
+    display.update();
+    return true;
+}
+
+#define DEP(stage) BOOT_STAGE_BIT(STAGE_##stage)
+
+static const BootStage BOOT_STAGES[STAGE_COUNT] = {
+    // name         run              deps          after                        core required
+    {"nvs",         initNvs,         0,            0,                           0,   true},
+    {"storage",     initStorage,     0,            0,                           1,   true},
+    {"display",     initDisplay,     0,            0,                           1,   false},
+    {"boot",        initBootManager, DEP(NVS),     0,                           0,   true},
+    {"ble",         initBle,         DEP(NVS),     0,                           0,   false},
+    {"plugins",     initPlugins,     DEP(STORAGE), 0,                           1,   false},
+    {"ready",       showReady,       DEP(BOOT),    DEP(DISPLAY) | DEP(PLUGINS), 1,   false},
+    {"ble_status",  showBleStatus,   DEP(BLE),     DEP(READY),                  1,   false},
+};
+
+#undef DEP
+
+extern "C" void app_main(void) {
+    ESP_LOGI(TAG, "DeZero Firmware v%s Starting...", DEZERO_VERSION);
+    
+    // Initialize log store first so the rest of boot is captured
+    if (!LogStore::getInstance().initialize()) {
+        ESP_LOGW(TAG, "Log store unavailable, logging to UART only");
+    }
     
-    // Initialize boot manager
-    ESP_LOGI(TAG, "Initializing Boot Manager...");
-    if (!BootManager::getInstance().initialize()) {
-        ESP_LOGE(TAG, "Failed to initialize Boot Manager");
+    if (!SubsystemManager::getInstance().initialize()) {
         esp_restart();
         return;
     }
     
-    // Initialize storage manager
-    ESP_LOGI(TAG, "Initializing Storage Manager...");
-    if (!StorageManager::getInstance().initialize()) {
-        ESP_LOGE(TAG, "Failed to initialize Storage Manager");
+    BootSequence& boot = BootSequence::getInstance();
+    if (!boot.run(BOOT_STAGES, STAGE_COUNT)) {
+        boot.logTimeline();
+        ESP_LOGE(TAG, "Boot failed, restarting");
         esp_restart();
         return;
     }
     
-    // Initialize display
-    ESP_LOGI(TAG, "Initializing Display...");
-    DisplayAPI::getInstance().initialize();
-    DisplayAPI::getInstance().clear();
-    DisplayAPI::getInstance().drawText(0, 0, "DeZero v2.0", 2);
-    DisplayAPI::getInstance().drawText(0, 20, "Initializing...", 1);
-    DisplayAPI::getInstance().update();
-    
-    // Initialize WiFi manager
-    ESP_LOGI(TAG, "Initializing WiFi Manager...");
-    WiFiManager::getInstance().initialize();
-    
-    // Initialize BLE server
-    ESP_LOGI(TAG, "Initializing BLE Server...");
-    BLEServer::getInstance().initialize();
-    BLEServer::getInstance().start();
-    
-    // Initialize plugin manager
-    ESP_LOGI(TAG, "Initializing Plugin Manager...");
-    if (!PluginManager::getInstance().initialize()) {
-        ESP_LOGE(TAG, "Failed to initialize Plugin Manager");
-    } else {
-        ESP_LOGI(TAG, "Plugin Manager initialized successfully");
-        
-        // Scan for payloads
-        int payload_count = PluginManager::getInstance().scanPayloads();
-        ESP_LOGI(TAG, "Found %d payloads", payload_count);
-    }
-    
-    // Update display
-    DisplayAPI::getInstance().clear();
-    DisplayAPI::getInstance().drawText(0, 0, "DeZero v2.0", 2);
-    DisplayAPI::getInstance().drawText(0, 20, "Ready", 1);
-    DisplayAPI::getInstance().drawText(0, 40, "BLE: Active", 1);
-    DisplayAPI::getInstance().update();
-    
     ESP_LOGI(TAG, "System initialization complete");
+    boot.logTimeline();
     ESP_LOGI(TAG, "Free heap: %" PRIu32 " bytes", esp_get_free_heap_size());
+#if CONFIG_DEZERO_PROTOCOL_BENCHMARK
+    CommandDispatcher::getInstance().benchmark();
+#endif
     
-    // Main loop
+    // Main loop: sleeps until the supervisor reports a payload limit breach
     while (true) {
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        
-        // Periodic tasks
-        PluginManager::getInstance().update();
+        PluginManager::getInstance().supervise(portMAX_DELAY);
     }
 }
@@ -1,4 +1,5 @@
 #include "lua_vm.h"
+#include "../core/payload_arena.h"
 #include "esp_log.h"
 
 static const char* TAG = "LuaVM";
@@ -7,7 +8,9 @@ bool LuaVM::load(const char* payload_id, PayloadContext* context,
                  const std::map<std::string, std::string>& params) {
     ESP_LOGI(TAG, "Loading Lua payload: %s", payload_id);
     
-    // TODO: Initialize Lua VM and load .lua file
+    // TODO: Initialize Lua VM with lua_newstate(arenaAlloc, context->arena)
+    // and load the chunk from context->image with lua_load(), or through a
+    // PayloadStream reader when the payload is stored compressed
     ESP_LOGW(TAG, "Lua VM not yet implemented");
     
     context->status = PAYLOAD_STATUS_RUNNING;
@@ -22,3 +25,12 @@ bool LuaVM::stop(PayloadContext* context) {
     context->status = PAYLOAD_STATUS_COMPLETED;
     return true;
 }
+
+void* LuaVM::arenaAlloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+    PayloadArena* arena = (PayloadArena*)ud;
+    if (nsize == 0) {
+        arena->free(ptr);
+        return nullptr;
+    }
+    return arena->realloc(ptr, nsize);
+}
@@ -16,6 +16,10 @@ public:
               const std::map<std::string, std::string>& params);
     bool stop(PayloadContext* context);
     
+    // lua_Alloc-compatible allocator; pass to lua_newstate() with the
+    // payload's arena as userdata so the whole VM lives in the arena
+    static void* arenaAlloc(void* ud, void* ptr, size_t osize, size_t nsize);
+    
 private:
     LuaVM() = default;
     ~LuaVM() = default;
@@ -1,13 +1,29 @@
 #include "micropython_vm.h"
+#include "../core/payload_arena.h"
 #include "esp_log.h"
 
 static const char* TAG = "MicroPythonVM";
 
+// Share of the payload arena handed to the MicroPython GC heap; the rest
+// stays available for dezero_* API buffers
+static const size_t GC_HEAP_SHARE_PERCENT = 75;
+
 bool MicroPythonVM::load(const char* payload_id, PayloadContext* context,
                          const std::map<std::string, std::string>& params) {
     ESP_LOGI(TAG, "Loading MicroPython payload: %s", payload_id);
     
-    // TODO: Initialize MicroPython VM and load .mpy file
+    // Carve the GC heap out of the payload arena
+    size_t gc_heap_size = context->memory_limit * GC_HEAP_SHARE_PERCENT / 100;
+    void* gc_heap = context->arena ? context->arena->alloc(gc_heap_size) : nullptr;
+    if (!gc_heap) {
+        ESP_LOGE(TAG, "Failed to allocate %u byte GC heap", (unsigned)gc_heap_size);
+        return false;
+    }
+    context->runtime_handle = gc_heap;
+    
+    // TODO: gc_init(gc_heap, gc_heap + gc_heap_size), then load the .mpy
+    // from context->image in place (bytecode and constants stay in flash),
+    // or through an mp_reader_t over a PayloadStream if it is compressed
     ESP_LOGW(TAG, "MicroPython VM not yet implemented");
     
     context->status = PAYLOAD_STATUS_RUNNING;
@@ -19,6 +35,9 @@ bool MicroPythonVM::stop(PayloadContext* context) {
     
     // TODO: Cleanup MicroPython VM
     
+    // The GC heap is reclaimed together with the arena
+    context->runtime_handle = nullptr;
+    
     context->status = PAYLOAD_STATUS_COMPLETED;
     return true;
 }
@@ -8,7 +8,9 @@ bool NativeLoader::load(const char* payload_id, PayloadContext* context,
                         const std::map<std::string, std::string>& params) {
     ESP_LOGI(TAG, "Loading native payload: %s", payload_id);
     
-    // TODO: Implement dynamic library loading
+    // TODO: Implement dynamic library loading. Relocate from the mapped
+    // image (context->image) so only writable sections are copied to RAM;
+    // compressed payloads have no image and must be inflated into the arena.
     // For now, return stub implementation
     ESP_LOGW(TAG, "Native payload loading not yet implemented");
     
@@ -0,0 +1,400 @@
+// Compressed payload decode: packs Lua and MicroPython bytecode modules the
+// way tools/pack_payload.py does (DZPZ header, zlib level 9, memLevel 9) at
+// several window sizes, stores them in the blob partition and reads them
+// back through PayloadStream, which inflates with the tinfl shim in
+// host_rom.cpp. Prints the compression ratio and inflate time per module.
+//
+// The corpora are generated: each module follows the layout of a Lua 5.4
+// binary chunk or a MicroPython v6 .mpy file (header, string and constant
+// tables, instruction streams built from common statement patterns, line
+// info), with identifiers drawn from the payload APIs.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "blob_store.h"
+#include "host_platform.h"
+#include "mbedtls/sha256.h"
+#include "payload_stream.h"
+#include "storage_manager.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static const char* const NAMES[] = {
+    "display", "clear", "draw_text", "draw_line", "show", "wifi", "scan", "ssid", "bssid",
+    "rssi", "channel", "ble", "advertise", "address", "name", "gpio", "set", "get", "delay",
+    "print", "format", "string", "table", "insert", "ipairs", "pairs", "tostring", "len",
+    "results", "target", "count", "timeout", "params", "duration", "self", "append", "range",
+    "send", "recv", "packet", "frame", "on_result", "update", "running", "stop", "log",
+};
+static const size_t NAME_COUNT = sizeof(NAMES) / sizeof(NAMES[0]);
+
+// xorshift32; every run builds the same corpus
+struct Random {
+    uint32_t state;
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    uint32_t below(uint32_t n) { return next() % n; }
+};
+
+static void put32(Bytes& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out.push_back((uint8_t)(value >> (8 * i)));
+}
+
+// ============================================================================
+// Lua 5.4 binary chunk
+// ============================================================================
+
+// ldump.c size encoding: 7 bits per byte, most significant first, the last
+// byte flagged with 0x80
+static void luaSize(Bytes& out, size_t value) {
+    uint8_t buf[10];
+    int n = 0;
+    do {
+        buf[n++] = value & 0x7F;
+        value >>= 7;
+    } while (value);
+    while (n-- > 1) out.push_back(buf[n]);
+    out.push_back(buf[0] | 0x80);
+}
+
+static void luaString(Bytes& out, const std::string& s) {
+    luaSize(out, s.size() + 1);
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+enum { OP_MOVE = 0, OP_LOADI = 1, OP_LOADK = 3, OP_GETTABUP = 11, OP_GETFIELD = 14,
+       OP_SETFIELD = 18, OP_SELF = 20, OP_ADDI = 21, OP_JMP = 56, OP_EQK = 61, OP_TEST = 66,
+       OP_CALL = 68, OP_RETURN0 = 71, OP_FORLOOP = 73, OP_FORPREP = 74 };
+
+static uint32_t abc(int op, int a, int b, int c, int k = 0) {
+    return op | (a << 7) | (k << 15) | (b << 16) | ((uint32_t)c << 24);
+}
+
+static uint32_t abx(int op, int a, uint32_t bx) {
+    return op | (a << 7) | (bx << 15);
+}
+
+static void luaFunction(Bytes& out, Random& rng, int depth, int line) {
+    std::vector<std::string> constants;
+    auto constant = [&](const std::string& s) {
+        for (size_t i = 0; i < constants.size(); i++) {
+            if (constants[i] == s) return (int)i;
+        }
+        constants.push_back(s);
+        return (int)constants.size() - 1;
+    };
+
+    std::vector<uint32_t> code;
+    int statements = 8 + rng.below(40);
+    for (int s = 0; s < statements; s++) {
+        int r = 1 + rng.below(6);
+        switch (rng.below(8)) {
+        case 0: case 1: case 2: {  // module.func(args)
+            code.push_back(abc(OP_GETTABUP, r, 0, constant(NAMES[rng.below(12)])));
+            code.push_back(abc(OP_GETFIELD, r, r, constant(NAMES[rng.below(NAME_COUNT)])));
+            int args = rng.below(4);
+            for (int i = 0; i < args; i++) {
+                code.push_back(rng.below(2) ? abx(OP_LOADK, r + 1 + i, constant(NAMES[rng.below(NAME_COUNT)]))
+                                            : abc(OP_MOVE, r + 1 + i, rng.below(r + 1), 0));
+            }
+            code.push_back(abc(OP_CALL, r, args + 1, 1 + rng.below(2)));
+            break;
+        }
+        case 3:  // local = constant or integer
+            code.push_back(rng.below(2) ? abx(OP_LOADI, r, 65535 + rng.below(300))
+                                        : abx(OP_LOADK, r, constant(NAMES[rng.below(NAME_COUNT)])));
+            break;
+        case 4:  // t.field = value
+            code.push_back(abc(OP_SETFIELD, 0, constant(NAMES[rng.below(NAME_COUNT)]), r));
+            break;
+        case 5:  // if x == "k" then ... end
+            code.push_back(abc(OP_EQK, r, constant(NAMES[rng.below(NAME_COUNT)]), 0));
+            code.push_back(OP_JMP | ((16777215u + 2 + rng.below(6)) << 7));
+            code.push_back(abc(OP_TEST, r, 0, 0));
+            break;
+        case 6:  // for i = 1, n do ... end
+            code.push_back(abx(OP_FORPREP, r, 2 + rng.below(4)));
+            code.push_back(abc(OP_ADDI, r + 3, r + 3, 127 + 1));
+            code.push_back(abx(OP_FORLOOP, r, 3 + rng.below(4)));
+            break;
+        default:  // obj:method(...)
+            code.push_back(abc(OP_SELF, r, 0, constant(NAMES[rng.below(NAME_COUNT)]), 1));
+            code.push_back(abc(OP_CALL, r, 2, 1));
+            break;
+        }
+    }
+    code.push_back(abc(OP_RETURN0, 0, 1, 0));
+
+    int children = depth < 2 ? rng.below(6) : 0;
+    luaString(out, depth == 0 ? "@payload.lua" : "");
+    luaSize(out, depth == 0 ? 0 : line);
+    luaSize(out, depth == 0 ? 0 : line + statements);
+    out.push_back(0);                       // numparams
+    out.push_back(depth == 0 ? 1 : 0);      // is_vararg
+    out.push_back(8 + rng.below(8));        // maxstacksize
+    luaSize(out, code.size());
+    for (uint32_t ins : code) put32(out, ins);
+    luaSize(out, constants.size());
+    for (const std::string& s : constants) {
+        out.push_back(0x04);                // LUA_VSHRSTR
+        luaString(out, s);
+    }
+    luaSize(out, 1);                        // _ENV
+    out.push_back(depth == 0 ? 1 : 0);
+    out.push_back(0);
+    out.push_back(0);
+    luaSize(out, children);
+    for (int i = 0; i < children; i++) {
+        luaFunction(out, rng, depth + 1, line + 1 + i * 20);
+    }
+    luaSize(out, code.size());              // lineinfo: deltas
+    for (size_t i = 0; i < code.size(); i++) out.push_back(rng.below(3) ? 0 : 1);
+    luaSize(out, 0);                        // abslineinfo
+    luaSize(out, 2);                        // locvars
+    for (int i = 0; i < 2; i++) {
+        luaString(out, NAMES[rng.below(NAME_COUNT)]);
+        luaSize(out, 0);
+        luaSize(out, code.size());
+    }
+    luaSize(out, 1);
+    luaString(out, "_ENV");
+}
+
+static Bytes luaChunk(uint32_t seed, size_t target) {
+    static const uint8_t HEADER[] = {0x1B, 'L', 'u', 'a', 0x54, 0x00,
+                                     0x19, 0x93, '\r', '\n', 0x1A, '\n', 4, 8, 8};
+    Bytes out(HEADER, HEADER + sizeof(HEADER));
+    for (int i = 0; i < 8; i++) out.push_back(i == 0 ? 0x78 : i == 1 ? 0x56 : 0);  // LUAC_INT
+    double num = 370.5;                                                             // LUAC_NUM
+    out.insert(out.end(), (uint8_t*)&num, (uint8_t*)&num + sizeof(num));
+    out.push_back(1);                       // upvalues of the main function
+    Random rng = {seed};
+    while (out.size() < target) {
+        luaFunction(out, rng, 0, 1);
+    }
+    return out;
+}
+
+// ============================================================================
+// MicroPython v6 .mpy
+// ============================================================================
+
+static void mpyUint(Bytes& out, size_t value) {
+    uint8_t buf[10];
+    int n = 0;
+    do {
+        buf[n++] = value & 0x7F;
+        value >>= 7;
+    } while (value);
+    while (n-- > 1) out.push_back(buf[n] | 0x80);
+    out.push_back(buf[0]);
+}
+
+enum { BC_LOAD_CONST_STRING = 0x10, BC_LOAD_GLOBAL = 0x1C, BC_LOAD_CONST_NONE = 0x51,
+       BC_LOAD_ATTR = 0x1D, BC_LOAD_METHOD = 0x1E, BC_STORE_ATTR = 0x26, BC_JUMP = 0x42,
+       BC_POP_JUMP_IF_FALSE = 0x44, BC_FOR_ITER = 0x4B, BC_POP_TOP = 0x59, BC_RETURN = 0x63,
+       BC_CALL_METHOD = 0x36, BC_SMALL_INT = 0x70,
+       BC_LOAD_FAST = 0xB0, BC_STORE_FAST = 0xC0, BC_BINARY_OP = 0xD7 };
+
+static void mpyRawCode(Bytes& out, Random& rng, int depth) {
+    Bytes code;
+    code.push_back(0x18 + rng.below(4));    // prelude signature
+    code.push_back(rng.below(4));
+    code.push_back(3 + rng.below(5));       // n_info: name qstr and line info
+    code.push_back(0);                      // n_cell
+    mpyUint(code, rng.below(NAME_COUNT));
+    int statements = 8 + rng.below(40);
+    for (int s = 0; s < statements; s++) {
+        code.push_back(rng.below(4) ? 0x41 : 0x61);  // line info: one line per statement
+    }
+
+    for (int s = 0; s < statements; s++) {
+        switch (rng.below(7)) {
+        case 0: case 1: case 2: {  // module.func(args)
+            int args = rng.below(4);
+            code.push_back(BC_LOAD_GLOBAL);
+            mpyUint(code, rng.below(12));
+            code.push_back(BC_LOAD_METHOD);
+            mpyUint(code, rng.below(NAME_COUNT));
+            for (int i = 0; i < args; i++) {
+                if (rng.below(2)) {
+                    code.push_back(BC_LOAD_FAST + rng.below(6));
+                } else {
+                    code.push_back(BC_LOAD_CONST_STRING);
+                    mpyUint(code, rng.below(NAME_COUNT));
+                }
+            }
+            code.push_back(BC_CALL_METHOD);
+            code.push_back(args);
+            code.push_back(BC_POP_TOP);
+            break;
+        }
+        case 3:  // local = small int or attribute
+            if (rng.below(2)) {
+                code.push_back(BC_SMALL_INT + 16 + rng.below(20));
+            } else {
+                code.push_back(BC_LOAD_FAST + rng.below(6));
+                code.push_back(BC_LOAD_ATTR);
+                mpyUint(code, rng.below(NAME_COUNT));
+            }
+            code.push_back(BC_STORE_FAST + rng.below(6));
+            break;
+        case 4:  // self.attr = value
+            code.push_back(BC_LOAD_FAST + rng.below(6));
+            code.push_back(BC_LOAD_FAST);
+            code.push_back(BC_STORE_ATTR);
+            mpyUint(code, rng.below(NAME_COUNT));
+            break;
+        case 5:  // if a < b:
+            code.push_back(BC_LOAD_FAST + rng.below(6));
+            code.push_back(BC_SMALL_INT + 16 + rng.below(8));
+            code.push_back(BC_BINARY_OP + rng.below(6));
+            code.push_back(BC_POP_JUMP_IF_FALSE);
+            code.push_back(4 + rng.below(20));
+            break;
+        default:  // for x in y:
+            code.push_back(BC_LOAD_FAST + rng.below(6));
+            code.push_back(BC_FOR_ITER);
+            code.push_back(6 + rng.below(10));
+            code.push_back(BC_STORE_FAST + rng.below(6));
+            code.push_back(BC_JUMP);
+            code.push_back(0x80 - 6 - rng.below(10));
+            break;
+        }
+    }
+    code.push_back(BC_LOAD_CONST_NONE);
+    code.push_back(BC_RETURN);
+
+    int children = depth < 2 ? rng.below(6) : 0;
+    mpyUint(out, (code.size() << 3) | (children ? 4 : 0));  // bytecode kind, has children
+    out.insert(out.end(), code.begin(), code.end());
+    if (children) {
+        mpyUint(out, children);
+        for (int i = 0; i < children; i++) {
+            mpyRawCode(out, rng, depth + 1);
+        }
+    }
+}
+
+static Bytes mpyModule(uint32_t seed, size_t target) {
+    Bytes out = {'M', 6, 0, 31};
+    mpyUint(out, NAME_COUNT + 1);           // qstr table
+    mpyUint(out, 0);                        // constant objects
+    const char* source = "payload.py";
+    mpyUint(out, strlen(source) << 1);
+    out.insert(out.end(), source, source + strlen(source) + 1);
+    for (const char* name : NAMES) {
+        mpyUint(out, strlen(name) << 1);
+        out.insert(out.end(), name, name + strlen(name) + 1);
+    }
+    Random rng = {seed};
+    while (out.size() < target) {
+        mpyRawCode(out, rng, 0);
+    }
+    return out;
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+// tools/pack_payload.py: header, then level 9 zlib with the given window
+static Bytes pack(const Bytes& data, int window_bits) {
+    PayloadPackHeader header = {PAYLOAD_PACK_MAGIC, PAYLOAD_PACK_VERSION, PAYLOAD_CODEC_ZLIB, 0,
+                                (uint32_t)data.size()};
+    Bytes out((uint8_t*)&header, (uint8_t*)&header + sizeof(header));
+    z_stream stream = {};
+    deflateInit2(&stream, 9, Z_DEFLATED, window_bits, 9, Z_DEFAULT_STRATEGY);
+    out.resize(sizeof(header) + deflateBound(&stream, data.size()));
+    stream.next_in = const_cast<Bytef*>(data.data());
+    stream.avail_in = data.size();
+    stream.next_out = out.data() + sizeof(header);
+    stream.avail_out = out.size() - sizeof(header);
+    CHECK(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+    out.resize(sizeof(header) + stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+static bool storeBlob(const char* payload_id, const Bytes& data) {
+    BlobStore& blobs = BlobStore::getInstance();
+    BlobExtent extent;
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(data.data(), data.size(), digest, 0);
+    return blobs.reserve(data.size(), extent) &&
+           blobs.write(extent, 0, data.data(), data.size()) &&
+           blobs.commit(payload_id, extent, digest);
+}
+
+struct Totals {
+    size_t raw = 0;
+    size_t stored = 0;
+    uint64_t decode_us = 0;
+};
+
+// One full pass through PayloadStream, as the verifier and loaders do
+static void decode(const char* name, const Bytes& raw, int window_bits, Totals& totals) {
+    Bytes packed = pack(raw, window_bits);
+    CHECK(storeBlob(name, packed));
+
+    PayloadStream stream;
+    CHECK(stream.open(name) && stream.isCompressed());
+    Bytes out;
+    uint8_t buf[1024];
+    size_t n;
+    while ((n = stream.read(buf, sizeof(buf))) > 0) {
+        out.insert(out.end(), buf, buf + n);
+    }
+    CHECK(!stream.failed() && stream.atEnd());
+    CHECK(out == raw);
+    PayloadStreamStats stats = stream.stats();
+    stream.close();
+    BlobStore::getInstance().remove(name);
+
+    printf("  %-12s %7u  %7u  %5.1f%%  %7u  %6.1f\n", name, (unsigned)stats.raw_size,
+           (unsigned)stats.stored_size, stats.stored_size * 100.0 / stats.raw_size,
+           (unsigned)stats.decode_us,
+           stats.decode_us ? stats.raw_size / 1024.0 / 1024.0 / (stats.decode_us / 1e6) : 0.0);
+    totals.raw += stats.raw_size;
+    totals.stored += stats.stored_size;
+    totals.decode_us += stats.decode_us;
+}
+
+int main() {
+    hostResetData();
+    hostAddPartition(BLOB_PARTITION_LABEL, ESP_PARTITION_TYPE_DATA,
+                     (esp_partition_subtype_t)BLOB_PARTITION_SUBTYPE, 1024 * 1024);
+    CHECK(StorageManager::getInstance().initialize());
+    CHECK(BlobStore::getInstance().initialize());
+
+    // Modules of at least these sizes; generation stops after the function
+    // that crosses the size
+    static const size_t SIZES[] = {8 * 1024, 32 * 1024, 96 * 1024, 256 * 1024};
+    static const int WINDOWS[] = {9, 12, 15};
+    for (int window_bits : WINDOWS) {
+        printf("window %d (%u B ring)\n", window_bits, 1u << window_bits);
+        printf("  module           raw   stored   ratio  inflate   MB/s\n");
+        Totals lua, mpy;
+        for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++) {
+            std::string name = "lua_" + std::to_string(i + 1);
+            decode(name.c_str(), luaChunk(0x1234 + i, SIZES[i]), window_bits, lua);
+            name = "mpy_" + std::to_string(i + 1);
+            decode(name.c_str(), mpyModule(0x5678 + i, SIZES[i]), window_bits, mpy);
+        }
+        printf("  lua total    %7u  %7u  %5.1f%%  %7u\n", (unsigned)lua.raw, (unsigned)lua.stored,
+               lua.stored * 100.0 / lua.raw, (unsigned)lua.decode_us);
+        printf("  mpy total    %7u  %7u  %5.1f%%  %7u\n", (unsigned)mpy.raw, (unsigned)mpy.stored,
+               mpy.stored * 100.0 / mpy.raw, (unsigned)mpy.decode_us);
+    }
+
+    return HOST_TEST_RESULT("decode_bench");
+}
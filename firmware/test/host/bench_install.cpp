@@ -0,0 +1,77 @@
+// Install throughput against upload chunk size: a synthetic payload goes
+// through the PluginManager install session API once per chunk size and is
+// aborted, so nothing is left installed. Covers the whole write path:
+// session lookup, checksum, buffered writes and the periodic checkpoints,
+// into payload files and into the blob partition.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include "blob_store.h"
+#include "esp_timer.h"
+#include "host_platform.h"
+#include "plugin_manager.h"
+#include "storage_manager.h"
+
+static const char* BENCH_ID = "install_bench";
+static const size_t TOTAL_SIZE = 128 * 1024;
+static const size_t CHUNK_SIZES[] = {128, 244, 512, 1024, 4096};
+
+static void run(bool with_blobs) {
+    static bool booted = false;
+    if (booted) {
+        StorageManager::getInstance().deinit();
+    }
+    booted = true;
+    hostResetData();
+    if (with_blobs) {
+        hostAddPartition(BLOB_PARTITION_LABEL, ESP_PARTITION_TYPE_DATA,
+                         (esp_partition_subtype_t)BLOB_PARTITION_SUBTYPE, 512 * 1024);
+    }
+    PluginManager& plugins = PluginManager::getInstance();
+    StorageManager& storage = StorageManager::getInstance();
+    CHECK(storage.initialize());
+    CHECK(plugins.initialize());
+    CHECK(BlobStore::getInstance().isAvailable() == with_blobs);
+
+    static uint8_t chunk[4096];
+    for (size_t i = 0; i < sizeof(chunk); i++) {
+        chunk[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    printf("install into %s\n", with_blobs ? "blob partition" : "payload files");
+    printf("  chunk    KB/s  begin us  us/chunk\n");
+    for (size_t chunk_size : CHUNK_SIZES) {
+        size_t resume_offset = 0;
+        int64_t start = esp_timer_get_time();
+        CHECK(plugins.beginInstall(BENCH_ID, TOTAL_SIZE, nullptr, &resume_offset));
+        CHECK(resume_offset == 0);
+        int64_t begun = esp_timer_get_time();
+
+        bool ok = true;
+        for (size_t offset = 0; ok && offset < TOTAL_SIZE; offset += chunk_size) {
+            size_t length = TOTAL_SIZE - offset < chunk_size ? TOTAL_SIZE - offset : chunk_size;
+            ok = plugins.writeInstallChunk(BENCH_ID, offset, chunk, length);
+        }
+        int64_t end = esp_timer_get_time();
+        CHECK(ok);
+        plugins.abortInstall(BENCH_ID);
+
+        int64_t elapsed = end - start;
+        size_t chunks = (TOTAL_SIZE + chunk_size - 1) / chunk_size;
+        printf("  %5u  %6u  %8u  %8u\n", (unsigned)chunk_size,
+               (unsigned)(elapsed ? TOTAL_SIZE * 1000000LL / 1024 / elapsed : 0),
+               (unsigned)(begun - start), (unsigned)((end - begun) / chunks));
+    }
+
+    // Every upload was aborted: no part file, no blob
+    CHECK(!storage.fileExists(storage.getPayloadPartPath(BENCH_ID).c_str()));
+    CHECK(!BlobStore::getInstance().find(BENCH_ID, nullptr, nullptr));
+    CHECK(!with_blobs || BlobStore::getInstance().getFreeSpace() == 512 * 1024 - 2 * 4096);
+}
+
+int main() {
+    run(false);
+    run(true);
+    return HOST_TEST_RESULT("install_bench");
+}
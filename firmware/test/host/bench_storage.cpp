@@ -0,0 +1,92 @@
+// StorageManager latency as the payload count grows: builds a tree shaped
+// like the payload directory (one directory per payload with a manifest
+// and a binary) and times writeFile, readFile, listDirectory (from the
+// filesystem and from the metadata cache) and deleteDirectory at every
+// size. Runs on the backend FsBackend::get() returns, here the host one.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include "esp_timer.h"
+#include "fs_backend.h"
+#include "host_platform.h"
+#include "storage_manager.h"
+
+static const char* BENCH_DIR = STORAGE_BASE_PATH "/bench";
+static const int COUNTS[] = {4, 8, 16, MAX_PAYLOADS};
+static const size_t MANIFEST_SIZE = 384;
+static const size_t BINARY_SIZE = 4096;
+
+int main() {
+    hostResetData();
+    StorageManager& storage = StorageManager::getInstance();
+    CHECK(storage.initialize());
+
+    static uint8_t data[BINARY_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)(i * 31 + 7);
+    }
+
+    printf("storage on %s (us per call)\n", FsBackend::get().name());
+    printf("  count   write    read  list/cold  list/cached  delete\n");
+
+    CHECK(storage.createDirectory(BENCH_DIR));
+    char dir[160];
+    char manifest[192];
+    char binary[192];
+    int created = 0;
+
+    for (int count : COUNTS) {
+        // writeFile: the files of the payloads added at this step
+        int64_t start = esp_timer_get_time();
+        int writes = 0;
+        bool ok = true;
+        for (; ok && created < count; created++, writes += 2) {
+            snprintf(dir, sizeof(dir), "%s/p%02d", BENCH_DIR, created);
+            snprintf(manifest, sizeof(manifest), "%s/manifest.json", dir);
+            snprintf(binary, sizeof(binary), "%s/payload", dir);
+            ok = storage.createDirectory(dir) &&
+                 storage.writeFile(manifest, data, MANIFEST_SIZE) &&
+                 storage.writeFile(binary, data, BINARY_SIZE);
+        }
+        int64_t write_us = writes ? (esp_timer_get_time() - start) / writes : 0;
+        CHECK(ok);
+
+        // readFile: every payload binary
+        start = esp_timer_get_time();
+        for (int i = 0; i < count; i++) {
+            snprintf(binary, sizeof(binary), "%s/p%02d/payload", BENCH_DIR, i);
+            CHECK(storage.readFile(binary, data, sizeof(data)) == (int)BINARY_SIZE);
+        }
+        int64_t read_us = (esp_timer_get_time() - start) / count;
+
+        // listDirectory: from the filesystem, then from the metadata cache
+        storage.invalidate(BENCH_DIR);
+        start = esp_timer_get_time();
+        size_t listed = storage.listDirectory(BENCH_DIR).size();
+        int64_t list_cold_us = esp_timer_get_time() - start;
+        start = esp_timer_get_time();
+        storage.listDirectory(BENCH_DIR);
+        int64_t list_cached_us = esp_timer_get_time() - start;
+        CHECK(listed == (size_t)count);
+
+        // deleteDirectory: the newest payload, which is then written again
+        snprintf(dir, sizeof(dir), "%s/p%02d", BENCH_DIR, count - 1);
+        start = esp_timer_get_time();
+        CHECK(storage.deleteDirectory(dir));
+        int64_t delete_us = esp_timer_get_time() - start;
+        created = count - 1;
+
+        printf("  %5d  %6u  %6u  %9u  %11u  %6u\n", count,
+               (unsigned)write_us, (unsigned)read_us, (unsigned)list_cold_us,
+               (unsigned)list_cached_us, (unsigned)delete_us);
+    }
+
+    for (int i = 0; i < created; i++) {
+        snprintf(dir, sizeof(dir), "%s/p%02d", BENCH_DIR, i);
+        storage.deleteDirectory(dir);
+    }
+    CHECK(storage.deleteDirectory(BENCH_DIR));
+    CHECK(!storage.fileExists(BENCH_DIR));
+    return HOST_TEST_RESULT("storage_bench");
+}
@@ -0,0 +1,167 @@
+// Fakes of the payload registry behind CommandDispatcher: the catalog,
+// install sessions and storage space. Each records what it was asked to do
+// in the globals from firmware_fakes.h. The rest of the system is faked in
+// system_fakes.cpp.
+
+#include "firmware_fakes.h"
+
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include "plugin_manager.h"
+#include "storage_manager.h"
+
+std::map<std::string, std::vector<uint8_t>> fake_uploads;
+std::vector<std::string> fake_committed;
+std::string fake_running;
+std::map<std::string, std::string> fake_params;
+std::map<std::string, std::string> fake_manifests;
+
+static PayloadCatalogRef catalog = std::make_shared<PayloadCatalog>();
+
+void fakeCatalog(int count) {
+    auto next = std::make_shared<PayloadCatalog>();
+    for (int i = 0; i < count; i++) {
+        PayloadSummary summary = {};
+        snprintf(summary.id, sizeof(summary.id), "payload_%d", i);
+        snprintf(summary.name, sizeof(summary.name), "Payload %d", i);
+        strcpy(summary.version, "1.0.0");
+        strcpy(summary.category, "test");
+        summary.type = PAYLOAD_TYPE_NATIVE;
+        summary.size = 1000 * i;
+        next->summaries.push_back(summary);
+        next->manifests[summary.id].id = summary.id;
+    }
+    catalog = next;
+}
+
+// Members of the real singletons; their constructors are never run here
+StorageFile::~StorageFile() {}
+PayloadArena::~PayloadArena() {}
+InstallSession::~InstallSession() {}
+
+// ============================================================================
+// PluginManager
+// ============================================================================
+
+PayloadCatalogRef PluginManager::getCatalog() {
+    return catalog;
+}
+
+// Same page layout as the real listPayloads(), without the binary search
+size_t PluginManager::listPayloads(const char* after_id, uint8_t* out, size_t capacity) {
+    const auto& summaries = catalog->summaries;
+    size_t pos = 5;
+    size_t count = 0;
+    size_t i = 0;
+    for (; i < summaries.size(); i++) {
+        const PayloadSummary& summary = summaries[i];
+        if (after_id[0] && strcmp(summary.id, after_id) <= 0) {
+            continue;
+        }
+        const char* fields[] = { summary.id, summary.name, summary.version, summary.category };
+        size_t record_size = 5;
+        for (const char* field : fields) {
+            record_size += 1 + strlen(field);
+        }
+        if (pos + record_size > capacity) {
+            break;
+        }
+        for (const char* field : fields) {
+            out[pos++] = (uint8_t)strlen(field);
+            memcpy(out + pos, field, strlen(field));
+            pos += strlen(field);
+        }
+        out[pos++] = summary.type;
+        memcpy(out + pos, &summary.size, 4);
+        pos += 4;
+        count++;
+    }
+    out[0] = (uint8_t)summaries.size();
+    out[1] = 0;
+    out[2] = (uint8_t)count;
+    out[3] = 0;
+    out[4] = i < summaries.size() ? 1 : 0;
+    return pos;
+}
+
+PayloadManifestRef PluginManager::getPayloadManifest(const char* payload_id) {
+    auto it = catalog->manifests.find(payload_id);
+    if (it == catalog->manifests.end()) {
+        return nullptr;
+    }
+    return PayloadManifestRef(catalog, &it->second);
+}
+
+payload_status_t PluginManager::getPayloadStatus(const char* payload_id) {
+    return fake_running == payload_id ? PAYLOAD_STATUS_RUNNING : PAYLOAD_STATUS_IDLE;
+}
+
+bool PluginManager::getPayloadStatusEntry(const char* payload_id, PayloadStatusEntry& entry) {
+    if (fake_running != payload_id) {
+        return false;
+    }
+    strncpy(entry.payload_id, payload_id, sizeof(entry.payload_id));
+    entry.status = PAYLOAD_STATUS_RUNNING;
+    entry.core_id = 1;
+    entry.start_time = 0;
+    return true;
+}
+
+bool PluginManager::getPayloadStorageStats(const char*, PayloadStreamStats& stats) {
+    stats = {100, 200, 300};
+    return true;
+}
+
+bool PluginManager::executePayload(const char* payload_id, const std::map<std::string, std::string>& params) {
+    fake_running = payload_id;
+    fake_params = params;
+    return true;
+}
+
+bool PluginManager::stopPayload(const char* payload_id) {
+    if (fake_running != payload_id) {
+        return false;
+    }
+    fake_running.clear();
+    return true;
+}
+
+bool PluginManager::uninstallPayload(const char*) {
+    return true;
+}
+
+bool PluginManager::beginInstall(const char* payload_id, size_t, const uint8_t*, size_t* resume_offset) {
+    *resume_offset = fake_uploads[payload_id].size();
+    return true;
+}
+
+bool PluginManager::writeInstallChunk(const char* payload_id, size_t offset, const uint8_t* data, size_t length) {
+    std::vector<uint8_t>& upload = fake_uploads[payload_id];
+    if (offset != upload.size()) {
+        return false;
+    }
+    upload.insert(upload.end(), data, data + length);
+    return true;
+}
+
+bool PluginManager::writeInstallManifest(const char* payload_id, const uint8_t* manifest, size_t length) {
+    fake_manifests[payload_id].assign((const char*)manifest, length);
+    return true;
+}
+
+bool PluginManager::commitInstall(const char* payload_id) {
+    fake_committed.push_back(payload_id);
+    return true;
+}
+
+void PluginManager::abortInstall(const char* payload_id) {
+    fake_uploads.erase(payload_id);
+}
+
+// ============================================================================
+// StorageManager
+// ============================================================================
+
+size_t StorageManager::getTotalSpace() { return 2 * 1024 * 1024; }
+size_t StorageManager::getFreeSpace() { return 1024 * 1024; }
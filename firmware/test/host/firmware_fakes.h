@@ -0,0 +1,34 @@
+#ifndef FIRMWARE_FAKES_H
+#define FIRMWARE_FAKES_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+// In-memory stand-ins for the managers CommandDispatcher talks to: the
+// payload registry (firmware_fakes.cpp) and the rest of the system
+// (system_fakes.cpp). Tests inspect what the commands did through these.
+
+// Publishes a catalog of payload_0 .. payload_<count - 1>
+void fakeCatalog(int count);
+
+// Bytes received so far by each install session, by payload id
+extern std::map<std::string, std::vector<uint8_t>> fake_uploads;
+extern std::vector<std::string> fake_committed;
+extern std::map<std::string, std::string> fake_manifests;
+
+// The payload executePayload() started, and its parameters
+extern std::string fake_running;
+extern std::map<std::string, std::string> fake_params;
+
+// Bytes written by the OTA session, and whether the update was applied
+extern size_t fake_ota_written;
+extern bool fake_ota_applied;
+
+// Every log page LogStore::read() returns is filled with this byte
+static const uint8_t FAKE_LOG_BYTE = 'L';
+static const size_t FAKE_LOG_PAGE = 4000;
+
+#endif // FIRMWARE_FAKES_H
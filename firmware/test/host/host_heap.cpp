@@ -0,0 +1,127 @@
+// multi_heap and heap_caps for host tests. The multi_heap model is a
+// first-fit list with an 8-byte header in front of every block and a
+// control structure at the start of the region, so block overhead and
+// fragmentation inside a payload arena behave like the IDF's.
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "multi_heap.h"
+
+static const size_t ALIGN = 8;
+static const size_t MIN_BLOCK = 16;
+
+struct HostBlock {
+    uint32_t size;              // Usable bytes after the header
+    uint32_t used;
+};
+
+struct multi_heap_info {
+    uint8_t* end;
+    uint8_t reserved[56];       // Stands in for the allocator's own tables
+};
+
+static size_t alignUp(size_t value) {
+    return (value + ALIGN - 1) & ~(ALIGN - 1);
+}
+
+static HostBlock* firstBlock(multi_heap_handle_t heap) {
+    return (HostBlock*)((uint8_t*)heap + sizeof(multi_heap_info));
+}
+
+static HostBlock* nextBlock(HostBlock* block) {
+    return (HostBlock*)((uint8_t*)(block + 1) + block->size);
+}
+
+static HostBlock* blockOf(void* ptr) {
+    return (HostBlock*)ptr - 1;
+}
+
+multi_heap_handle_t multi_heap_register(void* start, size_t size) {
+    uint8_t* base = (uint8_t*)alignUp((uintptr_t)start);
+    size_t usable = (size - (base - (uint8_t*)start)) & ~(ALIGN - 1);
+    if (usable < sizeof(multi_heap_info) + sizeof(HostBlock) + MIN_BLOCK) {
+        return nullptr;
+    }
+    multi_heap_handle_t heap = (multi_heap_handle_t)base;
+    heap->end = base + usable;
+    HostBlock* block = firstBlock(heap);
+    block->size = usable - sizeof(multi_heap_info) - sizeof(HostBlock);
+    block->used = 0;
+    return heap;
+}
+
+void* multi_heap_malloc(multi_heap_handle_t heap, size_t size) {
+    size = alignUp(size < MIN_BLOCK ? MIN_BLOCK : size);
+    for (HostBlock* block = firstBlock(heap); (uint8_t*)block < heap->end; block = nextBlock(block)) {
+        if (block->used) {
+            continue;
+        }
+        // Merge the free blocks that follow before judging the size
+        HostBlock* next = nextBlock(block);
+        while ((uint8_t*)next < heap->end && !next->used) {
+            block->size += sizeof(HostBlock) + next->size;
+            next = nextBlock(block);
+        }
+        if (block->size < size) {
+            continue;
+        }
+        if (block->size >= size + sizeof(HostBlock) + MIN_BLOCK) {
+            HostBlock* rest = (HostBlock*)((uint8_t*)(block + 1) + size);
+            rest->size = block->size - size - sizeof(HostBlock);
+            rest->used = 0;
+            block->size = size;
+        }
+        block->used = 1;
+        return block + 1;
+    }
+    return nullptr;
+}
+
+void multi_heap_free(multi_heap_handle_t, void* ptr) {
+    if (ptr) {
+        blockOf(ptr)->used = 0;
+    }
+}
+
+void* multi_heap_realloc(multi_heap_handle_t heap, void* ptr, size_t size) {
+    if (ptr && alignUp(size) <= blockOf(ptr)->size) {
+        return ptr;
+    }
+    void* moved = multi_heap_malloc(heap, size);
+    if (moved && ptr) {
+        memcpy(moved, ptr, blockOf(ptr)->size);
+        multi_heap_free(heap, ptr);
+    }
+    return moved;
+}
+
+size_t multi_heap_get_allocated_size(multi_heap_handle_t, void* ptr) {
+    return blockOf(ptr)->size;
+}
+
+size_t multi_heap_free_size(multi_heap_handle_t heap) {
+    size_t free_bytes = 0;
+    for (HostBlock* block = firstBlock(heap); (uint8_t*)block < heap->end; block = nextBlock(block)) {
+        if (!block->used) {
+            free_bytes += block->size;
+        }
+    }
+    return free_bytes;
+}
+
+void* heap_caps_malloc(size_t size, uint32_t) {
+    return malloc(size);
+}
+
+void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t) {
+    return 160 * 1024;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t) {
+    return 96 * 1024;
+}
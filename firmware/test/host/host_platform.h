@@ -0,0 +1,42 @@
+#ifndef HOST_PLATFORM_H
+#define HOST_PLATFORM_H
+
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_partition.h"
+
+// Test controls for the host implementations of the IDF and FreeRTOS
+// services (host_rtos.cpp, host_storage.cpp, host_heap.cpp).
+
+// Moves the esp_timer clock forward and returns once every timer that
+// became due has run
+void hostAdvanceTime(int64_t us);
+
+// Called on the waiting thread whenever ulTaskNotifyTake() times out,
+// before it returns 0; lets a test act inside that window
+void hostOnNotifyTimeout(std::function<void()> hook);
+
+// Notifications pending for the calling thread
+uint32_t hostPendingNotifications();
+
+// Empties HOST_DATA_DIR (the filesystem under STORAGE_BASE_PATH and the
+// partition images), forgets every partition and clears NVS
+void hostResetData();
+
+// A flash partition backed by <HOST_DATA_DIR>/<label>.img, mapped with
+// mmap. A new image starts erased; an existing one keeps its contents, so
+// dropping and adding a partition again is a reboot. Writes can only
+// clear bits, as on NOR flash.
+const esp_partition_t* hostAddPartition(const char* label, esp_partition_type_t type,
+                                        esp_partition_subtype_t subtype, size_t size);
+void hostRemovePartition(const char* label);
+uint8_t* hostPartitionData(const char* label);
+
+// Mappings handed out by esp_partition_mmap() and not yet released
+int hostActiveMappings();
+
+// Capacity the host FsBackend reports for the storage directory
+void hostSetStorageSize(size_t bytes);
+
+#endif // HOST_PLATFORM_H
@@ -0,0 +1,579 @@
+// FreeRTOS and esp_system/esp_timer on top of std::thread, for host tests.
+// Semantics follow the IDF closely enough for the code under test: tasks
+// are detached threads, ticks are milliseconds, critical sections are
+// spinlocks and esp_timer callbacks run on one timer thread. The clock
+// can be moved forward by a test (host_platform.h) to fire timers early.
+
+#include "host_platform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/task.h"
+
+using namespace std::chrono;
+
+static const steady_clock::time_point boot_time = steady_clock::now();
+static std::atomic<int64_t> clock_offset_us{0};
+
+int64_t esp_timer_get_time(void) {
+    return duration_cast<microseconds>(steady_clock::now() - boot_time).count() + clock_offset_us.load();
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return 128 * 1024;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return 96 * 1024;
+}
+
+void esp_restart(void) {
+    printf("esp_restart()\n");
+}
+
+const char* esp_err_to_name(esp_err_t err) {
+    return err == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+// Waits on cv until ready() holds; false if timeout ticks pass first
+template <typename Ready>
+static bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock,
+                    TickType_t timeout, Ready ready) {
+    if (timeout == portMAX_DELAY) {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, milliseconds(timeout), ready);
+}
+
+// ============================================================================
+// Critical sections: a spinlock per portMUX_TYPE that its owner may re-enter
+// ============================================================================
+
+static uint32_t currentThreadId() {
+    static std::atomic<uint32_t> next_id{1};
+    thread_local uint32_t id = next_id.fetch_add(1);
+    return id;
+}
+
+void vPortEnterCritical(portMUX_TYPE* mux) {
+    uint32_t self = currentThreadId();
+    if (__atomic_load_n(&mux->owner, __ATOMIC_ACQUIRE) == self) {
+        mux->count++;
+        return;
+    }
+    uint32_t unlocked = 0;
+    while (!__atomic_compare_exchange_n(&mux->owner, &unlocked, self, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        unlocked = 0;
+        std::this_thread::yield();
+    }
+    mux->count = 1;
+}
+
+void vPortExitCritical(portMUX_TYPE* mux) {
+    if (--mux->count == 0) {
+        __atomic_store_n(&mux->owner, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// ============================================================================
+// Semaphores: a mutex is a counting semaphore with one token
+// ============================================================================
+
+struct HostSemaphore {
+    std::mutex lock;
+    std::condition_variable cv;
+    UBaseType_t count;
+    UBaseType_t max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return new HostSemaphore{{}, {}, 1, 1};
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return new HostSemaphore{{}, {}, 0, 1};
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+    return new HostSemaphore{{}, {}, initial, max};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t timeout) {
+    HostSemaphore* sem = static_cast<HostSemaphore*>(handle);
+    std::unique_lock<std::mutex> lock(sem->lock);
+    if (!waitFor(sem->cv, lock, timeout, [sem] { return sem->count > 0; })) {
+        return pdFALSE;
+    }
+    sem->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+    HostSemaphore* sem = static_cast<HostSemaphore*>(handle);
+    std::lock_guard<std::mutex> lock(sem->lock);
+    if (sem->count >= sem->max) {
+        return pdFALSE;
+    }
+    sem->count++;
+    sem->cv.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t handle) {
+    HostSemaphore* sem = static_cast<HostSemaphore*>(handle);
+    std::lock_guard<std::mutex> lock(sem->lock);
+    return sem->count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t handle) {
+    delete static_cast<HostSemaphore*>(handle);
+}
+
+// Recursive mutexes are separate handles; only the *Recursive calls take them
+struct HostRecursiveMutex {
+    std::recursive_timed_mutex lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) {
+    return new HostRecursiveMutex();
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t handle, TickType_t timeout) {
+    HostRecursiveMutex* mutex = static_cast<HostRecursiveMutex*>(handle);
+    if (timeout == portMAX_DELAY) {
+        mutex->lock.lock();
+        return pdTRUE;
+    }
+    return mutex->lock.try_lock_for(milliseconds(timeout)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t handle) {
+    static_cast<HostRecursiveMutex*>(handle)->lock.unlock();
+    return pdTRUE;
+}
+
+// ============================================================================
+// Queues
+// ============================================================================
+
+struct HostQueue {
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    HostQueue* queue = new HostQueue();
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t handle) {
+    delete static_cast<HostQueue*>(handle);
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void* item, TickType_t timeout) {
+    HostQueue* queue = static_cast<HostQueue*>(handle);
+    std::unique_lock<std::mutex> lock(queue->lock);
+    if (!waitFor(queue->cv, lock, timeout, [queue] { return queue->items.size() < queue->length; })) {
+        return pdFALSE;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(item);
+    queue->items.emplace_back(bytes, bytes + queue->item_size);
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void* item, BaseType_t* woken) {
+    if (woken) {
+        *woken = pdFALSE;
+    }
+    return xQueueSend(handle, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void* item, TickType_t timeout) {
+    HostQueue* queue = static_cast<HostQueue*>(handle);
+    std::unique_lock<std::mutex> lock(queue->lock);
+    if (!waitFor(queue->cv, lock, timeout, [queue] { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+    HostQueue* queue = static_cast<HostQueue*>(handle);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    return queue->items.size();
+}
+
+BaseType_t xQueueReset(QueueHandle_t handle) {
+    HostQueue* queue = static_cast<HostQueue*>(handle);
+    std::lock_guard<std::mutex> lock(queue->lock);
+    queue->items.clear();
+    queue->cv.notify_all();
+    return pdPASS;
+}
+
+// ============================================================================
+// Event groups
+// ============================================================================
+
+struct HostEventGroup {
+    std::mutex lock;
+    std::condition_variable cv;
+    EventBits_t bits = 0;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t handle) {
+    delete static_cast<HostEventGroup*>(handle);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t handle, EventBits_t bits) {
+    HostEventGroup* group = static_cast<HostEventGroup*>(handle);
+    std::lock_guard<std::mutex> lock(group->lock);
+    group->bits |= bits;
+    group->cv.notify_all();
+    return group->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t handle, EventBits_t bits) {
+    HostEventGroup* group = static_cast<HostEventGroup*>(handle);
+    std::lock_guard<std::mutex> lock(group->lock);
+    EventBits_t previous = group->bits;
+    group->bits &= ~bits;
+    return previous;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t handle) {
+    HostEventGroup* group = static_cast<HostEventGroup*>(handle);
+    std::lock_guard<std::mutex> lock(group->lock);
+    return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t handle, EventBits_t bits, BaseType_t clear,
+                                BaseType_t all, TickType_t timeout) {
+    HostEventGroup* group = static_cast<HostEventGroup*>(handle);
+    std::unique_lock<std::mutex> lock(group->lock);
+    auto ready = [&] { return all ? (group->bits & bits) == bits : (group->bits & bits) != 0; };
+    bool met = waitFor(group->cv, lock, timeout, ready);
+    EventBits_t result = group->bits;
+    if (met && clear) {
+        group->bits &= ~bits;
+    }
+    return result;
+}
+
+// ============================================================================
+// Stream buffers
+// ============================================================================
+
+struct HostStreamBuffer {
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<uint8_t> data;
+    size_t capacity;
+};
+
+StreamBufferHandle_t xStreamBufferCreate(size_t capacity, size_t) {
+    HostStreamBuffer* buffer = new HostStreamBuffer();
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+void vStreamBufferDelete(StreamBufferHandle_t handle) {
+    delete static_cast<HostStreamBuffer*>(handle);
+}
+
+size_t xStreamBufferSend(StreamBufferHandle_t handle, const void* data, size_t length, TickType_t) {
+    HostStreamBuffer* buffer = static_cast<HostStreamBuffer*>(handle);
+    std::lock_guard<std::mutex> lock(buffer->lock);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    size_t accepted = std::min(length, buffer->capacity - buffer->data.size());
+    buffer->data.insert(buffer->data.end(), bytes, bytes + accepted);
+    buffer->cv.notify_all();
+    return accepted;
+}
+
+size_t xStreamBufferReceive(StreamBufferHandle_t handle, void* out, size_t length, TickType_t timeout) {
+    HostStreamBuffer* buffer = static_cast<HostStreamBuffer*>(handle);
+    std::unique_lock<std::mutex> lock(buffer->lock);
+    waitFor(buffer->cv, lock, timeout, [buffer] { return !buffer->data.empty(); });
+    size_t taken = std::min(length, buffer->data.size());
+    std::copy(buffer->data.begin(), buffer->data.begin() + taken, static_cast<uint8_t*>(out));
+    buffer->data.erase(buffer->data.begin(), buffer->data.begin() + taken);
+    return taken;
+}
+
+// ============================================================================
+// Tasks
+// ============================================================================
+
+static thread_local BaseType_t current_core = 0;
+static thread_local void* task_locals[4] = {};
+
+// The handle is stored before the task runs, as FreeRTOS does
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char*, uint32_t, void* arg,
+                                   UBaseType_t, TaskHandle_t* handle, BaseType_t core) {
+    static std::mutex start_lock;
+    std::lock_guard<std::mutex> lock(start_lock);
+    std::thread thread([function, arg, core] {
+        { std::lock_guard<std::mutex> started(start_lock); }
+        current_core = core == tskNO_AFFINITY ? 0 : core;
+        function(arg);
+    });
+    if (handle) {
+        *handle = reinterpret_cast<TaskHandle_t>(thread.native_handle());
+    }
+    thread.detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stack, void* arg,
+                       UBaseType_t priority, TaskHandle_t* handle) {
+    return xTaskCreatePinnedToCore(function, name, stack, arg, priority, handle, tskNO_AFFINITY);
+}
+
+// A task deleting itself just returns from its function on the host; a
+// thread cannot be killed from outside, so deleting another task only
+// forgets it
+void vTaskDelete(TaskHandle_t) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(milliseconds(ticks));
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return reinterpret_cast<TaskHandle_t>(pthread_self());
+}
+
+BaseType_t xPortGetCoreID(void) {
+    return current_core;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+// Only a task suspending itself is supported: it never runs again
+void vTaskSuspend(TaskHandle_t handle) {
+    while (handle == nullptr) {
+        std::this_thread::sleep_for(hours(1));
+    }
+}
+
+void vTaskResume(TaskHandle_t) {
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t, BaseType_t index, void* value) {
+    task_locals[index] = value;
+}
+
+void* pvTaskGetThreadLocalStoragePointer(TaskHandle_t, BaseType_t index) {
+    return task_locals[index];
+}
+
+// ============================================================================
+// Task notifications: one counting notification per task
+// ============================================================================
+
+struct HostNotification {
+    std::mutex lock;
+    std::condition_variable cv;
+    uint32_t count = 0;
+};
+
+static std::function<void()> notify_timeout_hook;
+
+static HostNotification& notificationOf(TaskHandle_t task) {
+    static std::mutex table_lock;
+    // Never destroyed: threads still waiting at exit would block it
+    static auto& table = *new std::map<TaskHandle_t, HostNotification>;
+    std::lock_guard<std::mutex> lock(table_lock);
+    return table[task];
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout) {
+    HostNotification& notification = notificationOf(xTaskGetCurrentTaskHandle());
+    std::unique_lock<std::mutex> lock(notification.lock);
+    if (!waitFor(notification.cv, lock, timeout, [&] { return notification.count > 0; })) {
+        if (notify_timeout_hook) {
+            lock.unlock();
+            notify_timeout_hook();
+        }
+        return 0;
+    }
+    uint32_t count = notification.count;
+    notification.count = clear ? 0 : count - 1;
+    return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    HostNotification& notification = notificationOf(task);
+    std::lock_guard<std::mutex> lock(notification.lock);
+    notification.count++;
+    notification.cv.notify_all();
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken) {
+    if (woken) {
+        *woken = pdFALSE;
+    }
+    xTaskNotifyGive(task);
+}
+
+void hostOnNotifyTimeout(std::function<void()> hook) {
+    notify_timeout_hook = hook;
+}
+
+uint32_t hostPendingNotifications() {
+    HostNotification& notification = notificationOf(xTaskGetCurrentTaskHandle());
+    std::lock_guard<std::mutex> lock(notification.lock);
+    return notification.count;
+}
+
+// ============================================================================
+// esp_timer: one dispatch thread, on the (advanceable) esp_timer clock
+// ============================================================================
+
+struct esp_timer {
+    esp_timer_cb_t callback;
+    void* arg;
+    int64_t expiry;
+    uint64_t period;
+    bool armed;
+};
+
+// Never destroyed, since the dispatch thread outlives main()
+static std::mutex& timer_lock = *new std::mutex;
+static std::condition_variable& timer_cv = *new std::condition_variable;
+static std::vector<esp_timer*>& timers = *new std::vector<esp_timer*>;
+static bool timer_busy = false;
+
+static esp_timer* nextTimer() {
+    esp_timer* next = nullptr;
+    for (esp_timer* timer : timers) {
+        if (timer->armed && (!next || timer->expiry < next->expiry)) {
+            next = timer;
+        }
+    }
+    return next;
+}
+
+static void timerTask() {
+    std::unique_lock<std::mutex> lock(timer_lock);
+    while (true) {
+        esp_timer* next = nextTimer();
+        if (!next) {
+            timer_cv.wait(lock);
+            continue;
+        }
+        int64_t now = esp_timer_get_time();
+        if (next->expiry > now) {
+            timer_cv.wait_for(lock, microseconds(next->expiry - now));
+            continue;
+        }
+
+        if (next->period) {
+            next->expiry += next->period;
+        } else {
+            next->armed = false;
+        }
+        esp_timer_cb_t callback = next->callback;
+        void* arg = next->arg;
+        timer_busy = true;
+        lock.unlock();
+        callback(arg);
+        lock.lock();
+        timer_busy = false;
+        timer_cv.notify_all();
+    }
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+    static std::once_flag started;
+    std::call_once(started, [] { std::thread(timerTask).detach(); });
+
+    esp_timer* timer = new esp_timer{args->callback, args->arg, 0, 0, false};
+    std::lock_guard<std::mutex> lock(timer_lock);
+    timers.push_back(timer);
+    *handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t startTimer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+    std::lock_guard<std::mutex> lock(timer_lock);
+    if (timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expiry = esp_timer_get_time() + timeout_us;
+    timer->period = period_us;
+    timer->armed = true;
+    timer_cv.notify_all();
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return startTimer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+    return startTimer(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timer_lock);
+    if (!timer->armed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(timer_lock);
+    timers.erase(std::remove(timers.begin(), timers.end(), timer), timers.end());
+    delete timer;
+    return ESP_OK;
+}
+
+void hostAdvanceTime(int64_t us) {
+    std::unique_lock<std::mutex> lock(timer_lock);
+    clock_offset_us += us;
+    timer_cv.notify_all();
+    timer_cv.wait(lock, [] {
+        esp_timer* next = nextTimer();
+        return !timer_busy && (!next || next->expiry > esp_timer_get_time());
+    });
+}
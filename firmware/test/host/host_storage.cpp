@@ -0,0 +1,316 @@
+// Persistent storage for host tests: flash partitions as image files
+// mapped with mmap, NVS in memory, and an FsBackend over a directory.
+// Everything lives under HOST_DATA_DIR, which the Makefile sets per test.
+
+#include "host_platform.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <map>
+#include <memory>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "fs_backend.h"
+#include "nvs.h"
+#include "spi_flash_mmap.h"
+#include "types.h"
+
+#ifndef HOST_DATA_DIR
+#define HOST_DATA_DIR "host-data"
+#endif
+
+static void makeDirectories(const std::string& path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    }
+    mkdir(path.c_str(), 0755);
+}
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+// ============================================================================
+// Flash partitions
+// ============================================================================
+
+struct HostPartition {
+    esp_partition_t info;
+    uint8_t* data;
+    int fd;
+};
+
+static std::vector<std::unique_ptr<HostPartition>> partitions;
+static std::map<spi_flash_mmap_handle_t, const void*> mappings;
+static spi_flash_mmap_handle_t next_mapping = 1;
+
+static HostPartition* partitionOf(const esp_partition_t* partition) {
+    for (auto& host : partitions) {
+        if (&host->info == partition) {
+            return host.get();
+        }
+    }
+    return nullptr;
+}
+
+const esp_partition_t* hostAddPartition(const char* label, esp_partition_type_t type,
+                                        esp_partition_subtype_t subtype, size_t size) {
+    makeDirectories(HOST_DATA_DIR);
+    std::string path = std::string(HOST_DATA_DIR) + "/" + label + ".img";
+    struct stat st;
+    bool fresh = stat(path.c_str(), &st) != 0 || (size_t)st.st_size != size;
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        return nullptr;
+    }
+    uint8_t* data = (uint8_t*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+    if (fresh) {
+        memset(data, 0xFF, size);
+    }
+
+    uint32_t address = 0x110000;
+    for (auto& host : partitions) {
+        address = host->info.address + host->info.size;
+    }
+
+    std::unique_ptr<HostPartition> host(new HostPartition());
+    host->info.type = type;
+    host->info.subtype = subtype;
+    host->info.address = address;
+    host->info.size = size;
+    strncpy(host->info.label, label, sizeof(host->info.label) - 1);
+    host->data = data;
+    host->fd = fd;
+    partitions.push_back(std::move(host));
+    return &partitions.back()->info;
+}
+
+void hostRemovePartition(const char* label) {
+    for (auto it = partitions.begin(); it != partitions.end(); ++it) {
+        if (strcmp((*it)->info.label, label) == 0) {
+            munmap((*it)->data, (*it)->info.size);
+            close((*it)->fd);
+            partitions.erase(it);
+            return;
+        }
+    }
+}
+
+uint8_t* hostPartitionData(const char* label) {
+    for (auto& host : partitions) {
+        if (strcmp(host->info.label, label) == 0) {
+            return host->data;
+        }
+    }
+    return nullptr;
+}
+
+int hostActiveMappings() {
+    return (int)mappings.size();
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+    for (auto& host : partitions) {
+        if (host->info.type == type &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || host->info.subtype == subtype) &&
+            (!label || strcmp(host->info.label, label) == 0)) {
+            return &host->info;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* out, size_t size) {
+    HostPartition* host = partitionOf(partition);
+    if (!host || offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(out, host->data + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* data, size_t size) {
+    HostPartition* host = partitionOf(partition);
+    if (!host || offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        host->data[offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    HostPartition* host = partitionOf(partition);
+    if (!host || offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memset(host->data + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             spi_flash_mmap_memory_t, const void** out, spi_flash_mmap_handle_t* handle) {
+    HostPartition* host = partitionOf(partition);
+    if (!host || offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = host->data + offset;
+    *handle = next_mapping++;
+    mappings[*handle] = *out;
+    return ESP_OK;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle) {
+    mappings.erase(handle);
+}
+
+// ============================================================================
+// NVS: namespaces of blobs, committed immediately
+// ============================================================================
+
+static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> nvs_store;
+static std::map<nvs_handle_t, std::pair<std::string, nvs_open_mode_t>> nvs_handles;
+static nvs_handle_t next_nvs_handle = 1;
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t mode, nvs_handle_t* handle) {
+    if (mode == NVS_READONLY && !nvs_store.count(name)) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    nvs_store[name];
+    *handle = next_nvs_handle++;
+    nvs_handles[*handle] = std::make_pair(std::string(name), mode);
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out, size_t* length) {
+    auto open = nvs_handles.find(handle);
+    if (open == nvs_handles.end()) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    auto& space = nvs_store[open->second.first];
+    auto it = space.find(key);
+    if (it == space.end()) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (!out) {
+        *length = it->second.size();
+        return ESP_OK;
+    }
+    if (*length < it->second.size()) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out, it->second.data(), it->second.size());
+    *length = it->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* data, size_t length) {
+    auto open = nvs_handles.find(handle);
+    if (open == nvs_handles.end()) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (open->second.second == NVS_READONLY) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    nvs_store[open->second.first][key].assign(bytes, bytes + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    auto open = nvs_handles.find(handle);
+    if (open == nvs_handles.end()) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    return nvs_store[open->second.first].erase(key) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t) {
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    nvs_handles.erase(handle);
+}
+
+// ============================================================================
+// Filesystem: a plain directory, sized like a small flash partition
+// ============================================================================
+
+static size_t storage_size = 1024 * 1024;
+
+class HostFsBackend : public FsBackend {
+public:
+    const char* name() const override { return "host"; }
+
+    bool mount(const char* base_path, const char*, int) override {
+        makeDirectories(base_path);
+        base_path_ = base_path;
+        return true;
+    }
+
+    void unmount() override {}
+
+    // Usage counts whole blocks, as flash filesystems allocate them
+    bool getInfo(size_t* total, size_t* used) override {
+        used_ = 0;
+        nftw(base_path_.c_str(), &HostFsBackend::countEntry, 16, FTW_PHYS);
+        *total = storage_size;
+        *used = used_;
+        return true;
+    }
+
+    bool hasDirectories() const override { return true; }
+    bool renameReplaces() const override { return true; }
+    size_t ioBlockSize() const override { return BLOCK_SIZE; }
+
+private:
+    static const size_t BLOCK_SIZE = 4096;
+
+    static int countEntry(const char*, const struct stat* st, int type, struct FTW*) {
+        if (type == FTW_F) {
+            used_ += (st->st_size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        }
+        return 0;
+    }
+
+    std::string base_path_;
+    static size_t used_;
+};
+
+size_t HostFsBackend::used_ = 0;
+
+FsBackend& FsBackend::get() {
+    static HostFsBackend backend;
+    return backend;
+}
+
+void hostSetStorageSize(size_t bytes) {
+    storage_size = bytes;
+}
+
+void hostResetData() {
+    while (!partitions.empty()) {
+        hostRemovePartition(partitions.back()->info.label);
+    }
+    mappings.clear();
+    nvs_store.clear();
+    nvs_handles.clear();
+    nftw(HOST_DATA_DIR, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    makeDirectories(STORAGE_BASE_PATH);
+}
@@ -0,0 +1,27 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+
+// Each test binary defines host_test_failures once (HOST_TEST_MAIN) and
+// returns it from main(); CHECK records a failure and carries on
+#ifdef HOST_TEST_MAIN
+int host_test_failures = 0;
+#else
+extern int host_test_failures;
+#endif
+
+#define CHECK(condition) do {                                                  \
+        if (!(condition)) {                                                    \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition);        \
+            host_test_failures++;                                              \
+        }                                                                      \
+    } while (0)
+
+// Prints the verdict; the exit status is the number of failed checks
+#define HOST_TEST_RESULT(name)                                                 \
+    (printf("%s: %s (%d failed)\n", name,                                      \
+            host_test_failures ? "FAILED" : "OK", host_test_failures),         \
+     fflush(stdout), host_test_failures)
+
+#endif // HOST_TEST_H
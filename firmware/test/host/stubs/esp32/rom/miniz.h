@@ -0,0 +1,17 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+// The ROM tinfl API on top of zlib's inflate (host_rom.cpp). zlib keeps
+// its own history window, so the caller's ring is only an output buffer;
+// the state zlib allocates is released when the stream ends or fails.
+typedef uint8_t mz_uint8; typedef uint32_t mz_uint32;
+typedef enum {
+    TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS = -4, TINFL_STATUS_BAD_PARAM = -3, TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1, TINFL_STATUS_DONE = 0, TINFL_STATUS_NEEDS_MORE_INPUT = 1, TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+enum { TINFL_FLAG_PARSE_ZLIB_HEADER = 1, TINFL_FLAG_HAS_MORE_INPUT = 2, TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4, TINFL_FLAG_COMPUTE_ADLER32 = 8 };
+typedef struct tinfl_decompressor_tag { z_stream stream; int state; } tinfl_decompressor;
+#define tinfl_init(r) do { (r)->state = 0; } while (0)
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* in, size_t* in_size, mz_uint8* out_start,
+                              mz_uint8* out_next, size_t* out_size, const mz_uint32 flags);
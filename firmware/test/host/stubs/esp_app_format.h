@@ -0,0 +1,5 @@
+#pragma once
+#include <stdint.h>
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+#define ESP_APP_DESC_MAGIC_WORD 0xABCD5432
+typedef struct { uint32_t magic_word; char version[32]; char project_name[32]; char time[16]; char date[16]; char idf_ver[32]; } esp_app_desc_t;
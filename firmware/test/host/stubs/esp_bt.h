@@ -0,0 +1,9 @@
+#pragma once
+#include "esp_err.h"
+typedef enum { ESP_BT_MODE_IDLE, ESP_BT_MODE_BLE, ESP_BT_MODE_CLASSIC_BT, ESP_BT_MODE_BTDM } esp_bt_mode_t;
+typedef struct { int x; } esp_bt_controller_config_t;
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() {0}
+typedef enum { ESP_BT_CONTROLLER_STATUS_IDLE, ESP_BT_CONTROLLER_STATUS_INITED, ESP_BT_CONTROLLER_STATUS_ENABLED } esp_bt_controller_status_t;
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t); esp_err_t esp_bt_controller_init(esp_bt_controller_config_t*);
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t); esp_err_t esp_bt_controller_disable(void); esp_err_t esp_bt_controller_deinit(void);
+esp_bt_controller_status_t esp_bt_controller_get_status(void);
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+typedef uint8_t esp_bd_addr_t[6];
+typedef enum { ESP_BT_STATUS_SUCCESS = 0 } esp_bt_status_t;
+typedef enum { ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT = 0, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT = 20, ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT = 21, ESP_GAP_BLE_PHY_UPDATE_COMPLETE_EVT = 40 } esp_gap_ble_cb_event_t;
+typedef union {
+  struct { esp_bt_status_t status; esp_bd_addr_t bda; uint16_t min_int, max_int, latency, conn_int, timeout; } update_conn_params;
+  struct { esp_bt_status_t status; struct { uint16_t rx_len, tx_len; } params; } pkt_data_length_cmpl;
+  struct { esp_bt_status_t status; esp_bd_addr_t bda; uint8_t tx_phy, rx_phy; } phy_update;
+} esp_ble_gap_cb_param_t;
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t, esp_ble_gap_cb_param_t*);
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t); esp_err_t esp_ble_gap_set_device_name(const char*);
+typedef struct { bool set_scan_rsp, include_name, include_txpower; int min_interval, max_interval, appearance; uint16_t manufacturer_len; uint8_t* p_manufacturer_data; uint16_t service_data_len; uint8_t* p_service_data; uint16_t service_uuid_len; uint8_t* p_service_uuid; uint8_t flag; } esp_ble_adv_data_t;
+typedef struct { uint16_t adv_int_min, adv_int_max; int adv_type, own_addr_type, channel_map, adv_filter_policy; } esp_ble_adv_params_t;
+typedef struct { esp_bd_addr_t bda; uint16_t min_int, max_int, latency, timeout; } esp_ble_conn_update_params_t;
+#define ESP_BLE_ADV_FLAG_GEN_DISC 2
+#define ESP_BLE_ADV_FLAG_BREDR_NOT_SPT 4
+enum { ADV_TYPE_IND, BLE_ADDR_TYPE_PUBLIC, ADV_CHNL_ALL = 7, ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY = 0 };
+#define ESP_BLE_GAP_NO_PREFER_TRANSMIT_PHY 1
+#define ESP_BLE_GAP_NO_PREFER_RECEIVE_PHY 2
+#define ESP_BLE_GAP_PHY_2M_PREF_MASK 2
+#define ESP_BLE_GAP_PHY_OPTIONS_NO_PREF 0
+#define ESP_BLE_GAP_PHY_2M 2
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t*); esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t*); esp_err_t esp_ble_gap_stop_advertising(void);
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t*);
+esp_err_t esp_ble_gap_set_pkt_data_len(esp_bd_addr_t, uint16_t);
+esp_err_t esp_ble_gap_set_preferred_phy(esp_bd_addr_t, uint8_t, uint8_t, uint8_t, uint16_t);
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_gap_ble_api.h"
+typedef uint8_t esp_gatt_if_t;
+#define ESP_GATT_IF_NONE 0xff
+typedef enum { ESP_GATT_OK = 0, ESP_GATT_REQ_NOT_SUPPORTED = 0x06, ESP_GATT_INVALID_OFFSET = 0x07, ESP_GATT_PREPARE_Q_FULL = 0x09, ESP_GATT_INVALID_ATTR_LEN = 0x0d } esp_gatt_status_t;
+#define ESP_GATT_MAX_ATTR_LEN 600
+#define ESP_GATT_PREP_WRITE_CANCEL 0x00
+#define ESP_GATT_PREP_WRITE_EXEC 0x01
+#define ESP_GATT_RSP_BY_APP 0
+typedef struct { uint8_t value[ESP_GATT_MAX_ATTR_LEN]; uint16_t handle; uint16_t offset; uint16_t len; uint8_t auth_req; } esp_gatt_value_t;
+typedef union { esp_gatt_value_t attr_value; uint16_t handle; } esp_gatt_rsp_t;
+typedef enum { ESP_GATTS_REG_EVT = 0, ESP_GATTS_WRITE_EVT = 2, ESP_GATTS_EXEC_WRITE_EVT = 3, ESP_GATTS_MTU_EVT = 4, ESP_GATTS_CONF_EVT = 5, ESP_GATTS_CONNECT_EVT = 14, ESP_GATTS_DISCONNECT_EVT = 15, ESP_GATTS_CONGEST_EVT = 18, ESP_GATTS_CREAT_ATTR_TAB_EVT = 22 } esp_gatts_cb_event_t;
+typedef union {
+  struct { esp_gatt_status_t status; uint16_t app_id; } reg;
+  struct { uint16_t conn_id; uint32_t trans_id; esp_bd_addr_t bda; uint16_t handle; uint16_t offset; bool need_rsp; bool is_prep; uint16_t len; uint8_t* value; } write;
+  struct { uint16_t conn_id; uint32_t trans_id; esp_bd_addr_t bda; uint8_t exec_write_flag; } exec_write;
+  struct { uint16_t conn_id; uint16_t mtu; } mtu;
+  struct { esp_gatt_status_t status; uint16_t conn_id; uint16_t handle; uint16_t len; uint8_t* value; } conf;
+  struct { uint16_t conn_id; uint8_t link_role; esp_bd_addr_t remote_bda; } connect;
+  struct { uint16_t conn_id; esp_bd_addr_t remote_bda; int reason; } disconnect;
+  struct { uint16_t conn_id; bool congested; } congest;
+  struct { esp_gatt_status_t status; struct { int len; } svc_uuid; uint8_t svc_inst_id; uint16_t num_handle; uint16_t* handles; } add_attr_tab;
+} esp_ble_gatts_cb_param_t;
+typedef void (*esp_gatts_cb_t)(esp_gatts_cb_event_t, esp_gatt_if_t, esp_ble_gatts_cb_param_t*);
+#define ESP_GATT_AUTO_RSP 1
+#define ESP_UUID_LEN_16 2
+#define ESP_GATT_PERM_READ 1
+#define ESP_GATT_PERM_WRITE 0x10
+#define ESP_GATT_UUID_PRI_SERVICE 0x2800
+#define ESP_GATT_UUID_CHAR_DECLARE 0x2803
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG 0x2902
+#define ESP_GATT_CHAR_PROP_BIT_WRITE_NR 0x04
+#define ESP_GATT_CHAR_PROP_BIT_WRITE 0x08
+#define ESP_GATT_CHAR_PROP_BIT_NOTIFY 0x10
+typedef struct { uint8_t auto_rsp; } esp_attr_control_t;
+typedef struct { uint16_t uuid_length; uint8_t* uuid_p; uint16_t perm; uint16_t max_length; uint16_t length; uint8_t* value; } esp_attr_desc_t;
+typedef struct { esp_attr_control_t attr_control; esp_attr_desc_t att_desc; } esp_gatts_attr_db_t;
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t); esp_err_t esp_ble_gatts_app_register(uint16_t);
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t*, esp_gatt_if_t, uint8_t, uint8_t);
+esp_err_t esp_ble_gatts_start_service(uint16_t);
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t, uint16_t, uint16_t, uint16_t, uint8_t*, bool);
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t, uint16_t, uint32_t, esp_gatt_status_t, esp_gatt_rsp_t*);
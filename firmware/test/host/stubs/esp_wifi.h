@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+typedef struct { uint8_t ssid[33]; int8_t rssi; uint8_t primary; } wifi_ap_record_t;
+typedef struct { int x; } wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() {0}
+typedef enum { WIFI_FAST_SCAN, WIFI_ALL_CHANNEL_SCAN } wifi_scan_method_t;
+typedef enum { WIFI_CONNECT_AP_BY_SIGNAL, WIFI_CONNECT_AP_BY_SECURITY } wifi_sort_method_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; wifi_scan_method_t scan_method; bool bssid_set; uint8_t bssid[6]; uint8_t channel; wifi_sort_method_t sort_method; } wifi_sta_config_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; uint8_t ssid_len; uint8_t channel; uint8_t max_connection; int authmode; } wifi_ap_config_t;
+typedef union { wifi_ap_config_t ap; wifi_sta_config_t sta; } wifi_config_t;
+typedef enum { WIFI_MODE_NULL, WIFI_MODE_STA, WIFI_MODE_AP, WIFI_MODE_APSTA } wifi_mode_t;
+typedef enum { WIFI_IF_STA, WIFI_IF_AP } wifi_interface_t;
+typedef enum { WIFI_STORAGE_FLASH, WIFI_STORAGE_RAM } wifi_storage_t;
+enum { WIFI_AUTH_OPEN, WIFI_AUTH_WPA_WPA2_PSK };
+typedef struct { bool show_hidden; } wifi_scan_config_t;
+extern esp_event_base_t WIFI_EVENT; extern esp_event_base_t IP_EVENT;
+enum { WIFI_EVENT_SCAN_DONE = 1, WIFI_EVENT_STA_START, WIFI_EVENT_STA_STOP, WIFI_EVENT_STA_CONNECTED, WIFI_EVENT_STA_DISCONNECTED, WIFI_EVENT_AP_START = 12, WIFI_EVENT_AP_STOP };
+enum { IP_EVENT_STA_GOT_IP = 0 };
+typedef struct { uint8_t ssid[32]; uint8_t ssid_len; uint8_t bssid[6]; uint8_t channel; int authmode; uint16_t aid; } wifi_event_sta_connected_t;
+esp_err_t esp_wifi_init(const wifi_init_config_t*); esp_err_t esp_wifi_deinit(void);
+esp_err_t esp_wifi_start(void); esp_err_t esp_wifi_stop(void); esp_err_t esp_wifi_set_storage(wifi_storage_t);
+esp_err_t esp_wifi_set_mode(wifi_mode_t); esp_err_t esp_wifi_set_config(wifi_interface_t, wifi_config_t*);
+esp_err_t esp_wifi_connect(void); esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t*, bool); esp_err_t esp_wifi_scan_stop(void);
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t*); esp_err_t esp_wifi_scan_get_ap_records(uint16_t*, wifi_ap_record_t*);
+typedef void* esp_netif_t;
+esp_err_t esp_netif_init(void); esp_netif_t* esp_netif_create_default_wifi_ap(void); esp_netif_t* esp_netif_create_default_wifi_sta(void);
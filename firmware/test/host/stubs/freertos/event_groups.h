@@ -0,0 +1,8 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void* EventGroupHandle_t; typedef uint32_t EventBits_t;
+EventGroupHandle_t xEventGroupCreate(void); void vEventGroupDelete(EventGroupHandle_t);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t, EventBits_t);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t, EventBits_t, BaseType_t, BaseType_t, TickType_t);
@@ -0,0 +1,7 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void* StreamBufferHandle_t;
+StreamBufferHandle_t xStreamBufferCreate(size_t, size_t);
+void vStreamBufferDelete(StreamBufferHandle_t);
+size_t xStreamBufferSend(StreamBufferHandle_t, const void*, size_t, TickType_t);
+size_t xStreamBufferReceive(StreamBufferHandle_t, void*, size_t, TickType_t);
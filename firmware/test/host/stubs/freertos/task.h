@@ -0,0 +1,16 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void* TaskHandle_t; typedef void (*TaskFunction_t)(void*);
+void vTaskDelay(TickType_t); void vTaskDelete(TaskHandle_t);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*, BaseType_t);
+BaseType_t xTaskCreate(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xPortGetCoreID(void);
+TickType_t xTaskGetTickCount(void);
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t);
+void vTaskSuspend(TaskHandle_t); void vTaskResume(TaskHandle_t);
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t, BaseType_t, void*);
+void* pvTaskGetThreadLocalStoragePointer(TaskHandle_t, BaseType_t);
@@ -0,0 +1,9 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+// Software SHA-256 (host_rom.cpp); is224 must be 0
+typedef struct { uint32_t state[8]; uint64_t length; uint8_t block[64]; size_t used; } mbedtls_sha256_context;
+void mbedtls_sha256_init(mbedtls_sha256_context*); void mbedtls_sha256_free(mbedtls_sha256_context*);
+int mbedtls_sha256_starts(mbedtls_sha256_context*, int); int mbedtls_sha256_update(mbedtls_sha256_context*, const unsigned char*, size_t);
+int mbedtls_sha256_finish(mbedtls_sha256_context*, unsigned char*);
+int mbedtls_sha256(const unsigned char*, size_t, unsigned char*, int);
@@ -0,0 +1,9 @@
+#pragma once
+#include <stddef.h>
+typedef struct multi_heap_info* multi_heap_handle_t;
+multi_heap_handle_t multi_heap_register(void*, size_t);
+void* multi_heap_malloc(multi_heap_handle_t, size_t);
+void multi_heap_free(multi_heap_handle_t, void*);
+void* multi_heap_realloc(multi_heap_handle_t, void*, size_t);
+size_t multi_heap_get_allocated_size(multi_heap_handle_t, void*);
+size_t multi_heap_free_size(multi_heap_handle_t);
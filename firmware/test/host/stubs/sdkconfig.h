@@ -0,0 +1,6 @@
+#pragma once
+// Host test configuration
+#define CONFIG_DEZERO_STORAGE_IO_BUFFER_SIZE 1024
+#ifndef CONFIG_DEZERO_PROTOCOL_BENCHMARK
+#define CONFIG_DEZERO_PROTOCOL_BENCHMARK 1
+#endif
@@ -0,0 +1,94 @@
+// Fakes of the rest of the system around the payload registry: OTA,
+// subsystems, logs, the boot timeline and the payload loader. Tests that
+// run the real registry (test_payload_install) link only these.
+
+#include "firmware_fakes.h"
+
+#include <string.h>
+#include "boot_manager.h"
+#include "boot_sequence.h"
+#include "delta_patcher.h"
+#include "log_store.h"
+#include "payload_loader.h"
+#include "subsystem_manager.h"
+
+size_t fake_ota_written = 0;
+bool fake_ota_applied = false;
+
+DeltaPatcher::~DeltaPatcher() {}
+
+// ============================================================================
+// BootManager
+// ============================================================================
+
+const char* BootManager::getFirmwareVersion() {
+    return "2.0.0-host";
+}
+
+bool BootManager::beginOta(size_t, const uint8_t*, size_t* resume_offset) {
+    fake_ota_written = 0;
+    *resume_offset = 0;
+    return true;
+}
+
+bool BootManager::writeOta(size_t offset, const uint8_t*, size_t length) {
+    if (offset != fake_ota_written) {
+        return false;
+    }
+    fake_ota_written += length;
+    return true;
+}
+
+bool BootManager::endOta() { return true; }
+bool BootManager::beginDeltaOta(size_t) { return true; }
+bool BootManager::writeDeltaOta(size_t, const uint8_t*, size_t) { return true; }
+bool BootManager::endDeltaOta() { return true; }
+void BootManager::abortOta() {}
+
+bool BootManager::applyUpdate() {
+    fake_ota_applied = true;
+    return true;
+}
+
+// ============================================================================
+// Subsystems, logs, boot timeline
+// ============================================================================
+
+uint32_t SubsystemManager::getActiveMask() {
+    return SUBSYSTEM_BIT(SUBSYSTEM_BLE) | SUBSYSTEM_BIT(SUBSYSTEM_DISPLAY);
+}
+
+uint32_t SubsystemManager::maskForManifest(const PayloadManifest&) { return 0; }
+bool SubsystemManager::acquireMask(uint32_t) { return true; }
+void SubsystemManager::releaseMask(uint32_t) {}
+
+// Every call returns one full page and advances the cursor by 100
+size_t LogStore::read(uint32_t cursor, uint8_t* out, size_t capacity, uint32_t* next_cursor) {
+    size_t length = capacity < FAKE_LOG_PAGE ? capacity : FAKE_LOG_PAGE;
+    memset(out, FAKE_LOG_BYTE, length);
+    *next_cursor = cursor + 100;
+    return length;
+}
+
+size_t BootSequence::getTimeline(uint8_t* out, size_t capacity) const {
+    memset(out, 0, 9);
+    return 9;
+}
+
+void BootSequence::mark(boot_milestone_t) {}
+
+// ============================================================================
+// PayloadLoader
+// ============================================================================
+
+// Payloads "run" until they are stopped; no task is started
+bool PayloadLoader::loadAndExecute(const char*, PayloadContext* context,
+                                   const std::map<std::string, std::string>&) {
+    context->status = PAYLOAD_STATUS_RUNNING;
+    return true;
+}
+
+bool PayloadLoader::stop(const char*, PayloadContext* context) {
+    context->status = PAYLOAD_STATUS_COMPLETED;
+    return true;
+}
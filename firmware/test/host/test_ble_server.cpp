@@ -0,0 +1,453 @@
+// BLEServer over a simulated Bluedroid stack and radio link, with the
+// dispatcher fakes from firmware_fakes.cpp behind it: a 64 KB upload,
+// 16 log pages down, a peer that drops mid-frame and reconnects, and a
+// request sent as a long (prepared) write.
+//
+// The link moves LINK_PACKETS link layer packets per connection interval
+// each way, so the printed rates follow MTU and DLE the way a phone's do.
+// Run with "legacy" for a peer that keeps the 23-byte MTU and 27-byte
+// packets.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "ble_server.h"
+#include "esp_bt.h"
+#include "esp_bt_main.h"
+#include "esp_gatt_common_api.h"
+#include "esp_timer.h"
+#include "firmware_fakes.h"
+
+using namespace std::chrono;
+
+typedef std::vector<uint8_t> Bytes;
+
+static const esp_gatt_if_t GATTS_IF = 3;
+static const int LINK_INTERVAL_US = 15000;
+static const int LINK_PACKETS = 6;
+static const size_t CONGESTED_AT = 10;  // Notifications queued in the stack
+static const size_t UNCONGESTED_AT = 4;
+
+// What the peer accepts; "legacy" lowers these
+static uint16_t peer_mtu = 517;
+static uint16_t peer_octets = 251;
+static bool peer_dle = true;
+
+// ============================================================================
+// Bluedroid: callbacks run one at a time on the BTC task
+// ============================================================================
+
+static std::mutex btc_lock;
+static std::condition_variable btc_cv;
+static std::deque<std::function<void()>> btc_queue;
+static esp_gatts_cb_t gatts_cb;
+static esp_gap_ble_cb_t gap_cb;
+
+static void btcPost(std::function<void()> run) {
+    std::lock_guard<std::mutex> lock(btc_lock);
+    btc_queue.push_back(run);
+    btc_cv.notify_all();
+}
+
+static void btcTask() {
+    while (true) {
+        std::function<void()> run;
+        {
+            std::unique_lock<std::mutex> lock(btc_lock);
+            btc_cv.wait(lock, [] { return !btc_queue.empty(); });
+            run = btc_queue.front();
+            btc_queue.pop_front();
+        }
+        run();
+    }
+}
+
+static void gattsEvent(esp_gatts_cb_event_t event, esp_ble_gatts_cb_param_t param = {}) {
+    btcPost([event, param]() mutable { gatts_cb(event, GATTS_IF, &param); });
+}
+
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t) { return ESP_OK; }
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t*) { return ESP_OK; }
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t) { return ESP_OK; }
+esp_err_t esp_bt_controller_disable(void) { return ESP_OK; }
+esp_err_t esp_bt_controller_deinit(void) { return ESP_OK; }
+
+esp_bt_controller_status_t esp_bt_controller_get_status(void) {
+    return ESP_BT_CONTROLLER_STATUS_IDLE;
+}
+
+esp_err_t esp_bluedroid_init(void) {
+    std::thread(btcTask).detach();
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void) { return ESP_OK; }
+esp_err_t esp_bluedroid_disable(void) { return ESP_OK; }
+esp_err_t esp_bluedroid_deinit(void) { return ESP_OK; }
+
+esp_bluedroid_status_t esp_bluedroid_get_status(void) {
+    return ESP_BLUEDROID_STATUS_UNINITIALIZED;
+}
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback) {
+    gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_device_name(const char*) { return ESP_OK; }
+esp_err_t esp_ble_gap_config_adv_data(esp_ble_adv_data_t*) { return ESP_OK; }
+esp_err_t esp_ble_gap_start_advertising(esp_ble_adv_params_t*) { return ESP_OK; }
+esp_err_t esp_ble_gap_stop_advertising(void) { return ESP_OK; }
+esp_err_t esp_ble_gap_set_preferred_phy(esp_bd_addr_t, uint8_t, uint8_t, uint8_t, uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t) { return ESP_OK; }
+esp_err_t esp_ble_gatts_start_service(uint16_t) { return ESP_OK; }
+
+esp_err_t esp_ble_gatts_register_callback(esp_gatts_cb_t callback) {
+    gatts_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_app_register(uint16_t) {
+    esp_ble_gatts_cb_param_t param = {};
+    param.reg.status = ESP_GATT_OK;
+    gattsEvent(ESP_GATTS_REG_EVT, param);
+    return ESP_OK;
+}
+
+// Service, RX value, TX value and TX CCCD land on these handles
+static uint16_t attr_handles[] = {40, 41, 42, 43, 44, 45};
+static const uint16_t RX_HANDLE = 42;
+static const uint16_t TX_CCCD_HANDLE = 45;
+
+esp_err_t esp_ble_gatts_create_attr_tab(const esp_gatts_attr_db_t*, esp_gatt_if_t, uint8_t count, uint8_t) {
+    esp_ble_gatts_cb_param_t param = {};
+    param.add_attr_tab.status = ESP_GATT_OK;
+    param.add_attr_tab.num_handle = count;
+    param.add_attr_tab.handles = attr_handles;
+    gattsEvent(ESP_GATTS_CREAT_ATTR_TAB_EVT, param);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t*) {
+    btcPost([] {
+        esp_ble_gap_cb_param_t param = {};
+        param.update_conn_params.conn_int = LINK_INTERVAL_US / 1250;
+        gap_cb(ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT, &param);
+    });
+    return ESP_OK;
+}
+
+// ============================================================================
+// Radio link
+// ============================================================================
+
+static std::mutex link_lock;
+static std::deque<Bytes> downlink;    // Notifications queued in the stack
+static std::deque<Bytes> uplink;      // Writes from the peer
+static uint16_t link_mtu = 23;
+static uint16_t link_octets = 27;
+static bool congested = false;
+static size_t peak_queue = 0;
+static int write_responses = 0;
+static int failed_responses = 0;
+
+// What the peer has received
+static std::mutex peer_lock;
+static std::condition_variable peer_cv;
+static Bytes peer_rx;
+
+esp_err_t esp_ble_gap_set_pkt_data_len(esp_bd_addr_t, uint16_t) {
+    if (!peer_dle) {
+        return ESP_OK;
+    }
+    btcPost([] {
+        link_octets = peer_octets;
+        esp_ble_gap_cb_param_t param = {};
+        param.pkt_data_length_cmpl.params.tx_len = peer_octets;
+        param.pkt_data_length_cmpl.params.rx_len = peer_octets;
+        gap_cb(ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT, &param);
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t, uint16_t, uint16_t, uint16_t length, uint8_t* value, bool) {
+    CHECK(length <= link_mtu - 3);
+    if (length > link_mtu - 3) {
+        return ESP_FAIL;
+    }
+    std::lock_guard<std::mutex> lock(link_lock);
+    downlink.emplace_back(value, value + length);
+    peak_queue = std::max(peak_queue, downlink.size());
+    if (downlink.size() >= CONGESTED_AT && !congested) {
+        congested = true;
+        esp_ble_gatts_cb_param_t param = {};
+        param.congest.congested = true;
+        gattsEvent(ESP_GATTS_CONGEST_EVT, param);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatts_send_response(esp_gatt_if_t, uint16_t, uint32_t, esp_gatt_status_t status,
+                                      esp_gatt_rsp_t*) {
+    write_responses++;
+    if (status != ESP_GATT_OK) {
+        failed_responses++;
+    }
+    return ESP_OK;
+}
+
+// Link layer packets one ATT PDU takes, with its L2CAP and ATT headers
+static size_t packetsFor(const Bytes& pdu) {
+    return (pdu.size() + 3 + 4 + link_octets - 1) / link_octets;
+}
+
+static std::vector<Bytes> takeInterval(std::deque<Bytes>& queue) {
+    std::vector<Bytes> taken;
+    size_t budget = LINK_PACKETS;
+    while (!queue.empty() && packetsFor(queue.front()) <= budget) {
+        budget -= packetsFor(queue.front());
+        taken.push_back(queue.front());
+        queue.pop_front();
+    }
+    return taken;
+}
+
+static void writeEvent(Bytes value, uint16_t handle, bool prepared = false, uint16_t offset = 0) {
+    btcPost([value, handle, prepared, offset]() mutable {
+        esp_ble_gatts_cb_param_t param = {};
+        param.write.handle = handle;
+        param.write.is_prep = prepared;
+        param.write.need_rsp = prepared;
+        param.write.offset = offset;
+        param.write.len = value.size();
+        param.write.value = value.data();
+        gatts_cb(ESP_GATTS_WRITE_EVT, GATTS_IF, &param);
+    });
+}
+
+static void linkTask() {
+    while (true) {
+        std::this_thread::sleep_for(microseconds(LINK_INTERVAL_US));
+        std::vector<Bytes> down, up;
+        {
+            std::lock_guard<std::mutex> lock(link_lock);
+            down = takeInterval(downlink);
+            up = takeInterval(uplink);
+            if (congested && downlink.size() < UNCONGESTED_AT) {
+                congested = false;
+                esp_ble_gatts_cb_param_t param = {};
+                param.congest.congested = false;
+                gattsEvent(ESP_GATTS_CONGEST_EVT, param);
+            }
+        }
+        for (const Bytes& notification : down) {
+            gattsEvent(ESP_GATTS_CONF_EVT);
+            std::lock_guard<std::mutex> lock(peer_lock);
+            peer_rx.insert(peer_rx.end(), notification.begin(), notification.end());
+            peer_cv.notify_all();
+        }
+        for (const Bytes& write : up) {
+            writeEvent(write, RX_HANDLE);
+        }
+    }
+}
+
+// Connect, exchange MTUs and subscribe to TX notifications
+static void peerConnect() {
+    gattsEvent(ESP_GATTS_CONNECT_EVT);
+    btcPost([] {
+        link_mtu = peer_mtu;
+        esp_ble_gatts_cb_param_t param = {};
+        param.mtu.mtu = peer_mtu;
+        gatts_cb(ESP_GATTS_MTU_EVT, GATTS_IF, &param);
+    });
+    writeEvent({1, 0}, TX_CCCD_HANDLE);
+}
+
+static void peerReconnect() {
+    gattsEvent(ESP_GATTS_DISCONNECT_EVT);
+    peerConnect();
+}
+
+// Writes without response, MTU - 3 bytes at a time
+static void peerWrite(const uint8_t* data, size_t length) {
+    size_t chunk = std::min<size_t>(link_mtu - 3, 512);
+    std::lock_guard<std::mutex> lock(link_lock);
+    for (size_t offset = 0; offset < length; offset += chunk) {
+        uplink.emplace_back(data + offset, data + std::min(length, offset + chunk));
+    }
+}
+
+// Prepared writes of MTU - 5 bytes each, then execute
+static void peerLongWrite(const Bytes& data) {
+    size_t part = link_mtu - 5;
+    for (size_t offset = 0; offset < data.size(); offset += part) {
+        Bytes value(data.begin() + offset, data.begin() + std::min(data.size(), offset + part));
+        writeEvent(value, RX_HANDLE, true, offset);
+    }
+    esp_ble_gatts_cb_param_t param = {};
+    param.exec_write.exec_write_flag = ESP_GATT_PREP_WRITE_EXEC;
+    gattsEvent(ESP_GATTS_EXEC_WRITE_EVT, param);
+}
+
+// ============================================================================
+// Test
+// ============================================================================
+
+static uint16_t request_id = 0;
+
+static Bytes frame(uint8_t opcode, const Bytes& payload, uint16_t id) {
+    Bytes out(FRAME_HEADER_SIZE + payload.size());
+    std::copy(payload.begin(), payload.end(), out.begin() + FRAME_HEADER_SIZE);
+    CommandDispatcher::encodeFrame(out.data(), opcode, 0, 0, id, payload.size());
+    return out;
+}
+
+// Length-prefixed string
+static Bytes str(const char* text) {
+    size_t length = strlen(text);
+    Bytes out(1 + length);
+    out[0] = (uint8_t)length;
+    memcpy(out.data() + 1, text, length);
+    return out;
+}
+
+static void put32(Bytes& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+// Waits for the response to request id; its status, or -1 on timeout
+static int awaitResponse(uint16_t id, Bytes* payload, int timeout_ms) {
+    std::unique_lock<std::mutex> lock(peer_lock);
+    int status = -1;
+    peer_cv.wait_for(lock, milliseconds(timeout_ms), [&] {
+        CommandFrame parsed;
+        size_t used = 0;
+        if (peer_rx.empty() ||
+            CommandDispatcher::parseFrame(peer_rx.data(), peer_rx.size(), parsed, &used) != FRAME_OK) {
+            return false;
+        }
+        if (parsed.header->request_id == id) {
+            status = parsed.header->status;
+            if (payload) {
+                payload->assign(parsed.payload, parsed.payload + parsed.header->length);
+            }
+        }
+        peer_rx.erase(peer_rx.begin(), peer_rx.begin() + used);
+        return status >= 0;
+    });
+    return status;
+}
+
+static int call(uint8_t opcode, const Bytes& request, Bytes* payload = nullptr) {
+    Bytes raw = frame(opcode, request, ++request_id);
+    peerWrite(raw.data(), raw.size());
+    return awaitResponse(request_id, payload, 5000);
+}
+
+int main(int argc, char** argv) {
+    setvbuf(stdout, nullptr, _IONBF, 0);
+    bool legacy = argc > 1 && strcmp(argv[1], "legacy") == 0;
+    if (legacy) {
+        peer_mtu = 23;
+        peer_octets = 27;
+        peer_dle = false;
+    }
+    fakeCatalog(8);
+
+    BLEServer& server = BLEServer::getInstance();
+    CHECK(server.initialize());
+    CHECK(server.start());
+    // Registration and the attribute table complete on the BTC task
+    std::this_thread::sleep_for(milliseconds(100));
+    std::thread(linkTask).detach();
+    peerConnect();
+    std::this_thread::sleep_for(milliseconds(100));
+    CHECK(server.isConnected());
+
+    // Upload 64 KB in full-size frames
+    const size_t UPLOAD_SIZE = 64 * 1024;
+    Bytes id = str("bigp");
+    Bytes request = {UPLOAD_BEGIN};
+    request.insert(request.end(), id.begin(), id.end());
+    put32(request, UPLOAD_SIZE);
+    CHECK(call(CMD_UPLOAD_PAYLOAD, request) == RESP_OK);
+    size_t per_frame = FRAME_MAX_PAYLOAD - 1 - id.size() - 4;
+    int64_t start = esp_timer_get_time();
+    for (size_t offset = 0; offset < UPLOAD_SIZE; offset += per_frame) {
+        request = {UPLOAD_WRITE};
+        request.insert(request.end(), id.begin(), id.end());
+        put32(request, offset);
+        request.insert(request.end(), std::min(per_frame, UPLOAD_SIZE - offset), (uint8_t)offset);
+        if (call(CMD_UPLOAD_PAYLOAD, request) != RESP_OK) {
+            CHECK(!"upload write failed");
+            break;
+        }
+    }
+    double upload_s = (esp_timer_get_time() - start) / 1e6;
+    CHECK(fake_uploads["bigp"].size() == UPLOAD_SIZE);
+
+    // Download 16 pages of logs
+    start = esp_timer_get_time();
+    size_t downloaded = 0;
+    Bytes page;
+    for (int i = 0; i < 16; i++) {
+        request = {};
+        put32(request, i * 100);
+        if (call(CMD_GET_LOGS, request, &page) != RESP_OK) {
+            CHECK(!"log download failed");
+            break;
+        }
+        downloaded += page.size();
+        CHECK(page.size() == 8 + FAKE_LOG_PAGE);
+        CHECK(std::all_of(page.begin() + 8, page.end(), [](uint8_t b) { return b == FAKE_LOG_BYTE; }));
+    }
+    double download_s = (esp_timer_get_time() - start) / 1e6;
+
+    // The peer drops after half a frame; requests after the reconnect
+    // must not be glued onto it
+    Bytes partial = frame(CMD_PING, {1, 2, 3}, 999);
+    peerWrite(partial.data(), 8);
+    std::this_thread::sleep_for(milliseconds(50));
+    peerReconnect();
+    for (int i = 0; i < 3; i++) {
+        CHECK(call(CMD_PING, {}) == RESP_OK);
+    }
+
+    // A request larger than one write, sent as a long write
+    Bytes ping(188, 0x33);
+    Bytes raw = frame(CMD_PING, ping, ++request_id);
+    peerLongWrite(raw);
+    Bytes echo;
+    CHECK(awaitResponse(request_id, &echo, 3000) == RESP_OK);
+    CHECK(echo == ping);
+    CHECK(write_responses > 0 && failed_responses == 0);
+
+    // Let the rate window close before reading the stats
+    std::this_thread::sleep_for(milliseconds(1200));
+    BleLinkStats stats;
+    server.getStats(stats);
+    CHECK(stats.mtu == peer_mtu);
+    CHECK(stats.tx_octets == (peer_dle ? peer_octets : 27));
+    printf("%s: upload %.1f KB/s, download %.1f KB/s (MTU %u, LL %u, congestion waits %u, "
+           "peak stack queue %zu, device rx %u B/s tx %u B/s)\n",
+           legacy ? "legacy" : "tuned", UPLOAD_SIZE / 1024.0 / upload_s, downloaded / 1024.0 / download_s,
+           stats.mtu, stats.tx_octets, (unsigned)stats.congestion_waits, peak_queue,
+           (unsigned)stats.last_rx_bps, (unsigned)stats.last_tx_bps);
+
+    // The BTC, link and command tasks never return
+    int failures = HOST_TEST_RESULT(legacy ? "ble_server (legacy peer)" : "ble_server");
+    _exit(failures);
+}
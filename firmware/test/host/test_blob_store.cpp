@@ -0,0 +1,212 @@
+// BlobStore over a host flash partition (mmapped image file): extents are
+// placed first fit and freed with their last reference, identical content
+// is stored once and reference counted, and a table update cut short by a
+// power loss leaves the previous copy of the two-slot table in charge.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <cstring>
+#include <vector>
+#include "blob_store.h"
+#include "host_platform.h"
+#include "mbedtls/sha256.h"
+#include "spi_flash_mmap.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static const uint32_t SECTOR = SPI_FLASH_SEC_SIZE;
+static const uint32_t DATA_START = 2 * SECTOR;     // After the two table slots
+static const size_t PARTITION_SIZE = 16 * SECTOR;
+
+static Bytes pattern(size_t size, uint8_t seed) {
+    Bytes data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * seed + i / 97);
+    }
+    return data;
+}
+
+// Reserve, write in two pieces and commit under payload_id; returns the
+// offset the extent was placed at
+static uint32_t store(const char* payload_id, const Bytes& data) {
+    BlobStore& blobs = BlobStore::getInstance();
+    BlobExtent extent;
+    CHECK(blobs.reserve(data.size(), extent));
+    size_t half = data.size() / 2;
+    CHECK(blobs.write(extent, 0, data.data(), half));
+    CHECK(blobs.write(extent, half, data.data() + half, data.size() - half));
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(data.data(), data.size(), digest, 0);
+    CHECK(blobs.commit(payload_id, extent, digest));
+    return extent.offset;
+}
+
+static bool stored(const char* payload_id, const Bytes& data) {
+    PayloadImage image;
+    if (!BlobStore::getInstance().map(payload_id, image)) {
+        return false;
+    }
+    bool same = image.size == data.size() && memcmp(image.data, data.data(), data.size()) == 0;
+    BlobStore::unmap(image);
+    return same;
+}
+
+// Drops the partition and adds it again over the same image: a reboot
+static void reboot() {
+    hostRemovePartition(BLOB_PARTITION_LABEL);
+    hostAddPartition(BLOB_PARTITION_LABEL, ESP_PARTITION_TYPE_DATA,
+                     (esp_partition_subtype_t)BLOB_PARTITION_SUBTYPE, PARTITION_SIZE);
+    CHECK(BlobStore::getInstance().initialize());
+}
+
+static void allocation() {
+    BlobStore& blobs = BlobStore::getInstance();
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START);
+
+    // Packed front to back, each extent rounded up to whole sectors
+    Bytes a = pattern(5000, 3), b = pattern(SECTOR, 5), c = pattern(3 * SECTOR - 10, 7);
+    CHECK(store("a", a) == DATA_START);
+    CHECK(store("b", b) == DATA_START + 2 * SECTOR);
+    CHECK(store("c", c) == DATA_START + 3 * SECTOR);
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START - 6 * SECTOR);
+    CHECK(stored("a", a) && stored("b", b) && stored("c", c));
+    CHECK(hostActiveMappings() == 0);
+
+    // Removing b leaves a one-sector hole: a one-sector blob goes into it,
+    // a two-sector one past c
+    CHECK(blobs.remove("b"));
+    CHECK(!blobs.find("b", nullptr, nullptr));
+    BlobExtent small, large;
+    CHECK(blobs.reserve(100, small) && small.offset == DATA_START + 2 * SECTOR);
+    CHECK(blobs.reserve(SECTOR + 1, large) && large.offset == DATA_START + 6 * SECTOR);
+
+    // Pending extents count as used until released
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START - 8 * SECTOR);
+    blobs.release(small);
+    blobs.release(large);
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START - 5 * SECTOR);
+
+    // The free space past c fits, one byte more does not
+    BlobExtent tail;
+    CHECK(!blobs.reserve(PARTITION_SIZE - DATA_START - 6 * SECTOR + 1, tail));
+    CHECK(blobs.reserve(PARTITION_SIZE - DATA_START - 6 * SECTOR, tail));
+    blobs.release(tail);
+
+    // Writes stay inside their extent
+    CHECK(blobs.reserve(100, small));
+    CHECK(!blobs.write(small, 50, a.data(), 51));
+    blobs.release(small);
+
+    CHECK(blobs.remove("a"));
+    CHECK(blobs.remove("c"));
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START);
+}
+
+static void dedup() {
+    BlobStore& blobs = BlobStore::getInstance();
+    Bytes shared = pattern(2 * SECTOR, 11);
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(shared.data(), shared.size(), digest, 0);
+
+    // The second copy is dropped on commit and both payloads use the first
+    uint32_t offset = store("one", shared);
+    size_t free_space = blobs.getFreeSpace();
+    CHECK(blobs.contains(digest, shared.size()));
+    CHECK(store("two", shared) == DATA_START + 2 * SECTOR);
+    CHECK(blobs.getFreeSpace() == free_space);
+    uint32_t generation_one = 0, generation_two = 0;
+    CHECK(blobs.find("one", nullptr, &generation_one));
+    CHECK(blobs.find("two", nullptr, &generation_two));
+    CHECK(generation_one == generation_two);
+
+    // link() adds a third reference without any data
+    CHECK(blobs.link("three", digest, shared.size()));
+    CHECK(!blobs.link("four", digest, shared.size() - 1));
+    CHECK(blobs.getFreeSpace() == free_space);
+
+    // The blob lives until its last reference is gone
+    CHECK(blobs.remove("one"));
+    CHECK(blobs.remove("two"));
+    CHECK(stored("three", shared));
+    CHECK(blobs.getFreeSpace() == free_space);
+    CHECK(blobs.remove("three"));
+    CHECK(!blobs.contains(digest, shared.size()));
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START);
+
+    // Replacing a payload's content frees its old blob, unless shared
+    Bytes other = pattern(SECTOR, 13);
+    CHECK(store("one", shared) == offset);
+    CHECK(blobs.link("two", digest, shared.size()));
+    store("one", other);
+    CHECK(stored("one", other) && stored("two", shared));
+    store("two", other);
+    CHECK(stored("two", other));
+    CHECK(!blobs.contains(digest, shared.size()));
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START - SECTOR);
+    CHECK(blobs.remove("one") && blobs.remove("two"));
+}
+
+// Each save goes to the other table slot; returns the slot just written
+static int lastSaved(const Bytes& before) {
+    const uint8_t* flash = hostPartitionData(BLOB_PARTITION_LABEL);
+    return memcmp(flash, before.data(), SECTOR) != 0 ? 0 : 1;
+}
+
+static Bytes tables() {
+    const uint8_t* flash = hostPartitionData(BLOB_PARTITION_LABEL);
+    return Bytes(flash, flash + DATA_START);
+}
+
+static void tableRecovery() {
+    BlobStore& blobs = BlobStore::getInstance();
+    Bytes kept = pattern(3000, 17), dropped = pattern(7000, 19);
+    store("kept", kept);
+
+    // Survives a reboot as is
+    reboot();
+    CHECK(stored("kept", kept));
+
+    // A save cut off after the erase, before the write finished: the table
+    // from before the update is loaded, and the data it points at is intact
+    Bytes before = tables();
+    store("dropped", dropped);
+    int slot = lastSaved(before);
+    memset(hostPartitionData(BLOB_PARTITION_LABEL) + slot * SECTOR + 64, 0xFF, SECTOR - 64);
+    reboot();
+    CHECK(stored("kept", kept));
+    CHECK(!blobs.find("dropped", nullptr, nullptr));
+
+    // The next save goes over the bad slot, not the good one
+    before = tables();
+    store("dropped", dropped);
+    CHECK(lastSaved(before) == slot);
+    reboot();
+    CHECK(stored("kept", kept) && stored("dropped", dropped));
+
+    // A single flipped bit fails the CRC just the same
+    before = tables();
+    CHECK(blobs.remove("dropped"));
+    slot = lastSaved(before);
+    hostPartitionData(BLOB_PARTITION_LABEL)[slot * SECTOR + 200] ^= 0x01;
+    reboot();
+    CHECK(stored("kept", kept) && stored("dropped", dropped));
+
+    // Both copies bad: the partition is formatted
+    hostPartitionData(BLOB_PARTITION_LABEL)[(1 - slot) * SECTOR + 200] ^= 0x01;
+    reboot();
+    CHECK(!blobs.find("kept", nullptr, nullptr));
+    CHECK(blobs.getFreeSpace() == PARTITION_SIZE - DATA_START);
+}
+
+int main() {
+    hostResetData();
+    hostAddPartition(BLOB_PARTITION_LABEL, ESP_PARTITION_TYPE_DATA,
+                     (esp_partition_subtype_t)BLOB_PARTITION_SUBTYPE, PARTITION_SIZE);
+    CHECK(BlobStore::getInstance().initialize());
+
+    allocation();
+    dedup();
+    tableRecovery();
+    return HOST_TEST_RESULT("blob_store");
+}
@@ -0,0 +1,231 @@
+// CommandDispatcher over a loopback transport: framing, resync after
+// garbage, CRC errors, every command against the fakes in firmware_fakes.cpp,
+// and the protocol benchmark.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "command_dispatcher.h"
+#include "firmware_fakes.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+// Collects every response frame the dispatcher sends
+struct RecordingTransport : CommandTransport {
+    uint8_t tx[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    std::vector<Bytes> sent;
+
+    uint8_t* txBuffer(size_t* capacity) override {
+        *capacity = sizeof(tx);
+        return tx;
+    }
+
+    bool send(size_t length) override {
+        sent.emplace_back(tx, tx + length);
+        return true;
+    }
+};
+
+static uint16_t request_id = 0;
+
+static Bytes frame(uint8_t opcode, const Bytes& payload) {
+    Bytes out(FRAME_HEADER_SIZE + payload.size());
+    std::copy(payload.begin(), payload.end(), out.begin() + FRAME_HEADER_SIZE);
+    CommandDispatcher::encodeFrame(out.data(), opcode, 0, 0, ++request_id, payload.size());
+    return out;
+}
+
+static void append(Bytes& out, const Bytes& more) {
+    out.insert(out.end(), more.begin(), more.end());
+}
+
+// Length-prefixed string
+static Bytes str(const char* text) {
+    size_t length = strlen(text);
+    Bytes out(1 + length);
+    out[0] = (uint8_t)length;
+    memcpy(out.data() + 1, text, length);
+    return out;
+}
+
+static void put32(Bytes& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+static uint32_t get32(const Bytes& in, size_t pos) {
+    uint32_t value;
+    memcpy(&value, in.data() + pos, 4);
+    return value;
+}
+
+// Parses the index-th response and checks it is well formed
+static FrameHeader response(const RecordingTransport& loop, size_t index, Bytes* payload = nullptr) {
+    FrameHeader header = {};
+    if (index >= loop.sent.size()) {
+        CHECK(index < loop.sent.size());
+        return header;
+    }
+    const Bytes& raw = loop.sent[index];
+    CommandFrame parsed;
+    size_t used = 0;
+    CHECK(CommandDispatcher::parseFrame(raw.data(), raw.size(), parsed, &used) == FRAME_OK);
+    CHECK(used == raw.size());
+    CHECK(parsed.header->flags & FRAME_FLAG_RESPONSE);
+    header = *parsed.header;
+    if (payload) {
+        payload->assign(parsed.payload, parsed.payload + header.length);
+    }
+    return header;
+}
+
+// Sends one command and returns the status of its response
+static uint8_t call(RecordingTransport& loop, uint8_t opcode, const Bytes& request, Bytes* payload = nullptr) {
+    Bytes raw = frame(opcode, request);
+    size_t before = loop.sent.size();
+    CHECK(CommandDispatcher::getInstance().process(raw.data(), raw.size(), loop) == raw.size());
+    CHECK(loop.sent.size() == before + 1);
+    FrameHeader header = response(loop, before, payload);
+    CHECK(header.opcode == opcode);
+    CHECK(header.request_id == request_id);
+    return header.status;
+}
+
+int main() {
+    CommandDispatcher& dispatcher = CommandDispatcher::getInstance();
+    RecordingTransport loop;
+    Bytes payload;
+    Bytes request;
+    fakeCatalog(8);
+
+    // Ping echoes its payload
+    CHECK(call(loop, CMD_PING, {1, 2, 3}, &payload) == RESP_OK);
+    CHECK(payload == Bytes({1, 2, 3}));
+
+    // A stream fed byte by byte, behind garbage, yields both commands
+    Bytes stream = {0x00, 0x11, FRAME_MAGIC, 0x22};
+    append(stream, frame(CMD_GET_INFO, {}));
+    append(stream, frame(CMD_LIST_PAYLOADS, str("payload_3")));
+    Bytes pending;
+    size_t before = loop.sent.size();
+    for (uint8_t byte : stream) {
+        pending.push_back(byte);
+        size_t used = dispatcher.process(pending.data(), pending.size(), loop);
+        pending.erase(pending.begin(), pending.begin() + used);
+    }
+    CHECK(pending.empty());
+    CHECK(loop.sent.size() == before + 2);
+    FrameHeader header = response(loop, before, &payload);
+    CHECK(header.opcode == CMD_GET_INFO && header.status == RESP_OK);
+    header = response(loop, before + 1, &payload);
+    CHECK(header.opcode == CMD_LIST_PAYLOADS && header.status == RESP_OK);
+    CHECK(payload.size() > 5 && payload[0] == 8 && payload[2] == 4 && payload[4] == 0);
+    CHECK(payload.size() > 6 && memcmp(&payload[6], "payload_4", payload[5]) == 0);
+
+    // A corrupt payload is answered with BAD_FRAME for the same request
+    Bytes corrupt = frame(CMD_PING, {9, FRAME_MAGIC, 3});
+    corrupt.back() ^= 1;
+    before = loop.sent.size();
+    dispatcher.process(corrupt.data(), corrupt.size(), loop);
+    header = response(loop, before);
+    CHECK(header.status == RESP_BAD_FRAME && header.request_id == request_id);
+
+    // Malformed commands
+    CHECK(call(loop, 0x77, {}) == RESP_INVALID_COMMAND);
+    CHECK(call(loop, CMD_DELETE_PAYLOAD, {5, 'a'}) == RESP_INVALID_PARAMS);
+    CHECK(call(loop, CMD_DELETE_PAYLOAD, str("nope")) == RESP_NOT_FOUND);
+    CHECK(call(loop, CMD_DELETE_PAYLOAD, str("payload_2")) == RESP_OK);
+
+    // Upload: begin, manifest, three chunks, commit
+    request = {UPLOAD_BEGIN};
+    append(request, str("newp"));
+    put32(request, 5000);
+    CHECK(call(loop, CMD_UPLOAD_PAYLOAD, request, &payload) == RESP_OK);
+    CHECK(payload.size() == 4 && get32(payload, 0) == 0);
+    request = {UPLOAD_MANIFEST};
+    append(request, str("newp"));
+    CHECK(call(loop, CMD_UPLOAD_PAYLOAD, request) == RESP_INVALID_PARAMS);
+    request.insert(request.end(), {'{', '}'});
+    CHECK(call(loop, CMD_UPLOAD_PAYLOAD, request) == RESP_OK);
+    CHECK(fake_manifests["newp"] == "{}");
+    for (uint32_t offset = 0; offset < 5000; offset += 2000) {
+        request = {UPLOAD_WRITE};
+        append(request, str("newp"));
+        put32(request, offset);
+        request.insert(request.end(), std::min<uint32_t>(2000, 5000 - offset), 0x5A);
+        CHECK(call(loop, CMD_UPLOAD_PAYLOAD, request) == RESP_OK);
+    }
+    request = {UPLOAD_COMMIT};
+    append(request, str("newp"));
+    CHECK(call(loop, CMD_UPLOAD_PAYLOAD, request) == RESP_OK);
+    CHECK(fake_uploads["newp"].size() == 5000);
+    CHECK(fake_committed == std::vector<std::string>({"newp"}));
+
+    // A write at the wrong offset is refused
+    request = {UPLOAD_WRITE};
+    append(request, str("other"));
+    put32(request, 100);
+    request.push_back(0);
+    CHECK(call(loop, CMD_UPLOAD_PAYLOAD, request) != RESP_OK);
+
+    // Execute with parameters, then again while it runs
+    request = str("payload_1");
+    request.push_back(2);
+    append(request, str("ssid"));
+    append(request, str("x"));
+    append(request, str("ch"));
+    append(request, str("6"));
+    CHECK(call(loop, CMD_EXECUTE_PAYLOAD, request) == RESP_OK);
+    CHECK(fake_running == "payload_1");
+    CHECK(fake_params.size() == 2 && fake_params["ssid"] == "x" && fake_params["ch"] == "6");
+    CHECK(call(loop, CMD_EXECUTE_PAYLOAD, request) == RESP_ALREADY_RUNNING);
+
+    // Status of a running and an idle payload
+    CHECK(call(loop, CMD_GET_PAYLOAD_STATUS, str("payload_1"), &payload) == RESP_OK);
+    CHECK(payload.size() == 18 && payload[0] == PAYLOAD_STATUS_RUNNING && payload[1] == 1);
+    CHECK(call(loop, CMD_GET_PAYLOAD_STATUS, str("payload_2"), &payload) == RESP_OK);
+    CHECK(payload.size() == 18 && payload[0] == PAYLOAD_STATUS_IDLE && payload[1] == 0xFF);
+
+    CHECK(call(loop, CMD_STOP_PAYLOAD, str("payload_1")) == RESP_OK);
+    CHECK(fake_running.empty());
+    CHECK(call(loop, CMD_STOP_PAYLOAD, str("payload_1")) != RESP_OK);
+
+    // Logs: next cursor, dropped count, then one page of log bytes
+    request = {};
+    put32(request, 10);
+    CHECK(call(loop, CMD_GET_LOGS, request, &payload) == RESP_OK);
+    CHECK(payload.size() == 8 + FAKE_LOG_PAGE);
+    CHECK(get32(payload, 0) == 110);
+    CHECK(payload.size() > 8 && payload[8] == FAKE_LOG_BYTE && payload.back() == FAKE_LOG_BYTE);
+
+    CHECK(call(loop, CMD_GET_BOOT_TIMELINE, {}, &payload) == RESP_OK);
+    CHECK(payload.size() == 9);
+
+    // Full OTA image in frame-sized writes
+    request = {OTA_IMAGE_FULL};
+    put32(request, 8192);
+    request.insert(request.end(), 32, 7);
+    CHECK(call(loop, CMD_OTA_BEGIN, request) == RESP_OK);
+    for (uint32_t offset = 0; offset < 8192; offset += 4092) {
+        request = {};
+        put32(request, offset);
+        request.insert(request.end(), std::min<uint32_t>(4092, 8192 - offset), 1);
+        CHECK(call(loop, CMD_OTA_WRITE, request) == RESP_OK);
+    }
+    CHECK(call(loop, CMD_OTA_END, {}) == RESP_OK);
+    CHECK(fake_ota_written == 8192);
+
+    // A header claiming more than FRAME_MAX_PAYLOAD is skipped, not waited on
+    Bytes oversize = {FRAME_MAGIC, 1, 0, 0, 1, 0, 0xFF, 0xFF, 0, 0, 0, 0};
+    before = loop.sent.size();
+    CHECK(dispatcher.process(oversize.data(), oversize.size(), loop) == oversize.size());
+    CHECK(loop.sent.size() == before);
+
+    dispatcher.benchmark();
+
+    return HOST_TEST_RESULT("command_dispatcher");
+}
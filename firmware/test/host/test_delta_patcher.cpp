@@ -0,0 +1,187 @@
+// DeltaPatcher over patches made by tools/make_delta.py between two builds
+// of the firmware sources (base without and target with the protocol
+// benchmark, see the Makefile). The base image sits in the running app
+// partition and each patch streams in as BLE-sized writes; the output must
+// match the target byte for byte and hash to the digest in the patch
+// header. Prints the apply time and the most heap the patcher held at
+// once: malloc is wrapped at link time, so zlib's own state behind the
+// host tinfl is not counted, and the host tinfl_decompressor is far
+// smaller than the ROM one. A patch for another base, a truncated patch
+// and a corrupted one must all be refused.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "delta_patcher.h"
+#include "esp32/rom/miniz.h"
+#include "esp_timer.h"
+#include "host_platform.h"
+#include "mbedtls/sha256.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static const int WINDOW_BITS[] = {9, 12, 15};
+static const size_t CHUNK = 244;        // One BLE write at the default MTU
+static const size_t HASH_CHUNK = 4096;  // Base digest buffer in delta_patcher.cpp
+
+// ============================================================================
+// Heap use, counted on the main thread only
+// ============================================================================
+
+static size_t heap_live = 0;
+static size_t heap_peak = 0;
+
+extern "C" void* __real_malloc(size_t size);
+extern "C" void __real_free(void* ptr);
+
+extern "C" void* __wrap_malloc(size_t size) {
+    void* ptr = __real_malloc(size);
+    if (ptr) {
+        heap_live += malloc_usable_size(ptr);
+        if (heap_live > heap_peak) {
+            heap_peak = heap_live;
+        }
+    }
+    return ptr;
+}
+
+extern "C" void __wrap_free(void* ptr) {
+    if (ptr) {
+        heap_live -= malloc_usable_size(ptr);
+    }
+    __real_free(ptr);
+}
+
+// ============================================================================
+// Patching
+// ============================================================================
+
+static Bytes readImage(const char* name) {
+    std::string path = std::string(DELTA_DIR) + "/" + name;
+    Bytes data;
+    FILE* f = fopen(path.c_str(), "rb");
+    CHECK(f != nullptr);
+    if (f) {
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+            data.insert(data.end(), buf, buf + n);
+        }
+        fclose(f);
+    }
+    return data;
+}
+
+struct Output {
+    Bytes data;
+    mbedtls_sha256_context sha;
+    bool accepted = false;          // Every write() succeeded
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+};
+
+static bool collect(const uint8_t* data, size_t length, void* arg) {
+    Output* out = (Output*)arg;
+    out->data.insert(out->data.end(), data, data + length);
+    mbedtls_sha256_update(&out->sha, data, length);
+    return true;
+}
+
+// Streams the first length bytes of the patch against base; true if the
+// patcher accepted all of it and finished
+static bool apply(const esp_partition_t* base, const Bytes& patch, size_t length, Output& out) {
+    out.data.clear();
+    mbedtls_sha256_init(&out.sha);
+    mbedtls_sha256_starts(&out.sha, 0);
+
+    DeltaPatcher patcher;
+    bool ok = patcher.begin(base, collect, &out);
+    for (size_t offset = 0; ok && offset < length; offset += CHUNK) {
+        ok = patcher.write(patch.data() + offset, length - offset < CHUNK ? length - offset : CHUNK);
+    }
+    out.accepted = ok;
+    ok = ok && patcher.finish();
+
+    mbedtls_sha256_finish(&out.sha, out.digest);
+    mbedtls_sha256_free(&out.sha);
+    return ok;
+}
+
+int main() {
+    Bytes base = readImage("base.bin");
+    Bytes target = readImage("target.bin");
+    CHECK(!base.empty() && !target.empty() && base != target);
+    uint8_t target_digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(target.data(), target.size(), target_digest, 0);
+
+    // The running image, and the other slot holding something else
+    hostResetData();
+    size_t slot_size = ((base.size() > target.size() ? base.size() : target.size()) + 0xFFFF) & ~(size_t)0xFFFF;
+    const esp_partition_t* running = hostAddPartition("ota_0", ESP_PARTITION_TYPE_APP, 0x10, slot_size);
+    const esp_partition_t* other = hostAddPartition("ota_1", ESP_PARTITION_TYPE_APP, 0x11, slot_size);
+    memcpy(hostPartitionData("ota_0"), base.data(), base.size());
+    memcpy(hostPartitionData("ota_1"), target.data(), target.size());
+
+    printf("delta %u -> %u bytes, %u byte writes, patcher %u bytes\n", (unsigned)base.size(),
+           (unsigned)target.size(), (unsigned)CHUNK, (unsigned)sizeof(DeltaPatcher));
+    printf("  window   patch  %%image  apply us    MB/s  heap peak\n");
+
+    Output out;
+    for (int bits : WINDOW_BITS) {
+        char name[32];
+        snprintf(name, sizeof(name), "patch_%d.dzdl", bits);
+        Bytes patch = readImage(name);
+        CHECK(patch.size() > sizeof(DeltaHeader));
+        if (patch.size() <= sizeof(DeltaHeader)) {
+            continue;
+        }
+        DeltaHeader header;
+        memcpy(&header, patch.data(), sizeof(header));
+        CHECK(header.old_size == base.size() && header.new_size == target.size());
+        CHECK(memcmp(header.new_digest, target_digest, PAYLOAD_DIGEST_SIZE) == 0);
+
+        size_t heap_before = heap_live;
+        heap_peak = heap_live;
+        int64_t start = esp_timer_get_time();
+        CHECK(apply(running, patch, patch.size(), out));
+        int64_t elapsed = esp_timer_get_time() - start;
+        size_t peak = heap_peak - heap_before;
+
+        CHECK(out.data == target);
+        CHECK(memcmp(out.digest, header.new_digest, PAYLOAD_DIGEST_SIZE) == 0);
+        CHECK(heap_live == heap_before);
+
+        // The digest buffer, then the inflate window and decompressor,
+        // whatever the size of the images
+        size_t window = (size_t)1 << bits;
+        size_t bound = window + sizeof(tinfl_decompressor) > HASH_CHUNK ?
+                       window + sizeof(tinfl_decompressor) : HASH_CHUNK;
+        CHECK(peak <= bound + 64);
+
+        printf("  %6u  %6u  %5.1f%%  %8u  %6.1f  %9u\n", (unsigned)window, (unsigned)patch.size(),
+               100.0 * patch.size() / target.size(), (unsigned)elapsed,
+               elapsed ? (double)target.size() / elapsed : 0.0, (unsigned)peak);
+    }
+
+    Bytes patch = readImage("patch_15.dzdl");
+    if (patch.size() > sizeof(DeltaHeader)) {
+        // Made for another base: refused on the header, before any output
+        CHECK(!apply(other, patch, patch.size(), out));
+        CHECK(!out.accepted && out.data.empty());
+
+        // Cut short inside the zlib trailer: every byte that came is
+        // accepted, but the patch is not finished
+        CHECK(!apply(running, patch, patch.size() - 1, out));
+        CHECK(out.accepted);
+
+        // A flipped bit in the compressed body
+        patch[sizeof(DeltaHeader) + (patch.size() - sizeof(DeltaHeader)) / 2] ^= 0x10;
+        CHECK(!apply(running, patch, patch.size(), out));
+    }
+
+    return HOST_TEST_RESULT("delta_patcher");
+}
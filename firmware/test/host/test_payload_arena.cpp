@@ -0,0 +1,97 @@
+// PayloadArena over the host multi_heap (first fit, 8-byte block headers):
+// small blocks fill the whole limit, only a request over the limit is
+// reported to the supervisor, and a request the region cannot place
+// while under the limit is counted as a region failure instead.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <vector>
+#include "payload_arena.h"
+#include "payload_supervisor.h"
+
+static const size_t LIMIT = 16 * 1024;
+
+// A breach posts MEMORY_EXCEEDED for the watched payload
+static bool breached() {
+    SupervisorEvent event;
+    bool any = false;
+    while (PayloadSupervisor::getInstance().waitForEvent(event, 0)) {
+        any = any || event.reason == SUPERVISOR_EVENT_MEMORY_EXCEEDED;
+    }
+    return any;
+}
+
+// Allocates blocks of `size` until one fails
+static std::vector<void*> fill(PayloadArena& arena, size_t size) {
+    std::vector<void*> blocks;
+    while (void* ptr = arena.alloc(size)) {
+        blocks.push_back(ptr);
+    }
+    return blocks;
+}
+
+int main() {
+    PayloadSupervisor& supervisor = PayloadSupervisor::getInstance();
+    CHECK(supervisor.initialize());
+
+    PayloadContext context = {};
+    context.start_time = 0;
+    context.cpu_time_limit = 3600 * 1000;
+    CHECK(supervisor.watch("arena", &context));
+
+    PayloadArena arena;
+    CHECK(arena.create(&context, LIMIT));
+    CHECK(arena.regionSize() > LIMIT + 4096);
+
+    // Blocks of the expected size use the whole limit, and the one past it
+    // is a breach
+    std::vector<void*> blocks = fill(arena, 32);
+    CHECK(blocks.size() == LIMIT / 32);
+    CHECK(arena.used() == LIMIT && context.memory_allocated == LIMIT);
+    CHECK(arena.regionFailures() == 0);
+    CHECK(breached());
+
+    // Freeing every other block leaves half the limit free, but in 32-byte
+    // holes and a region tail shorter than 6000 bytes: a block that size is
+    // a region failure, not a breach
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        arena.free(blocks[i]);
+    }
+    CHECK(arena.used() == LIMIT / 2);
+    CHECK(arena.alloc(6000) == nullptr);
+    CHECK(arena.regionFailures() == 1);
+    CHECK(!breached());
+    CHECK(arena.alloc(32) != nullptr);
+
+    // realloc that cannot grow in place or move: a region failure too
+    CHECK(arena.realloc(blocks[1], 6000) == nullptr);
+    CHECK(arena.regionFailures() == 2);
+    CHECK(!breached());
+    CHECK(arena.realloc(blocks[1], 32 * 1024) == nullptr);
+    CHECK(breached());
+
+    // Blocks smaller than the region was sized for run out of headers
+    // before the limit: the payload keeps running, the failure is counted
+    arena.reset();
+    CHECK(arena.used() == 0 && arena.regionFailures() == 0);
+    blocks = fill(arena, 1);
+    CHECK(arena.used() < LIMIT);
+    CHECK(arena.regionFailures() == 1);
+    CHECK(!breached());
+    CHECK(context.memory_peak == arena.used());
+
+    // Peak survives frees, and reset() starts a new run
+    size_t peak = arena.peak();
+    for (void* ptr : blocks) {
+        arena.free(ptr);
+    }
+    CHECK(arena.used() == 0 && arena.peak() == peak);
+    void* big = arena.alloc(LIMIT);
+    CHECK(big != nullptr && arena.contains(big));
+    arena.free(big);
+
+    supervisor.unwatch("arena");
+    arena.destroy();
+    return HOST_TEST_RESULT("payload_arena");
+}
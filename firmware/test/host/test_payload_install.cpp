@@ -0,0 +1,334 @@
+// Payload installs through CommandDispatcher into the real registry:
+// PluginManager, install sessions, the blob store and the storage manager
+// over host_storage.cpp. Each case runs twice, once with payloads stored as
+// files and once in the blob partition: an upload with its manifest shows
+// up in the catalog, an upload without one is refused and leaves nothing
+// behind, and one whose manifest does not validate or whose data does not
+// match the manifest checksum is removed again. With payload files, a part
+// file left behind by a reboot is resumed only for the same upload and is
+// checked against the announced digest on commit.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "blob_store.h"
+#include "command_dispatcher.h"
+#include "host_platform.h"
+#include "install_session.h"
+#include "mbedtls/sha256.h"
+#include "plugin_manager.h"
+#include "storage_manager.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static const size_t CHUNK_SIZE = 3000;
+
+// Collects every response frame the dispatcher sends
+struct InstallTransport : CommandTransport {
+    uint8_t tx[FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD];
+    Bytes last;
+
+    uint8_t* txBuffer(size_t* capacity) override {
+        *capacity = sizeof(tx);
+        return tx;
+    }
+
+    bool send(size_t length) override {
+        last.assign(tx, tx + length);
+        return true;
+    }
+};
+
+static uint16_t request_id = 0;
+
+// Sends one CMD_UPLOAD_PAYLOAD step and returns the status of its response
+static uint8_t upload(InstallTransport& loop, upload_step_t step, const char* payload_id,
+                      const Bytes& args = {}, Bytes* reply = nullptr) {
+    Bytes request = {(uint8_t)step, (uint8_t)strlen(payload_id)};
+    request.insert(request.end(), payload_id, payload_id + strlen(payload_id));
+    request.insert(request.end(), args.begin(), args.end());
+
+    Bytes raw(FRAME_HEADER_SIZE + request.size());
+    std::copy(request.begin(), request.end(), raw.begin() + FRAME_HEADER_SIZE);
+    CommandDispatcher::encodeFrame(raw.data(), CMD_UPLOAD_PAYLOAD, 0, 0, ++request_id, request.size());
+    loop.last.clear();
+    CHECK(CommandDispatcher::getInstance().process(raw.data(), raw.size(), loop) == raw.size());
+
+    CommandFrame parsed;
+    size_t used = 0;
+    if (loop.last.empty() ||
+        CommandDispatcher::parseFrame(loop.last.data(), loop.last.size(), parsed, &used) != FRAME_OK) {
+        CHECK(!"no response");
+        return 0xFF;
+    }
+    CHECK(parsed.header->request_id == request_id);
+    if (reply) {
+        reply->assign(parsed.payload, parsed.payload + parsed.header->length);
+    }
+    return parsed.header->status;
+}
+
+static Bytes u32(uint32_t value) {
+    return {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+}
+
+static std::string hex(const uint8_t* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (size_t i = 0; i < length; i++) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 0xF];
+    }
+    return out;
+}
+
+static std::string manifestFor(const char* payload_id, const uint8_t* digest, size_t size) {
+    return std::string("{\"id\": \"") + payload_id + "\", \"name\": \"Test " + payload_id +
+           "\", \"version\": \"1.2.0\", \"category\": \"test\", \"payload\": {\"type\": \"lua\", "
+           "\"runtime\": \"lua\", \"entry\": \"payload\", \"checksum\": \"sha256:" +
+           hex(digest, PAYLOAD_DIGEST_SIZE) + "\", \"size\": " + std::to_string(size) + "}}";
+}
+
+// Begin, optionally the manifest, every chunk; returns the commit status
+static uint8_t install(InstallTransport& loop, const char* payload_id, const Bytes& data,
+                       const std::string* manifest) {
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(data.data(), data.size(), digest, 0);
+    Bytes begin = u32(data.size());
+    begin.insert(begin.end(), digest, digest + PAYLOAD_DIGEST_SIZE);
+    Bytes reply;
+    CHECK(upload(loop, UPLOAD_BEGIN, payload_id, begin, &reply) == RESP_OK);
+    CHECK(reply.size() == 4);
+
+    if (manifest) {
+        CHECK(upload(loop, UPLOAD_MANIFEST, payload_id, Bytes(manifest->begin(), manifest->end())) == RESP_OK);
+    }
+    for (size_t offset = 0; offset < data.size(); offset += CHUNK_SIZE) {
+        Bytes chunk = u32(offset);
+        size_t length = std::min(CHUNK_SIZE, data.size() - offset);
+        chunk.insert(chunk.end(), data.begin() + offset, data.begin() + offset + length);
+        CHECK(upload(loop, UPLOAD_WRITE, payload_id, chunk) == RESP_OK);
+    }
+    return upload(loop, UPLOAD_COMMIT, payload_id);
+}
+
+static bool inCatalog(const char* payload_id) {
+    PayloadCatalogRef catalog = PluginManager::getInstance().getCatalog();
+    for (const PayloadSummary& summary : catalog->summaries) {
+        if (strcmp(summary.id, payload_id) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool exists(const std::string& path) {
+    return StorageManager::getInstance().fileExists(path.c_str());
+}
+
+// A fresh device: empty storage, with or without a blob partition
+static void boot(bool with_blobs) {
+    static bool booted = false;
+    if (booted) {
+        StorageManager::getInstance().deinit();
+    }
+    booted = true;
+    hostResetData();
+    if (with_blobs) {
+        hostAddPartition(BLOB_PARTITION_LABEL, ESP_PARTITION_TYPE_DATA,
+                         (esp_partition_subtype_t)BLOB_PARTITION_SUBTYPE, 576 * 1024);
+    }
+    CHECK(StorageManager::getInstance().initialize());
+    CHECK(PluginManager::getInstance().initialize());
+    PluginManager::getInstance().scanPayloads(true);
+    CHECK(BlobStore::getInstance().isAvailable() == with_blobs);
+}
+
+static Bytes readAll(const std::string& path) {
+    size_t size = 0;
+    StorageManager::getInstance().getFileInfo(path.c_str(), &size, nullptr);
+    Bytes out(size);
+    if (size) {
+        CHECK(StorageManager::getInstance().readFile(path.c_str(), out.data(), size) == (int)size);
+    }
+    return out;
+}
+
+static void writeAll(const std::string& path, const Bytes& data) {
+    CHECK(StorageManager::getInstance().writeFile(path.c_str(), data.data(), data.size()));
+}
+
+// What a session leaves on storage when the device reboots mid-upload
+struct PartFiles {
+    Bytes part;
+    Bytes checkpoint;
+};
+
+static PartFiles interruptedUpload(const char* payload_id, const Bytes& data, size_t sent) {
+    StorageManager& storage = StorageManager::getInstance();
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(data.data(), data.size(), digest, 0);
+    InstallSession session;
+    size_t resume_offset = 1;
+    CHECK(session.begin(payload_id, data.size(), digest, &resume_offset));
+    CHECK(resume_offset == 0);
+    CHECK(session.write(0, data.data(), sent));
+    PartFiles files = {readAll(storage.getPayloadPartPath(payload_id)),
+                       readAll(storage.getPayloadPartCheckpointPath(payload_id))};
+    session.abort();
+    return files;
+}
+
+static void reboot(const char* payload_id, const PartFiles& files) {
+    StorageManager& storage = StorageManager::getInstance();
+    writeAll(storage.getPayloadPartPath(payload_id), files.part);
+    if (!files.checkpoint.empty()) {
+        writeAll(storage.getPayloadPartCheckpointPath(payload_id), files.checkpoint);
+    }
+}
+
+// Part files after a reboot: resumed for the same upload, started over
+// for a different or unrecorded one, rejected on commit when tampered with
+static void resumePartFile() {
+    StorageManager& storage = StorageManager::getInstance();
+    Bytes data(150000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 13 + i / 509);
+    }
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(data.data(), data.size(), digest, 0);
+    std::string manifest = manifestFor("resumed", digest, data.size());
+
+    // Past the first checkpoint, so the start of the upload is on storage
+    PartFiles files = interruptedUpload("resumed", data, 100000);
+    CHECK(files.part.size() >= INSTALL_CHECKPOINT_INTERVAL && files.part.size() <= 100000);
+    CHECK(files.checkpoint.size() > 0);
+    CHECK(!exists(storage.getPayloadPartPath("resumed")));
+    CHECK(!exists(storage.getPayloadPartCheckpointPath("resumed")));
+
+    // Same upload: continues where the part file ends, and commits
+    reboot("resumed", files);
+    InstallSession session;
+    size_t resume_offset = 0;
+    CHECK(session.begin("resumed", data.size(), digest, &resume_offset));
+    CHECK(resume_offset == files.part.size());
+    CHECK(session.write(resume_offset, data.data() + resume_offset, data.size() - resume_offset));
+    CHECK(session.writeManifest((const uint8_t*)manifest.data(), manifest.size()));
+    CHECK(session.commit());
+    CHECK(readAll(storage.getPayloadDataPath("resumed")) == data);
+    CHECK(!exists(storage.getPayloadPartCheckpointPath("resumed")));
+
+    // A different digest, or no checkpoint at all: starts over
+    uint8_t other_digest[PAYLOAD_DIGEST_SIZE];
+    memcpy(other_digest, digest, sizeof(other_digest));
+    other_digest[0] ^= 1;
+    reboot("resumed", files);
+    CHECK(session.begin("resumed", data.size(), other_digest, &resume_offset));
+    CHECK(resume_offset == 0);
+    session.abort();
+    reboot("resumed", {files.part, {}});
+    CHECK(session.begin("resumed", data.size(), digest, &resume_offset));
+    CHECK(resume_offset == 0);
+    session.abort();
+
+    // Same upload, but the stored bytes changed: the digest check on
+    // commit catches it and nothing is installed
+    PartFiles tampered = files;
+    tampered.part[1000] ^= 0xFF;
+    reboot("resumed", tampered);
+    CHECK(session.begin("resumed", data.size(), digest, &resume_offset));
+    CHECK(resume_offset == tampered.part.size());
+    CHECK(session.write(resume_offset, data.data() + resume_offset, data.size() - resume_offset));
+    CHECK(session.writeManifest((const uint8_t*)manifest.data(), manifest.size()));
+    CHECK(!session.commit());
+    CHECK(!session.isActive());
+    CHECK(!exists(storage.getPayloadPartPath("resumed")));
+    CHECK(!exists(storage.getPayloadManifestPartPath("resumed")));
+    CHECK(!exists(storage.getPayloadPartCheckpointPath("resumed")));
+    CHECK(readAll(storage.getPayloadDataPath("resumed")) == data);
+}
+
+static void run(bool with_blobs) {
+    printf("%s\n", with_blobs ? "blob partition" : "payload files");
+    boot(with_blobs);
+    InstallTransport loop;
+    StorageManager& storage = StorageManager::getInstance();
+
+    Bytes data(10000);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 7 + i / 251);
+    }
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(data.data(), data.size(), digest, 0);
+
+    // Payload and manifest: indexed and verified
+    std::string manifest = manifestFor("lua_demo", digest, data.size());
+    CHECK(install(loop, "lua_demo", data, &manifest) == RESP_OK);
+    CHECK(inCatalog("lua_demo"));
+    PayloadManifestRef installed = PluginManager::getInstance().getPayloadManifest("lua_demo");
+    CHECK(installed && installed->version == "1.2.0" && installed->payload.type == PAYLOAD_TYPE_LUA);
+    CHECK(exists(storage.getPayloadManifestPath("lua_demo")));
+    CHECK(!exists(storage.getPayloadManifestPartPath("lua_demo")));
+    CHECK(exists(storage.getPayloadDataPath("lua_demo")) != with_blobs);
+    CHECK(BlobStore::getInstance().find("lua_demo", nullptr, nullptr) == with_blobs);
+
+    // No manifest: commit is refused, abort leaves nothing behind
+    CHECK(install(loop, "no_manifest", data, nullptr) == RESP_ERROR);
+    CHECK(!inCatalog("no_manifest"));
+    CHECK(upload(loop, UPLOAD_ABORT, "no_manifest") == RESP_OK);
+    CHECK(!exists(storage.getPayloadPartPath("no_manifest")));
+    CHECK(!exists(storage.getPayloadManifestPath("no_manifest")));
+
+    // An aborted upload drops its manifest too
+    Bytes reply;
+    Bytes begin = u32(data.size());
+    CHECK(upload(loop, UPLOAD_BEGIN, "dropped", begin, &reply) == RESP_OK);
+    CHECK(upload(loop, UPLOAD_MANIFEST, "dropped", Bytes(manifest.begin(), manifest.end())) == RESP_OK);
+    CHECK(exists(storage.getPayloadManifestPartPath("dropped")));
+    CHECK(upload(loop, UPLOAD_ABORT, "dropped") == RESP_OK);
+    CHECK(!exists(storage.getPayloadManifestPartPath("dropped")));
+    CHECK(upload(loop, UPLOAD_MANIFEST, "dropped", Bytes(manifest.begin(), manifest.end())) == RESP_ERROR);
+
+    // Data that does not match the manifest checksum is removed again
+    Bytes other = data;
+    other[123] ^= 0xFF;
+    std::string wrong = manifestFor("mismatch", digest, other.size());
+    CHECK(install(loop, "mismatch", other, &wrong) == RESP_ERROR);
+    CHECK(!inCatalog("mismatch"));
+
+    // A manifest that does not validate fails the install and takes the
+    // stored data with it
+    std::string invalid = manifestFor("bad_type", digest, data.size());
+    invalid.replace(invalid.find("\"lua\", \"runtime\""), 5, "\"elf\"");
+    CHECK(install(loop, "bad_type", data, &invalid) == RESP_ERROR);
+    CHECK(!inCatalog("bad_type"));
+    CHECK(!exists(storage.getPayloadDataPath("bad_type")));
+    CHECK(!exists(storage.getPayloadManifestPath("bad_type")));
+    CHECK(!BlobStore::getInstance().find("bad_type", nullptr, nullptr));
+
+    // Reinstalling replaces the manifest of the installed version
+    std::string update = manifestFor("lua_demo", digest, data.size());
+    update.replace(update.find("1.2.0"), 5, "1.3.0");
+    CHECK(install(loop, "lua_demo", data, &update) == RESP_OK);
+    installed = PluginManager::getInstance().getPayloadManifest("lua_demo");
+    CHECK(installed && installed->version == "1.3.0");
+
+    // The index survives a rescan from the files on storage
+    PluginManager::getInstance().scanPayloads(true);
+    CHECK(inCatalog("lua_demo"));
+    CHECK(PluginManager::getInstance().getCatalog()->summaries.size() == 1);
+
+    if (!with_blobs) {
+        resumePartFile();
+    }
+}
+
+int main() {
+    run(false);
+    run(true);
+    return HOST_TEST_RESULT("payload_install");
+}
@@ -0,0 +1,139 @@
+// PayloadScheduler task lifetimes: a payload that exits on its own, a
+// terminate() that times out while the task is on its way out, and the
+// terminate() after it, which must still wait out its own grace period
+// instead of returning on the late notification from the first task.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "host_platform.h"
+#include "payload_scheduler.h"
+
+using namespace std::chrono;
+
+struct TestTask {
+    std::atomic<bool> exit{false};
+    std::atomic<bool> in_release{false};
+    std::atomic<bool> finish_release{true};
+    std::atomic<int> released{0};
+};
+
+static void runUntilExit(PayloadContext*, void* arg) {
+    TestTask* task = (TestTask*)arg;
+    while (!task->exit) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+}
+
+static void releaseTask(void* arg) {
+    TestTask* task = (TestTask*)arg;
+    task->in_release = true;
+    while (!task->finish_release) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    task->released++;
+}
+
+static PayloadContext makeContext(const char* payload_id) {
+    auto manifest = std::make_shared<PayloadManifest>();
+    manifest->id = payload_id;
+    manifest->requirements.priority = PAYLOAD_PRIORITY_NORMAL;
+    manifest->requirements.stack_kb = 0;
+    PayloadContext context = {};
+    context.status = PAYLOAD_STATUS_RUNNING;
+    context.manifest = manifest;
+    return context;
+}
+
+static uint32_t totalLoad() {
+    PayloadScheduler& scheduler = PayloadScheduler::getInstance();
+    return scheduler.getCoreLoad(0) + scheduler.getCoreLoad(1);
+}
+
+template <typename Condition>
+static bool waitUntil(Condition condition) {
+    for (int i = 0; i < 2000 && !condition(); i++) {
+        std::this_thread::sleep_for(milliseconds(1));
+    }
+    return condition();
+}
+
+int main() {
+    PayloadScheduler& scheduler = PayloadScheduler::getInstance();
+
+    // Exits on its own: released once, slot and load given back, and a
+    // later terminate() has nothing to wait for
+    TestTask done;
+    PayloadContext done_context = makeContext("done");
+    CHECK(scheduler.spawn("done", &done_context, runUntilExit, &done, releaseTask));
+    CHECK(totalLoad() > 0);
+    done.exit = true;
+    CHECK(waitUntil([] { return totalLoad() == 0; }));
+    CHECK(done.released == 1);
+    CHECK(done_context.status == PAYLOAD_STATUS_COMPLETED);
+    CHECK(scheduler.terminate(&done_context, 10));
+
+    // Stopped in time: terminate() returns once the task has released
+    TestTask quick;
+    quick.finish_release = false;
+    PayloadContext quick_context = makeContext("quick");
+    CHECK(scheduler.spawn("quick", &quick_context, runUntilExit, &quick, releaseTask));
+    std::thread([&] {
+        quick.exit = true;
+        waitUntil([&] { return quick.in_release.load(); });
+        std::this_thread::sleep_for(milliseconds(20));
+        quick.finish_release = true;
+    }).detach();
+    CHECK(scheduler.terminate(&quick_context, 1000));
+    CHECK(quick.released == 1);
+    CHECK(totalLoad() == 0);
+
+    // The grace period runs out just as the task starts to exit; its
+    // release callback is still running when the wait times out
+    TestTask late;
+    late.finish_release = false;
+    PayloadContext late_context = makeContext("late");
+    CHECK(scheduler.spawn("late", &late_context, runUntilExit, &late, releaseTask));
+    bool timed_out = false;
+    hostOnNotifyTimeout([&] {
+        if (timed_out) {
+            return;
+        }
+        timed_out = true;
+        late.exit = true;
+        waitUntil([&] { return late.in_release.load(); });
+        std::thread([&] {
+            std::this_thread::sleep_for(milliseconds(50));
+            late.finish_release = true;
+        }).detach();
+    });
+    CHECK(scheduler.terminate(&late_context, 20));
+    hostOnNotifyTimeout(nullptr);
+    CHECK(timed_out);
+    CHECK(late.released == 1);
+    CHECK(waitUntil([] { return totalLoad() == 0; }));
+    std::this_thread::sleep_for(milliseconds(20));
+
+    // The next terminate() gets the late task's notification, but its own
+    // task is still running: it waits the full grace, then deletes it
+    TestTask stuck;
+    PayloadContext stuck_context = makeContext("stuck");
+    CHECK(scheduler.spawn("stuck", &stuck_context, runUntilExit, &stuck, releaseTask));
+    steady_clock::time_point start = steady_clock::now();
+    CHECK(scheduler.terminate(&stuck_context, 100));
+    CHECK(steady_clock::now() - start >= milliseconds(100));
+    CHECK(stuck.released == 1);
+    CHECK(stuck_context.task_handle == nullptr && stuck_context.core_id == -1);
+    CHECK(totalLoad() == 0);
+
+    // The deleted task never reaches its own release; on the host it parks
+    stuck.exit = true;
+    std::this_thread::sleep_for(milliseconds(20));
+    CHECK(stuck.released == 1);
+
+    return HOST_TEST_RESULT("payload_scheduler");
+}
@@ -0,0 +1,107 @@
+// PayloadSupervisor over the host esp_timer, with time moved forward by
+// hostAdvanceTime(): a deadline posts TIMEOUT only once it has passed, a
+// completion is still reported when its wakeup does not fit in the event
+// queue, and a TIMEOUT queued for a payload that was unwatched before it
+// was read is dropped, even once its slot has been watched again.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <cstring>
+#include "host_platform.h"
+#include "payload_supervisor.h"
+
+static const int64_t MS = 1000;
+
+static PayloadContext makeContext(uint32_t limit_ms) {
+    PayloadContext context = {};
+    context.start_time = esp_timer_get_time() / 1000;
+    context.cpu_time_limit = limit_ms;
+    return context;
+}
+
+static bool nextEvent(SupervisorEvent& event) {
+    return PayloadSupervisor::getInstance().waitForEvent(event, 0);
+}
+
+static bool isEvent(const SupervisorEvent& event, supervisor_event_reason_t reason,
+                    const char* payload_id) {
+    return event.reason == reason && strcmp(event.payload_id, payload_id) == 0;
+}
+
+int main() {
+    PayloadSupervisor& supervisor = PayloadSupervisor::getInstance();
+    SupervisorEvent event;
+    CHECK(supervisor.initialize());
+    CHECK(!nextEvent(event));
+
+    // Deadline: nothing before it, one TIMEOUT once it has passed
+    PayloadContext slow = makeContext(1000);
+    CHECK(supervisor.watch("slow", &slow));
+    hostAdvanceTime(900 * MS);
+    CHECK(!nextEvent(event));
+    hostAdvanceTime(200 * MS);
+    CHECK(nextEvent(event) && isEvent(event, SUPERVISOR_EVENT_TIMEOUT, "slow"));
+    CHECK(!nextEvent(event));
+    supervisor.unwatch("slow");
+
+    // Full queue: the completion's wakeup is dropped, but its slot flag is
+    // seen first on the next wait, ahead of the queued events
+    PayloadContext hog = makeContext(60000);
+    PayloadContext done = makeContext(60000);
+    CHECK(supervisor.watch("hog", &hog));
+    CHECK(supervisor.watch("done", &done));
+    for (int i = 0; i < MAX_PAYLOADS * 2; i++) {
+        supervisor.notifyMemoryExceeded(&hog);
+    }
+    supervisor.notifyCompleted(&done);
+    CHECK(nextEvent(event) && isEvent(event, SUPERVISOR_EVENT_COMPLETED, "done"));
+    int exceeded = 0;
+    while (nextEvent(event)) {
+        CHECK(isEvent(event, SUPERVISOR_EVENT_MEMORY_EXCEEDED, "hog"));
+        exceeded++;
+    }
+    CHECK(exceeded == MAX_PAYLOADS * 2);
+
+    // Reported once: the flag is cleared with the event
+    supervisor.notifyCompleted(&done);
+    CHECK(nextEvent(event) && isEvent(event, SUPERVISOR_EVENT_COMPLETED, "done"));
+    CHECK(!nextEvent(event));
+    supervisor.unwatch("hog");
+    supervisor.unwatch("done");
+
+    // A TIMEOUT still queued when its payload is unwatched is stale, both
+    // for a new payload in the same slot and for the same payload again
+    PayloadContext first = makeContext(100);
+    CHECK(supervisor.watch("first", &first));
+    hostAdvanceTime(200 * MS);
+    supervisor.unwatch("first");
+    PayloadContext second = makeContext(60000);
+    CHECK(supervisor.watch("second", &second));
+    CHECK(!nextEvent(event));
+
+    PayloadContext again = makeContext(100);
+    CHECK(supervisor.watch("again", &again));
+    hostAdvanceTime(200 * MS);
+    again = makeContext(60000);
+    CHECK(supervisor.watch("again", &again));
+    CHECK(!nextEvent(event));
+
+    // The rewatched payload still gets its own deadline
+    hostAdvanceTime(61000 * MS);
+    int timeouts = 0;
+    while (nextEvent(event)) {
+        CHECK(event.reason == SUPERVISOR_EVENT_TIMEOUT);
+        timeouts++;
+    }
+    CHECK(timeouts == 2);
+
+    // Memory and completion reports for a payload that is not watched
+    supervisor.unwatch("second");
+    supervisor.notifyMemoryExceeded(&second);
+    supervisor.notifyCompleted(&second);
+    CHECK(!nextEvent(event));
+
+    supervisor.unwatch("again");
+    return HOST_TEST_RESULT("payload_supervisor");
+}
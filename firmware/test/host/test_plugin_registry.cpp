@@ -0,0 +1,160 @@
+// Payload registry readers against its writer: reader threads poll the
+// catalog and the status table through the lock-free read paths while the
+// main thread installs, runs, stops and uninstalls payloads through the
+// real PluginManager over host_storage.cpp. A reader must never see a
+// catalog whose listing and manifests disagree, or a status entry that is
+// not the one it asked for or has no valid state.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "host_platform.h"
+#include "mbedtls/sha256.h"
+#include "plugin_manager.h"
+#include "storage_manager.h"
+
+using namespace std::chrono;
+
+static const int READERS = 4;
+static const int CYCLES = 40;
+static const char* STEADY_ID = "steady";
+
+struct Reader {
+    std::thread thread;
+    uint32_t reads = 0;
+    uint32_t torn = 0;
+    int64_t max_us = 0;
+};
+
+static std::atomic<bool> running{true};
+
+static std::string hex(const uint8_t* data, size_t length) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    for (size_t i = 0; i < length; i++) {
+        out += digits[data[i] >> 4];
+        out += digits[data[i] & 0xF];
+    }
+    return out;
+}
+
+static bool install(const char* payload_id, const std::vector<uint8_t>& data) {
+    uint8_t digest[PAYLOAD_DIGEST_SIZE];
+    mbedtls_sha256(data.data(), data.size(), digest, 0);
+    std::string manifest = std::string("{\"id\": \"") + payload_id + "\", \"name\": \"Stress " +
+                           payload_id + "\", \"version\": \"1.0.0\", \"category\": \"test\", "
+                           "\"payload\": {\"type\": \"lua\", \"runtime\": \"lua\", \"entry\": "
+                           "\"payload\", \"checksum\": \"sha256:" + hex(digest, PAYLOAD_DIGEST_SIZE) +
+                           "\", \"size\": " + std::to_string(data.size()) + "}}";
+    return PluginManager::getInstance().installPayload(payload_id, manifest.c_str(),
+                                                       data.data(), data.size());
+}
+
+static bool validStatus(payload_status_t status) {
+    return status == PAYLOAD_STATUS_IDLE || status == PAYLOAD_STATUS_LOADING ||
+           status == PAYLOAD_STATUS_RUNNING || status == PAYLOAD_STATUS_COMPLETED ||
+           status == PAYLOAD_STATUS_ERROR;
+}
+
+// A catalog lists each manifest once, in id order, and always holds the
+// payload that stays installed throughout
+static bool consistent(const PayloadCatalog& catalog) {
+    if (catalog.summaries.size() != catalog.manifests.size()) {
+        return false;
+    }
+    bool steady = false;
+    for (size_t i = 0; i < catalog.summaries.size(); i++) {
+        const char* id = catalog.summaries[i].id;
+        if (!catalog.manifests.count(id) ||
+            (i > 0 && strcmp(catalog.summaries[i - 1].id, id) >= 0)) {
+            return false;
+        }
+        steady = steady || strcmp(id, STEADY_ID) == 0;
+    }
+    return steady;
+}
+
+static void readLoop(Reader* reader) {
+    PluginManager& manager = PluginManager::getInstance();
+    char cycling[MAX_PAYLOAD_ID_LEN];
+
+    while (running.load(std::memory_order_relaxed)) {
+        steady_clock::time_point start = steady_clock::now();
+        PayloadStatusEntry entry;
+        if (manager.getPayloadStatusEntry(STEADY_ID, entry) &&
+            (strcmp(entry.payload_id, STEADY_ID) != 0 || !validStatus(entry.status))) {
+            reader->torn++;
+        }
+        snprintf(cycling, sizeof(cycling), "cycle_%u", (unsigned)(reader->reads % CYCLES));
+        if (manager.getPayloadStatusEntry(cycling, entry) &&
+            (strcmp(entry.payload_id, cycling) != 0 || !validStatus(entry.status))) {
+            reader->torn++;
+        }
+        if ((reader->reads & 15) == 0 && !consistent(*manager.getCatalog())) {
+            reader->torn++;
+        }
+        int64_t elapsed = duration_cast<microseconds>(steady_clock::now() - start).count();
+        reader->max_us = elapsed > reader->max_us ? elapsed : reader->max_us;
+        reader->reads++;
+    }
+}
+
+int main() {
+    hostResetData();
+    CHECK(StorageManager::getInstance().initialize());
+    PluginManager& manager = PluginManager::getInstance();
+    CHECK(manager.initialize());
+    manager.scanPayloads(true);
+
+    std::vector<uint8_t> data(4096);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)(i * 5 + i / 257);
+    }
+    CHECK(install(STEADY_ID, data));
+    std::map<std::string, std::string> params;
+
+    Reader readers[READERS];
+    for (Reader& reader : readers) {
+        reader.thread = std::thread(readLoop, &reader);
+    }
+
+    // Every write path that publishes a catalog or a status entry, over and
+    // over, with the readers running
+    steady_clock::time_point start = steady_clock::now();
+    uint32_t writes = 0;
+    for (int i = 0; i < CYCLES; i++) {
+        std::string payload_id = "cycle_" + std::to_string(i);
+        CHECK(install(payload_id.c_str(), data));
+        CHECK(manager.executePayload(payload_id.c_str(), params));
+        CHECK(manager.executePayload(STEADY_ID, params));
+        CHECK(manager.getPayloadStatus(STEADY_ID) == PAYLOAD_STATUS_RUNNING);
+        CHECK(manager.stopPayload(STEADY_ID));
+        CHECK(manager.getPayloadStatus(STEADY_ID) == PAYLOAD_STATUS_COMPLETED);
+        CHECK(manager.uninstallPayload(payload_id.c_str()));
+        CHECK(manager.getPayloadStatus(payload_id.c_str()) == PAYLOAD_STATUS_IDLE);
+        writes += 6;
+    }
+    double seconds = duration_cast<microseconds>(steady_clock::now() - start).count() / 1e6;
+
+    running = false;
+    uint32_t torn = 0;
+    printf("registry: %.0f writes/s, %d readers\n", writes / seconds, READERS);
+    for (int i = 0; i < READERS; i++) {
+        Reader& reader = readers[i];
+        reader.thread.join();
+        printf("  reader %d: %.0f reads/s, max %lld us, %u torn\n", i, reader.reads / seconds,
+               (long long)reader.max_us, (unsigned)reader.torn);
+        CHECK(reader.reads > 0);
+        torn += reader.torn;
+    }
+    CHECK(torn == 0);
+    CHECK(manager.getCatalog()->summaries.size() == 1);
+
+    return HOST_TEST_RESULT("plugin_registry");
+}
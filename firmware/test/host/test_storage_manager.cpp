@@ -0,0 +1,189 @@
+// StorageManager over the host filesystem backend: stat results, listings
+// and usage are served from the metadata cache until a change made through
+// the manager drops them, changes made behind its back stay invisible until
+// invalidate(), and StorageFile streams files in chunks of any size with
+// the size and transfer counters kept up to date.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "host_platform.h"
+#include "storage_manager.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+static const std::string DIR_PATH = STORAGE_BASE_PATH "/cache";
+
+static Bytes pattern(size_t size, uint8_t seed) {
+    Bytes data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (uint8_t)(i * seed + i / 101);
+    }
+    return data;
+}
+
+static std::string pathOf(const char* name) {
+    return DIR_PATH + "/" + name;
+}
+
+// Writes a file without going through the manager, as an open upload does
+static void writeBehind(const std::string& path, size_t size) {
+    FILE* f = fopen(path.c_str(), "wb");
+    Bytes data = pattern(size, 1);
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+}
+
+static bool listed(const std::vector<std::string>& names, const char* name) {
+    return std::find(names.begin(), names.end(), name) != names.end();
+}
+
+static void metadataCache() {
+    StorageManager& storage = StorageManager::getInstance();
+    StorageCacheStats before, after;
+    std::string a = pathOf("a"), b = pathOf("b");
+    CHECK(storage.createDirectory(DIR_PATH.c_str()));
+
+    // Negative results are cached too
+    storage.getCacheStats(before);
+    CHECK(!storage.fileExists(a.c_str()));
+    CHECK(!storage.fileExists(a.c_str()));
+    storage.getCacheStats(after);
+    CHECK(after.stat_misses == before.stat_misses + 1);
+    CHECK(after.stat_hits == before.stat_hits + 1);
+
+    // A file written behind the manager's back stays unseen until the
+    // path is invalidated; one written through it is seen at once
+    writeBehind(a, 100);
+    CHECK(!storage.fileExists(a.c_str()));
+    storage.invalidate(a.c_str());
+    CHECK(storage.fileExists(a.c_str()) && storage.getFileSize(a.c_str()) == 100);
+    Bytes data = pattern(300, 3);
+    CHECK(storage.writeFile(a.c_str(), data.data(), data.size()));
+    CHECK(storage.getFileSize(a.c_str()) == 300);
+
+    // Listings: cached, refreshed by a write into the directory
+    std::vector<std::string> names = storage.listDirectory(DIR_PATH.c_str());
+    CHECK(names.size() == 1 && listed(names, "a"));
+    writeBehind(b, 10);
+    storage.getCacheStats(before);
+    CHECK(storage.listDirectory(DIR_PATH.c_str()).size() == 1);
+    storage.getCacheStats(after);
+    CHECK(after.list_hits == before.list_hits + 1 && after.list_misses == before.list_misses);
+    CHECK(storage.writeFile(b.c_str(), data.data(), 10));
+    names = storage.listDirectory(DIR_PATH.c_str());
+    CHECK(names.size() == 2 && listed(names, "a") && listed(names, "b"));
+
+    // Rename drops both names from the stat cache and the listing
+    std::string c = pathOf("c");
+    CHECK(storage.fileExists(b.c_str()) && !storage.fileExists(c.c_str()));
+    CHECK(storage.renameFile(b.c_str(), c.c_str()));
+    CHECK(!storage.fileExists(b.c_str()) && storage.getFileSize(c.c_str()) == 10);
+    names = storage.listDirectory(DIR_PATH.c_str());
+    CHECK(names.size() == 2 && listed(names, "c") && !listed(names, "b"));
+
+    // Usage: cached, dropped by any change
+    size_t used = storage.getUsedSpace();
+    storage.getCacheStats(before);
+    CHECK(storage.getUsedSpace() == used);
+    storage.getCacheStats(after);
+    CHECK(after.usage_hits == before.usage_hits + 1);
+    Bytes big = pattern(3 * storage.ioBlockSize(), 5);
+    CHECK(storage.writeFile(c.c_str(), big.data(), big.size()));
+    CHECK(storage.getUsedSpace() == used + 2 * storage.ioBlockSize());
+    CHECK(storage.getFreeSpace() == storage.getTotalSpace() - storage.getUsedSpace());
+
+    // Deleting the directory drops every entry below it and its own listing
+    CHECK(storage.deleteDirectory(DIR_PATH.c_str()));
+    CHECK(!storage.fileExists(a.c_str()) && !storage.fileExists(c.c_str()));
+    CHECK(!storage.fileExists(DIR_PATH.c_str()));
+    CHECK(!listed(storage.listDirectory(STORAGE_BASE_PATH), "cache"));
+
+    storage.getCacheStats(after);
+    CHECK(after.stat_hits > 0 && after.miss_us > 0);
+}
+
+static bool collect(const uint8_t* data, size_t length, void* arg) {
+    Bytes* out = (Bytes*)arg;
+    out->insert(out->end(), data, data + length);
+    return true;
+}
+
+static bool stopAfterOne(const uint8_t* data, size_t length, void* arg) {
+    (*(int*)arg)++;
+    return false;
+}
+
+static void streaming() {
+    StorageManager& storage = StorageManager::getInstance();
+    std::string path = pathOf("stream");
+    CHECK(storage.createDirectory(DIR_PATH.c_str()));
+    Bytes data = pattern(50000, 7);
+
+    // Odd-sized writes through a small buffer; flush makes the size visible
+    StorageFile file;
+    CHECK(storage.openWrite(path.c_str(), file, false, 1000));
+    CHECK(file.isOpen() && file.size() == 0);
+    for (size_t offset = 0; offset < 30000; offset += 777) {
+        CHECK(file.write(data.data() + offset, std::min<size_t>(777, 30000 - offset)));
+    }
+    CHECK(file.size() == 30000 && file.read(data.data(), 1) == 0);
+    CHECK(file.flush());
+    CHECK(storage.getFileSize(path.c_str()) == 30000);
+    CHECK(file.close());
+    CHECK(!file.isOpen() && file.stats().bytes == 30000);
+
+    // Appending starts from the size on storage
+    CHECK(storage.openWrite(path.c_str(), file, true));
+    CHECK(file.size() == 30000);
+    CHECK(file.write(data.data() + 30000, data.size() - 30000));
+    CHECK(file.close());
+    CHECK(storage.getFileSize(path.c_str()) == data.size());
+
+    // Reads in chunks that do not divide the file, then a seek back
+    CHECK(storage.openRead(path.c_str(), file, 512));
+    CHECK(file.size() == data.size() && !file.write(data.data(), 1));
+    Bytes back;
+    uint8_t chunk[1234];
+    size_t n;
+    while ((n = file.read(chunk, sizeof(chunk))) > 0) {
+        back.insert(back.end(), chunk, chunk + n);
+    }
+    CHECK(back == data && file.stats().bytes == data.size());
+    CHECK(file.seek(40000) && file.read(chunk, 10) == 10);
+    CHECK(std::equal(chunk, chunk + 10, data.begin() + 40000));
+    file.close();
+
+    // streamFile trims the chunk to whole I/O blocks and stops when asked
+    Bytes streamed;
+    Bytes buffer(storage.ioBlockSize() * 2 + 100);
+    StorageIoStats stats;
+    CHECK(storage.streamFile(path.c_str(), buffer.data(), buffer.size(), collect, &streamed, &stats));
+    CHECK(streamed == data && stats.bytes == data.size());
+    int calls = 0;
+    CHECK(!storage.streamFile(path.c_str(), buffer.data(), buffer.size(), stopAfterOne, &calls, &stats));
+    CHECK(calls == 1 && stats.bytes == storage.ioBlockSize() * 2);
+    CHECK(!storage.streamFile(pathOf("missing").c_str(), buffer.data(), buffer.size(),
+                              collect, &streamed, nullptr));
+
+    // readFile fills at most the caller's buffer
+    Bytes head(1000);
+    CHECK(storage.readFile(path.c_str(), head.data(), head.size()) == (int)head.size());
+    CHECK(std::equal(head.begin(), head.end(), data.begin()));
+
+    CHECK(storage.deleteDirectory(DIR_PATH.c_str()));
+}
+
+int main() {
+    hostResetData();
+    hostSetStorageSize(1024 * 1024);
+    CHECK(StorageManager::getInstance().initialize());
+
+    metadataCache();
+    streaming();
+    return HOST_TEST_RESULT("storage_manager");
+}
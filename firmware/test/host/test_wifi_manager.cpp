@@ -0,0 +1,314 @@
+// WiFiManager against a simulated driver: joins, cached fast rejoins,
+// link drops, an AP that moves channel, and the NVS station cache.
+//
+// The fake driver joins a cached BSSID/channel in FAST_JOIN_MS and needs
+// SCAN_JOIN_MS when it has to scan every channel, so the statistics show
+// which path each connection took.
+
+#define HOST_TEST_MAIN
+#include "host_test.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "nvs.h"
+#include "wifi_manager.h"
+
+using namespace std::chrono;
+
+static const int FAST_JOIN_MS = 60;
+static const int SCAN_JOIN_MS = 600;
+static const int DHCP_MS = 50;
+
+// ============================================================================
+// Default event loop: callbacks run on one thread in due-time order
+// ============================================================================
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT = "IP_EVENT";
+
+static esp_event_handler_t event_handler;
+static void* event_handler_arg;
+
+struct PendingEvent {
+    int64_t due_us;
+    std::function<void()> run;
+};
+
+static std::mutex loop_lock;
+static std::condition_variable loop_cv;
+static std::deque<PendingEvent> loop_queue;
+
+static void postAfter(int delay_ms, std::function<void()> run) {
+    std::lock_guard<std::mutex> lock(loop_lock);
+    loop_queue.push_back({esp_timer_get_time() + delay_ms * 1000LL, run});
+    loop_cv.notify_all();
+}
+
+static void eventLoop() {
+    while (true) {
+        std::function<void()> run;
+        {
+            std::unique_lock<std::mutex> lock(loop_lock);
+            loop_cv.wait(lock, [] { return !loop_queue.empty(); });
+            auto next = loop_queue.begin();
+            for (auto it = loop_queue.begin(); it != loop_queue.end(); ++it) {
+                if (it->due_us < next->due_us) {
+                    next = it;
+                }
+            }
+            int64_t wait_us = next->due_us - esp_timer_get_time();
+            if (wait_us > 0) {
+                loop_cv.wait_for(lock, microseconds(wait_us));
+                continue;
+            }
+            run = next->run;
+            loop_queue.erase(next);
+        }
+        run();
+    }
+}
+
+static void dispatch(esp_event_base_t base, int32_t id, void* data) {
+    event_handler(event_handler_arg, base, id, data);
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+    std::thread(eventLoop).detach();
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t base, int32_t, esp_event_handler_t handler,
+                                              void* arg, esp_event_handler_instance_t* instance) {
+    event_handler = handler;
+    event_handler_arg = arg;
+    *instance = (void*)base;
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_unregister(esp_event_base_t, int32_t, esp_event_handler_instance_t) {
+    return ESP_OK;
+}
+
+// ============================================================================
+// NVS
+// ============================================================================
+
+static std::map<std::string, std::vector<uint8_t>> nvs_blobs;
+
+esp_err_t nvs_open(const char*, nvs_open_mode_t, nvs_handle_t* handle) {
+    *handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t, const char* key, void* out, size_t* length) {
+    auto it = nvs_blobs.find(key);
+    if (it == nvs_blobs.end() || *length < it->second.size()) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *length = it->second.size();
+    memcpy(out, it->second.data(), *length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t, const char* key, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    nvs_blobs[key].assign(bytes, bytes + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t, const char* key) {
+    nvs_blobs.erase(key);
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t) {
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t) {
+}
+
+// ============================================================================
+// WiFi driver with one AP called "lab"
+// ============================================================================
+
+static uint8_t ap_bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static uint8_t ap_channel = 6;
+static wifi_config_t sta_config;
+static std::atomic<int> attempt{0};
+static std::atomic<bool> associated{false};
+
+static void linkDown() {
+    associated = false;
+    dispatch(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, nullptr);
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t*) { return ESP_OK; }
+esp_err_t esp_wifi_deinit(void) { return ESP_OK; }
+esp_err_t esp_wifi_start(void) { return ESP_OK; }
+esp_err_t esp_wifi_stop(void) { return ESP_OK; }
+esp_err_t esp_wifi_set_storage(wifi_storage_t) { return ESP_OK; }
+esp_err_t esp_wifi_set_mode(wifi_mode_t) { return ESP_OK; }
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* config) {
+    if (interface == WIFI_IF_STA) {
+        sta_config = *config;
+    }
+    return ESP_OK;
+}
+
+// A cached target only works while the AP is still on that BSSID/channel
+esp_err_t esp_wifi_connect(void) {
+    int mine = ++attempt;
+    const wifi_sta_config_t& sta = sta_config.sta;
+    bool targeted = sta.bssid_set;
+    bool reachable = !targeted || (memcmp(sta.bssid, ap_bssid, 6) == 0 && sta.channel == ap_channel);
+    int join_ms = targeted ? FAST_JOIN_MS : SCAN_JOIN_MS;
+
+    if (!reachable) {
+        postAfter(join_ms, [] { linkDown(); });
+        return ESP_OK;
+    }
+    postAfter(join_ms, [mine] {
+        if (mine != attempt) {
+            return;
+        }
+        associated = true;
+        static wifi_event_sta_connected_t event;
+        memset(&event, 0, sizeof(event));
+        memcpy(event.ssid, "lab", 3);
+        event.ssid_len = 3;
+        memcpy(event.bssid, ap_bssid, 6);
+        event.channel = ap_channel;
+        dispatch(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &event);
+    });
+    postAfter(join_ms + DHCP_MS, [mine] {
+        if (mine == attempt && associated) {
+            dispatch(IP_EVENT, IP_EVENT_STA_GOT_IP, nullptr);
+        }
+    });
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+    ++attempt;
+    postAfter(5, [] { linkDown(); });
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t*, bool) {
+    postAfter(200, [] { dispatch(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, nullptr); });
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_stop(void) { return ESP_OK; }
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t* count) {
+    *count = 2;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t* count, wifi_ap_record_t* records) {
+    memset(records, 0, sizeof(*records) * *count);
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_init(void) { return ESP_OK; }
+esp_netif_t* esp_netif_create_default_wifi_ap(void) { return nullptr; }
+esp_netif_t* esp_netif_create_default_wifi_sta(void) { return nullptr; }
+
+// ============================================================================
+// Test
+// ============================================================================
+
+static WiFiStats stats() {
+    WiFiStats s;
+    WiFiManager::getInstance().getStats(s);
+    return s;
+}
+
+// Polls until the manager has rejoined `count` times in total
+static bool waitForReconnects(uint32_t count, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        if (stats().reconnects >= count && WiFiManager::getInstance().isConnected()) {
+            return true;
+        }
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+    return false;
+}
+
+static void show(const char* step) {
+    WiFiStats s = stats();
+    printf("%-22s connects %u (fast %u), reconnects %u, last connect %u ms, last reconnect %u ms\n",
+           step, (unsigned)s.connects, (unsigned)s.fast_connects, (unsigned)s.reconnects,
+           (unsigned)s.last_connect_ms, (unsigned)s.last_reconnect_ms);
+}
+
+int main() {
+    setvbuf(stdout, nullptr, _IONBF, 0);
+    WiFiManager& wifi = WiFiManager::getInstance();
+
+    CHECK(wifi.initialize());
+    CHECK(wifi.scan());
+    CHECK(wifi.getScanResults().size() == 2);
+
+    // First join has nothing cached and scans
+    CHECK(wifi.connectSTA("lab", "password1"));
+    show("first join");
+    CHECK(stats().connects == 1 && stats().fast_connects == 0);
+    CHECK(stats().last_connect_ms >= SCAN_JOIN_MS);
+    CHECK(nvs_blobs.count("sta_cache") == 1);
+
+    // Joining again goes straight to the cached AP
+    CHECK(wifi.disconnect());
+    CHECK(wifi.connectSTA("lab", "password1"));
+    show("cached join");
+    CHECK(stats().connects == 2 && stats().fast_connects == 1);
+    CHECK(stats().last_connect_ms < SCAN_JOIN_MS);
+
+    // A dropped link is rejoined without a scan
+    postAfter(0, [] { linkDown(); });
+    CHECK(waitForReconnects(1, 2000));
+    show("link dropped");
+    CHECK(stats().last_reconnect_ms < SCAN_JOIN_MS);
+
+    // The AP moved: the cached attempts fail and a full scan finds it
+    ap_channel = 11;
+    ap_bssid[5] = 0x09;
+    postAfter(0, [] { linkDown(); });
+    CHECK(waitForReconnects(2, 5000));
+    show("AP moved");
+    CHECK(stats().last_reconnect_ms >= SCAN_JOIN_MS);
+
+    // The cache now points at the AP's new BSSID and channel
+    CHECK(wifi.disconnect());
+    CHECK(wifi.connectSTA("lab", "password1"));
+    show("join after move");
+    CHECK(stats().fast_connects == 2);
+    const std::vector<uint8_t>& saved = nvs_blobs["sta_cache"];
+    CHECK(std::search(saved.begin(), saved.end(), ap_bssid, ap_bssid + 6) != saved.end());
+
+    // Restarting the driver keeps using the cache
+    CHECK(wifi.deinitialize());
+    CHECK(wifi.initialize());
+    CHECK(wifi.connectSTA("lab", "password1"));
+    show("after reinit");
+    CHECK(stats().fast_connects == 3);
+
+    // Background threads are still blocked on the event loop
+    int failures = HOST_TEST_RESULT("wifi_manager");
+    _exit(failures);
+}
@@ -0,0 +1,209 @@
+#!/usr/bin/env python3
+"""
+Build the deferred log format table and decode fetched log records.
+
+DZ_LOG* / DEZERO_LOG* calls (main/include/deferred_log.h) store a 32-bit
+FNV-1a id of their format string plus the raw arguments. "ids" scans
+sources for those calls and writes the id -> format table; the firmware
+build runs it to produce build/log_ids.json. "decode" reads records as
+returned by CMD_GET_LOGS (LogRecordHeader + body, back to back) and prints
+them as text, formatting deferred records with the table.
+
+Usage: python log_decode.py ids [-o log_ids.json] source [...]
+       python log_decode.py decode [--ids log_ids.json] records.bin
+"""
+
+import argparse
+import json
+import re
+import struct
+import sys
+from pathlib import Path
+
+SOURCE_SUFFIXES = {".c", ".cc", ".cpp", ".h", ".hpp"}
+CALL_RE = re.compile(r"\b(DZ_LOG[EWID]|DEZERO_LOG[EWID]|DEFERRED_LOG)\s*\(")
+LITERAL_RE = re.compile(r'\s*"((?:[^"\\\n]|\\.)*)"')
+SPEC_RE = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGaAcspn%])")
+
+RECORD_HEADER = struct.Struct("<HBBII")
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D", 5: "V"}
+FLAG_BOOT = 0x01
+FLAG_DEFERRED = 0x02
+
+
+def format_id(text):
+    value = 2166136261
+    for byte in text.encode("utf-8"):
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def unescape(literal):
+    return literal.encode("latin-1", "backslashreplace").decode("unicode_escape")
+
+
+def skip_argument(source, pos):
+    """Returns the index just past the first macro argument and its comma."""
+    depth = 0
+    while pos < len(source):
+        ch = source[pos]
+        if ch == '"':
+            pos = LITERAL_RE.match(source, pos).end()
+            continue
+        if ch in "([{":
+            depth += 1
+        elif ch in ")]}":
+            depth -= 1
+        elif ch == "," and depth == 0:
+            return pos + 1
+        pos += 1
+    return pos
+
+
+def scan_formats(source):
+    for call in CALL_RE.finditer(source):
+        pos = call.end()
+        # DZ_LOG* takes a tag and DEFERRED_LOG a level and a tag first
+        name = call.group(1)
+        skip = 2 if name == "DEFERRED_LOG" else 1 if name.startswith("DZ_") else 0
+        for _ in range(skip):
+            pos = skip_argument(source, pos)
+
+        pieces = []
+        match = LITERAL_RE.match(source, pos)
+        while match:
+            pieces.append(unescape(match.group(1)))
+            pos = match.end()
+            match = LITERAL_RE.match(source, pos)
+        if pieces and re.match(r"\s*[,)]", source[pos:]):
+            yield "".join(pieces)
+
+
+def build_table(dirs):
+    table = {}
+    for root in dirs:
+        paths = [root] if root.is_file() else sorted(root.rglob("*"))
+        for path in paths:
+            if path.suffix not in SOURCE_SUFFIXES or path.name == "deferred_log.h":
+                continue
+            for fmt in scan_formats(path.read_text(errors="replace")):
+                key = "%08x" % format_id(fmt)
+                if key in table and table[key] != fmt:
+                    raise SystemExit("format id collision %s: %r vs %r" % (key, table[key], fmt))
+                table[key] = fmt
+    return table
+
+
+class Reader:
+    def __init__(self, data, pos):
+        self.data = data
+        self.pos = pos
+
+    def take(self, size):
+        if self.pos + size > len(self.data):
+            raise ValueError("truncated record")
+        chunk = self.data[self.pos:self.pos + size]
+        self.pos += size
+        return chunk
+
+    def string(self):
+        length = self.take(1)[0]
+        return self.take(length).decode("utf-8", "replace")
+
+
+def format_deferred(body, table):
+    reader = Reader(body, 0)
+    fmt_id = struct.unpack("<I", reader.take(4))[0]
+    tag = reader.string()
+    fmt = table.get("%08x" % fmt_id)
+    if fmt is None:
+        return tag, "<unknown format %08x>" % fmt_id
+
+    out = []
+    last = 0
+    try:
+        for spec in SPEC_RE.finditer(fmt):
+            out.append(fmt[last:spec.start()])
+            last = spec.end()
+            flags, width, precision, length, conv = spec.groups()
+            if conv == "%":
+                out.append("%")
+                continue
+            if width == "*":
+                width = str(struct.unpack("<i", reader.take(4))[0])
+            if precision == "*":
+                precision = str(struct.unpack("<i", reader.take(4))[0])
+            py_spec = "%" + flags + (width or "") + ("." + precision if precision else "")
+
+            if conv == "s":
+                value = reader.string()
+            elif conv in "eEfFgGaA":
+                value = struct.unpack("<d", reader.take(8))[0]
+                conv = {"a": "e", "A": "E"}.get(conv, conv)
+            elif conv == "p":
+                value = struct.unpack("<I", reader.take(4))[0]
+                py_spec, conv = "0x%08", "x"
+            elif length in ("ll", "j"):
+                signed = conv in "di"
+                value = struct.unpack("<q" if signed else "<Q", reader.take(8))[0]
+            else:
+                signed = conv in "dic"
+                value = struct.unpack("<i" if signed else "<I", reader.take(4))[0]
+                if conv == "c":
+                    value = chr(value & 0xFF)
+                elif conv == "n":
+                    continue
+            out.append((py_spec + conv) % value)
+    except ValueError as err:
+        out.append("<%s>" % err)
+        return tag, "".join(out)
+    out.append(fmt[last:])
+    return tag, "".join(out)
+
+
+def decode(data, table):
+    pos = 0
+    while pos + RECORD_HEADER.size <= len(data):
+        length, level, flags, seq, time_ms = RECORD_HEADER.unpack_from(data, pos)
+        pos += RECORD_HEADER.size
+        body = data[pos:pos + length]
+        pos += length
+
+        if flags & FLAG_BOOT:
+            print("---- boot ----")
+        if flags & FLAG_DEFERRED:
+            tag, text = format_deferred(body, table)
+            text = "%s: %s" % (tag, text) if tag else text
+        else:
+            text = body.decode("utf-8", "replace")
+        print("%8u %s (%u) %s" % (seq, LEVELS.get(level, "?"), time_ms, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="DeZer0 deferred log tools")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    ids = sub.add_parser("ids", help="build the format id table from sources")
+    ids.add_argument("-o", "--output", type=Path, default=Path("log_ids.json"))
+    ids.add_argument("sources", nargs="+", type=Path)
+
+    dec = sub.add_parser("decode", help="print fetched log records as text")
+    dec.add_argument("--ids", type=Path, default=Path("build/log_ids.json"))
+    dec.add_argument("records", type=Path)
+
+    args = parser.parse_args()
+    if args.command == "ids":
+        table = build_table(args.sources)
+        args.output.write_text(json.dumps(table, indent=1, sort_keys=True) + "\n")
+        print("%d format strings -> %s" % (len(table), args.output))
+        return 0
+
+    table = json.loads(args.ids.read_text()) if args.ids.exists() else {}
+    if not table:
+        print("warning: no format table, deferred records cannot be decoded", file=sys.stderr)
+    decode(args.records.read_bytes(), table)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
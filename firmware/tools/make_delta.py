@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+"""
+Make a firmware delta for BootManager's delta OTA.
+
+Diffs two firmware images (the one running on the device and the new
+build) into a DZDL patch: a header naming both images' size and SHA-256,
+followed by a zlib stream of bsdiff-style commands. Runs of the new image
+found in the old one, possibly shifted and with a few bytes changed (as
+relinked code is), become "add to old" diff bytes that are almost all
+zero and compress well; the rest is sent as literal bytes.
+
+The patch is then applied back to the old image exactly as the device
+does and checked against the new image; sizes and timings are printed.
+
+Usage: python make_delta.py [--window-bits 15] old.bin new.bin [-o patch.dzdl]
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+import zlib
+from pathlib import Path
+
+DELTA_MAGIC = 0x4C445A44  # "DZDL"
+DELTA_VERSION = 1
+CODEC_ZLIB = 1
+HEADER = struct.Struct("<IHBBII32s32s")
+COMMAND = struct.Struct("<IIi")
+
+SEED = 8            # Bytes that must match exactly to start a run
+INDEX_STEP = 4      # Old image positions indexed for seeds
+GIVE_UP = 64        # Stop extending a run after this many bytes without gain
+
+
+def build_index(old):
+    index = {}
+    for pos in range(0, len(old) - SEED + 1, INDEX_STEP):
+        index.setdefault(old[pos:pos + SEED], pos)
+    return index
+
+
+def extend(old, new, o, n):
+    """Length of the approximate match at old[o:], new[n:], as in bsdiff:
+    the prefix where matching bytes most outnumber differing ones."""
+    limit = min(len(old) - o, len(new) - n)
+    k = 0
+    # Exact stretches first, a block at a time
+    while k + 64 <= limit and old[o + k:o + k + 64] == new[n + k:n + k + 64]:
+        k += 64
+    score = best_score = k
+    best = k
+    while k < limit and k - best < GIVE_UP:
+        score += 1 if old[o + k] == new[n + k] else -1
+        k += 1
+        if score > best_score:
+            best_score = score
+            best = k
+    return best
+
+
+def find_runs(old, new):
+    """Yields (new_start, old_start, length) runs in new-image order."""
+    index = build_index(old)
+    n = 0
+    floor = 0           # End of the previous run in the new image
+    expected = 0        # Old offset that would continue the previous run
+    while n + SEED <= len(new):
+        key = new[n:n + SEED]
+        if 0 <= expected <= len(old) - SEED and old[expected:expected + SEED] == key:
+            o = expected
+        else:
+            o = index.get(key)
+            if o is None:
+                n += 1
+                expected += 1
+                continue
+            # The indexed position may be a few bytes off the best alignment
+            while o > 0 and n > floor and old[o - 1] == new[n - 1] and o % INDEX_STEP:
+                o -= 1
+                n -= 1
+        length = extend(old, new, o, n)
+        if length < SEED:
+            n += 1
+            expected += 1
+            continue
+        yield n, o, length
+        n += length
+        floor = n
+        expected = o + length
+
+
+def diff(old, new):
+    body = bytearray()
+
+    def command(run_new, run_old, length, next_new, next_old):
+        delta = bytes((new[run_new + i] - old[run_old + i]) & 0xFF for i in range(length))
+        extra = new[run_new + length:next_new]
+        body.extend(COMMAND.pack(length, len(extra), next_old - (run_old + length)))
+        body.extend(delta)
+        body.extend(extra)
+
+    # Each run is written once the next one is known, since its literal
+    # tail and seek run up to there; a zero-length run covers any prefix
+    pending = (0, 0, 0)
+    for run in find_runs(old, new):
+        command(*pending, run[0], run[1])
+        pending = run
+    command(*pending, len(new), pending[1] + pending[2])
+    return bytes(body)
+
+
+def apply(old, patch):
+    """Reference applier, same semantics as DeltaPatcher on the device."""
+    magic, version, codec, _, old_size, new_size, old_digest, new_digest = HEADER.unpack_from(patch)
+    if magic != DELTA_MAGIC or version != DELTA_VERSION:
+        raise ValueError("not a DZDL patch")
+    if hashlib.sha256(old[:old_size]).digest() != old_digest:
+        raise ValueError("patch was made for a different base image")
+    body = patch[HEADER.size:]
+    if codec == CODEC_ZLIB:
+        body = zlib.decompress(body)
+
+    out = bytearray()
+    pos = 0
+    base = 0
+    while pos < len(body):
+        diff_len, extra_len, seek = COMMAND.unpack_from(body, pos)
+        pos += COMMAND.size
+        out.extend((old[base + i] + body[pos + i]) & 0xFF for i in range(diff_len))
+        pos += diff_len
+        base += diff_len
+        out.extend(body[pos:pos + extra_len])
+        pos += extra_len
+        base += seek
+        if not 0 <= base <= old_size:
+            raise ValueError("seek out of range")
+    if len(out) != new_size or hashlib.sha256(out).digest() != new_digest:
+        raise ValueError("reconstructed image does not match")
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Make a DeZer0 firmware delta")
+    parser.add_argument("--window-bits", type=int, default=15, choices=range(9, 16),
+                        help="zlib window (9-15); the device allocates 2^N bytes to inflate")
+    parser.add_argument("--link-kbps", type=float, default=20.0,
+                        help="link throughput used for the transfer time estimate (KB/s)")
+    parser.add_argument("-o", "--output", type=Path)
+    parser.add_argument("old", type=Path)
+    parser.add_argument("new", type=Path)
+    args = parser.parse_args()
+
+    old = args.old.read_bytes()
+    new = args.new.read_bytes()
+
+    start = time.monotonic()
+    body = diff(old, new)
+    compressor = zlib.compressobj(9, zlib.DEFLATED, args.window_bits, 9)
+    packed = compressor.compress(body) + compressor.flush()
+    header = HEADER.pack(DELTA_MAGIC, DELTA_VERSION, CODEC_ZLIB, 0, len(old), len(new),
+                         hashlib.sha256(old).digest(), hashlib.sha256(new).digest())
+    patch = header + packed
+    diff_time = time.monotonic() - start
+
+    start = time.monotonic()
+    try:
+        rebuilt = apply(old, patch)
+    except ValueError as err:
+        print("error: %s" % err, file=sys.stderr)
+        return 1
+    apply_time = time.monotonic() - start
+    assert rebuilt == new
+
+    output = args.output or args.new.with_suffix(".dzdl")
+    output.write_bytes(patch)
+
+    full_time = len(new) / 1024 / args.link_kbps
+    delta_time = len(patch) / 1024 / args.link_kbps
+    print("%s -> %s: %d -> %d bytes" % (args.old.name, args.new.name, len(old), len(new)))
+    print("  patch %d bytes (%.1f%% of new image), %d before compression" %
+          (len(patch), 100.0 * len(patch) / len(new), len(body)))
+    print("  diff %.2f s, verified reconstruction in %.2f s" % (diff_time, apply_time))
+    print("  at %.0f KB/s: %.0f s for the full image, %.0f s for the patch" %
+          (args.link_kbps, full_time, delta_time))
+    print("  wrote %s" % output)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
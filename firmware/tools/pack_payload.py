@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""
+Pack payload binaries for compressed storage on the device.
+
+Writes <input>.dzpz next to each input: a DZPZ header followed by a zlib
+stream whose window is limited to --window-bits, which is also the size of
+the ring buffer the firmware inflates through. The manifest keeps the
+size and sha256 of the original file; both are printed here.
+
+Usage: python pack_payload.py [--window-bits 12] payload [payload ...]
+"""
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+from pathlib import Path
+
+PACK_MAGIC = 0x5A505A44  # "DZPZ"
+PACK_VERSION = 1
+CODEC_ZLIB = 1
+MAX_PAYLOAD_SIZE = 512 * 1024
+
+
+def pack(data, window_bits):
+    header = struct.pack("<IHBBI", PACK_MAGIC, PACK_VERSION, CODEC_ZLIB, 0, len(data))
+    compressor = zlib.compressobj(9, zlib.DEFLATED, window_bits, 9)
+    return header + compressor.compress(data) + compressor.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack DeZer0 payloads for compressed storage")
+    parser.add_argument("--window-bits", type=int, default=12, choices=range(9, 16),
+                        help="zlib window (9-15); the device allocates 2^N bytes to inflate")
+    parser.add_argument("payloads", nargs="+", type=Path)
+    args = parser.parse_args()
+
+    total_raw = 0
+    total_packed = 0
+    for path in args.payloads:
+        data = path.read_bytes()
+        if len(data) > MAX_PAYLOAD_SIZE:
+            print(f"{path}: larger than {MAX_PAYLOAD_SIZE} bytes, skipped", file=sys.stderr)
+            continue
+
+        packed = pack(data, args.window_bits)
+        out = path.with_name(path.name + ".dzpz")
+        out.write_bytes(packed)
+
+        total_raw += len(data)
+        total_packed += len(packed)
+        ratio = len(packed) * 100 // max(len(data), 1)
+        print(f"{path}: {len(data)} -> {len(packed)} bytes ({ratio}%)")
+        print(f'  "size": {len(data)}, "checksum": "sha256:{hashlib.sha256(data).hexdigest()}"')
+        if len(packed) >= len(data):
+            print("  no gain, upload the original instead")
+
+    if len(args.payloads) > 1 and total_raw:
+        print(f"total: {total_raw} -> {total_packed} bytes ({total_packed * 100 // total_raw}%)")
+
+
+if __name__ == "__main__":
+    main()